@@ -1,13 +1,30 @@
 ; HellOS Unified Bootloader - Compact Version
-; Fixed architecture bootloader that fits in 512 bytes
+; Fixed architecture bootloader: a 512 byte boot sector plus one
+; extension sector, which reads in the kernel behind it
 
 [BITS 16]
 [ORG 0x7C00]
 
+%include "kernel_size.inc"          ; KERNEL_SECTORS, written by the Makefile
+
 ; Boot sector constants
-KERNEL_LOAD_ADDR    equ 0x8000      ; Kernel load address
+EXTENSION_ADDR      equ 0x7E00      ; Sector 1, right behind the boot sector
+KERNEL_LOAD_ADDR    equ 0x8000      ; Kernel load address (sector 2 onwards)
 STACK_ADDR          equ 0x7C00      ; Stack below bootloader
-KERNEL_SECTORS      equ 8           ; Number of sectors to read (4KB max)
+KERNEL_CHUNK_SECTORS equ 64         ; Sectors per read, 32KB
+%define KERNEL_MAX_SECTORS 1024     ; KERNEL_MAX_SIZE (memory_layout.h) in sectors
+E820_MAP_ADDR       equ 0x5000      ; E820 entry count, entries at +8 (memory_layout.h)
+E820_SIGNATURE      equ 0x534D4150  ; 'SMAP'
+E820_MAX_ENTRIES    equ 64          ; Room below VBE_INFO_ADDR (memory_layout.h)
+VBE_INFO_ADDR       equ 0x5800      ; VBE controller info (memory_layout.h)
+VBE_MODE_INFO_ADDR  equ 0x5A00      ; Mode info of the mode that was set
+VBE_MODE_ADDR       equ 0x5B00      ; Mode number set, 0 = none
+VIDEO_WIDTH         equ 800         ; Smallest common mode that holds
+VIDEO_HEIGHT        equ 600         ; the 680x480 screen
+
+%if KERNEL_SECTORS > KERNEL_MAX_SECTORS
+%error "Kernel image is larger than KERNEL_MAX_SIZE"
+%endif
 
 start:
     ; Set up segments and stack
@@ -40,43 +57,48 @@ start:
     mov si, banner
     call print_string
     
-    ; Load kernel
+    ; Load the extension sector, then the kernel with its code
+    call load_extension
     call load_kernel
     
+    ; Collect the BIOS memory map for the page frame allocator
+    call detect_memory
+    
+    ; Switch to a linear framebuffer mode, last: BIOS text output ends here
+    call set_video_mode
+    
     ; Switch to protected mode
     call init_protected_mode
     
     ; Hang if we get here
     jmp hang
 
-; Load kernel from disk sector 2
-load_kernel:
-    ; Debug message
-    mov si, debug_kernel_loading
-    call print_string_serial
-    
-    ; Read kernel from disk
-    mov ah, 0x02                ; BIOS read sectors
-    mov al, KERNEL_SECTORS      ; Number of sectors to read
-    mov ch, 0                   ; Cylinder 0
-    mov cl, 3           ; Sector 3 (kernel is at LBA sector 2, which is CHS sector 3)
-    mov dh, 0                   ; Head 0
-    mov dl, [boot_drive]        ; Drive number
-    
-    ; Set up buffer
-    mov bx, KERNEL_LOAD_ADDR    ; Buffer address
-    
-    ; Read sectors
+; Load the extension sector (LBA 1), which loads the kernel behind it
+; Booted from CD, El Torito has already put the whole image in memory.
+load_extension:
+    mov si, E820_MAP_ADDR       ; Scratch for the specification packet
+    mov byte [si], 0x13
+    mov ax, 0x4B01              ; El Torito emulation status
+    mov dl, [boot_drive]
     int 0x13
-    jc disk_error               ; Jump if carry flag set (error)
+    jnc .preloaded
     
-    ; Debug message
-    mov si, debug_kernel_loaded
-    call print_string_serial
+    mov ah, 0x41                ; INT 13h extensions present?
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+    cmp bx, 0xAA55
+    jne disk_error
     
-    ; Print success message
-    mov si, kernel_loaded_msg
-    call print_string
+    mov si, disk_packet         ; Still set up for the extension sector
+    mov ah, 0x42                ; Extended read
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+    ret
+.preloaded:
+    mov byte [boot_preloaded], 1
     ret
 
 disk_error:
@@ -220,34 +242,174 @@ gdt_descriptor:
 CODE_SEG equ gdt_code - gdt_start
 DATA_SEG equ gdt_data - gdt_start
 
+; INT 13h extensions disk address packet
+disk_packet:
+    db 16, 0
+.count:
+    dw 1
+.offset:
+    dw EXTENSION_ADDR
+.segment:
+    dw 0
+.lba:
+    dq 1
+
 ; Data
 boot_drive: db 0
+boot_preloaded: db 0            ; Image already in memory, nothing to read
 
 banner:
-    db 13, 10, 'HellOS v2.0 - Infernal Boot', 13, 10
-    db 'Loading kernel...', 13, 10, 0
-
-kernel_loaded_msg:
-    db 'Kernel loaded from disk!', 13, 10, 0
+    db 13, 10, 'HellOS v2.0 - Infernal Boot', 13, 10, 0
 
 disk_error_msg:
-    db 'DISK ERROR: Cannot load kernel!', 13, 10, 0
+    db 'Disk error!', 0
 
 debug_msg:
-    db 'Jumping to kernel at 0x8000...', 0
+    db 'Entering kernel...', 0
 
 debug_boot_start:
     db '[BOOT] Starting...', 13, 10, 0
 
+debug_protected_mode:
+    db '[BOOT] PM', 13, 10, 0
+
+; Pad to 512 bytes and add boot signature
+times 510-($-$$) db 0
+dw 0xAA55
+
+; Extension sector (LBA 1), at EXTENSION_ADDR once load_extension has run
+[BITS 16]
+; Read the kernel from LBA 2 on, KERNEL_CHUNK_SECTORS per INT 13h call
+; Chunks start 32KB aligned, so none straddles a 64KB DMA boundary.
+load_kernel:
+    mov si, debug_kernel_loading
+    call print_string_serial
+    
+    cmp byte [boot_preloaded], 0
+    jne .done
+    mov word [disk_packet.offset], 0
+    mov word [disk_packet.segment], KERNEL_LOAD_ADDR >> 4
+    mov dword [disk_packet.lba], 2
+    mov cx, KERNEL_SECTORS
+    test cx, cx
+    jz .done
+.next:
+    mov ax, KERNEL_CHUNK_SECTORS
+    cmp cx, ax
+    jae .read
+    mov ax, cx                  ; Last, short chunk
+.read:
+    mov [disk_packet.count], ax
+    push ax
+    push cx
+    mov si, disk_packet
+    mov ah, 0x42                ; Extended read
+    mov dl, [boot_drive]
+    int 0x13
+    pop cx
+    pop ax
+    jc disk_error
+    sub cx, ax
+    add [disk_packet.lba], ax
+    adc word [disk_packet.lba + 2], 0
+    shl ax, 5                   ; Sectors to paragraphs
+    add [disk_packet.segment], ax
+    test cx, cx
+    jnz .next
+.done:
+    mov si, debug_kernel_loaded
+    call print_string_serial
+    ret
+
+; Query the E820 memory map into E820_MAP_ADDR
+; A zero count tells the kernel to fall back to CMOS
+detect_memory:
+    xor ebx, ebx                ; Continuation value, 0 = first entry
+    xor bp, bp                  ; Entry count
+    mov di, E820_MAP_ADDR + 8   ; ES:DI = entry buffer
+.next:
+    mov eax, 0xE820
+    mov ecx, 24
+    mov edx, E820_SIGNATURE
+    int 0x15
+    jc .done                    ; Carry set: unsupported or past the end
+    cmp eax, E820_SIGNATURE
+    jne .done
+    add di, 24
+    inc bp
+    cmp bp, E820_MAX_ENTRIES    ; Buffer full: keep what fits
+    jae .done
+    test ebx, ebx               ; Zero continuation: that was the last entry
+    jnz .next
+.done:
+    mov [E820_MAP_ADDR], bp
+    ret
+
+; Pick the deepest VIDEO_WIDTH x VIDEO_HEIGHT mode with a linear
+; framebuffer at 8, 16 or 32 bpp and set it. The kernel reads the mode
+; info block left at VBE_MODE_INFO_ADDR; it keeps VGA if none was set.
+set_video_mode:
+    mov word [VBE_MODE_ADDR], 0
+    mov di, VBE_INFO_ADDR
+    mov dword [di], 'VBE2'      ; Ask for the VBE 2.0+ controller info
+    mov ax, 0x4F00
+    int 0x10
+    cmp ax, 0x004F
+    jne .done
+    lfs si, [VBE_INFO_ADDR + 14] ; Far pointer to the mode list
+    xor bx, bx                  ; Best mode so far
+    xor dl, dl                  ; and its bpp
+.next:
+    mov cx, [fs:si]
+    add si, 2
+    cmp cx, 0xFFFF              ; End of list
+    je .set
+    mov ax, 0x4F01              ; Get mode info for CX
+    mov di, VBE_MODE_INFO_ADDR
+    int 0x10
+    cmp ax, 0x004F
+    jne .next
+    test byte [di], 0x80        ; Linear framebuffer supported
+    jz .next
+    cmp word [di + 18], VIDEO_WIDTH
+    jne .next
+    cmp word [di + 20], VIDEO_HEIGHT
+    jne .next
+    mov al, [di + 25]           ; Bits per pixel
+    cmp al, dl
+    jbe .next
+    cmp al, 8
+    je .better
+    cmp al, 16
+    je .better
+    cmp al, 32
+    jne .next
+.better:
+    mov bx, cx
+    mov dl, al
+    jmp .next
+.set:
+    test bx, bx
+    jz .done
+    mov cx, bx                  ; Leave the chosen mode's info behind
+    mov ax, 0x4F01
+    mov di, VBE_MODE_INFO_ADDR
+    int 0x10
+    or bx, 0x4000               ; Linear framebuffer
+    mov ax, 0x4F02
+    int 0x10
+    cmp ax, 0x004F
+    jne .done
+    mov [VBE_MODE_ADDR], cx
+.done:
+    ret
+
 debug_kernel_loading:
     db '[BOOT] Loading...', 13, 10, 0
 
 debug_kernel_loaded:
     db '[BOOT] Loaded', 13, 10, 0
 
-debug_protected_mode:
-    db '[BOOT] PM', 13, 10, 0
-
-; Pad to 512 bytes and add boot signature
-times 510-($-$$) db 0
-dw 0xAA55 
\ No newline at end of file
+; Pad the extension to a full sector
+times 1024-($-$$) db 0
+ 
\ No newline at end of file
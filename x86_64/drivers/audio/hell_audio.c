@@ -1,23 +1,33 @@
 /*
- * HellOS 3-Channel Audio Driver
- * Square, Sine, and Sawtooth waveforms
+ * HellOS Audio Driver
+ * Square, Sine, and Sawtooth voices mixed in blocks and streamed to a
+ * Sound Blaster 16 over ISA DMA
  */
 
 #include "../../kernel/kernel.h"
 #include "../../kernel/audio.h"
 #include "../../kernel/memory.h"
+#include "../../kernel/memory_layout.h"
+#include "../../kernel/interrupts.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/debug.h"
 #include <stdint.h>
 
 // Audio constants
-#define SAMPLE_RATE 44100
-#define BUFFER_SIZE 1024
-#define MAX_CHANNELS 3
+#define SAMPLE_RATE AUDIO_SAMPLE_RATE
+#define BUFFER_SIZE AUDIO_BLOCK_SAMPLES
+#define MAX_CHANNELS AUDIO_VOICES
 
-// Audio state
+// Audio state; the voices are shared with the completion interrupt
 static audio_state_t audio_state;
 static audio_channel_t channels[MAX_CHANNELS];
-static int16_t audio_buffer[BUFFER_SIZE];
-static uint32_t buffer_position = 0;
+static spinlock_t audio_lock = SPINLOCK_INIT;
+static int32_t mix_buffer[BUFFER_SIZE];
+
+// The DMA stream is two blocks: the card plays one while the other is mixed
+static int16_t* const dma_buffer = (int16_t*)AUDIO_DMA_ADDR;
+static uint32_t dma_block = 0;      // Block the card finished last
+static uint32_t silent_blocks = 0;  // Consecutive blocks mixed with no voice
 
 // Waveform lookup tables
 static int16_t sine_table[256];
@@ -29,6 +39,132 @@ static int16_t saw_table[256];
 #define PIT_COMMAND     0x43
 #define SPEAKER_PORT    0x61
 
+// Sound Blaster 16 at its default resources
+#define SB16_BASE           0x220
+#define SB16_MIXER_ADDR     (SB16_BASE + 0x4)
+#define SB16_MIXER_DATA     (SB16_BASE + 0x5)
+#define SB16_RESET          (SB16_BASE + 0x6)
+#define SB16_READ           (SB16_BASE + 0xA)
+#define SB16_WRITE          (SB16_BASE + 0xC)   // Bit 7 set while busy
+#define SB16_READ_STATUS    (SB16_BASE + 0xE)   // Bit 7 set when data waits; reading acks 8-bit IRQs
+#define SB16_ACK_16         (SB16_BASE + 0xF)   // Reading acks 16-bit IRQs
+#define SB16_IRQ            5
+#define SB16_DMA            5                   // 16-bit channel
+#define SB16_TIMEOUT        100000              // Status polls before giving up
+
+// DSP commands and mixer registers
+#define DSP_SET_OUTPUT_RATE 0x41
+#define DSP_PLAY_16_AUTO    0xB6    // 16-bit output, auto-init, FIFO on
+#define DSP_MODE_MONO_SIGNED 0x10
+#define DSP_SPEAKER_ON      0xD1
+#define DSP_PAUSE_16        0xD5
+#define DSP_CONTINUE_16     0xD6
+#define DSP_EXIT_AUTO_16    0xD9
+#define DSP_GET_VERSION     0xE1
+#define DSP_RESET_READY     0xAA
+#define MIXER_IRQ_SELECT    0x80
+#define MIXER_DMA_SELECT    0x81
+#define MIXER_IRQ_5         0x02
+#define MIXER_DMA_1_5       0x22
+
+// ISA DMA controller 2, channels 4-7 with word addresses and counts
+#define DMA2_MASK           0xD4
+#define DMA2_MODE           0xD6
+#define DMA2_FLIP_FLOP      0xD8
+#define DMA5_ADDRESS        0xC4
+#define DMA5_COUNT          0xC6
+#define DMA5_PAGE           0x8B
+#define DMA_MASK_ON         0x04
+#define DMA_MODE_PLAYBACK   0x58    // Single, auto-init, memory to device
+
+static void sb16_interrupt_handler(void);
+
+/*
+ * Write a DSP command or argument once it can take one
+ */
+static bool dsp_write(uint8_t value) {
+    for (uint32_t i = 0; i < SB16_TIMEOUT; i++) {
+        if (!(inb(SB16_WRITE) & 0x80)) {
+            outb(SB16_WRITE, value);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read a DSP byte, -1 if none arrives
+ */
+static int dsp_read(void) {
+    for (uint32_t i = 0; i < SB16_TIMEOUT; i++) {
+        if (inb(SB16_READ_STATUS) & 0x80) {
+            return inb(SB16_READ);
+        }
+    }
+    return -1;
+}
+
+/*
+ * Reset the DSP, true if a Sound Blaster 16 or later answered
+ */
+static bool sb16_detect(void) {
+    outb(SB16_RESET, 1);
+    for (int i = 0; i < 4; i++) {
+        inb(0x80);  // At least 3us
+    }
+    outb(SB16_RESET, 0);
+    if (dsp_read() != DSP_RESET_READY) {
+        return false;
+    }
+    
+    if (!dsp_write(DSP_GET_VERSION)) {
+        return false;
+    }
+    int major = dsp_read();
+    int minor = dsp_read();
+    if (major < 4 || minor < 0) {
+        return false;
+    }
+    audio_state.dsp_version = (uint16_t)((major << 8) | minor);
+    return true;
+}
+
+/*
+ * Start the auto-init stream over both blocks of the DMA buffer
+ * The card interrupts at the end of each block.
+ */
+static bool sb16_start_stream(void) {
+    uint32_t address = AUDIO_DMA_ADDR;
+    uint32_t words = 2 * BUFFER_SIZE;
+    
+    // Route the card to IRQ 5 and DMA 1/5
+    outb(SB16_MIXER_ADDR, MIXER_IRQ_SELECT);
+    outb(SB16_MIXER_DATA, MIXER_IRQ_5);
+    outb(SB16_MIXER_ADDR, MIXER_DMA_SELECT);
+    outb(SB16_MIXER_DATA, MIXER_DMA_1_5);
+    
+    outb(DMA2_MASK, DMA_MASK_ON | (SB16_DMA & 3));
+    outb(DMA2_FLIP_FLOP, 0);
+    outb(DMA2_MODE, DMA_MODE_PLAYBACK | (SB16_DMA & 3));
+    outb(DMA5_ADDRESS, (address >> 1) & 0xFF);
+    outb(DMA5_ADDRESS, (address >> 9) & 0xFF);
+    outb(DMA5_COUNT, (words - 1) & 0xFF);
+    outb(DMA5_COUNT, ((words - 1) >> 8) & 0xFF);
+    outb(DMA5_PAGE, (address >> 16) & 0xFE);
+    outb(DMA2_MASK, SB16_DMA & 3);
+    
+    register_irq_handler(SB16_IRQ, sb16_interrupt_handler);
+    
+    return dsp_write(DSP_SPEAKER_ON) &&
+           dsp_write(DSP_SET_OUTPUT_RATE) &&
+           dsp_write((SAMPLE_RATE >> 8) & 0xFF) &&
+           dsp_write(SAMPLE_RATE & 0xFF) &&
+           dsp_write(DSP_PLAY_16_AUTO) &&
+           dsp_write(DSP_MODE_MONO_SIGNED) &&
+           dsp_write((BUFFER_SIZE - 1) & 0xFF) &&
+           dsp_write(((BUFFER_SIZE - 1) >> 8) & 0xFF);
+}
+
 /*
  * Initialize the audio system
  */
@@ -38,6 +174,10 @@ int init_hell_audio_driver(void) {
     audio_state.channels = MAX_CHANNELS;
     audio_state.buffer_size = BUFFER_SIZE;
     audio_state.initialized = false;
+    audio_state.output = AUDIO_OUTPUT_PC_SPEAKER;
+    audio_state.dsp_version = 0;
+    audio_state.streaming = false;
+    audio_state.blocks_mixed = 0;
     
     // Initialize channels
     for (int i = 0; i < MAX_CHANNELS; i++) {
@@ -45,19 +185,32 @@ int init_hell_audio_driver(void) {
         channels[i].waveform = WAVE_SINE;
         channels[i].volume = 0;
         channels[i].phase = 0;
+        channels[i].phase_increment = 0;
+        channels[i].gain = 0;
         channels[i].active = false;
     }
     
     // Generate waveform lookup tables
     generate_waveform_tables();
     
-    // Initialize PC Speaker
-    init_pc_speaker();
-    
-    // Clear audio buffer
-    memset(audio_buffer, 0, sizeof(audio_buffer));
+    // Stream to a Sound Blaster 16 when there is one, else just beep
+    memset(dma_buffer, 0, 2 * BUFFER_SIZE * sizeof(int16_t));
+    if (sb16_detect()) {
+        dma_block = 1;
+        silent_blocks = 0;
+        if (!sb16_start_stream()) {
+            return HELL_ERROR_GENERAL;
+        }
+        audio_state.output = AUDIO_OUTPUT_SB16;
+        audio_state.streaming = true;
+        DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "SB16 DSP %d.%d streaming at %d Hz",
+                      audio_state.dsp_version >> 8, audio_state.dsp_version & 0xFF, SAMPLE_RATE);
+    } else {
+        init_pc_speaker();
+    }
     
     audio_state.initialized = true;
+    init_audio_sequencer();
     return HELL_SUCCESS;
 }
 
@@ -101,19 +254,34 @@ void init_pc_speaker(void) {
 
 /*
  * Play a note on a specific channel
+ * Everything the mixer needs per sample is worked out here, once.
  */
 void play_note(int channel, uint16_t frequency, uint8_t waveform, uint8_t volume) {
     if (channel < 0 || channel >= MAX_CHANNELS) return;
     if (!audio_state.initialized) return;
+    if (waveform > WAVE_SAW) waveform = WAVE_SINE;
     
-    channels[channel].frequency = frequency;
-    channels[channel].waveform = waveform;
-    channels[channel].volume = volume;
-    channels[channel].phase = 0;
-    channels[channel].active = true;
+    uint32_t increment = (uint32_t)div64_32((uint64_t)frequency << 32, SAMPLE_RATE);
+    
+    uint32_t flags = spin_lock_irqsave(&audio_lock);
+    audio_channel_t* ch = &channels[channel];
+    ch->frequency = frequency;
+    ch->waveform = waveform;
+    ch->volume = volume;
+    ch->phase = 0;
+    ch->phase_increment = increment;
+    ch->gain = volume + (volume >> 7);  // 255 becomes 256, unity
+    ch->active = frequency > 0;
     
-    // For channel 0, also use PC Speaker for compatibility
-    if (channel == 0 && frequency > 0) {
+    if (ch->active && audio_state.output == AUDIO_OUTPUT_SB16 && !audio_state.streaming) {
+        audio_state.streaming = true;
+        silent_blocks = 0;
+        dsp_write(DSP_CONTINUE_16);
+    }
+    spin_unlock_irqrestore(&audio_lock, flags);
+    
+    // Without a card, channel 0 goes to the PC Speaker
+    if (audio_state.output == AUDIO_OUTPUT_PC_SPEAKER && channel == 0 && frequency > 0) {
         set_pc_speaker_frequency(frequency);
     }
 }
@@ -125,11 +293,14 @@ void stop_note(int channel) {
     if (channel < 0 || channel >= MAX_CHANNELS) return;
     if (!audio_state.initialized) return;
     
+    uint32_t flags = spin_lock_irqsave(&audio_lock);
     channels[channel].active = false;
     channels[channel].volume = 0;
+    channels[channel].gain = 0;
+    spin_unlock_irqrestore(&audio_lock, flags);
     
     // Turn off PC Speaker if channel 0
-    if (channel == 0) {
+    if (audio_state.output == AUDIO_OUTPUT_PC_SPEAKER && channel == 0) {
         silence_pc_speaker();
     }
 }
@@ -161,131 +332,114 @@ void silence_pc_speaker(void) {
 }
 
 /*
- * Generate audio samples for mixing
+ * Add a block of one voice to the mix
+ * One loop per waveform, each free of branches: the sine is a table
+ * lookup, the square the sign of the phase and the saw the phase itself.
  */
-int16_t generate_sample(int channel) {
-    if (!channels[channel].active) return 0;
-    
-    audio_channel_t* ch = &channels[channel];
-    int16_t sample = 0;
-    
-    // Calculate phase increment
-    uint32_t phase_increment = (ch->frequency * 256) / SAMPLE_RATE;
-    
-    // Get sample from waveform table
-    uint8_t table_index = (ch->phase >> 8) & 0xFF;
-    
-    switch (ch->waveform) {
-        case WAVE_SINE:
-            sample = sine_table[table_index];
-            break;
-        case WAVE_SQUARE:
-            sample = square_table[table_index];
-            break;
-        case WAVE_SAW:
-            sample = saw_table[table_index];
-            break;
-        default:
-            sample = 0;
-            break;
+static void mix_sine(audio_channel_t* ch, int32_t* mix, uint32_t samples) {
+    uint32_t phase = ch->phase;
+    uint32_t increment = ch->phase_increment;
+    int32_t gain = ch->gain;
+    for (uint32_t i = 0; i < samples; i++) {
+        mix[i] += (sine_table[phase >> 24] * gain) >> 8;
+        phase += increment;
     }
-    
-    // Apply volume
-    sample = (sample * ch->volume) / 255;
-    
-    // Update phase
-    ch->phase += phase_increment;
-    
-    return sample;
+    ch->phase = phase;
 }
 
-/*
- * Mix all channels and update audio buffer
- */
-void update_audio_system(void) {
-    if (!audio_state.initialized) return;
-    
-    // Mix all active channels
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        int32_t mixed_sample = 0;
-        
-        // Mix all channels
-        for (int ch = 0; ch < MAX_CHANNELS; ch++) {
-            mixed_sample += generate_sample(ch);
-        }
-        
-        // Clamp to 16-bit range
-        if (mixed_sample > 32767) mixed_sample = 32767;
-        if (mixed_sample < -32768) mixed_sample = -32768;
-        
-        audio_buffer[i] = (int16_t)mixed_sample;
+static void mix_square(audio_channel_t* ch, int32_t* mix, uint32_t samples) {
+    uint32_t phase = ch->phase;
+    uint32_t increment = ch->phase_increment;
+    int32_t level = (32767 * ch->gain) >> 8;
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t sign = (int32_t)phase >> 31;   // -1 in the second half period
+        mix[i] += (level ^ sign) - sign;
+        phase += increment;
     }
-    
-    // Update buffer position
-    buffer_position = (buffer_position + 1) % BUFFER_SIZE;
+    ch->phase = phase;
 }
 
+static void mix_saw(audio_channel_t* ch, int32_t* mix, uint32_t samples) {
+    uint32_t phase = ch->phase;
+    uint32_t increment = ch->phase_increment;
+    int32_t gain = ch->gain;
+    for (uint32_t i = 0; i < samples; i++) {
+        mix[i] += (((int32_t)(phase >> 16) - 32768) * gain) >> 8;
+        phase += increment;
+    }
+    ch->phase = phase;
+}
+
+static void (*const voice_mixers[])(audio_channel_t*, int32_t*, uint32_t) = {
+    [WAVE_SINE] = mix_sine,
+    [WAVE_SQUARE] = mix_square,
+    [WAVE_SAW] = mix_saw,
+};
+
 /*
- * Play an audio sequence
+ * Mix every active voice into a block of 16-bit samples
+ * Returns the number of voices mixed. Called with audio_lock held.
  */
-void play_audio_sequence(audio_note_t* sequence, int max_channels) {
-    if (!audio_state.initialized) return;
-    if (max_channels > MAX_CHANNELS) max_channels = MAX_CHANNELS;
+static uint32_t mix_block_locked(int16_t* out, uint32_t samples) {
+    uint32_t voices = 0;
     
-    int channel = 0;
-    
-    while (sequence->frequency != 0 && channel < max_channels) {
-        play_note(channel, sequence->frequency, sequence->waveform, 128);
-        
-        // Simple delay (in a real OS, this would be timer-based)
-        for (volatile int i = 0; i < sequence->duration_ms * 1000; i++) {
-            // Busy wait - not ideal but simple
+    memset(mix_buffer, 0, samples * sizeof(int32_t));
+    for (int ch = 0; ch < MAX_CHANNELS; ch++) {
+        if (channels[ch].active) {
+            voice_mixers[channels[ch].waveform](&channels[ch], mix_buffer, samples);
+            voices++;
         }
-        
-        stop_note(channel);
-        
-        channel = (channel + 1) % max_channels;
-        sequence++;
     }
+    
+    // Clamp to 16-bit range
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t sample = mix_buffer[i];
+        sample = sample > 32767 ? 32767 : sample;
+        sample = sample < -32768 ? -32768 : sample;
+        out[i] = (int16_t)sample;
+    }
+    audio_state.blocks_mixed++;
+    return voices;
 }
 
 /*
- * Create demonic sound effects
+ * Mix the active voices into a buffer, advancing them
  */
-void create_demonic_growl(int channel) {
+void audio_mix(int16_t* out, uint32_t samples) {
     if (!audio_state.initialized) return;
     
-    // Low frequency sawtooth for growl effect
-    play_note(channel, 60, WAVE_SAW, 200);
-    
-    // Add some frequency modulation
-    for (int i = 0; i < 100; i++) {
-        uint16_t freq = 60 + (i % 20);
-        channels[channel].frequency = freq;
-        
-        // Simple delay
-        for (volatile int j = 0; j < 10000; j++);
+    uint32_t flags = spin_lock_irqsave(&audio_lock);
+    while (samples) {
+        uint32_t count = samples < BUFFER_SIZE ? samples : BUFFER_SIZE;
+        mix_block_locked(out, count);
+        out += count;
+        samples -= count;
     }
+    spin_unlock_irqrestore(&audio_lock, flags);
 }
 
 /*
- * Create fire crackling sound
+ * SB16 block completion: refill the block the card just finished
+ * The card has moved on to the other block, so there is a whole block's
+ * time for this. Once both blocks hold silence the stream pauses until
+ * play_note continues it.
  */
-void create_fire_crackling(int channel) {
-    if (!audio_state.initialized) return;
+static void sb16_interrupt_handler(void) {
+    inb(SB16_ACK_16);
     
-    // Random high frequency square waves
-    for (int i = 0; i < 50; i++) {
-        uint16_t freq = 1000 + (i * 17) % 500; // Pseudo-random
-        play_note(channel, freq, WAVE_SQUARE, 100);
-        
-        // Short burst
-        for (volatile int j = 0; j < 5000; j++);
-        stop_note(channel);
-        
-        // Brief pause
-        for (volatile int j = 0; j < 2000; j++);
+    spin_lock(&audio_lock);
+    if (!audio_state.streaming) {
+        spin_unlock(&audio_lock);
+        return;
     }
+    dma_block ^= 1;
+    uint32_t voices = mix_block_locked(dma_buffer + dma_block * BUFFER_SIZE, BUFFER_SIZE);
+    silent_blocks = voices ? 0 : silent_blocks + 1;
+    if (silent_blocks >= 2) {
+        audio_state.streaming = false;
+        dsp_write(DSP_PAUSE_16);
+    }
+    spin_unlock(&audio_lock);
 }
 
 /*
@@ -301,12 +455,17 @@ void init_audio_system(void) {
  */
 void shutdown_audio_driver(void) {
     if (audio_state.initialized) {
-        // Stop all channels
+        // Stop all sequences and channels
+        audio_cancel_all_sequences();
         for (int i = 0; i < MAX_CHANNELS; i++) {
             stop_note(i);
         }
         
-        // Silence PC Speaker
+        // Stop the stream, silence PC Speaker
+        if (audio_state.output == AUDIO_OUTPUT_SB16) {
+            dsp_write(DSP_EXIT_AUTO_16);
+            audio_state.streaming = false;
+        }
         silence_pc_speaker();
         
         audio_state.initialized = false;
@@ -0,0 +1,274 @@
+/*
+ * HellOS Audio Sequencer
+ * Note sequences played off one-shot deadlines, so nothing waits on a
+ * sound but the mixer
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/audio.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/process.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/wakeup.h"
+#include <stdint.h>
+
+typedef enum {
+    SEQUENCE_FREE,
+    SEQUENCE_WAITING,       // Chained, starts when its predecessor ends
+    SEQUENCE_PLAYING
+} sequence_state_t;
+
+// Sequence slot i plays on voice i. An id is the slot plus a generation
+// bumped every time the slot is freed, so stale ids are refused.
+typedef struct {
+    audio_note_t notes[AUDIO_SEQUENCE_NOTES];
+    uint32_t count;
+    uint32_t position;      // Note sounding now
+    uint64_t deadline;      // When it ends, system time in ms
+    sequence_state_t state;
+    uint8_t volume;
+    uint8_t generation;
+    int after;              // Slot a waiting sequence follows
+} sequence_t;
+
+#define SEQUENCE_ID(slot)   ((int)((sequences[slot].generation << 8) | (slot)))
+
+static sequence_t sequences[AUDIO_SEQUENCES];
+static spinlock_t sequencer_lock = SPINLOCK_INIT;
+static int sequencer_wakeup = -1;
+
+static void sequencer_update(void);
+
+/*
+ * Slot of a live sequence id, or -1
+ */
+static int sequence_slot(int id) {
+    if (id < 0) {
+        return -1;
+    }
+    int slot = id & 0xFF;
+    if (slot >= AUDIO_SEQUENCES || sequences[slot].state == SEQUENCE_FREE ||
+        sequences[slot].generation != (uint8_t)(id >> 8)) {
+        return -1;
+    }
+    return slot;
+}
+
+/*
+ * Sound the current note of a sequence until start plus its duration
+ */
+static void start_note_locked(int slot, uint64_t start) {
+    sequence_t* sequence = &sequences[slot];
+    const audio_note_t* note = &sequence->notes[sequence->position];
+    
+    if (note->waveform == WAVE_REST) {
+        stop_note(slot);
+    } else {
+        play_note(slot, note->frequency, note->waveform, sequence->volume);
+    }
+    sequence->deadline = start + note->duration_ms;
+}
+
+/*
+ * Start a sequence from its first note
+ */
+static void start_sequence_locked(int slot, uint64_t start) {
+    sequences[slot].state = SEQUENCE_PLAYING;
+    sequences[slot].position = 0;
+    start_note_locked(slot, start);
+}
+
+/*
+ * Free a slot and deal with what was chained after it
+ * Finishing starts the followers at the moment it ended; cancelling
+ * cancels them too.
+ */
+static void end_sequence_locked(int slot, bool cancelled, uint64_t end) {
+    stop_note(slot);
+    sequences[slot].state = SEQUENCE_FREE;
+    sequences[slot].generation++;
+    
+    for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+        if (sequences[i].state != SEQUENCE_WAITING || sequences[i].after != slot) {
+            continue;
+        }
+        if (cancelled) {
+            end_sequence_locked(i, true, end);
+        } else {
+            start_sequence_locked(i, end);
+        }
+    }
+}
+
+/*
+ * Arm the wakeup for the next note to end, or disarm it
+ */
+static void arm_sequencer_locked(void) {
+    uint64_t next = 0;
+    for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+        if (sequences[i].state == SEQUENCE_PLAYING && (!next || sequences[i].deadline < next)) {
+            next = sequences[i].deadline;
+        }
+    }
+    wakeup_at(sequencer_wakeup, next);
+}
+
+/*
+ * Initialize the sequencer
+ */
+void init_audio_sequencer(void) {
+    memset(sequences, 0, sizeof(sequences));
+    sequencer_wakeup = wakeup_register("sequencer", sequencer_update);
+}
+
+/*
+ * Advance every sequence whose note has ended
+ * Runs from the sequencer wakeup. Late wakeups don't stretch a
+ * sequence: each note is timed from when the last one should have ended.
+ */
+static void sequencer_update(void) {
+    uint64_t now = get_system_time();
+    
+    uint32_t flags = spin_lock_irqsave(&sequencer_lock);
+    bool advanced = true;
+    while (advanced) {
+        // Followers started here can be already due, so go round again
+        advanced = false;
+        for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+            sequence_t* sequence = &sequences[i];
+            while (sequence->state == SEQUENCE_PLAYING && sequence->deadline <= now) {
+                advanced = true;
+                if (++sequence->position == sequence->count) {
+                    end_sequence_locked(i, false, sequence->deadline);
+                } else {
+                    start_note_locked(i, sequence->deadline);
+                }
+            }
+        }
+    }
+    arm_sequencer_locked();
+    spin_unlock_irqrestore(&sequencer_lock, flags);
+}
+
+/*
+ * Queue a note sequence, returning at once
+ * The notes run up to a zero frequency that isn't a WAVE_REST, or to
+ * AUDIO_SEQUENCE_NOTES, and are
+ * copied, so they may live on the caller's stack. The sequence starts
+ * now, or chained when the sequence after ends; an after that already
+ * ended means now. Returns its id, or AUDIO_NO_SEQUENCE when there is
+ * nothing to play or every voice is taken.
+ */
+int audio_play_sequence(const audio_note_t* notes, uint8_t volume, int after) {
+    uint32_t count = 0;
+    while (count < AUDIO_SEQUENCE_NOTES &&
+           (notes[count].frequency != 0 || notes[count].waveform == WAVE_REST)) {
+        count++;
+    }
+    if (!count || sequencer_wakeup < 0) {
+        return AUDIO_NO_SEQUENCE;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&sequencer_lock);
+    int slot = -1;
+    for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+        if (sequences[i].state == SEQUENCE_FREE) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        spin_unlock_irqrestore(&sequencer_lock, flags);
+        return AUDIO_NO_SEQUENCE;
+    }
+    
+    sequence_t* sequence = &sequences[slot];
+    memcpy(sequence->notes, notes, count * sizeof(audio_note_t));
+    sequence->count = count;
+    sequence->volume = volume;
+    sequence->after = sequence_slot(after);
+    if (sequence->after >= 0) {
+        sequence->state = SEQUENCE_WAITING;
+    } else {
+        start_sequence_locked(slot, get_system_time());
+        arm_sequencer_locked();
+    }
+    int id = SEQUENCE_ID(slot);
+    spin_unlock_irqrestore(&sequencer_lock, flags);
+    return id;
+}
+
+/*
+ * Stop a sequence and everything chained after it
+ * Returns false if it had already ended.
+ */
+bool audio_cancel_sequence(int id) {
+    uint32_t flags = spin_lock_irqsave(&sequencer_lock);
+    int slot = sequence_slot(id);
+    if (slot >= 0) {
+        end_sequence_locked(slot, true, get_system_time());
+        arm_sequencer_locked();
+    }
+    spin_unlock_irqrestore(&sequencer_lock, flags);
+    return slot >= 0;
+}
+
+/*
+ * Stop every sequence
+ */
+void audio_cancel_all_sequences(void) {
+    uint32_t flags = spin_lock_irqsave(&sequencer_lock);
+    for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+        if (sequences[i].state != SEQUENCE_FREE) {
+            end_sequence_locked(i, true, get_system_time());
+        }
+    }
+    arm_sequencer_locked();
+    spin_unlock_irqrestore(&sequencer_lock, flags);
+}
+
+/*
+ * Whether a sequence is still playing or waiting to
+ */
+bool audio_sequence_playing(int id) {
+    return sequence_slot(id) >= 0;
+}
+
+/*
+ * Whether nothing is playing or waiting
+ */
+bool audio_sequencer_idle(void) {
+    for (int i = 0; i < AUDIO_SEQUENCES; i++) {
+        if (sequences[i].state != SEQUENCE_FREE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Create demonic sound effects
+ * A low sawtooth wobbling through twenty pitches.
+ */
+int create_demonic_growl(void) {
+    audio_note_t growl[21];
+    for (int i = 0; i < 20; i++) {
+        growl[i] = (audio_note_t){(uint16_t)(60 + i), WAVE_SAW, 10};
+    }
+    growl[20] = (audio_note_t){0, 0, 0};
+    return audio_play_sequence(growl, 200, AUDIO_NO_SEQUENCE);
+}
+
+/*
+ * Create fire crackling sound
+ * Short square bursts at pseudo-random pitches with gaps between.
+ */
+int create_fire_crackling(void) {
+    audio_note_t crackle[AUDIO_SEQUENCE_NOTES + 1];
+    for (int i = 0; i < AUDIO_SEQUENCE_NOTES / 2; i++) {
+        crackle[2 * i] = (audio_note_t){(uint16_t)(1000 + (i * 17) % 500), WAVE_SQUARE, 5};
+        crackle[2 * i + 1] = (audio_note_t){0, WAVE_REST, 2};
+    }
+    crackle[AUDIO_SEQUENCE_NOTES] = (audio_note_t){0, 0, 0};
+    return audio_play_sequence(crackle, 100, AUDIO_NO_SEQUENCE);
+}
@@ -0,0 +1,228 @@
+/*
+ * HellOS Console
+ * Scrolling text on the cell grid, for the shell and anything else that
+ * prints a lot
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/graphics.h"
+#include "../../kernel/console.h"
+#include "../../kernel/memory.h"
+#include <stdint.h>
+
+/*
+ * Set up a console filling a rectangle of a surface with whole cells
+ */
+int console_init(console_t* console, surface_t* surface, int x, int y, int width, int height) {
+    console->initialized = false;
+    console->surface = surface;
+    console->x = x;
+    console->y = y;
+    console->columns = width > 0 ? (uint32_t)width / GLYPH_CELL_WIDTH : 0;
+    console->rows = height > 0 ? (uint32_t)height / GLYPH_CELL_HEIGHT : 0;
+    console->cursor_column = 0;
+    console->cursor_row = 0;
+    console->update_depth = 0;
+    console->dirty_first = 1;
+    console->dirty_last = 0;
+    
+    if (!console->columns || !console->rows) {
+        return HELL_ERROR_GENERAL;
+    }
+    
+    console->cells = (console_cell_t*)malloc(console->columns * console->rows * sizeof(console_cell_t));
+    if (!console->cells) {
+        return HELL_ERROR_MEMORY;
+    }
+    
+    console->initialized = true;
+    console_clear(console);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Note rows changed while drawing is deferred
+ */
+static void console_mark_dirty(console_t* console, uint32_t first, uint32_t last) {
+    if (console->dirty_first > console->dirty_last) {
+        console->dirty_first = first;
+        console->dirty_last = last;
+        return;
+    }
+    if (first < console->dirty_first) {
+        console->dirty_first = first;
+    }
+    if (last > console->dirty_last) {
+        console->dirty_last = last;
+    }
+}
+
+/*
+ * Blank every cell and home the cursor
+ */
+void console_clear(console_t* console) {
+    if (!console->initialized) return;
+    
+    for (uint32_t i = 0; i < console->columns * console->rows; i++) {
+        console->cells[i].character = ' ';
+        console->cells[i].color = GLYPH_CELL_BACKGROUND;
+    }
+    console->cursor_column = 0;
+    console->cursor_row = 0;
+    if (console->update_depth) {
+        console_mark_dirty(console, 0, console->rows - 1);
+        return;
+    }
+    surface_fill_rect(console->surface, console->x, console->y, (int)(console->columns * GLYPH_CELL_WIDTH),
+                      (int)(console->rows * GLYPH_CELL_HEIGHT), GLYPH_CELL_BACKGROUND);
+}
+
+/*
+ * Draw rows from the backing store, a run per same-colored stretch
+ */
+static void console_draw_rows(console_t* console, uint32_t first, uint32_t last) {
+    char run[128];
+    for (uint32_t row = first; row <= last; row++) {
+        console_cell_t* cells = &console->cells[row * console->columns];
+        uint32_t start = 0;
+        while (start < console->columns) {
+            uint8_t color = cells[start].color;
+            uint32_t length = 0;
+            while (start + length < console->columns && length < sizeof(run) &&
+                   cells[start + length].color == color) {
+                run[length] = cells[start + length].character;
+                length++;
+            }
+            surface_draw_glyph_run(console->surface, run, length, console->x + (int)(start * GLYPH_CELL_WIDTH),
+                                   console->y + (int)(row * GLYPH_CELL_HEIGHT), color);
+            start += length;
+        }
+    }
+}
+
+/*
+ * Draw every cell from the backing store
+ */
+void console_redraw(console_t* console) {
+    if (!console->initialized) return;
+    
+    console_draw_rows(console, 0, console->rows - 1);
+}
+
+/*
+ * Defer drawing until the matching console_end_update; calls nest
+ */
+void console_begin_update(console_t* console) {
+    if (!console->initialized) return;
+    
+    console->update_depth++;
+}
+
+/*
+ * Draw everything written since the outermost console_begin_update
+ * A scroll dirties every row, so a burst of output that scrolls the
+ * screen many times over is still drawn just once.
+ */
+void console_end_update(console_t* console) {
+    if (!console->initialized || !console->update_depth) return;
+    
+    if (--console->update_depth == 0 && console->dirty_first <= console->dirty_last) {
+        console_draw_rows(console, console->dirty_first, console->dirty_last);
+        console->dirty_first = 1;
+        console->dirty_last = 0;
+    }
+}
+
+/*
+ * Move everything up a row, the cells and the pixels alike
+ */
+static void console_scroll(console_t* console) {
+    uint32_t columns = console->columns;
+    memmove(console->cells, console->cells + columns, (console->rows - 1) * columns * sizeof(console_cell_t));
+    console_cell_t* last = &console->cells[(console->rows - 1) * columns];
+    for (uint32_t i = 0; i < columns; i++) {
+        last[i].character = ' ';
+        last[i].color = GLYPH_CELL_BACKGROUND;
+    }
+    
+    if (console->update_depth) {
+        console_mark_dirty(console, 0, console->rows - 1);
+        return;
+    }
+    surface_scroll(console->surface, console->x, console->y, (int)(columns * GLYPH_CELL_WIDTH),
+                   (int)(console->rows * GLYPH_CELL_HEIGHT), GLYPH_CELL_HEIGHT, GLYPH_CELL_BACKGROUND);
+}
+
+/*
+ * Draw the run of cells written since the last flush on the cursor row
+ */
+static void console_flush_run(console_t* console, uint32_t start, uint8_t color) {
+    uint32_t end = console->cursor_column;
+    if (end <= start) return;
+    if (console->update_depth) {
+        console_mark_dirty(console, console->cursor_row, console->cursor_row);
+        return;
+    }
+    
+    char run[128];
+    console_cell_t* cells = &console->cells[console->cursor_row * console->columns];
+    while (start < end) {
+        uint32_t length = end - start < sizeof(run) ? end - start : sizeof(run);
+        for (uint32_t i = 0; i < length; i++) {
+            run[i] = cells[start + i].character;
+        }
+        surface_draw_glyph_run(console->surface, run, length, console->x + (int)(start * GLYPH_CELL_WIDTH),
+                               console->y + (int)(console->cursor_row * GLYPH_CELL_HEIGHT), color);
+        start += length;
+    }
+}
+
+/*
+ * Advance to the start of the next row, scrolling at the bottom
+ */
+static void console_newline(console_t* console) {
+    console->cursor_column = 0;
+    if (++console->cursor_row == console->rows) {
+        console->cursor_row = console->rows - 1;
+        console_scroll(console);
+    }
+}
+
+/*
+ * Write text at the cursor
+ * Handles newline, carriage return and backspace; lines wrap at the last
+ * column. Consecutive characters on a row are drawn as one run, or
+ * left for console_end_update inside an update.
+ */
+void console_write(console_t* console, const char* text, uint8_t color) {
+    if (!console->initialized) return;
+    
+    uint32_t run_start = console->cursor_column;
+    for (; *text; text++) {
+        char c = *text;
+        if (c == '\n' || c == '\r' || c == '\b') {
+            console_flush_run(console, run_start, color);
+            if (c == '\n') {
+                console_newline(console);
+            } else if (c == '\r') {
+                console->cursor_column = 0;
+            } else if (console->cursor_column > 0) {
+                console->cursor_column--;
+            }
+            run_start = console->cursor_column;
+            continue;
+        }
+        
+        if (console->cursor_column == console->columns) {
+            console_flush_run(console, run_start, color);
+            console_newline(console);
+            run_start = 0;
+        }
+        
+        console_cell_t* cell = &console->cells[console->cursor_row * console->columns + console->cursor_column];
+        cell->character = c;
+        cell->color = color;
+        console->cursor_column++;
+    }
+    console_flush_run(console, run_start, color);
+}
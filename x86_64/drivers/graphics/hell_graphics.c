@@ -1,20 +1,76 @@
 /*
  * HellOS Proprietary Graphics Driver
- * 680x480 resolution, 32-color palette
+ * 680x480 resolution, 32-color palette, on a VBE linear framebuffer at
+ * 8, 16 or 32 bpp when the bootloader found one
  */
 
 #include "../../kernel/kernel.h"
 #include "../../kernel/graphics.h"
 #include "../../kernel/memory.h"
+#include "../../kernel/paging.h"
+#include "../../kernel/process.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/wakeup.h"
 #include <stdint.h>
 
-// Forward declaration
+// Forward declarations
 int abs(int x);
+static void build_glyph_expand(void);
+static void surface_draw_char(surface_t* surface, char c, int x, int y, uint8_t color);
+static void screen_damage(surface_t* surface, int x, int y, int width, int height);
 
 // Graphics state
 static graphics_state_t graphics_state;
-static uint8_t* framebuffer;
+static uint8_t* framebuffer;        // Drawing target: the back buffer in RAM
 static uint32_t framebuffer_size;
+static uint32_t back_pitch;         // Bytes per back buffer row
+static uint32_t pixel_bytes;
+static uint8_t* video_memory;       // Where the screen's top left pixel is presented
+static uint32_t video_lines;        // Rows of the screen video memory holds
+static surface_t screen_surface;    // The back buffer as a surface
+
+// Damage since the last present, merged as it accumulates.
+// A rectangle is [x0, x1) by [y0, y1).
+typedef struct {
+    int x0, y0, x1, y1;
+} dirty_rect_t;
+
+static dirty_rect_t dirty_rects[GRAPHICS_DIRTY_RECTS];
+static uint32_t dirty_count = 0;
+static spinlock_t dirty_lock = SPINLOCK_INIT;
+static int present_wakeup = -1;     // Presents at most once per frame
+static graphics_stats_t graphics_stats = {0};
+
+// Glyph row expansion: word 0 covers the left four pixels of a font row
+// byte, word 1 the right four, with 0xFF in each byte whose bit is set
+static uint32_t glyph_expand[256][2];
+
+// Glyph rows are stored at any byte offset
+typedef uint32_t __attribute__((aligned(1), may_alias)) unaligned_u32;
+
+// Palette colors as pixel values in the video format
+static uint32_t native_colors[256];
+
+// Glyph atlas: per palette color, every glyph pre-rasterized as an
+// opaque GLYPH_CELL_WIDTH x GLYPH_CELL_HEIGHT cell on GLYPH_CELL_BACKGROUND
+// in the video format. A color's atlas is allocated the first time it is
+// drawn and each glyph rasterized on its first use.
+#define GLYPH_ATLAS_COLORS      32
+static uint8_t* glyph_atlas[GLYPH_ATLAS_COLORS];
+static uint32_t glyph_atlas_ready[GLYPH_ATLAS_COLORS][256 / 32];
+static uint32_t glyph_cell_bytes;
+static spinlock_t atlas_lock = SPINLOCK_INIT;
+
+// Pixel loops for one format, picked at init so no inner loop tests it.
+// Pointers are into a surface; columns and glyphs step its pitch.
+typedef struct {
+    void (*put)(uint8_t* dest, uint32_t pixel);
+    void (*fill)(uint8_t* dest, uint32_t pixel, int count);
+    void (*fill_column)(uint8_t* dest, uint32_t pixel, int count, uint32_t pitch);
+    void (*glyph)(uint8_t* dest, const uint8_t* glyph, uint32_t pixel, uint32_t pitch);
+} pixel_ops_t;
+
+static const pixel_ops_t* pixel_ops;
 
 // 32-color palette (RGB values)
 static uint32_t hell_palette[32] = {
@@ -66,6 +122,175 @@ static uint8_t hell_font[256][8] = {
     // For now, using a simple pattern for all characters
 };
 
+/*
+ * Fill a row of pixels
+ * 8 bpp is the optimized memset; 16 and 32 store whole words
+ */
+static void fill_8(uint8_t* dest, uint32_t pixel, int count) {
+    memset(dest, (int)pixel, (size_t)count);
+}
+
+static void fill_16(uint8_t* dest, uint32_t pixel, int count) {
+    uint16_t* p = (uint16_t*)dest;
+    if (count > 0 && ((uintptr_t)p & 2)) {
+        *p++ = (uint16_t)pixel;
+        count--;
+    }
+    uint32_t pairs = (uint32_t)count >> 1;
+    __asm__ volatile ("rep stosl" : "+D"(p), "+c"(pairs) : "a"((pixel & 0xFFFF) * 0x00010001U) : "memory");
+    if (count & 1) {
+        *p = (uint16_t)pixel;
+    }
+}
+
+static void fill_32(uint8_t* dest, uint32_t pixel, int count) {
+    uint32_t words = (uint32_t)count;
+    __asm__ volatile ("rep stosl" : "+D"(dest), "+c"(words) : "a"(pixel) : "memory");
+}
+
+/*
+ * Blit an 8x8 glyph wholly inside a surface
+ * 8 bpp writes each row as two masked words from the expansion table.
+ */
+static void glyph_8(uint8_t* dest, const uint8_t* glyph, uint32_t pixel, uint32_t pitch) {
+    uint32_t pattern = pixel * 0x01010101U;
+    for (int row = 0; row < 8; row++, dest += pitch) {
+        uint8_t line = glyph[row];
+        if (!line) {
+            continue;
+        }
+        unaligned_u32* words = (unaligned_u32*)dest;
+        uint32_t left = glyph_expand[line][0];
+        uint32_t right = glyph_expand[line][1];
+        words[0] = (words[0] & ~left) | (pattern & left);
+        words[1] = (words[1] & ~right) | (pattern & right);
+    }
+}
+
+// Single pixels, columns, and for the direct color formats glyphs
+#define DEFINE_PIXEL_OPS(bits, type) \
+    static void put_##bits(uint8_t* dest, uint32_t pixel) { \
+        *(type*)dest = (type)pixel; \
+    } \
+    static void fill_column_##bits(uint8_t* dest, uint32_t pixel, int count, uint32_t pitch) { \
+        for (int i = 0; i < count; i++, dest += pitch) { \
+            *(type*)dest = (type)pixel; \
+        } \
+    }
+
+#define DEFINE_GLYPH_OPS(bits, type) \
+    static void glyph_##bits(uint8_t* dest, const uint8_t* glyph, uint32_t pixel, uint32_t pitch) { \
+        for (int row = 0; row < 8; row++, dest += pitch) { \
+            type* p = (type*)dest; \
+            uint8_t line = glyph[row]; \
+            for (int col = 0; line; col++, line <<= 1) { \
+                if (line & 0x80) { \
+                    p[col] = (type)pixel; \
+                } \
+            } \
+        } \
+    }
+
+DEFINE_PIXEL_OPS(8, uint8_t)
+DEFINE_PIXEL_OPS(16, uint16_t)
+DEFINE_PIXEL_OPS(32, uint32_t)
+DEFINE_GLYPH_OPS(16, uint16_t)
+DEFINE_GLYPH_OPS(32, uint32_t)
+
+static const pixel_ops_t pixel_ops_8 = {put_8, fill_8, fill_column_8, glyph_8};
+static const pixel_ops_t pixel_ops_16 = {put_16, fill_16, fill_column_16, glyph_16};
+static const pixel_ops_t pixel_ops_32 = {put_32, fill_32, fill_column_32, glyph_32};
+
+/*
+ * Scale an 8-bit color component into a direct color field
+ */
+static uint32_t color_field(uint32_t value, uint8_t size, uint8_t position) {
+    if (size > 8) {
+        size = 8;
+    }
+    return (value >> (8 - size)) << position;
+}
+
+/*
+ * Use the linear framebuffer mode the bootloader set, if any
+ */
+static bool setup_vbe_mode(void) {
+    uint16_t mode = *(volatile uint16_t*)VBE_MODE_ADDR;
+    const vbe_controller_info_t* controller = (const vbe_controller_info_t*)VBE_INFO_ADDR;
+    const vbe_mode_info_t* info = (const vbe_mode_info_t*)VBE_MODE_INFO_ADDR;
+    
+    if (!mode || !info->framebuffer || info->width < SCREEN_WIDTH || info->height < SCREEN_HEIGHT) {
+        return false;
+    }
+    
+    switch (info->bpp) {
+        case 8:
+            graphics_state.format = PIXEL_FORMAT_INDEXED8;
+            pixel_ops = &pixel_ops_8;
+            break;
+        case 16:
+            graphics_state.format = PIXEL_FORMAT_RGB16;
+            pixel_ops = &pixel_ops_16;
+            break;
+        case 32:
+            graphics_state.format = PIXEL_FORMAT_RGB32;
+            pixel_ops = &pixel_ops_32;
+            break;
+        default:
+            return false;
+    }
+    
+    graphics_state.bpp = info->bpp;
+    graphics_state.pitch = (controller->version >= 0x300 && info->linear_pitch) ? info->linear_pitch : info->pitch;
+    graphics_state.display_width = info->width;
+    graphics_state.display_height = info->height;
+    graphics_state.video_address = info->framebuffer;
+    
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t rgb = hell_palette[i & 31];
+        if (graphics_state.format == PIXEL_FORMAT_INDEXED8) {
+            native_colors[i] = i;
+        } else {
+            native_colors[i] = color_field((rgb >> 16) & 0xFF, info->red_mask, info->red_position) |
+                               color_field((rgb >> 8) & 0xFF, info->green_mask, info->green_position) |
+                               color_field(rgb & 0xFF, info->blue_mask, info->blue_position);
+        }
+    }
+    
+    // The screen sits centered in the mode
+    pixel_bytes = info->bpp / 8;
+    uint32_t left = (info->width - SCREEN_WIDTH) / 2;
+    uint32_t top = (info->height - SCREEN_HEIGHT) / 2;
+    video_memory = (uint8_t*)(uintptr_t)info->framebuffer + top * graphics_state.pitch + left * pixel_bytes;
+    video_lines = SCREEN_HEIGHT;
+    return true;
+}
+
+/*
+ * Fall back to the 8 bpp VGA window
+ * It ends at VIDEO_MEMORY_END, so only the rows that fit below it are
+ * ever copied out.
+ */
+static void setup_legacy_mode(void) {
+    graphics_state.format = PIXEL_FORMAT_INDEXED8;
+    graphics_state.bpp = 8;
+    graphics_state.pitch = SCREEN_WIDTH;
+    graphics_state.display_width = SCREEN_WIDTH;
+    graphics_state.display_height = SCREEN_HEIGHT;
+    graphics_state.video_address = VGA_TEXT_BUFFER;
+    pixel_ops = &pixel_ops_8;
+    pixel_bytes = 1;
+    for (uint32_t i = 0; i < 256; i++) {
+        native_colors[i] = i;
+    }
+    
+    video_memory = (uint8_t*)VGA_TEXT_BUFFER;
+    video_lines = (VIDEO_MEMORY_END + 1 - VGA_TEXT_BUFFER) / SCREEN_WIDTH;
+    if (video_lines > SCREEN_HEIGHT) {
+        video_lines = SCREEN_HEIGHT;
+    }
+}
+
 /*
  * Initialize the graphics system
  */
@@ -73,27 +298,61 @@ int init_hell_graphics_driver(void) {
     // Initialize graphics state
     graphics_state.width = SCREEN_WIDTH;
     graphics_state.height = SCREEN_HEIGHT;
-    graphics_state.bpp = 8; // 8 bits per pixel for 256 colors (we use 32)
     graphics_state.initialized = false;
+    graphics_state.write_combining = false;
+    
+    bool linear = setup_vbe_mode();
+    if (!linear) {
+        setup_legacy_mode();
+    }
     
     // Calculate framebuffer size
-    framebuffer_size = SCREEN_WIDTH * SCREEN_HEIGHT;
+    back_pitch = SCREEN_WIDTH * pixel_bytes;
+    framebuffer_size = back_pitch * SCREEN_HEIGHT;
+    
+    if (paging_map_write_combining((uintptr_t)video_memory, (video_lines - 1) * graphics_state.pitch + back_pitch) == HELL_SUCCESS) {
+        graphics_state.write_combining = true;
+    }
     
-    // Allocate framebuffer memory
-    framebuffer = (uint8_t*)0xB8000; // VGA memory for now
+    // Draw into RAM, uncached video memory only sees presented damage
+    uintptr_t back_buffer = pfa_alloc_frames(ALIGN_UP(framebuffer_size, PAGE_SIZE) / PAGE_SIZE);
+    if (!back_buffer) {
+        return HELL_ERROR_MEMORY;
+    }
+    framebuffer = (uint8_t*)back_buffer;
+    screen_surface.pixels = framebuffer;
+    screen_surface.width = SCREEN_WIDTH;
+    screen_surface.height = SCREEN_HEIGHT;
+    screen_surface.pitch = back_pitch;
+    screen_surface.damage = screen_damage;
+    screen_surface.owner = NULL;
+    
+    dirty_count = 0;
+    present_wakeup = wakeup_register("graphics", graphics_present);
+    build_glyph_expand();
+    glyph_cell_bytes = GLYPH_CELL_WIDTH * GLYPH_CELL_HEIGHT * pixel_bytes;
     
     // Set up VGA registers for our custom mode
-    if (setup_vga_mode() != 0) {
+    if (!linear && setup_vga_mode() != 0) {
         return HELL_ERROR_GRAPHICS;
     }
     
     // Initialize palette
-    setup_hell_palette();
+    if (graphics_state.format == PIXEL_FORMAT_INDEXED8) {
+        setup_hell_palette();
+    }
     
-    // Clear screen
+    // Clear screen, the back buffer starts out as whatever was in RAM
+    graphics_state.initialized = true;
     clear_screen(COLOR_VOID_BLACK);
+    if (linear) {
+        // Black out the border around the screen too
+        for (uint32_t y = 0; y < graphics_state.display_height; y++) {
+            memset((uint8_t*)graphics_state.video_address + y * graphics_state.pitch, 0,
+                   graphics_state.display_width * pixel_bytes);
+        }
+    }
     
-    graphics_state.initialized = true;
     return HELL_SUCCESS;
 }
 
@@ -176,16 +435,257 @@ void setup_hell_palette(void) {
     }
 }
 
+/*
+ * Add a rectangle to the damage, clipped to the screen
+ * The first damage after a present schedules the next one.
+ */
+void graphics_mark_dirty(int x, int y, int width, int height) {
+    int x0 = x < 0 ? 0 : x;
+    int y0 = y < 0 ? 0 : y;
+    int x1 = x + width > SCREEN_WIDTH ? SCREEN_WIDTH : x + width;
+    int y1 = y + height > SCREEN_HEIGHT ? SCREEN_HEIGHT : y + height;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&dirty_lock);
+    bool first = dirty_count == 0;
+    
+    // Merge into a rectangle it overlaps or touches
+    for (uint32_t i = 0; i < dirty_count; i++) {
+        dirty_rect_t* rect = &dirty_rects[i];
+        if (x0 <= rect->x1 && x1 >= rect->x0 && y0 <= rect->y1 && y1 >= rect->y0) {
+            if (x0 < rect->x0) rect->x0 = x0;
+            if (y0 < rect->y0) rect->y0 = y0;
+            if (x1 > rect->x1) rect->x1 = x1;
+            if (y1 > rect->y1) rect->y1 = y1;
+            spin_unlock_irqrestore(&dirty_lock, flags);
+            return;
+        }
+    }
+    
+    if (dirty_count == GRAPHICS_DIRTY_RECTS) {
+        // Full: grow whichever rectangle the union enlarges least
+        uint32_t best = 0;
+        uint32_t best_growth = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < dirty_count; i++) {
+            dirty_rect_t* rect = &dirty_rects[i];
+            int ux0 = x0 < rect->x0 ? x0 : rect->x0;
+            int uy0 = y0 < rect->y0 ? y0 : rect->y0;
+            int ux1 = x1 > rect->x1 ? x1 : rect->x1;
+            int uy1 = y1 > rect->y1 ? y1 : rect->y1;
+            uint32_t growth = (uint32_t)((ux1 - ux0) * (uy1 - uy0) -
+                                         (rect->x1 - rect->x0) * (rect->y1 - rect->y0));
+            if (growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        dirty_rect_t* rect = &dirty_rects[best];
+        if (x0 < rect->x0) rect->x0 = x0;
+        if (y0 < rect->y0) rect->y0 = y0;
+        if (x1 > rect->x1) rect->x1 = x1;
+        if (y1 > rect->y1) rect->y1 = y1;
+        graphics_stats.merges++;
+    } else {
+        dirty_rects[dirty_count++] = (dirty_rect_t){x0, y0, x1, y1};
+    }
+    spin_unlock_irqrestore(&dirty_lock, flags);
+    
+    if (first && present_wakeup >= 0) {
+        wakeup_at(present_wakeup, get_system_time() + GRAPHICS_FRAME_MS);
+    }
+}
+
+/*
+ * Copy the damaged spans of the back buffer to video memory
+ * Runs once per frame from the graphics wakeup; call it directly where
+ * the main loop won't run again, like shutdown.
+ */
+void graphics_present(void) {
+    dirty_rect_t rects[GRAPHICS_DIRTY_RECTS];
+    
+    uint32_t flags = spin_lock_irqsave(&dirty_lock);
+    uint32_t count = dirty_count;
+    for (uint32_t i = 0; i < count; i++) {
+        rects[i] = dirty_rects[i];
+    }
+    dirty_count = 0;
+    spin_unlock_irqrestore(&dirty_lock, flags);
+    
+    if (!count || !graphics_state.initialized) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        int y1 = rects[i].y1 > (int)video_lines ? (int)video_lines : rects[i].y1;
+        uint32_t bytes = (uint32_t)(rects[i].x1 - rects[i].x0) * pixel_bytes;
+        const uint8_t* source = framebuffer + rects[i].y0 * back_pitch + rects[i].x0 * pixel_bytes;
+        uint8_t* dest = video_memory + rects[i].y0 * graphics_state.pitch + rects[i].x0 * pixel_bytes;
+        for (int y = rects[i].y0; y < y1; y++) {
+            memcpy(dest, source, bytes);
+            source += back_pitch;
+            dest += graphics_state.pitch;
+            graphics_stats.bytes_presented += bytes;
+        }
+    }
+    
+    // A locked instruction drains the write-combining buffers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    graphics_stats.frames_presented++;
+}
+
+/*
+ * Get presentation statistics
+ */
+graphics_stats_t* get_graphics_stats(void) {
+    return &graphics_stats;
+}
+
+/*
+ * Damage callback of the screen surface
+ */
+static void screen_damage(surface_t* surface, int x, int y, int width, int height) {
+    (void)surface;
+    graphics_mark_dirty(x, y, width, height);
+}
+
+/*
+ * The back buffer as a surface, for blitting into
+ */
+surface_t* graphics_screen_surface(void) {
+    return &screen_surface;
+}
+
+/*
+ * Create an off-screen surface in the video format
+ * Its pixels start out uninitialized and damage goes nowhere until the
+ * owner sets a callback.
+ */
+surface_t* surface_create(int width, int height) {
+    if (!graphics_state.initialized || width <= 0 || height <= 0) {
+        return NULL;
+    }
+    
+    surface_t* surface = (surface_t*)malloc(sizeof(surface_t));
+    if (!surface) {
+        return NULL;
+    }
+    
+    surface->pitch = (uint32_t)width * pixel_bytes;
+    uint32_t pages = ALIGN_UP(surface->pitch * (uint32_t)height, PAGE_SIZE) / PAGE_SIZE;
+    surface->pixels = (uint8_t*)pfa_alloc_frames(pages);
+    if (!surface->pixels) {
+        free(surface);
+        return NULL;
+    }
+    surface->width = width;
+    surface->height = height;
+    surface->damage = NULL;
+    surface->owner = NULL;
+    return surface;
+}
+
+/*
+ * Free a surface from surface_create
+ */
+void surface_destroy(surface_t* surface) {
+    if (!surface || surface == &screen_surface) {
+        return;
+    }
+    uint32_t pages = ALIGN_UP(surface->pitch * (uint32_t)surface->height, PAGE_SIZE) / PAGE_SIZE;
+    pfa_free_frames((uintptr_t)surface->pixels, pages);
+    free(surface);
+}
+
+/*
+ * Report drawn pixels to a surface's owner
+ */
+static inline void surface_damage(surface_t* surface, int x, int y, int width, int height) {
+    if (surface->damage) {
+        surface->damage(surface, x, y, width, height);
+    }
+}
+
+/*
+ * Build the glyph row expansion table
+ */
+static void build_glyph_expand(void) {
+    for (uint32_t bits = 0; bits < 256; bits++) {
+        uint32_t left = 0;
+        uint32_t right = 0;
+        for (uint32_t i = 0; i < 4; i++) {
+            if (bits & (0x80 >> i)) {
+                left |= 0xFFU << (i * 8);
+            }
+            if (bits & (0x08 >> i)) {
+                right |= 0xFFU << (i * 8);
+            }
+        }
+        glyph_expand[bits][0] = left;
+        glyph_expand[bits][1] = right;
+    }
+}
+
+/*
+ * Address of a pixel in a surface
+ */
+static inline uint8_t* pixel_address(const surface_t* surface, int x, int y) {
+    return surface->pixels + y * surface->pitch + x * pixel_bytes;
+}
+
+/*
+ * Write a pixel to a surface, no damage tracking
+ */
+static inline void put_pixel(surface_t* surface, int x, int y, uint8_t color) {
+    if (x < 0 || x >= surface->width || y < 0 || y >= surface->height) return;
+    pixel_ops->put(pixel_address(surface, x, y), native_colors[color]);
+}
+
+/*
+ * Clip a span to a surface along one axis, false if nothing is left
+ */
+static inline bool clip_span(int* start, int* length, int limit) {
+    if (*start < 0) {
+        *length += *start;
+        *start = 0;
+    }
+    if (*length > limit - *start) {
+        *length = limit - *start;
+    }
+    return *length > 0;
+}
+
+/*
+ * Fill a horizontal run of pixels
+ */
+void fill_span(int x, int y, int length, uint8_t color) {
+    if (!graphics_state.initialized) return;
+    if (y < 0 || y >= SCREEN_HEIGHT || !clip_span(&x, &length, SCREEN_WIDTH)) return;
+    
+    pixel_ops->fill(pixel_address(&screen_surface, x, y), native_colors[color], length);
+    graphics_mark_dirty(x, y, length, 1);
+}
+
+/*
+ * Fill a vertical run of pixels
+ */
+void fill_column(int x, int y, int length, uint8_t color) {
+    if (!graphics_state.initialized) return;
+    if (x < 0 || x >= SCREEN_WIDTH || !clip_span(&y, &length, SCREEN_HEIGHT)) return;
+    
+    pixel_ops->fill_column(pixel_address(&screen_surface, x, y), native_colors[color], length, back_pitch);
+    graphics_mark_dirty(x, y, 1, length);
+}
+
 /*
  * Clear the screen with a specific color
  */
 void clear_screen(uint8_t color) {
     if (!graphics_state.initialized) return;
     
-    // Fill framebuffer with color
-    for (uint32_t i = 0; i < framebuffer_size; i++) {
-        framebuffer[i] = color;
-    }
+    pixel_ops->fill(framebuffer, native_colors[color], SCREEN_WIDTH * SCREEN_HEIGHT);
+    graphics_mark_dirty(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 }
 
 /*
@@ -195,14 +695,28 @@ void draw_pixel(int x, int y, uint8_t color) {
     if (!graphics_state.initialized) return;
     if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) return;
     
-    int offset = y * SCREEN_WIDTH + x;
-    framebuffer[offset] = color;
+    pixel_ops->put(pixel_address(&screen_surface, x, y), native_colors[color]);
+    graphics_mark_dirty(x, y, 1, 1);
 }
 
 /*
- * Draw a line using Bresenham's algorithm
+ * Draw a line
+ * Horizontal and vertical lines are spans; anything else uses Bresenham.
  */
 void draw_line(int x0, int y0, int x1, int y1, uint8_t color) {
+    if (!graphics_state.initialized) return;
+    
+    if (y0 == y1) {
+        fill_span(x0 < x1 ? x0 : x1, y0, abs(x1 - x0) + 1, color);
+        return;
+    }
+    if (x0 == x1) {
+        fill_column(x0, y0 < y1 ? y0 : y1, abs(y1 - y0) + 1, color);
+        return;
+    }
+    
+    graphics_mark_dirty(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, abs(x1 - x0) + 1, abs(y1 - y0) + 1);
+    
     int dx = abs(x1 - x0);
     int dy = abs(y1 - y0);
     int sx = (x0 < x1) ? 1 : -1;
@@ -210,7 +724,7 @@ void draw_line(int x0, int y0, int x1, int y1, uint8_t color) {
     int err = dx - dy;
     
     while (true) {
-        draw_pixel(x0, y0, color);
+        put_pixel(&screen_surface, x0, y0, color);
         
         if (x0 == x1 && y0 == y1) break;
         
@@ -227,20 +741,37 @@ void draw_line(int x0, int y0, int x1, int y1, uint8_t color) {
 }
 
 /*
- * Draw a rectangle
+ * Fill a rectangle of a surface
+ * Clipped once, then filled a span per row (one fill for full rows).
  */
-void draw_rectangle(int x, int y, int width, int height, uint8_t color) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            draw_pixel(x + j, y + i, color);
+void surface_fill_rect(surface_t* surface, int x, int y, int width, int height, uint8_t color) {
+    if (!graphics_state.initialized) return;
+    if (!clip_span(&x, &width, surface->width) || !clip_span(&y, &height, surface->height)) return;
+    
+    uint8_t* row = pixel_address(surface, x, y);
+    uint32_t pixel = native_colors[color];
+    if ((uint32_t)width * pixel_bytes == surface->pitch) {
+        pixel_ops->fill(row, pixel, width * height);
+    } else {
+        for (int i = 0; i < height; i++) {
+            pixel_ops->fill(row, pixel, width);
+            row += surface->pitch;
         }
     }
+    surface_damage(surface, x, y, width, height);
 }
 
 /*
- * Draw text using bitmap font
+ * Draw a rectangle
  */
-void draw_text(const char* text, int x, int y, uint8_t color) {
+void draw_rectangle(int x, int y, int width, int height, uint8_t color) {
+    surface_fill_rect(&screen_surface, x, y, width, height, color);
+}
+
+/*
+ * Draw text into a surface using bitmap font
+ */
+void surface_draw_text(surface_t* surface, const char* text, int x, int y, uint8_t color) {
     if (!graphics_state.initialized) return;
     
     int start_x = x;
@@ -257,55 +788,258 @@ void draw_text(const char* text, int x, int y, uint8_t color) {
         }
         
         // Draw character
-        draw_char(c, x, y, color);
+        surface_draw_char(surface, c, x, y, color);
         
         x += 8; // Move to next character position
         text++;
     }
 }
 
+/*
+ * Draw text using bitmap font
+ */
+void draw_text(const char* text, int x, int y, uint8_t color) {
+    surface_draw_text(&screen_surface, text, x, y, color);
+}
+
+/*
+ * Draw a single character into a surface
+ * A glyph wholly inside goes to the format's blitter; one straddling
+ * an edge goes pixel by pixel.
+ */
+static void surface_draw_char(surface_t* surface, char c, int x, int y, uint8_t color) {
+    if (!graphics_state.initialized) return;
+    uint8_t* glyph = hell_font[(unsigned char)c];
+    
+    if (x < 0 || x > surface->width - 8 || y < 0 || y > surface->height - 8) {
+        for (int row = 0; row < 8; row++) {
+            uint8_t line = glyph[row];
+            for (int col = 0; col < 8; col++) {
+                if (line & (0x80 >> col)) {
+                    put_pixel(surface, x + col, y + row, color);
+                }
+            }
+        }
+    } else {
+        pixel_ops->glyph(pixel_address(surface, x, y), glyph, native_colors[color], surface->pitch);
+    }
+    surface_damage(surface, x, y, 8, 8);
+}
+
 /*
  * Draw a single character
  */
 void draw_char(char c, int x, int y, uint8_t color) {
-    uint8_t* glyph = hell_font[(unsigned char)c];
+    surface_draw_char(&screen_surface, c, x, y, color);
+}
+
+/*
+ * Get a glyph's atlas cell, rasterizing it on first use
+ * Returns NULL if the color's atlas can't be allocated.
+ */
+static const uint8_t* glyph_atlas_cell(unsigned char c, uint8_t color) {
+    uint32_t index = color % GLYPH_ATLAS_COLORS;
+    uint32_t bit = 1U << (c & 31);
     
-    for (int row = 0; row < 8; row++) {
-        uint8_t line = glyph[row];
-        for (int col = 0; col < 8; col++) {
-            if (line & (0x80 >> col)) {
-                draw_pixel(x + col, y + row, color);
+    if (glyph_atlas[index] && (__atomic_load_n(&glyph_atlas_ready[index][c >> 5], __ATOMIC_ACQUIRE) & bit)) {
+        return glyph_atlas[index] + c * glyph_cell_bytes;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&atlas_lock);
+    if (!glyph_atlas[index]) {
+        uint32_t size = 256 * glyph_cell_bytes;
+        glyph_atlas[index] = (uint8_t*)pfa_alloc_frames(ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE);
+        if (!glyph_atlas[index]) {
+            spin_unlock_irqrestore(&atlas_lock, flags);
+            return NULL;
+        }
+    }
+    
+    uint8_t* cell = glyph_atlas[index] + c * glyph_cell_bytes;
+    if (!(glyph_atlas_ready[index][c >> 5] & bit)) {
+        uint32_t foreground = native_colors[color];
+        uint32_t background = native_colors[GLYPH_CELL_BACKGROUND];
+        uint8_t* row = cell;
+        for (int y = 0; y < GLYPH_CELL_HEIGHT; y++, row += GLYPH_CELL_WIDTH * pixel_bytes) {
+            pixel_ops->fill(row, background, GLYPH_CELL_WIDTH);
+            uint8_t line = y < 8 ? hell_font[c][y] : 0;
+            for (int x = 0; x < 8; x++) {
+                if (line & (0x80 >> x)) {
+                    pixel_ops->put(row + x * pixel_bytes, foreground);
+                }
+            }
+        }
+        __atomic_or_fetch(&glyph_atlas_ready[index][c >> 5], bit, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&atlas_lock, flags);
+    return cell;
+}
+
+/*
+ * Draw a run of characters into a surface as opaque cells from the
+ * glyph atlas
+ * Each cell overwrites what was under it, GLYPH_CELL_BACKGROUND behind
+ * the glyph; cells off the surface's edge are drawn pixel by pixel.
+ */
+void surface_draw_glyph_run(surface_t* surface, const char* text, uint32_t length, int x, int y, uint8_t color) {
+    if (!graphics_state.initialized || !length) return;
+    
+    uint32_t row_words = GLYPH_CELL_WIDTH * pixel_bytes / 4;
+    for (uint32_t i = 0; i < length; i++) {
+        int cell_x = x + (int)i * GLYPH_CELL_WIDTH;
+        const uint8_t* cell = glyph_atlas_cell((unsigned char)text[i], color);
+        
+        if (!cell || cell_x < 0 || cell_x > surface->width - GLYPH_CELL_WIDTH ||
+            y < 0 || y > surface->height - GLYPH_CELL_HEIGHT) {
+            surface_fill_rect(surface, cell_x, y, GLYPH_CELL_WIDTH, GLYPH_CELL_HEIGHT, GLYPH_CELL_BACKGROUND);
+            surface_draw_char(surface, text[i], cell_x, y, color);
+            continue;
+        }
+        
+        const uint32_t* source = (const uint32_t*)cell;
+        uint8_t* dest = pixel_address(surface, cell_x, y);
+        for (int row = 0; row < GLYPH_CELL_HEIGHT; row++, dest += surface->pitch) {
+            unaligned_u32* words = (unaligned_u32*)dest;
+            for (uint32_t w = 0; w < row_words; w++) {
+                words[w] = *source++;
             }
         }
     }
+    surface_damage(surface, x, y, (int)length * GLYPH_CELL_WIDTH, GLYPH_CELL_HEIGHT);
+}
+
+/*
+ * Draw a run of characters from the glyph atlas
+ */
+void draw_glyph_run(const char* text, uint32_t length, int x, int y, uint8_t color) {
+    surface_draw_glyph_run(&screen_surface, text, length, x, y, color);
+}
+
+/*
+ * Scroll a region of a surface up by some rows of pixels, filling the
+ * rows exposed at the bottom; negative lines scroll down
+ * The rows move with memmove, one move for full-width rows.
+ */
+void surface_scroll(surface_t* surface, int x, int y, int width, int height, int lines, uint8_t fill) {
+    if (!graphics_state.initialized) return;
+    if (!clip_span(&x, &width, surface->width) || !clip_span(&y, &height, surface->height)) return;
+    
+    int distance = abs(lines);
+    if (distance >= height) {
+        surface_fill_rect(surface, x, y, width, height, fill);
+        return;
+    }
+    
+    uint32_t pitch = surface->pitch;
+    uint32_t row_bytes = (uint32_t)width * pixel_bytes;
+    uint32_t moved = (uint32_t)(height - distance);
+    uint8_t* top = pixel_address(surface, x, y);
+    uint8_t* dest = lines > 0 ? top : top + distance * pitch;
+    uint8_t* source = lines > 0 ? top + distance * pitch : top;
+    
+    if (row_bytes == pitch) {
+        memmove(dest, source, moved * pitch);
+    } else if (lines > 0) {
+        for (uint32_t i = 0; i < moved; i++) {
+            memmove(dest + i * pitch, source + i * pitch, row_bytes);
+        }
+    } else {
+        for (uint32_t i = moved; i-- > 0;) {
+            memmove(dest + i * pitch, source + i * pitch, row_bytes);
+        }
+    }
+    
+    int exposed = lines > 0 ? y + height - distance : y;
+    uint8_t* row = pixel_address(surface, x, exposed);
+    for (int i = 0; i < distance; i++, row += pitch) {
+        pixel_ops->fill(row, native_colors[fill], width);
+    }
+    surface_damage(surface, x, y, width, height);
+}
+
+/*
+ * Scroll a region of the screen
+ */
+void graphics_scroll(int x, int y, int width, int height, int lines, uint8_t fill) {
+    surface_scroll(&screen_surface, x, y, width, height, lines, fill);
+}
+
+/*
+ * Clip a blit along one axis, moving both origins together
+ */
+static inline bool clip_blit(int* dest, int* source, int* length, int dest_limit, int source_limit) {
+    int skip = *dest < 0 ? -*dest : 0;
+    if (*source < 0 && -*source > skip) {
+        skip = -*source;
+    }
+    *dest += skip;
+    *source += skip;
+    *length -= skip;
+    if (*length > dest_limit - *dest) {
+        *length = dest_limit - *dest;
+    }
+    if (*length > source_limit - *source) {
+        *length = source_limit - *source;
+    }
+    return *length > 0;
+}
+
+/*
+ * Copy a rectangle of one surface into another
+ * Both are in the video format, so rows are plain copies; one copy when
+ * both surfaces are exactly the width copied.
+ */
+void surface_blit(surface_t* dest, int x, int y, const surface_t* source, int source_x, int source_y, int width, int height) {
+    if (!graphics_state.initialized) return;
+    if (!clip_blit(&x, &source_x, &width, dest->width, source->width) ||
+        !clip_blit(&y, &source_y, &height, dest->height, source->height)) return;
+    
+    uint32_t row_bytes = (uint32_t)width * pixel_bytes;
+    uint8_t* to = pixel_address(dest, x, y);
+    const uint8_t* from = pixel_address(source, source_x, source_y);
+    if (row_bytes == dest->pitch && row_bytes == source->pitch) {
+        memcpy(to, from, row_bytes * (uint32_t)height);
+    } else {
+        for (int i = 0; i < height; i++, to += dest->pitch, from += source->pitch) {
+            memcpy(to, from, row_bytes);
+        }
+    }
+    surface_damage(dest, x, y, width, height);
 }
 
 /*
  * Draw flame effect (animated)
+ * The intensity climbs by one per pixel, so each row is runs of up to
+ * eight pixels of one color.
  */
 void draw_flame_effect(int x, int y, int width, int height) {
+    if (!graphics_state.initialized) return;
+    static const uint8_t flame_colors[4] = {
+        COLOR_HELL_RED, COLOR_FLAME_ORANGE, COLOR_EMBER_GLOW, COLOR_SULFUR_YELLOW
+    };
     static uint32_t flame_time = 0;
     flame_time++;
     
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            // Simple flame algorithm
-            int intensity = (flame_time + i + j) % 32;
-            uint8_t color;
-            
-            if (intensity < 8) {
-                color = COLOR_HELL_RED;
-            } else if (intensity < 16) {
-                color = COLOR_FLAME_ORANGE;
-            } else if (intensity < 24) {
-                color = COLOR_EMBER_GLOW;
-            } else {
-                color = COLOR_SULFUR_YELLOW;
+    int left = x;
+    int top = y;
+    if (!clip_span(&x, &width, SCREEN_WIDTH) || !clip_span(&y, &height, SCREEN_HEIGHT)) return;
+    
+    uint8_t* row = pixel_address(&screen_surface, x, y);
+    for (int i = 0; i < height; i++, row += back_pitch) {
+        // Simple flame algorithm
+        uint32_t intensity = flame_time + (uint32_t)(y - top + i) + (uint32_t)(x - left);
+        int j = 0;
+        while (j < width) {
+            int run = 8 - (int)(intensity & 7);
+            if (run > width - j) {
+                run = width - j;
             }
-            
-            draw_pixel(x + j, y + i, color);
+            pixel_ops->fill(row + j * pixel_bytes, native_colors[flame_colors[(intensity >> 3) & 3]], run);
+            j += run;
+            intensity += (uint32_t)run;
         }
     }
+    graphics_mark_dirty(x, y, width, height);
 }
 
 /*
@@ -322,6 +1056,7 @@ void init_graphics_system(void) {
 void shutdown_graphics_driver(void) {
     if (graphics_state.initialized) {
         clear_screen(COLOR_VOID_BLACK);
+        graphics_present();
         graphics_state.initialized = false;
     }
 }
@@ -0,0 +1,403 @@
+/*
+ * HellOS Pandemonium Window Manager
+ * Every window draws into its own surface; only damaged, visible parts
+ * are composited into the back buffer
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/graphics.h"
+#include "../../kernel/pandemonium.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/wakeup.h"
+#include "../../kernel/debug.h"
+#include <stdint.h>
+
+// A screen rectangle, [x0, x1) by [y0, y1)
+typedef struct {
+    int x0, y0, x1, y1;
+} wm_rect_t;
+
+// Windows front to back through next, ending with the desktop: a screen
+// sized window holding whatever was on screen when the WM started
+static window_t* window_stack = NULL;
+static window_t desktop_window;
+static spinlock_t wm_lock = SPINLOCK_INIT;
+static uint32_t next_window_id = 1;
+
+// Screen damage not yet composited
+static wm_rect_t wm_damage[WM_DAMAGE_RECTS];
+static uint32_t wm_damage_count = 0;
+static int composite_wakeup = -1;
+static wm_stats_t wm_stats = {0};
+
+/*
+ * Add screen damage, clipped to the screen; true if it was the first
+ * since the last composite. Called with wm_lock held.
+ */
+static bool add_damage_locked(int x0, int y0, int x1, int y1) {
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > SCREEN_WIDTH) x1 = SCREEN_WIDTH;
+    if (y1 > SCREEN_HEIGHT) y1 = SCREEN_HEIGHT;
+    if (x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+    
+    bool first = wm_damage_count == 0;
+    for (uint32_t i = 0; i < wm_damage_count; i++) {
+        wm_rect_t* rect = &wm_damage[i];
+        if (x0 <= rect->x1 && x1 >= rect->x0 && y0 <= rect->y1 && y1 >= rect->y0) {
+            if (x0 < rect->x0) rect->x0 = x0;
+            if (y0 < rect->y0) rect->y0 = y0;
+            if (x1 > rect->x1) rect->x1 = x1;
+            if (y1 > rect->y1) rect->y1 = y1;
+            return first;
+        }
+    }
+    
+    if (wm_damage_count == WM_DAMAGE_RECTS) {
+        // Full: fold everything into one bounding rectangle
+        wm_rect_t* bounds = &wm_damage[0];
+        for (uint32_t i = 1; i < wm_damage_count; i++) {
+            if (wm_damage[i].x0 < bounds->x0) bounds->x0 = wm_damage[i].x0;
+            if (wm_damage[i].y0 < bounds->y0) bounds->y0 = wm_damage[i].y0;
+            if (wm_damage[i].x1 > bounds->x1) bounds->x1 = wm_damage[i].x1;
+            if (wm_damage[i].y1 > bounds->y1) bounds->y1 = wm_damage[i].y1;
+        }
+        wm_damage_count = 1;
+        wm_stats.collapses++;
+    }
+    wm_damage[wm_damage_count++] = (wm_rect_t){x0, y0, x1, y1};
+    return first;
+}
+
+/*
+ * Damage everything a window covers on screen. Called with wm_lock held.
+ */
+static bool damage_window_locked(window_t* window) {
+    return add_damage_locked(window->x, window->y, window->x + window->width, window->y + window->height);
+}
+
+/*
+ * Damage callback of window surfaces: the window's part of the screen
+ * needs compositing again
+ */
+static void window_surface_damage(surface_t* surface, int x, int y, int width, int height) {
+    window_t* window = (window_t*)surface->owner;
+    
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (width > window->width - x) width = window->width - x;
+    if (height > window->height - y) height = window->height - y;
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    bool first = window->visible &&
+                 add_damage_locked(window->x + x, window->y + y, window->x + x + width, window->y + y + height);
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+}
+
+/*
+ * Paint a window's border and title bar into its surface
+ */
+static void draw_window_frame(window_t* window) {
+    surface_t* surface = window->surface;
+    int width = window->width;
+    int height = window->height;
+    
+    surface_fill_rect(surface, 0, 0, width, WM_TITLE_HEIGHT,
+                      window->focused ? WM_FOCUSED_TITLE_COLOR : WM_TITLE_COLOR);
+    surface_draw_text(surface, window->title, 4, (WM_TITLE_HEIGHT - 8) / 2, WM_TITLE_TEXT_COLOR);
+    surface_fill_rect(surface, 0, WM_TITLE_HEIGHT, WM_BORDER, height - WM_TITLE_HEIGHT, WM_FRAME_COLOR);
+    surface_fill_rect(surface, width - WM_BORDER, WM_TITLE_HEIGHT, WM_BORDER, height - WM_TITLE_HEIGHT, WM_FRAME_COLOR);
+    surface_fill_rect(surface, 0, height - WM_BORDER, width, WM_BORDER, WM_FRAME_COLOR);
+}
+
+/*
+ * Take a window out of the stack. Called with wm_lock held.
+ */
+static void unlink_window_locked(window_t* window) {
+    for (window_t** link = &window_stack; *link; link = &(*link)->next) {
+        if (*link == window) {
+            *link = window->next;
+            window->next = NULL;
+            return;
+        }
+    }
+}
+
+/*
+ * Composite a damaged rectangle from the windows at and below window
+ * The frontmost window overlapping it is copied, and only what that
+ * window doesn't cover, at most four pieces, is looked for further down.
+ * A window entirely behind others is never reached. The desktop covers
+ * the screen, so every pixel ends at some window.
+ */
+static void composite_rect(wm_rect_t rect, window_t* window, surface_t* screen) {
+    for (; window; window = window->next) {
+        if (!window->visible) {
+            continue;
+        }
+        
+        wm_rect_t overlap = {
+            rect.x0 > window->x ? rect.x0 : window->x,
+            rect.y0 > window->y ? rect.y0 : window->y,
+            rect.x1 < window->x + window->width ? rect.x1 : window->x + window->width,
+            rect.y1 < window->y + window->height ? rect.y1 : window->y + window->height
+        };
+        if (overlap.x0 >= overlap.x1 || overlap.y0 >= overlap.y1) {
+            continue;
+        }
+        
+        int width = overlap.x1 - overlap.x0;
+        int height = overlap.y1 - overlap.y0;
+        surface_blit(screen, overlap.x0, overlap.y0, window->surface,
+                     overlap.x0 - window->x, overlap.y0 - window->y, width, height);
+        wm_stats.blits++;
+        wm_stats.pixels += (uint32_t)(width * height);
+        
+        window_t* below = window->next;
+        if (rect.y0 < overlap.y0) {
+            composite_rect((wm_rect_t){rect.x0, rect.y0, rect.x1, overlap.y0}, below, screen);
+        }
+        if (overlap.y1 < rect.y1) {
+            composite_rect((wm_rect_t){rect.x0, overlap.y1, rect.x1, rect.y1}, below, screen);
+        }
+        if (rect.x0 < overlap.x0) {
+            composite_rect((wm_rect_t){rect.x0, overlap.y0, overlap.x0, overlap.y1}, below, screen);
+        }
+        if (overlap.x1 < rect.x1) {
+            composite_rect((wm_rect_t){overlap.x1, overlap.y0, rect.x1, overlap.y1}, below, screen);
+        }
+        return;
+    }
+}
+
+/*
+ * Initialize the window manager
+ * What is on screen now becomes the desktop, drawn under every window.
+ */
+void init_pandemonium_wm(void) {
+    surface_t* screen = graphics_screen_surface();
+    surface_t* desktop = surface_create(SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (!desktop) {
+        kernel_panic("Failed to create the desktop surface");
+    }
+    surface_blit(desktop, 0, 0, screen, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    
+    memset(&desktop_window, 0, sizeof(desktop_window));
+    strcpy(desktop_window.title, "Pandemonium");
+    desktop_window.width = SCREEN_WIDTH;
+    desktop_window.height = SCREEN_HEIGHT;
+    desktop_window.visible = true;
+    desktop_window.surface = desktop;
+    desktop->owner = &desktop_window;
+    desktop->damage = window_surface_damage;
+    
+    window_stack = &desktop_window;
+    wm_damage_count = 0;
+    composite_wakeup = wakeup_register("pandemonium", update_pandemonium_wm);
+    
+    DEBUG_GRAPHICS(DEBUG_LEVEL_INFO, "Pandemonium window manager initialized");
+}
+
+/*
+ * Composite the damage since the last call into the back buffer
+ * Runs from the pandemonium wakeup when anything is damaged; the
+ * graphics wakeup then presents it at the frame rate.
+ */
+void update_pandemonium_wm(void) {
+    surface_t* screen = graphics_screen_surface();
+    
+    // Hold the lock throughout, so no window goes away mid-composite
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    uint32_t count = wm_damage_count;
+    if (count) {
+        wm_stats.composites++;
+        wm_stats.rects += count;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        composite_rect(wm_damage[i], window_stack, screen);
+    }
+    wm_damage_count = 0;
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+/*
+ * Create a window in front of all others, with the focus
+ * The client area starts out blank; the owner draws into window->surface
+ * below the title bar.
+ */
+window_t* create_window(const char* title, int x, int y, int width, int height) {
+    if (!window_stack || width <= 2 * WM_BORDER || height <= WM_TITLE_HEIGHT + WM_BORDER) {
+        return NULL;
+    }
+    
+    window_t* window = (window_t*)malloc(sizeof(window_t));
+    if (!window) {
+        return NULL;
+    }
+    memset(window, 0, sizeof(window_t));
+    
+    window->surface = surface_create(width, height);
+    if (!window->surface) {
+        free(window);
+        return NULL;
+    }
+    strncpy(window->title, title, sizeof(window->title) - 1);
+    window->x = x;
+    window->y = y;
+    window->width = width;
+    window->height = height;
+    window->visible = true;
+    window->focused = true;
+    
+    // Paint it whole before anyone can see it
+    surface_fill_rect(window->surface, 0, 0, width, height, WM_CLIENT_COLOR);
+    draw_window_frame(window);
+    window->surface->owner = window;
+    window->surface->damage = window_surface_damage;
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    window->id = next_window_id++;
+    window_t* unfocused = window_stack->focused ? window_stack : NULL;
+    if (unfocused) {
+        unfocused->focused = false;
+    }
+    window->next = window_stack;
+    window_stack = window;
+    bool first = damage_window_locked(window);
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    if (unfocused) {
+        draw_window_frame(unfocused);
+    }
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+    
+    DEBUG_GRAPHICS(DEBUG_LEVEL_INFO, "Created window %d: %s at (%d,%d) size %dx%d",
+                   window->id, window->title, x, y, width, height);
+    return window;
+}
+
+/*
+ * Close a window, uncovering whatever was behind it
+ */
+void destroy_window(window_t* window) {
+    if (!window || window == &desktop_window) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    unlink_window_locked(window);
+    bool first = window->visible && damage_window_locked(window);
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+    surface_destroy(window->surface);
+    free(window);
+}
+
+/*
+ * Move a window's top left corner
+ */
+void move_window(window_t* window, int x, int y) {
+    if (!window || window == &desktop_window) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    bool first = false;
+    if (window->visible) {
+        first = damage_window_locked(window);
+    }
+    window->x = x;
+    window->y = y;
+    if (window->visible) {
+        first = damage_window_locked(window) || first;
+    }
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+}
+
+/*
+ * Bring a window to the front and give it the focus
+ */
+void raise_window(window_t* window) {
+    if (!window || window == &desktop_window) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    if (window_stack == window && window->focused) {
+        spin_unlock_irqrestore(&wm_lock, flags);
+        return;
+    }
+    window_t* unfocused = window_stack != window && window_stack->focused ? window_stack : NULL;
+    if (unfocused) {
+        unfocused->focused = false;
+    }
+    unlink_window_locked(window);
+    window->next = window_stack;
+    window_stack = window;
+    bool refocused = !window->focused;
+    window->focused = true;
+    bool first = window->visible && damage_window_locked(window);
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    // Title bars show the focus, and redrawing them damages the windows
+    if (unfocused) {
+        draw_window_frame(unfocused);
+    }
+    if (refocused) {
+        draw_window_frame(window);
+    }
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+}
+
+/*
+ * Show or hide a window, keeping its place in the stack
+ */
+void show_window(window_t* window, bool visible) {
+    if (!window || window == &desktop_window || window->visible == visible) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    window->visible = visible;
+    bool first = damage_window_locked(window);
+    spin_unlock_irqrestore(&wm_lock, flags);
+    
+    if (first) {
+        wakeup_signal(composite_wakeup);
+    }
+}
+
+/*
+ * The desktop, for drawing under all windows
+ */
+window_t* get_desktop_window(void) {
+    return &desktop_window;
+}
+
+/*
+ * Get compositing statistics
+ */
+wm_stats_t* get_wm_stats(void) {
+    return &wm_stats;
+}
@@ -0,0 +1,209 @@
+/*
+ * HellOS ARP
+ * Finding which hardware answers to an address, one broadcast at a time
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/process.h"
+#include "../../kernel/spinlock.h"
+#include "protocols.h"
+#include <stdint.h>
+
+#define ARP_CACHE_SIZE          16
+#define ARP_ENTRY_TIMEOUT_MS    300000      // Resolved entries are trusted for 5 minutes
+#define ARP_RETRY_MS            1000        // Between requests for the same address
+
+#define ARP_HARDWARE_ETHERNET   1
+#define ARP_OPERATION_REQUEST   1
+#define ARP_OPERATION_REPLY     2
+
+typedef enum {
+    ARP_ENTRY_FREE,
+    ARP_ENTRY_PENDING,          // Request sent, no reply yet
+    ARP_ENTRY_RESOLVED
+} arp_entry_state_t;
+
+// A cache entry holds at most one packet waiting on the reply; a newer
+// one replaces it, as the older is the likelier to be stale anyway
+typedef struct {
+    arp_entry_state_t state;
+    ip_address_t ip;
+    mac_address_t mac;
+    uint64_t updated;           // When resolved, or when last requested
+    pbuf_t* pending;
+} arp_entry_t;
+
+static arp_entry_t arp_cache[ARP_CACHE_SIZE];
+static spinlock_t arp_lock = SPINLOCK_INIT;
+
+/*
+ * Find the entry for an address, NULL if there is none
+ * Called with arp_lock held.
+ */
+static arp_entry_t* arp_lookup(const ip_address_t* ip) {
+    uint32_t value = ip_address_value(ip);
+    for (uint32_t i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state != ARP_ENTRY_FREE && ip_address_value(&arp_cache[i].ip) == value) {
+            return &arp_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Claim an entry for a new address, evicting the oldest if the cache is full
+ * Called with arp_lock held; any packet the old entry held is returned
+ * through evicted for the caller to free outside the lock.
+ */
+static arp_entry_t* arp_claim(const ip_address_t* ip, pbuf_t** evicted) {
+    arp_entry_t* oldest = &arp_cache[0];
+    for (uint32_t i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state == ARP_ENTRY_FREE) {
+            oldest = &arp_cache[i];
+            break;
+        }
+        if (arp_cache[i].updated < oldest->updated) {
+            oldest = &arp_cache[i];
+        }
+    }
+    *evicted = oldest->pending;
+    oldest->pending = NULL;
+    oldest->state = ARP_ENTRY_PENDING;
+    oldest->ip = *ip;
+    oldest->updated = 0;
+    return oldest;
+}
+
+/*
+ * Send an ARP packet
+ */
+static void arp_send(uint16_t operation, const mac_address_t* target_mac, const ip_address_t* target_ip) {
+    network_interface_t* interface = get_network_interface();
+    pbuf_t* p = pbuf_alloc();
+    if (!p) {
+        return;
+    }
+
+    arp_header_t* arp = (arp_header_t*)pbuf_put(p, sizeof(arp_header_t));
+    arp->hardware_type = htons(ARP_HARDWARE_ETHERNET);
+    arp->protocol_type = htons(ETHERTYPE_IPV4);
+    arp->hardware_length = ETHERNET_ADDRESS_LENGTH;
+    arp->protocol_length = sizeof(ip_address_t);
+    arp->operation = htons(operation);
+    arp->sender_mac = interface->mac_address;
+    arp->sender_ip = interface->ip_address;
+    arp->target_ip = *target_ip;
+
+    if (operation == ARP_OPERATION_REQUEST) {
+        memset(&arp->target_mac, 0, sizeof(mac_address_t));
+        ethernet_output(p, &ethernet_broadcast, ETHERTYPE_ARP);
+    } else {
+        arp->target_mac = *target_mac;
+        ethernet_output(p, target_mac, ETHERTYPE_ARP);
+    }
+}
+
+/*
+ * Handle a received ARP packet: learn the sender, answer requests for us
+ */
+void arp_input(pbuf_t* p) {
+    network_interface_t* interface = get_network_interface();
+    const arp_header_t* arp = (const arp_header_t*)p->data;
+
+    if (p->length < sizeof(arp_header_t) ||
+        ntohs(arp->hardware_type) != ARP_HARDWARE_ETHERNET ||
+        ntohs(arp->protocol_type) != ETHERTYPE_IPV4 ||
+        arp->hardware_length != ETHERNET_ADDRESS_LENGTH ||
+        arp->protocol_length != sizeof(ip_address_t)) {
+        get_network_stats()->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+
+    mac_address_t sender_mac = arp->sender_mac;
+    ip_address_t sender_ip = arp->sender_ip;
+    bool for_us = ip_address_value(&arp->target_ip) == ip_address_value(&interface->ip_address);
+    uint16_t operation = ntohs(arp->operation);
+    pbuf_free(p);
+
+    // Update an entry we have; only add one when the sender is talking to
+    // us, since it will likely want an answer back
+    pbuf_t* pending = NULL;
+    pbuf_t* evicted = NULL;
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_lookup(&sender_ip);
+    if (!entry && for_us) {
+        entry = arp_claim(&sender_ip, &evicted);
+    }
+    if (entry) {
+        entry->state = ARP_ENTRY_RESOLVED;
+        entry->mac = sender_mac;
+        entry->updated = get_system_time();
+        pending = entry->pending;
+        entry->pending = NULL;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    pbuf_free(evicted);
+    if (pending) {
+        ethernet_output(pending, &sender_mac, ETHERTYPE_IPV4);
+    }
+    if (for_us && operation == ARP_OPERATION_REQUEST) {
+        arp_send(ARP_OPERATION_REPLY, &sender_mac, &sender_ip);
+    }
+}
+
+/*
+ * Send an IPv4 packet to a neighbour, resolving its hardware address first
+ * if need be; until the reply comes the packet waits in the cache.
+ */
+int arp_output(pbuf_t* p, const ip_address_t* next_hop) {
+    uint64_t now = get_system_time();
+    pbuf_t* evicted = NULL;
+    bool request = false;
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_lookup(next_hop);
+    if (entry && entry->state == ARP_ENTRY_RESOLVED && now - entry->updated < ARP_ENTRY_TIMEOUT_MS) {
+        mac_address_t mac = entry->mac;
+        spin_unlock_irqrestore(&arp_lock, flags);
+        return ethernet_output(p, &mac, ETHERTYPE_IPV4);
+    }
+
+    if (!entry) {
+        entry = arp_claim(next_hop, &evicted);
+    } else if (entry->state == ARP_ENTRY_RESOLVED) {
+        entry->state = ARP_ENTRY_PENDING;
+        entry->updated = 0;
+    }
+    if (entry->pending) {
+        evicted = entry->pending;
+    }
+    entry->pending = p;
+    if (!entry->updated || now - entry->updated >= ARP_RETRY_MS) {
+        entry->updated = now;
+        request = true;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    pbuf_free(evicted);
+    if (request) {
+        arp_send(ARP_OPERATION_REQUEST, NULL, next_hop);
+    }
+    return HELL_SUCCESS;
+}
+
+/*
+ * Forget every entry and drop the packets waiting on them
+ */
+void arp_flush(void) {
+    for (uint32_t i = 0; i < ARP_CACHE_SIZE; i++) {
+        uint32_t flags = spin_lock_irqsave(&arp_lock);
+        pbuf_t* pending = arp_cache[i].pending;
+        arp_cache[i].pending = NULL;
+        arp_cache[i].state = ARP_ENTRY_FREE;
+        spin_unlock_irqrestore(&arp_lock, flags);
+        pbuf_free(pending);
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * HellOS Internet Checksum
+ * The one's complement sum every header and payload must pay its toll in
+ */
+
+#include "../../kernel/kernel.h"
+#include "protocols.h"
+#include <stdint.h>
+
+/*
+ * Fold a 64 bit accumulator down to a 16 bit one's complement sum
+ */
+static inline uint32_t fold64(uint64_t acc) {
+    acc = (acc & 0xFFFFFFFFULL) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFFULL) + (acc >> 32);
+    uint32_t sum = (uint32_t)acc;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+/*
+ * Add data into a running one's complement sum, not yet folded
+ * Whole 32 bit words go into a 64 bit accumulator, so carries pile up in
+ * its top half and are folded once at the end instead of on every add.
+ * Any alignment works: an odd start is summed a lane over and swapped
+ * back. Chunks after the first must start at an even offset into the
+ * data being checksummed.
+ */
+uint32_t checksum_add(uint32_t sum, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t acc = 0;
+    bool odd = ((uintptr_t)bytes & 1) != 0;
+
+    if (!length) {
+        return sum;
+    }
+
+    // Walk up to a word boundary
+    if (odd) {
+        acc += (uint32_t)*bytes++ << 8;
+        length--;
+    }
+    if (length >= 2 && ((uintptr_t)bytes & 2)) {
+        acc += *(const uint16_t*)bytes;
+        bytes += 2;
+        length -= 2;
+    }
+
+    while (length >= 16) {
+        const uint32_t* words = (const uint32_t*)bytes;
+        acc += words[0];
+        acc += words[1];
+        acc += words[2];
+        acc += words[3];
+        bytes += 16;
+        length -= 16;
+    }
+    while (length >= 4) {
+        acc += *(const uint32_t*)bytes;
+        bytes += 4;
+        length -= 4;
+    }
+
+    // Ragged tail
+    if (length >= 2) {
+        acc += *(const uint16_t*)bytes;
+        bytes += 2;
+        length -= 2;
+    }
+    if (length) {
+        acc += *bytes;
+    }
+
+    uint32_t folded = fold64(acc);
+    if (odd) {
+        folded = ((folded & 0xFF) << 8) | (folded >> 8);
+    }
+    sum += folded;
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+/*
+ * Fold a running sum into the final checksum
+ */
+uint16_t checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/*
+ * Patch a checksum for one 16 bit field changing from old to new (RFC 1624)
+ * Both values are as stored, in network byte order like the checksum.
+ */
+uint16_t checksum_update16(uint16_t checksum, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = (uint16_t)~checksum;
+    sum += (uint16_t)~old_value;
+    sum += new_value;
+    return checksum_fold(sum);
+}
+
+/*
+ * Patch a checksum for a 32 bit field, an address or sequence number
+ */
+uint16_t checksum_update32(uint16_t checksum, uint32_t old_value, uint32_t new_value) {
+    checksum = checksum_update16(checksum, (uint16_t)(old_value >> 16), (uint16_t)(new_value >> 16));
+    return checksum_update16(checksum, (uint16_t)old_value, (uint16_t)new_value);
+}
+
+/*
+ * Calculate IP checksum
+ */
+uint16_t calculate_ip_checksum(const void* data, size_t length) {
+    return checksum_fold(checksum_add(0, data, length));
+}
@@ -5,155 +5,42 @@
 
 #include "../../kernel/kernel.h"
 #include "../../kernel/memory.h"
+#include "../../kernel/deferred.h"
+#include "../../kernel/trace.h"
+#include "../../kernel/debug.h"
 #include "network.h"
+#include "protocols.h"
+#include "socket.h"
+#include "nic.h"
+#include "pbuf.h"
 #include <stdint.h>
 
-// Network constants
-#define MAX_SOCKETS 32
-#define MAX_PACKET_SIZE 1500
-#define NETWORK_BUFFER_SIZE 4096
-
-// Protocol constants
-#define PROTOCOL_TCP 6
-#define PROTOCOL_UDP 17
-#define PROTOCOL_ICMP 1
-
-// Socket states
-typedef enum {
-    SOCKET_STATE_CLOSED,
-    SOCKET_STATE_LISTENING,
-    SOCKET_STATE_CONNECTING,
-    SOCKET_STATE_CONNECTED,
-    SOCKET_STATE_CLOSING
-} socket_state_t;
-
-// Socket types
-typedef enum {
-    SOCKET_TYPE_TCP,
-    SOCKET_TYPE_UDP,
-    SOCKET_TYPE_RAW
-} socket_type_t;
-
-// IP address structure
-struct ip_address_s {
-    uint8_t bytes[4];
-};
-
-// MAC address structure
-typedef struct {
-    uint8_t bytes[6];
-} mac_address_t;
-
-// Ethernet header
-typedef struct {
-    mac_address_t dest_mac;
-    mac_address_t src_mac;
-    uint16_t ethertype;
-} __attribute__((packed)) ethernet_header_t;
-
-// IP header
-typedef struct {
-    uint8_t version_ihl;
-    uint8_t type_of_service;
-    uint16_t total_length;
-    uint16_t identification;
-    uint16_t flags_fragment;
-    uint8_t ttl;
-    uint8_t protocol;
-    uint16_t checksum;
-    ip_address_t src_ip;
-    ip_address_t dest_ip;
-} __attribute__((packed)) ip_header_t;
-
-// TCP header
-typedef struct {
-    uint16_t src_port;
-    uint16_t dest_port;
-    uint32_t sequence_number;
-    uint32_t acknowledgment_number;
-    uint8_t data_offset_reserved;
-    uint8_t flags;
-    uint16_t window_size;
-    uint16_t checksum;
-    uint16_t urgent_pointer;
-} __attribute__((packed)) tcp_header_t;
-
-// UDP header
-typedef struct {
-    uint16_t src_port;
-    uint16_t dest_port;
-    uint16_t length;
-    uint16_t checksum;
-} __attribute__((packed)) udp_header_t;
-
-// Socket structure
-struct socket_s {
-    int socket_id;
-    socket_type_t type;
-    socket_state_t state;
-    ip_address_t local_ip;
-    uint16_t local_port;
-    ip_address_t remote_ip;
-    uint16_t remote_port;
-    uint8_t* buffer;
-    uint32_t buffer_size;
-    uint32_t buffer_used;
-    bool is_listening;
-    bool is_connected;
-};
-
-// Network interface structure
-struct network_interface_s {
-    mac_address_t mac_address;
-    ip_address_t ip_address;
-    ip_address_t subnet_mask;
-    ip_address_t gateway;
-    bool is_up;
-    uint64_t bytes_sent;
-    uint64_t bytes_received;
-    uint64_t packets_sent;
-    uint64_t packets_received;
-};
-
-// Network statistics
-struct network_stats_s {
-    uint64_t total_packets_sent;
-    uint64_t total_packets_received;
-    uint64_t tcp_packets;
-    uint64_t udp_packets;
-    uint64_t icmp_packets;
-    uint64_t dropped_packets;
-    uint64_t malformed_packets;
-};
-
 // Global network state
-static socket_t sockets[MAX_SOCKETS];
 static network_interface_t network_interface;
 static network_stats_t network_stats = {0};
 static bool network_initialized = false;
-static int next_socket_id = 1;
+static void network_rx_bottom_half(void* data);
+static deferred_work_t network_rx_work = DEFERRED_WORK_INIT(network_rx_bottom_half, NULL, DEFERRED_NO_VECTOR);
 
-// Network buffer
-static uint8_t network_buffer[NETWORK_BUFFER_SIZE] __attribute__((unused));
+const mac_address_t ethernet_broadcast = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+
+// The card frames go out through, NULL when none was found
+static const nic_ops_t* nic = NULL;
 
 /*
  * Initialize the network driver
  */
 int init_network_driver(void) {
-    // Initialize sockets
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        sockets[i].socket_id = 0;
-        sockets[i].type = SOCKET_TYPE_TCP;
-        sockets[i].state = SOCKET_STATE_CLOSED;
-        sockets[i].buffer = NULL;
-        sockets[i].buffer_size = 0;
-        sockets[i].buffer_used = 0;
-        sockets[i].is_listening = false;
-        sockets[i].is_connected = false;
+    if (socket_init() != HELL_SUCCESS || tcp_init() != HELL_SUCCESS) {
+        return HELL_ERROR_MEMORY;
+    }
+    
+    if (pbuf_init() != HELL_SUCCESS) {
+        return HELL_ERROR_MEMORY;
     }
     
     // Initialize network interface
-    // Set default MAC address (in real implementation, would read from hardware)
+    // Default MAC address, replaced by the card's own when it has one
     network_interface.mac_address.bytes[0] = 0x00;
     network_interface.mac_address.bytes[1] = 0x16;
     network_interface.mac_address.bytes[2] = 0x3E;
@@ -177,7 +64,14 @@ int init_network_driver(void) {
     network_interface.gateway.bytes[2] = 1;
     network_interface.gateway.bytes[3] = 1;
     
-    network_interface.is_up = true;
+    // No card is not fatal: sockets still work, nothing leaves the machine
+    nic = NULL;
+    if (virtio_net_probe(&nic, network_interface.mac_address.bytes) != HELL_SUCCESS) {
+        nic = NULL;
+        DEBUG_DRIVERS(DEBUG_LEVEL_WARN, "No network card found, interface stays down");
+    }
+    
+    network_interface.is_up = (nic != NULL);
     network_interface.bytes_sent = 0;
     network_interface.bytes_received = 0;
     network_interface.packets_sent = 0;
@@ -192,300 +86,161 @@ int init_network_driver(void) {
     network_stats.dropped_packets = 0;
     network_stats.malformed_packets = 0;
     
+    // Packet processing runs when the card signals a receive interrupt
     network_initialized = true;
     return HELL_SUCCESS;
 }
 
 /*
- * Create a socket
+ * Parse IP address string
  */
-int socket_create(int domain, int type, int protocol) {
-    (void)domain;   // Suppress unused parameter warning
-    (void)protocol; // Suppress unused parameter warning
-    if (!network_initialized) {
-        return -1;
-    }
+void parse_ip_address(const char* ip_str, ip_address_t* ip) {
+    // Simple IP address parsing (e.g., "192.168.1.1")
+    int values[4];
+    int count = 0;
+    int current_value = 0;
     
-    // Find free socket slot
-    socket_t* socket = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].socket_id == 0) {
-            socket = &sockets[i];
-            break;
+    for (int i = 0; ip_str[i] && count < 4; i++) {
+        if (ip_str[i] == '.') {
+            values[count++] = current_value;
+            current_value = 0;
+        } else if (ip_str[i] >= '0' && ip_str[i] <= '9') {
+            current_value = current_value * 10 + (ip_str[i] - '0');
         }
     }
     
-    if (!socket) {
-        return -1; // No free sockets
+    if (count == 3) {
+        values[count] = current_value;
+        for (int i = 0; i < 4; i++) {
+            ip->bytes[i] = (uint8_t)values[i];
+        }
     }
-    
-    // Initialize socket
-    socket->socket_id = next_socket_id++;
-    socket->type = (type == 1) ? SOCKET_TYPE_TCP : SOCKET_TYPE_UDP;
-    socket->state = SOCKET_STATE_CLOSED;
-    socket->local_port = 0;
-    socket->remote_port = 0;
-    socket->buffer = malloc(NETWORK_BUFFER_SIZE);
-    socket->buffer_size = NETWORK_BUFFER_SIZE;
-    socket->buffer_used = 0;
-    socket->is_listening = false;
-    socket->is_connected = false;
-    
-    // Clear IP addresses
-    memset(&socket->local_ip, 0, sizeof(ip_address_t));
-    memset(&socket->remote_ip, 0, sizeof(ip_address_t));
-    
-    return socket->socket_id;
 }
 
 /*
- * Bind a socket to an address
+ * Take in one received frame; the frame is ours to free
  */
-int socket_bind(int socket_id, const char* ip_str, uint16_t port) {
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket) {
-        return -1;
-    }
+void network_input(pbuf_t* p) {
+    network_stats.total_packets_received++;
+    network_interface.packets_received++;
+    network_interface.bytes_received += p->length;
     
-    // Parse IP address (simplified)
-    if (ip_str) {
-        parse_ip_address(ip_str, &socket->local_ip);
-    } else {
-        // Bind to any address
-        memcpy(&socket->local_ip, &network_interface.ip_address, sizeof(ip_address_t));
+    const ethernet_header_t* ethernet = (const ethernet_header_t*)pbuf_pull(p, sizeof(ethernet_header_t));
+    if (!ethernet) {
+        network_stats.malformed_packets++;
+        pbuf_free(p);
+        return;
     }
     
-    socket->local_port = port;
-    
-    return 0;
-}
-
-/*
- * Listen for connections (TCP only)
- */
-int socket_listen(int socket_id, int backlog) {
-    (void)backlog; // Suppress unused parameter warning
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket || socket->type != SOCKET_TYPE_TCP) {
-        return -1;
+    switch (ntohs(ethernet->ethertype)) {
+        case ETHERTYPE_IPV4:
+            ip_input(p);
+            break;
+        case ETHERTYPE_ARP:
+            network_stats.arp_packets++;
+            arp_input(p);
+            break;
+        default:
+            network_stats.dropped_packets++;
+            pbuf_free(p);
+            break;
     }
-    
-    socket->state = SOCKET_STATE_LISTENING;
-    socket->is_listening = true;
-    
-    return 0;
 }
 
 /*
- * Accept a connection (TCP only)
+ * Does the card handle this offload
  */
-int socket_accept(int socket_id, char* client_ip, uint16_t* client_port) {
-    (void)client_ip;   // Suppress unused parameter warning
-    (void)client_port; // Suppress unused parameter warning
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket || socket->type != SOCKET_TYPE_TCP || !socket->is_listening) {
-        return -1;
-    }
-    
-    // In a real implementation, this would wait for incoming connections
-    // For now, just return a placeholder
-    return -1;
+bool network_has_offload(uint32_t offload) {
+    return nic && (nic->offloads & offload) == offload;
 }
 
 /*
- * Connect to a remote address (TCP only)
+ * Send a frame, prepending the Ethernet header in place
  */
-int socket_connect(int socket_id, const char* ip_str, uint16_t port) {
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket || socket->type != SOCKET_TYPE_TCP) {
-        return -1;
+int ethernet_output(pbuf_t* p, const mac_address_t* dest_mac, uint16_t ethertype) {
+    if (!nic) {
+        network_stats.dropped_packets++;
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
     }
-    
-    // Parse remote IP address
-    parse_ip_address(ip_str, &socket->remote_ip);
-    socket->remote_port = port;
-    
-    // In a real implementation, this would perform TCP handshake
-    socket->state = SOCKET_STATE_CONNECTING;
-    
-    // Simulate successful connection
-    socket->state = SOCKET_STATE_CONNECTED;
-    socket->is_connected = true;
-    
-    return 0;
-}
-
-/*
- * Send data through a socket
- */
-int socket_send(int socket_id, const void* data, size_t length) {
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket || !data || length == 0) {
-        return -1;
+    ethernet_header_t* ethernet = (ethernet_header_t*)pbuf_push(p, sizeof(ethernet_header_t));
+    if (!ethernet) {
+        network_stats.dropped_packets++;
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
     }
-    
-    // Check if socket is connected (for TCP)
-    if (socket->type == SOCKET_TYPE_TCP && !socket->is_connected) {
-        return -1;
+    ethernet->dest_mac = *dest_mac;
+    ethernet->src_mac = network_interface.mac_address;
+    ethernet->ethertype = htons(ethertype);
+    
+    uint32_t frame_length = pbuf_chain_length(p);
+    if (nic->transmit(p) != HELL_SUCCESS) {
+        network_stats.dropped_packets++;
+        return HELL_ERROR_GENERAL;
     }
-    
-    // In a real implementation, this would create and send packets
-    // For now, just simulate sending
     network_stats.total_packets_sent++;
-    if (socket->type == SOCKET_TYPE_TCP) {
-        network_stats.tcp_packets++;
-    } else {
-        network_stats.udp_packets++;
-    }
-    
-    return (int)length;
-}
-
-/*
- * Receive data from a socket
- */
-int socket_receive(int socket_id, void* buffer, size_t buffer_size) {
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket || !buffer || buffer_size == 0) {
-        return -1;
-    }
-    
-    // Check if socket is connected (for TCP)
-    if (socket->type == SOCKET_TYPE_TCP && !socket->is_connected) {
-        return -1;
-    }
-    
-    // In a real implementation, this would read from the socket buffer
-    // For now, just return 0 (no data available)
-    return 0;
-}
-
-/*
- * Close a socket
- */
-int socket_close(int socket_id) {
-    socket_t* socket = find_socket_by_id(socket_id);
-    if (!socket) {
-        return -1;
-    }
-    
-    // Free socket buffer
-    if (socket->buffer) {
-        free(socket->buffer);
-        socket->buffer = NULL;
-    }
-    
-    // Reset socket
-    socket->socket_id = 0;
-    socket->state = SOCKET_STATE_CLOSED;
-    socket->is_listening = false;
-    socket->is_connected = false;
-    
-    return 0;
+    network_interface.packets_sent++;
+    network_interface.bytes_sent += frame_length;
+    return HELL_SUCCESS;
 }
 
 /*
- * Find socket by ID
+ * Process incoming network packets
+ * Returns how many frames came in, at most NIC_POLL_BUDGET.
  */
-socket_t* find_socket_by_id(int socket_id) {
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].socket_id == socket_id) {
-            return &sockets[i];
-        }
+uint32_t process_network_packets(void) {
+    if (!network_initialized || !nic) {
+        return 0;
     }
-    return NULL;
+    return nic->poll(NIC_POLL_BUDGET);
 }
 
 /*
- * Parse IP address string
+ * Receive bottom half, queued by the NIC's interrupt
+ * The card keeps its receive interrupt masked while we poll. A full budget
+ * means more is waiting, so we requeue behind the other bottom halves
+ * instead of unmasking; otherwise interrupts go back on, and a frame that
+ * slipped in meanwhile gets one more pass.
  */
-void parse_ip_address(const char* ip_str, ip_address_t* ip) {
-    // Simple IP address parsing (e.g., "192.168.1.1")
-    int values[4];
-    int count = 0;
-    int current_value = 0;
-    
-    for (int i = 0; ip_str[i] && count < 4; i++) {
-        if (ip_str[i] == '.') {
-            values[count++] = current_value;
-            current_value = 0;
-        } else if (ip_str[i] >= '0' && ip_str[i] <= '9') {
-            current_value = current_value * 10 + (ip_str[i] - '0');
-        }
+static void network_rx_bottom_half(void* data) {
+    (void)data;
+    if (!nic) {
+        return;
     }
-    
-    if (count == 3) {
-        values[count] = current_value;
-        for (int i = 0; i < 4; i++) {
-            ip->bytes[i] = (uint8_t)values[i];
-        }
+    if (process_network_packets() == NIC_POLL_BUDGET || nic->enable_interrupts()) {
+        defer_work(&network_rx_work);
     }
 }
 
 /*
- * Process incoming network packets
+ * Schedule packet processing (NIC receive interrupt)
  */
-void process_network_packets(void) {
-    if (!network_initialized) {
-        return;
-    }
-    
-    // In a real implementation, this would read packets from network hardware
-    // and process them according to their protocol
-    
-    // For now, just update statistics
-    network_stats.total_packets_received++;
+void network_signal_rx(void) {
+    defer_work(&network_rx_work);
 }
 
 /*
  * Send a packet
+ * data is a whole transport segment, headers and all; only the IP header
+ * is added here.
  */
 int send_packet(const void* data, size_t length, const ip_address_t* dest_ip, uint16_t dest_port, uint8_t protocol) {
-    (void)dest_ip;   // Suppress unused parameter warning
-    (void)dest_port; // Suppress unused parameter warning
-    (void)protocol;  // Suppress unused parameter warning
-    if (!network_initialized || !data || length == 0) {
+    (void)dest_port; // Transport headers are the caller's
+    if (!network_initialized || !data || length == 0 || !dest_ip) {
         return -1;
     }
-    
-    // In a real implementation, this would:
-    // 1. Create Ethernet header
-    // 2. Create IP header
-    // 3. Create TCP/UDP header
-    // 4. Send packet through network hardware
-    
-    // For now, just simulate sending
-    network_stats.total_packets_sent++;
-    network_interface.packets_sent++;
-    network_interface.bytes_sent += length;
-    
-    return 0;
-}
-
-/*
- * Calculate IP checksum
- */
-uint16_t calculate_ip_checksum(const void* data, size_t length) {
-    const uint16_t* ptr = (const uint16_t*)data;
-    uint32_t sum = 0;
-    
-    // Sum all 16-bit words
-    while (length > 1) {
-        sum += *ptr++;
-        length -= 2;
-    }
-    
-    // Add the last byte if present
-    if (length == 1) {
-        sum += *(const uint8_t*)ptr;
+    if (length > MAX_PACKET_SIZE - sizeof(ip_header_t)) {
+        return -1;
     }
     
-    // Add carry bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    pbuf_t* p = pbuf_alloc();
+    if (!p) {
+        network_stats.dropped_packets++;
+        return -1;
     }
+    memcpy(pbuf_put(p, (uint16_t)length), data, length);
     
-    return (uint16_t)~sum;
+    return ip_output(p, dest_ip, protocol) == HELL_SUCCESS ? 0 : -1;
 }
 
 /*
@@ -552,11 +307,9 @@ void shutdown_network_driver(void) {
     }
     
     // Close all sockets
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].socket_id != 0) {
-            socket_close(sockets[i].socket_id);
-        }
-    }
+    socket_shutdown();
+    
+    arp_flush();
     
     // Mark interface as down
     network_interface.is_up = false;
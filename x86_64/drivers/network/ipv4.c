@@ -0,0 +1,166 @@
+/*
+ * HellOS IPv4
+ * Routing the damned's datagrams between the wire and the transports
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "protocols.h"
+#include <stdint.h>
+
+#define IP_VERSION_4            4
+#define IP_BROADCAST            0xFFFFFFFFU
+
+// Pseudo header summed into TCP and UDP checksums
+typedef struct {
+    ip_address_t src_ip;
+    ip_address_t dest_ip;
+    uint8_t zero;
+    uint8_t protocol;
+    uint16_t length;
+} __attribute__((packed)) ip_pseudo_header_t;
+
+static uint16_t next_ip_id = 0;
+
+/*
+ * Sum of the pseudo header for a transport segment of length bytes
+ * Left unfolded, as the start of a software checksum or, folded but not
+ * inverted, as the seed a checksum offload finishes from.
+ */
+uint32_t ip_pseudo_header_sum(const ip_address_t* src_ip, const ip_address_t* dest_ip,
+                              uint8_t protocol, uint16_t length) {
+    ip_pseudo_header_t pseudo;
+    pseudo.src_ip = *src_ip;
+    pseudo.dest_ip = *dest_ip;
+    pseudo.zero = 0;
+    pseudo.protocol = protocol;
+    pseudo.length = htons(length);
+    return checksum_add(0, &pseudo, sizeof(pseudo));
+}
+
+/*
+ * Checksum a transport segment, across all its buffers, along with its
+ * pseudo header
+ * A segment that starts at an odd offset has its bytes summed in the other
+ * lanes, which swapping its 16 bit partial sum puts right (RFC 1071).
+ */
+uint16_t ip_pseudo_checksum(const ip_address_t* src_ip, const ip_address_t* dest_ip,
+                            uint8_t protocol, const pbuf_t* p) {
+    uint32_t sum = ip_pseudo_header_sum(src_ip, dest_ip, protocol, (uint16_t)pbuf_chain_length(p));
+    uint32_t offset = 0;
+    for (; p; p = p->chain) {
+        uint16_t part = (uint16_t)~checksum_fold(checksum_add(0, p->data, p->length));
+        if (offset & 1) {
+            part = htons(part);
+        }
+        sum += part;
+        offset += p->length;
+    }
+    return checksum_fold(sum);
+}
+
+/*
+ * Is this address ours to accept: our own, or a broadcast we hear
+ */
+static bool ip_accepts(const ip_address_t* dest_ip) {
+    network_interface_t* interface = get_network_interface();
+    uint32_t dest = ip_address_value(dest_ip);
+    uint32_t mask = ip_address_value(&interface->subnet_mask);
+    uint32_t local = ip_address_value(&interface->ip_address);
+
+    return dest == local || dest == IP_BROADCAST || dest == ((local & mask) | ~mask);
+}
+
+/*
+ * Handle a received datagram, its IP header at the front of the buffer
+ */
+void ip_input(pbuf_t* p) {
+    network_stats_t* stats = get_network_stats();
+    const ip_header_t* ip = (const ip_header_t*)p->data;
+
+    if (p->length < sizeof(ip_header_t) || (ip->version_ihl >> 4) != IP_VERSION_4) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+    uint16_t header_length = (ip->version_ihl & 0xF) * 4;
+    uint16_t total_length = ntohs(ip->total_length);
+    if (header_length < sizeof(ip_header_t) || total_length < header_length || total_length > p->length ||
+        calculate_ip_checksum(ip, header_length) != 0) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+
+    // No reassembly: fragments are dropped like anything not for us
+    if ((ntohs(ip->flags_fragment) & IP_FRAGMENT_MASK) || !ip_accepts(&ip->dest_ip)) {
+        stats->dropped_packets++;
+        pbuf_free(p);
+        return;
+    }
+
+    // Trim Ethernet padding, then hand the payload up with the header
+    // still readable just in front of it
+    p->length = total_length;
+    pbuf_pull(p, header_length);
+
+    switch (ip->protocol) {
+        case PROTOCOL_UDP:
+            stats->udp_packets++;
+            udp_input(p, ip);
+            return;
+        case PROTOCOL_TCP:
+            stats->tcp_packets++;
+            tcp_input(p, ip);
+            return;
+        case PROTOCOL_ICMP:
+            stats->icmp_packets++;
+            break;
+        default:
+            stats->dropped_packets++;
+            break;
+    }
+    pbuf_free(p);
+}
+
+/*
+ * Send a transport segment, prepending the IP header in place
+ * Addresses on our subnet are sent to directly, the rest to the gateway.
+ */
+int ip_output(pbuf_t* p, const ip_address_t* dest_ip, uint8_t protocol) {
+    network_interface_t* interface = get_network_interface();
+    uint32_t length = pbuf_chain_length(p) + sizeof(ip_header_t);
+
+    if (length > MAX_PACKET_SIZE) {
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
+    }
+    ip_header_t* ip = (ip_header_t*)pbuf_push(p, sizeof(ip_header_t));
+    if (!ip) {
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
+    }
+
+    ip->version_ihl = (IP_VERSION_4 << 4) | (sizeof(ip_header_t) / 4);
+    ip->type_of_service = 0;
+    ip->total_length = htons((uint16_t)length);
+    ip->identification = htons(next_ip_id++);
+    ip->flags_fragment = 0;
+    ip->ttl = IP_DEFAULT_TTL;
+    ip->protocol = protocol;
+    ip->checksum = 0;
+    ip->src_ip = interface->ip_address;
+    ip->dest_ip = *dest_ip;
+    ip->checksum = calculate_ip_checksum(ip, sizeof(ip_header_t));
+
+    uint32_t dest = ip_address_value(dest_ip);
+    uint32_t mask = ip_address_value(&interface->subnet_mask);
+    uint32_t local = ip_address_value(&interface->ip_address);
+    if (dest == IP_BROADCAST || dest == ((local & mask) | ~mask)) {
+        return ethernet_output(p, &ethernet_broadcast, ETHERTYPE_IPV4);
+    }
+    if ((dest & mask) == (local & mask)) {
+        return arp_output(p, dest_ip);
+    }
+    return arp_output(p, &interface->gateway);
+}
@@ -9,12 +9,50 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Network byte order
+static inline uint16_t htons(uint16_t value) {
+    return (uint16_t)((value << 8) | (value >> 8));
+}
+
+static inline uint32_t htonl(uint32_t value) {
+    return __builtin_bswap32(value);
+}
+
+#define ntohs(value) htons(value)
+#define ntohl(value) htonl(value)
+
 // Forward declarations
 typedef struct socket_s socket_t;
 typedef struct network_interface_s network_interface_t;
 typedef struct network_stats_s network_stats_t;
 typedef struct ip_address_s ip_address_t;
 
+// Socket readiness events
+#define SOCKET_EVENT_READABLE   0x1     // Data, a connection to accept, or end of stream
+#define SOCKET_EVENT_WRITABLE   0x2
+#define SOCKET_EVENT_HANGUP     0x4     // Peer closed; always reported
+
+typedef struct {
+    int socket_id;
+    uint32_t events;
+} socket_event_t;
+
+// A TCP connection's state and round trip estimates, times in milliseconds
+typedef struct {
+    uint32_t state;
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    uint32_t rto_ms;
+    uint32_t rtt_min_ms;
+    uint32_t rtt_samples;
+    uint32_t mss;
+    uint32_t cwnd;              // Bytes
+    uint32_t ssthresh;
+    uint32_t send_window;       // Peer's, scaled
+    uint32_t receive_window;
+    uint32_t retransmits;
+} tcp_info_t;
+
 // Network initialization
 int init_network_driver(void);
 void shutdown_network_driver(void);
@@ -28,11 +66,21 @@ int socket_connect(int socket_id, const char* ip_str, uint16_t port);
 int socket_send(int socket_id, const void* data, size_t length);
 int socket_receive(int socket_id, void* buffer, size_t buffer_size);
 int socket_close(int socket_id);
+int socket_set_blocking(int socket_id, bool blocking);
+int socket_get_tcp_info(int socket_id, tcp_info_t* info);
+
+// Socket readiness sets
+int socket_poll_create(void);
+int socket_poll_add(int poll_id, int socket_id, uint32_t events);
+int socket_poll_remove(int poll_id, int socket_id);
+int socket_poll_wait(int poll_id, socket_event_t* events, int max_events, bool block);
+void socket_poll_destroy(int poll_id);
 
 // Network utilities
 socket_t* find_socket_by_id(int socket_id);
 void parse_ip_address(const char* ip_str, ip_address_t* ip);
-void process_network_packets(void);
+uint32_t process_network_packets(void);
+void network_signal_rx(void);
 int send_packet(const void* data, size_t length, const ip_address_t* dest_ip, uint16_t dest_port, uint8_t protocol);
 uint16_t calculate_ip_checksum(const void* data, size_t length);
 
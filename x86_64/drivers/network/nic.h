@@ -0,0 +1,50 @@
+/*
+ * HellOS NIC Interface Header
+ * What the stack needs from a network card, and what a card calls back into
+ */
+
+#ifndef NIC_H
+#define NIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pbuf.h"
+
+#define NIC_POLL_BUDGET     64      // Frames per receive bottom half pass
+
+// Offloads
+#define NIC_OFFLOAD_TX_CSUM (1U << 0)   // Finishes PBUF_CSUM_PARTIAL checksums
+#define NIC_OFFLOAD_RX_CSUM (1U << 1)   // Marks good frames PBUF_CSUM_VERIFIED
+
+// NIC counters
+typedef struct {
+    uint32_t rx_frames;
+    uint32_t tx_frames;
+    uint32_t rx_no_buffer;      // Ring refills the pool couldn't cover
+    uint32_t tx_ring_full;      // Frames dropped for want of descriptors
+    uint32_t interrupts;
+    uint32_t polls;
+} nic_stats_t;
+
+// A probed card. Frames handed to transmit belong to the driver from then
+// on, sent or not; they may be chained, and the first buffer must keep
+// some headroom free in front for the driver's own header.
+typedef struct {
+    const char* name;
+    uint32_t offloads;
+    int (*transmit)(pbuf_t* p);
+    uint32_t (*poll)(uint32_t budget);      // Frames delivered
+    bool (*enable_interrupts)(void);        // True if work arrived meanwhile
+    nic_stats_t* stats;
+} nic_ops_t;
+
+// Called by the driver: network_input owns the frame it is given, and
+// network_signal_rx queues the bottom half that calls poll. A driver masks
+// its receive interrupt before signalling, until enable_interrupts.
+void network_input(pbuf_t* p);
+void network_signal_rx(void);
+
+// Drivers
+int virtio_net_probe(const nic_ops_t** ops, uint8_t mac[6]);
+
+#endif // NIC_H
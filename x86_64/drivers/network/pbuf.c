@@ -0,0 +1,139 @@
+/*
+ * HellOS Packet Buffers
+ * One allocation at init carved into frame buffers, so no packet ever
+ * goes through malloc
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/paging.h"
+#include "../../kernel/spinlock.h"
+#include "pbuf.h"
+#include <stdint.h>
+
+static pbuf_t pbufs[PBUF_COUNT];
+static pbuf_t* free_list = NULL;
+static spinlock_t pbuf_lock = SPINLOCK_INIT;
+static pbuf_stats_t pbuf_stats = {0};
+
+/*
+ * Allocate the pool
+ */
+int pbuf_init(void) {
+    if (free_list) {
+        return HELL_SUCCESS;
+    }
+    
+    uintptr_t memory = pfa_alloc_frames(PBUF_COUNT * PBUF_SIZE / PAGE_SIZE);
+    if (!memory) {
+        return HELL_ERROR_MEMORY;
+    }
+    
+    for (uint32_t i = 0; i < PBUF_COUNT; i++) {
+        pbufs[i].buffer = (uint8_t*)(memory + i * PBUF_SIZE);
+        pbufs[i].next = free_list;
+        free_list = &pbufs[i];
+    }
+    pbuf_stats.free = PBUF_COUNT;
+    pbuf_stats.low_water = PBUF_COUNT;
+    return HELL_SUCCESS;
+}
+
+/*
+ * Take a buffer, empty with PBUF_HEADROOM in front; NULL if none are left
+ */
+pbuf_t* pbuf_alloc(void) {
+    uint32_t flags = spin_lock_irqsave(&pbuf_lock);
+    pbuf_t* p = free_list;
+    if (p) {
+        free_list = p->next;
+        if (--pbuf_stats.free < pbuf_stats.low_water) {
+            pbuf_stats.low_water = pbuf_stats.free;
+        }
+    } else {
+        pbuf_stats.alloc_failures++;
+    }
+    spin_unlock_irqrestore(&pbuf_lock, flags);
+    
+    if (p) {
+        p->next = NULL;
+        p->chain = NULL;
+        p->data = p->buffer + PBUF_HEADROOM;
+        p->length = 0;
+        p->flags = 0;
+    }
+    return p;
+}
+
+/*
+ * Return a buffer and every segment chained after it to the pool
+ */
+void pbuf_free(pbuf_t* p) {
+    if (!p) {
+        return;
+    }
+    pbuf_t* last = p;
+    uint32_t count = 1;
+    while (last->chain) {
+        last->next = last->chain;
+        last = last->chain;
+        count++;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&pbuf_lock);
+    last->next = free_list;
+    free_list = p;
+    pbuf_stats.free += count;
+    spin_unlock_irqrestore(&pbuf_lock, flags);
+}
+
+/*
+ * Append tail's segments to the end of head's packet
+ */
+void pbuf_chain(pbuf_t* head, pbuf_t* tail) {
+    while (head->chain) {
+        head = head->chain;
+    }
+    head->chain = tail;
+}
+
+/*
+ * Bytes in a whole packet
+ */
+uint32_t pbuf_chain_length(const pbuf_t* p) {
+    uint32_t length = 0;
+    for (; p; p = p->chain) {
+        length += p->length;
+    }
+    return length;
+}
+
+/*
+ * Copy bytes out of a packet across segment boundaries, returns how many
+ */
+uint32_t pbuf_copy_out(const pbuf_t* p, uint32_t offset, void* dest, uint32_t length) {
+    uint8_t* out = (uint8_t*)dest;
+    uint32_t copied = 0;
+    
+    for (; p && copied < length; p = p->chain) {
+        if (offset >= p->length) {
+            offset -= p->length;
+            continue;
+        }
+        uint32_t bytes = p->length - offset;
+        if (bytes > length - copied) {
+            bytes = length - copied;
+        }
+        memcpy(out + copied, p->data + offset, bytes);
+        copied += bytes;
+        offset = 0;
+    }
+    return copied;
+}
+
+/*
+ * Get pool statistics
+ */
+pbuf_stats_t* get_pbuf_stats(void) {
+    return &pbuf_stats;
+}
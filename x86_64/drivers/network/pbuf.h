@@ -0,0 +1,88 @@
+/*
+ * HellOS Packet Buffers Header
+ * Fixed-size pooled frame buffers, shared by the stack and the NIC
+ */
+
+#ifndef PBUF_H
+#define PBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PBUF_SIZE       2048    // One whole frame per buffer
+#define PBUF_HEADROOM   128     // Left free at the front for headers
+#define PBUF_COUNT      512
+
+// Flags
+#define PBUF_CSUM_PARTIAL   0x0001  // Transport checksum left for the card to finish
+#define PBUF_CSUM_VERIFIED  0x0002  // Card already checked the transport checksum
+
+// A buffer from the pool. The memory is identity mapped and physically
+// contiguous, so its address goes straight into a descriptor ring.
+// A packet may span a chain of buffers; headers are pushed onto the
+// front of the first one, and the whole chain is freed together.
+typedef struct pbuf {
+    struct pbuf* next;          // Free list, or whatever queue the owner keeps it on
+    struct pbuf* chain;         // Next segment of the same packet
+    uint8_t* buffer;            // PBUF_SIZE bytes
+    uint8_t* data;              // First valid byte
+    uint16_t length;            // Valid bytes from data
+    uint16_t flags;
+    uint16_t csum_offset;       // PBUF_CSUM_PARTIAL: checksum field within the
+    uint8_t* csum_start;        // transport header starting here
+} pbuf_t;
+
+// Pool statistics
+typedef struct {
+    uint32_t free;
+    uint32_t low_water;         // Fewest ever free
+    uint32_t alloc_failures;
+} pbuf_stats_t;
+
+/*
+ * Grow the front by length bytes for a header, NULL if out of headroom
+ */
+static inline uint8_t* pbuf_push(pbuf_t* p, uint16_t length) {
+    if ((uint32_t)(p->data - p->buffer) < length) {
+        return NULL;
+    }
+    p->data -= length;
+    p->length += length;
+    return p->data;
+}
+
+/*
+ * Strip length bytes off the front, returns the header they held
+ */
+static inline uint8_t* pbuf_pull(pbuf_t* p, uint16_t length) {
+    if (p->length < length) {
+        return NULL;
+    }
+    uint8_t* header = p->data;
+    p->data += length;
+    p->length -= length;
+    return header;
+}
+
+/*
+ * Grow the back by length bytes, NULL if the buffer is full
+ */
+static inline uint8_t* pbuf_put(pbuf_t* p, uint16_t length) {
+    uint8_t* tail = p->data + p->length;
+    if (tail + length > p->buffer + PBUF_SIZE) {
+        return NULL;
+    }
+    p->length += length;
+    return tail;
+}
+
+// Packet buffer functions
+int pbuf_init(void);
+pbuf_t* pbuf_alloc(void);
+void pbuf_free(pbuf_t* p);
+void pbuf_chain(pbuf_t* head, pbuf_t* tail);
+uint32_t pbuf_chain_length(const pbuf_t* p);
+uint32_t pbuf_copy_out(const pbuf_t* p, uint32_t offset, void* dest, uint32_t length);
+pbuf_stats_t* get_pbuf_stats(void);
+
+#endif // PBUF_H
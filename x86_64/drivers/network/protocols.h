@@ -0,0 +1,180 @@
+/*
+ * HellOS Network Protocols Header
+ * Wire formats and the layers between the socket API and the card
+ */
+
+#ifndef PROTOCOLS_H
+#define PROTOCOLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "network.h"
+#include "pbuf.h"
+
+// Network constants
+#define MAX_PACKET_SIZE 1500
+
+// Protocol constants
+#define PROTOCOL_TCP 6
+#define PROTOCOL_UDP 17
+#define PROTOCOL_ICMP 1
+
+// Ethernet constants
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define ETHERNET_ADDRESS_LENGTH 6
+#define IP_DEFAULT_TTL 64
+#define IP_FRAGMENT_MASK 0x3FFF     // More fragments flag and offset
+
+// IP address structure
+struct ip_address_s {
+    uint8_t bytes[4];
+};
+
+// MAC address structure
+typedef struct {
+    uint8_t bytes[6];
+} mac_address_t;
+
+// Ethernet header
+typedef struct {
+    mac_address_t dest_mac;
+    mac_address_t src_mac;
+    uint16_t ethertype;
+} __attribute__((packed)) ethernet_header_t;
+
+// IP header
+typedef struct {
+    uint8_t version_ihl;
+    uint8_t type_of_service;
+    uint16_t total_length;
+    uint16_t identification;
+    uint16_t flags_fragment;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    ip_address_t src_ip;
+    ip_address_t dest_ip;
+} __attribute__((packed)) ip_header_t;
+
+// TCP header
+typedef struct {
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint32_t sequence_number;
+    uint32_t acknowledgment_number;
+    uint8_t data_offset_reserved;
+    uint8_t flags;
+    uint16_t window_size;
+    uint16_t checksum;
+    uint16_t urgent_pointer;
+} __attribute__((packed)) tcp_header_t;
+
+// UDP header
+typedef struct {
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint16_t length;
+    uint16_t checksum;
+} __attribute__((packed)) udp_header_t;
+
+// ARP header, for IPv4 over Ethernet
+typedef struct {
+    uint16_t hardware_type;
+    uint16_t protocol_type;
+    uint8_t hardware_length;
+    uint8_t protocol_length;
+    uint16_t operation;
+    mac_address_t sender_mac;
+    ip_address_t sender_ip;
+    mac_address_t target_mac;
+    ip_address_t target_ip;
+} __attribute__((packed)) arp_header_t;
+
+// Network interface structure
+struct network_interface_s {
+    mac_address_t mac_address;
+    ip_address_t ip_address;
+    ip_address_t subnet_mask;
+    ip_address_t gateway;
+    bool is_up;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+};
+
+// Network statistics
+struct network_stats_s {
+    uint64_t total_packets_sent;
+    uint64_t total_packets_received;
+    uint64_t tcp_packets;
+    uint64_t udp_packets;
+    uint64_t icmp_packets;
+    uint64_t dropped_packets;
+    uint64_t malformed_packets;
+    uint64_t arp_packets;
+
+    // TCP, over every connection
+    uint64_t tcp_connections;       // Reached ESTABLISHED
+    uint64_t tcp_retransmits;       // Segments sent again
+    uint64_t tcp_fast_retransmits;  // Losses caught by duplicate ACKs
+    uint64_t tcp_timeouts;          // Losses caught by the timer
+    uint64_t tcp_resets;            // Resets sent
+    uint64_t tcp_rtt_samples;
+    uint32_t tcp_srtt_ms;           // Smoothed round trip of the latest sample's connection
+    uint32_t tcp_rtt_min_ms;
+    uint32_t tcp_rtt_max_ms;
+};
+
+/*
+ * An address as one value, in network byte order like the bytes
+ */
+static inline uint32_t ip_address_value(const ip_address_t* ip) {
+    return (uint32_t)ip->bytes[0] | ((uint32_t)ip->bytes[1] << 8) |
+           ((uint32_t)ip->bytes[2] << 16) | ((uint32_t)ip->bytes[3] << 24);
+}
+
+// Every layer consumes the packet it is given, delivered or not
+// Ethernet (hell_network.c)
+int ethernet_output(pbuf_t* p, const mac_address_t* dest_mac, uint16_t ethertype);
+bool network_has_offload(uint32_t offload);
+extern const mac_address_t ethernet_broadcast;
+
+// ARP (arp.c)
+void arp_input(pbuf_t* p);
+int arp_output(pbuf_t* p, const ip_address_t* next_hop);
+void arp_flush(void);
+
+// IPv4 (ipv4.c)
+void ip_input(pbuf_t* p);
+int ip_output(pbuf_t* p, const ip_address_t* dest_ip, uint8_t protocol);
+uint32_t ip_pseudo_header_sum(const ip_address_t* src_ip, const ip_address_t* dest_ip,
+                              uint8_t protocol, uint16_t length);
+uint16_t ip_pseudo_checksum(const ip_address_t* src_ip, const ip_address_t* dest_ip,
+                            uint8_t protocol, const pbuf_t* p);
+
+// UDP (udp.c)
+void udp_input(pbuf_t* p, const ip_header_t* ip);
+int udp_output(pbuf_t* p, uint16_t src_port, const ip_address_t* dest_ip, uint16_t dest_port);
+
+// TCP (tcp.c), all but tcp_input called with socket_lock held
+void tcp_input(pbuf_t* p, const ip_header_t* ip);
+int tcp_init(void);
+int tcp_connect(socket_t* socket);
+void tcp_send_queued(socket_t* socket);
+void tcp_receive_window_opened(socket_t* socket);
+bool tcp_close(socket_t* socket);
+void tcp_detach(socket_t* socket);
+
+// Sockets (socket.c)
+bool socket_deliver_udp(uint16_t port, pbuf_t* p, const ip_address_t* src_ip, uint16_t src_port);
+
+// Checksums (checksum.c)
+uint32_t checksum_add(uint32_t sum, const void* data, size_t length);
+uint16_t checksum_fold(uint32_t sum);
+uint16_t checksum_update16(uint16_t checksum, uint16_t old_value, uint16_t new_value);
+uint16_t checksum_update32(uint16_t checksum, uint32_t old_value, uint32_t new_value);
+
+#endif // PROTOCOLS_H
@@ -0,0 +1,960 @@
+/*
+ * HellOS Sockets
+ * Where the damned wait for their messages: per-socket queues, blocking
+ * calls and readiness sets
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/process.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/trace.h"
+#include "network.h"
+#include "protocols.h"
+#include "socket.h"
+#include <stdint.h>
+
+#define SOCKET_SLOT_MASK        (MAX_SOCKETS - 1)
+#define SOCKET_GENERATION_MAX   (0x7FFFFFFF >> SOCKET_SLOT_BITS)
+
+// A readiness set: sockets join it with socket_poll_add, and those with
+// events pending sit on its ready list, so waiting costs nothing per idle
+// socket. Reporting is level triggered: a socket reported ready stays on
+// the list until a wait finds it no longer is.
+typedef struct socket_poll_s {
+    bool used;
+    uint32_t members;
+    socket_t* ready_head;
+    socket_t* ready_tail;
+    wait_queue_t wait;
+} socket_poll_t;
+
+spinlock_t socket_lock = SPINLOCK_INIT;
+
+// Sockets by slot, bound sockets by local port
+static kmem_cache_t* socket_cache = NULL;
+static socket_t* socket_table[MAX_SOCKETS];
+static uint32_t socket_generations[MAX_SOCKETS];
+static uint16_t free_slots[MAX_SOCKETS];
+static uint32_t free_slot_count = 0;
+static socket_t* port_buckets[SOCKET_PORT_BUCKETS];
+static uint16_t next_ephemeral_port = EPHEMERAL_PORT_FIRST;
+static socket_poll_t poll_sets[SOCKET_POLL_SETS];
+
+/*
+ * Append bytes to a ring, returns how many fit
+ */
+uint32_t byte_ring_write(byte_ring_t* ring, const void* data, uint32_t length) {
+    uint32_t space = byte_ring_free(ring);
+    if (length > space) {
+        length = space;
+    }
+    uint32_t start = ring->head & (ring->size - 1);
+    uint32_t first = ring->size - start;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(ring->data + start, data, first);
+    memcpy(ring->data, (const uint8_t*)data + first, length - first);
+    ring->head += length;
+    return length;
+}
+
+/*
+ * Copy queued bytes from offset past the tail without consuming them
+ */
+uint32_t byte_ring_peek(const byte_ring_t* ring, uint32_t offset, void* dest, uint32_t length) {
+    uint32_t used = byte_ring_used(ring);
+    if (offset >= used) {
+        return 0;
+    }
+    if (length > used - offset) {
+        length = used - offset;
+    }
+    uint32_t start = (ring->tail + offset) & (ring->size - 1);
+    uint32_t first = ring->size - start;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(dest, ring->data + start, first);
+    memcpy((uint8_t*)dest + first, ring->data, length - first);
+    return length;
+}
+
+/*
+ * Drop bytes from the tail
+ */
+void byte_ring_consume(byte_ring_t* ring, uint32_t length) {
+    uint32_t used = byte_ring_used(ring);
+    ring->tail += (length < used) ? length : used;
+}
+
+/*
+ * Set up the socket table
+ */
+int socket_init(void) {
+    // Socket descriptors come from a dedicated slab cache
+    socket_cache = kmem_cache_create("socket_t", sizeof(socket_t), 0);
+    if (!socket_cache) {
+        return HELL_ERROR_MEMORY;
+    }
+
+    // Lowest slots handed out first
+    free_slot_count = 0;
+    for (uint32_t i = MAX_SOCKETS; i > 0; i--) {
+        free_slots[free_slot_count++] = (uint16_t)(i - 1);
+        socket_table[i - 1] = NULL;
+    }
+    memset(port_buckets, 0, sizeof(port_buckets));
+    for (uint32_t i = 0; i < SOCKET_POLL_SETS; i++) {
+        poll_sets[i].used = false;
+        wait_queue_init(&poll_sets[i].wait);
+    }
+    return HELL_SUCCESS;
+}
+
+/*
+ * Socket for an id, NULL if it was closed
+ * A TCP socket closed while its connection finishes keeps its slot but
+ * is no longer reachable by id.
+ */
+socket_t* socket_get(int socket_id) {
+    if (socket_id <= 0) {
+        return NULL;
+    }
+    socket_t* socket = socket_table[socket_id & SOCKET_SLOT_MASK];
+    return (socket && socket->socket_id == socket_id && !socket->orphaned) ? socket : NULL;
+}
+
+/*
+ * Find socket by ID
+ */
+socket_t* find_socket_by_id(int socket_id) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return socket;
+}
+
+/*
+ * Find the socket a segment for local_port from the given remote belongs to
+ * A socket connected to exactly that remote wins over one bound to the
+ * port alone; remote_ip NULL matches only the latter.
+ */
+socket_t* socket_lookup(socket_type_t type, uint16_t local_port,
+                        const ip_address_t* remote_ip, uint16_t remote_port) {
+    socket_t* wildcard = NULL;
+    for (socket_t* socket = port_buckets[local_port % SOCKET_PORT_BUCKETS]; socket;
+         socket = socket->port_next) {
+        if (socket->type != type || socket->local_port != local_port) {
+            continue;
+        }
+        if (!socket->remote_port) {
+            wildcard = wildcard ? wildcard : socket;
+        } else if (remote_ip && socket->remote_port == remote_port &&
+                   ip_address_value(&socket->remote_ip) == ip_address_value(remote_ip)) {
+            return socket;
+        }
+    }
+    return wildcard;
+}
+
+/*
+ * Take a socket out of the port hash
+ */
+static void socket_unhash(socket_t* socket) {
+    if (!socket->hashed) {
+        return;
+    }
+    socket_t** link = &port_buckets[socket->local_port % SOCKET_PORT_BUCKETS];
+    while (*link && *link != socket) {
+        link = &(*link)->port_next;
+    }
+    if (*link) {
+        *link = socket->port_next;
+    }
+    socket->port_next = NULL;
+    socket->hashed = false;
+}
+
+/*
+ * Whether any bound socket of a type has a local port, connected or not
+ */
+static bool socket_port_in_use(socket_type_t type, uint16_t port) {
+    for (socket_t* socket = port_buckets[port % SOCKET_PORT_BUCKETS]; socket; socket = socket->port_next) {
+        if (socket->type == type && socket->local_port == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Bind to a local port, 0 for an ephemeral one
+ * Fails if another unconnected socket of the same type has the port;
+ * a connected one may share it, as accepted connections share their
+ * listener's. An ephemeral port is one nothing at all is bound to, so
+ * it can't repeat a connected socket's four-tuple.
+ */
+bool socket_bind_port(socket_t* socket, uint16_t port) {
+    if (!port) {
+        for (uint32_t tries = 0; tries < 0x10000 - EPHEMERAL_PORT_FIRST; tries++) {
+            uint16_t candidate = next_ephemeral_port++;
+            if (!next_ephemeral_port) {
+                next_ephemeral_port = EPHEMERAL_PORT_FIRST;
+            }
+            if (!socket_port_in_use(socket->type, candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (!port) {
+            return false;
+        }
+    } else {
+        socket_t* owner = socket_lookup(socket->type, port, NULL, 0);
+        if (owner && owner != socket && !socket->remote_port) {
+            return false;
+        }
+    }
+
+    socket_unhash(socket);
+    socket->local_port = port;
+    socket_t** bucket = &port_buckets[port % SOCKET_PORT_BUCKETS];
+    socket->port_next = *bucket;
+    *bucket = socket;
+    socket->hashed = true;
+    return true;
+}
+
+/*
+ * Allocate a socket and give it a slot
+ */
+socket_t* socket_alloc(socket_type_t type) {
+    if (!free_slot_count) {
+        return NULL;
+    }
+    socket_t* socket = kmem_cache_alloc(socket_cache);
+    if (!socket) {
+        return NULL;
+    }
+    memset(socket, 0, sizeof(socket_t));
+
+    // Only streams carry byte rings
+    if (type == SOCKET_TYPE_TCP) {
+        socket->rx_stream.data = malloc(SOCKET_STREAM_BUFFER);
+        socket->tx_stream.data = malloc(SOCKET_STREAM_BUFFER);
+        if (!socket->rx_stream.data || !socket->tx_stream.data) {
+            free(socket->rx_stream.data);
+            free(socket->tx_stream.data);
+            kmem_cache_free(socket_cache, socket);
+            return NULL;
+        }
+        socket->rx_stream.size = SOCKET_STREAM_BUFFER;
+        socket->tx_stream.size = SOCKET_STREAM_BUFFER;
+    }
+
+    uint16_t slot = free_slots[--free_slot_count];
+    uint32_t generation = socket_generations[slot] + 1;
+    if (generation > SOCKET_GENERATION_MAX) {
+        generation = 1;
+    }
+    socket_generations[slot] = generation;
+    socket->socket_id = (int)((generation << SOCKET_SLOT_BITS) | slot);
+    socket->type = type;
+    socket->state = SOCKET_STATE_CLOSED;
+    socket->blocking = true;
+    wait_queue_init(&socket->wait);
+    socket_table[slot] = socket;
+    return socket;
+}
+
+/*
+ * Take a socket off its readiness set's ready list
+ */
+static void socket_unready(socket_t* socket) {
+    if (!socket->on_ready_list) {
+        return;
+    }
+    socket_poll_t* poll = socket->poll;
+    socket_t* prev = NULL;
+    for (socket_t* entry = poll->ready_head; entry; prev = entry, entry = entry->ready_next) {
+        if (entry != socket) {
+            continue;
+        }
+        if (prev) {
+            prev->ready_next = entry->ready_next;
+        } else {
+            poll->ready_head = entry->ready_next;
+        }
+        if (poll->ready_tail == entry) {
+            poll->ready_tail = prev;
+        }
+        break;
+    }
+    socket->ready_next = NULL;
+    socket->on_ready_list = false;
+}
+
+/*
+ * Put a socket at the end of its readiness set's ready list
+ */
+static void socket_make_ready(socket_t* socket) {
+    socket_poll_t* poll = socket->poll;
+    socket->ready_next = NULL;
+    socket->on_ready_list = true;
+    if (poll->ready_tail) {
+        poll->ready_tail->ready_next = socket;
+    } else {
+        poll->ready_head = socket;
+    }
+    poll->ready_tail = socket;
+}
+
+/*
+ * Free a socket, waking anyone still blocked on it first
+ */
+void socket_release(socket_t* socket) {
+    tcp_detach(socket);
+    socket_unhash(socket);
+    socket_unready(socket);
+    if (socket->poll) {
+        socket->poll->members--;
+    }
+    socket_table[socket->socket_id & SOCKET_SLOT_MASK] = NULL;
+    free_slots[free_slot_count++] = (uint16_t)(socket->socket_id & SOCKET_SLOT_MASK);
+
+    // Waiters find the id gone when they look again
+    wake_up_all(&socket->wait);
+
+    while (socket->datagram_tail != socket->datagram_head) {
+        pbuf_free(socket->datagrams[socket->datagram_tail++ % SOCKET_DATAGRAM_QUEUE]);
+    }
+    while (socket->accept_tail != socket->accept_head) {
+        socket_release(socket->accept_queue[socket->accept_tail++ % SOCKET_BACKLOG_MAX]);
+    }
+    free(socket->rx_stream.data);
+    free(socket->tx_stream.data);
+    kmem_cache_free(socket_cache, socket);
+}
+
+/*
+ * Events a socket has pending right now
+ */
+uint32_t socket_ready_events(const socket_t* socket) {
+    uint32_t events = 0;
+
+    if (socket->type == SOCKET_TYPE_UDP) {
+        if (socket->datagram_head != socket->datagram_tail) {
+            events |= SOCKET_EVENT_READABLE;
+        }
+        return events | SOCKET_EVENT_WRITABLE;
+    }
+
+    if (socket->is_listening) {
+        return (socket->accept_head != socket->accept_tail) ? SOCKET_EVENT_READABLE : 0;
+    }
+    if (byte_ring_used(&socket->rx_stream) || socket->peer_closed) {
+        events |= SOCKET_EVENT_READABLE;
+    }
+    if (socket->is_connected && byte_ring_free(&socket->tx_stream)) {
+        events |= SOCKET_EVENT_WRITABLE;
+    }
+    if (socket->peer_closed) {
+        events |= SOCKET_EVENT_HANGUP;
+    }
+    return events;
+}
+
+/*
+ * Something changed on a socket: wake its blockers and tell its set
+ */
+void socket_notify(socket_t* socket) {
+    wake_up_all(&socket->wait);
+
+    socket_poll_t* poll = socket->poll;
+    if (poll && !socket->on_ready_list &&
+        (socket_ready_events(socket) & (socket->poll_events | SOCKET_EVENT_HANGUP))) {
+        socket_make_ready(socket);
+        wake_up_all(&poll->wait);
+    }
+}
+
+/*
+ * Queue an established connection for accept, false if the backlog is full
+ */
+bool socket_queue_connection(socket_t* listener, socket_t* child) {
+    if (listener->accept_head - listener->accept_tail >= listener->backlog) {
+        return false;
+    }
+    listener->accept_queue[listener->accept_head++ % SOCKET_BACKLOG_MAX] = child;
+    socket_notify(listener);
+    return true;
+}
+
+/*
+ * Queue a received datagram on the UDP socket bound to port
+ * Returns false if nothing is listening or its queue is full, leaving the
+ * buffer with the caller.
+ */
+bool socket_deliver_udp(uint16_t port, pbuf_t* p, const ip_address_t* src_ip, uint16_t src_port) {
+    bool delivered = false;
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_lookup(SOCKET_TYPE_UDP, port, src_ip, src_port);
+    if (socket && socket->datagram_head - socket->datagram_tail < SOCKET_DATAGRAM_QUEUE) {
+        socket->datagrams[socket->datagram_head++ % SOCKET_DATAGRAM_QUEUE] = p;
+        socket_notify(socket);
+        delivered = true;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return delivered;
+}
+
+/*
+ * Send one datagram to a UDP socket's remote end
+ */
+static int udp_send(const ip_address_t* dest_ip, uint16_t local_port, uint16_t dest_port,
+                    const void* data, size_t length) {
+    if (length > MAX_PACKET_SIZE - sizeof(ip_header_t) - sizeof(udp_header_t)) {
+        return -1;
+    }
+
+    pbuf_t* p = pbuf_alloc();
+    if (!p) {
+        get_network_stats()->dropped_packets++;
+        return -1;
+    }
+    memcpy(pbuf_put(p, (uint16_t)length), data, length);
+
+    if (udp_output(p, local_port, dest_ip, dest_port) != HELL_SUCCESS) {
+        return -1;
+    }
+    get_network_stats()->udp_packets++;
+    return (int)length;
+}
+
+/*
+ * Write an address as a dotted quad, at least 16 bytes of room
+ */
+static void format_ip_address(const ip_address_t* ip, char* out) {
+    for (int i = 0; i < 4; i++) {
+        uint8_t value = ip->bytes[i];
+        if (value >= 100) {
+            *out++ = (char)('0' + value / 100);
+        }
+        if (value >= 10) {
+            *out++ = (char)('0' + (value / 10) % 10);
+        }
+        *out++ = (char)('0' + value % 10);
+        if (i < 3) {
+            *out++ = '.';
+        }
+    }
+    *out = '\0';
+}
+
+/*
+ * Create a socket
+ */
+int socket_create(int domain, int type, int protocol) {
+    (void)domain;   // Suppress unused parameter warning
+    (void)protocol; // Suppress unused parameter warning
+    if (!socket_cache) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_alloc((type == 1) ? SOCKET_TYPE_TCP : SOCKET_TYPE_UDP);
+    int socket_id = socket ? socket->socket_id : -1;
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    return socket_id;
+}
+
+/*
+ * Bind a socket to an address
+ */
+int socket_bind(int socket_id, const char* ip_str, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (!socket || !socket_bind_port(socket, port)) {
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return -1;
+    }
+
+    // Parse IP address (simplified)
+    if (ip_str) {
+        parse_ip_address(ip_str, &socket->local_ip);
+    } else {
+        // Bind to any address
+        socket->local_ip = get_network_interface()->ip_address;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    return 0;
+}
+
+/*
+ * Set whether receive, send and accept wait or return straight away
+ */
+int socket_set_blocking(int socket_id, bool blocking) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (socket) {
+        socket->blocking = blocking;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return socket ? 0 : -1;
+}
+
+/*
+ * Listen for connections (TCP only)
+ */
+int socket_listen(int socket_id, int backlog) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (!socket || socket->type != SOCKET_TYPE_TCP || !socket->local_port) {
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return -1;
+    }
+
+    if (backlog < 1) {
+        backlog = 1;
+    }
+    socket->backlog = (backlog > SOCKET_BACKLOG_MAX) ? SOCKET_BACKLOG_MAX : (uint32_t)backlog;
+    socket->state = SOCKET_STATE_LISTENING;
+    socket->is_listening = true;
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    return 0;
+}
+
+/*
+ * Accept a connection (TCP only)
+ * Blocks until one is established unless the socket is non-blocking;
+ * client_ip needs room for a dotted quad.
+ */
+int socket_accept(int socket_id, char* client_ip, uint16_t* client_port) {
+    socket_t* child = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    for (;;) {
+        socket_t* socket = socket_get(socket_id);
+        if (!socket || socket->type != SOCKET_TYPE_TCP || !socket->is_listening) {
+            break;
+        }
+        if (socket->accept_head != socket->accept_tail) {
+            child = socket->accept_queue[socket->accept_tail++ % SOCKET_BACKLOG_MAX];
+            finish_wait(&socket->wait);
+            break;
+        }
+        if (!socket->blocking) {
+            finish_wait(&socket->wait);
+            break;
+        }
+        prepare_to_wait(&socket->wait);
+        spin_unlock_irqrestore(&socket_lock, flags);
+        block_current_process();
+        flags = spin_lock_irqsave(&socket_lock);
+    }
+
+    int child_id = -1;
+    if (child) {
+        child_id = child->socket_id;
+        if (client_ip) {
+            format_ip_address(&child->remote_ip, client_ip);
+        }
+        if (client_port) {
+            *client_port = child->remote_port;
+        }
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return child_id;
+}
+
+/*
+ * Connect to a remote address (TCP only)
+ */
+int socket_connect(int socket_id, const char* ip_str, uint16_t port) {
+    if (!ip_str) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (!socket || (!socket->local_port && !socket_bind_port(socket, 0))) {
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return -1;
+    }
+
+    // Parse remote IP address
+    parse_ip_address(ip_str, &socket->remote_ip);
+    socket->remote_port = port;
+
+    // A UDP socket only remembers where its datagrams go
+    if (socket->type == SOCKET_TYPE_UDP) {
+        socket->is_connected = true;
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return 0;
+    }
+
+    // Send the SYN; a non-blocking socket turns writable once connected
+    if (socket->is_connected || tcp_connect(socket) != HELL_SUCCESS) {
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return -1;
+    }
+
+    int result = 0;
+    for (;;) {
+        socket = socket_get(socket_id);
+        if (!socket || socket->is_connected || socket->peer_closed || !socket->blocking) {
+            result = (socket && (socket->is_connected || !socket->peer_closed)) ? 0 : -1;
+            if (socket) {
+                finish_wait(&socket->wait);
+            }
+            break;
+        }
+        prepare_to_wait(&socket->wait);
+        spin_unlock_irqrestore(&socket_lock, flags);
+        block_current_process();
+        flags = spin_lock_irqsave(&socket_lock);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    return result;
+}
+
+/*
+ * Queue stream data for TCP to send
+ * Blocks while the send ring is full unless the socket is non-blocking,
+ * returning what was queued, or -1 if the connection is gone before any.
+ * Called with socket_lock held; may drop and retake it.
+ */
+static int tcp_stream_send(int socket_id, const uint8_t* data, size_t length, uint32_t* flags) {
+    size_t queued = 0;
+    for (;;) {
+        socket_t* socket = socket_get(socket_id);
+        if (!socket || !socket->is_connected) {
+            break;
+        }
+        uint32_t written = byte_ring_write(&socket->tx_stream, data + queued, (uint32_t)(length - queued));
+        if (written) {
+            queued += written;
+            tcp_send_queued(socket);
+        }
+        if (queued == length || !socket->blocking) {
+            finish_wait(&socket->wait);
+            break;
+        }
+        prepare_to_wait(&socket->wait);
+        spin_unlock_irqrestore(&socket_lock, *flags);
+        block_current_process();
+        *flags = spin_lock_irqsave(&socket_lock);
+    }
+    return queued ? (int)queued : -1;
+}
+
+/*
+ * Send data through a socket
+ */
+int socket_send(int socket_id, const void* data, size_t length) {
+    if (!data || length == 0) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (!socket || !socket->is_connected) {
+        spin_unlock_irqrestore(&socket_lock, flags);
+        return -1;
+    }
+    if (socket->type == SOCKET_TYPE_TCP) {
+        TRACE_BEGIN(TRACE_SOCKET_SEND, socket_id);
+        int sent = tcp_stream_send(socket_id, (const uint8_t*)data, length, &flags);
+        spin_unlock_irqrestore(&socket_lock, flags);
+        TRACE_END(TRACE_SOCKET_SEND, socket_id);
+        return sent;
+    }
+    socket_type_t type = socket->type;
+    ip_address_t remote_ip = socket->remote_ip;
+    uint16_t local_port = socket->local_port;
+    uint16_t remote_port = socket->remote_port;
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    TRACE_BEGIN(TRACE_SOCKET_SEND, socket_id);
+
+    int sent = -1;
+    if (type == SOCKET_TYPE_UDP) {
+        sent = udp_send(&remote_ip, local_port, remote_port, data, length);
+    }
+
+    TRACE_END(TRACE_SOCKET_SEND, socket_id);
+    return sent;
+}
+
+/*
+ * Receive data from a socket
+ * A datagram socket returns one datagram per call, truncated to the
+ * buffer; a stream returns what is queued, and 0 once the peer has
+ * closed. Either blocks while there is nothing unless non-blocking.
+ */
+int socket_receive(int socket_id, void* buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) {
+        return -1;
+    }
+
+    TRACE_BEGIN(TRACE_SOCKET_RECEIVE, socket_id);
+
+    int received = -1;
+    pbuf_t* datagram = NULL;
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    for (;;) {
+        socket_t* socket = socket_get(socket_id);
+        if (!socket || (socket->type == SOCKET_TYPE_TCP && !socket->is_connected && !socket->peer_closed)) {
+            received = -1;
+            break;
+        }
+
+        if (socket->type == SOCKET_TYPE_UDP && socket->datagram_head != socket->datagram_tail) {
+            datagram = socket->datagrams[socket->datagram_tail++ % SOCKET_DATAGRAM_QUEUE];
+            finish_wait(&socket->wait);
+            break;
+        }
+        if (socket->type == SOCKET_TYPE_TCP && byte_ring_used(&socket->rx_stream)) {
+            received = (int)byte_ring_peek(&socket->rx_stream, 0, buffer, (uint32_t)buffer_size);
+            byte_ring_consume(&socket->rx_stream, (uint32_t)received);
+            tcp_receive_window_opened(socket);
+            finish_wait(&socket->wait);
+            break;
+        }
+        if (socket->peer_closed || !socket->blocking) {
+            received = 0;
+            finish_wait(&socket->wait);
+            break;
+        }
+
+        prepare_to_wait(&socket->wait);
+        spin_unlock_irqrestore(&socket_lock, flags);
+        block_current_process();
+        flags = spin_lock_irqsave(&socket_lock);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    // Copied outside the lock, the datagram is ours now
+    if (datagram) {
+        received = (int)pbuf_copy_out(datagram, 0, buffer, (uint32_t)buffer_size);
+        pbuf_free(datagram);
+    }
+
+    TRACE_END(TRACE_SOCKET_RECEIVE, socket_id);
+    return received;
+}
+
+/*
+ * Close a socket
+ * A TCP connection sends what is queued and then its FIN; the socket
+ * lingers, unreachable, until the close completes.
+ */
+int socket_close(int socket_id) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    if (socket && socket->type == SOCKET_TYPE_TCP && tcp_close(socket)) {
+        socket_unready(socket);
+        if (socket->poll) {
+            socket->poll->members--;
+            socket->poll = NULL;
+        }
+        socket->orphaned = true;
+        wake_up_all(&socket->wait);
+    } else if (socket) {
+        socket_release(socket);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return socket ? 0 : -1;
+}
+
+/*
+ * Create a readiness set, returns its id or -1
+ */
+int socket_poll_create(void) {
+    int poll_id = -1;
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    for (uint32_t i = 0; i < SOCKET_POLL_SETS; i++) {
+        if (!poll_sets[i].used) {
+            poll_sets[i].used = true;
+            poll_sets[i].members = 0;
+            poll_sets[i].ready_head = NULL;
+            poll_sets[i].ready_tail = NULL;
+            poll_id = (int)i + 1;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return poll_id;
+}
+
+/*
+ * Readiness set for an id
+ * Called with socket_lock held.
+ */
+static socket_poll_t* socket_poll_get(int poll_id) {
+    if (poll_id < 1 || poll_id > SOCKET_POLL_SETS || !poll_sets[poll_id - 1].used) {
+        return NULL;
+    }
+    return &poll_sets[poll_id - 1];
+}
+
+/*
+ * Watch a socket for events, or change the events watched
+ * A socket belongs to at most one set at a time.
+ */
+int socket_poll_add(int poll_id, int socket_id, uint32_t events) {
+    int result = -1;
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_poll_t* poll = socket_poll_get(poll_id);
+    socket_t* socket = socket_get(socket_id);
+    if (poll && socket && (!socket->poll || socket->poll == poll)) {
+        if (!socket->poll) {
+            socket->poll = poll;
+            poll->members++;
+        }
+        socket->poll_events = events;
+        if (!socket->on_ready_list && (socket_ready_events(socket) & (events | SOCKET_EVENT_HANGUP))) {
+            socket_make_ready(socket);
+            wake_up_all(&poll->wait);
+        }
+        result = 0;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return result;
+}
+
+/*
+ * Stop watching a socket
+ */
+int socket_poll_remove(int poll_id, int socket_id) {
+    int result = -1;
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_poll_t* poll = socket_poll_get(poll_id);
+    socket_t* socket = socket_get(socket_id);
+    if (poll && socket && socket->poll == poll) {
+        socket_unready(socket);
+        socket->poll = NULL;
+        socket->poll_events = 0;
+        poll->members--;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return result;
+}
+
+/*
+ * Collect up to max_events ready sockets, waiting for one if block is set
+ * Only the ready list is walked, however many sockets the set watches.
+ * Returns how many were filled in, or -1 for a bad set.
+ */
+int socket_poll_wait(int poll_id, socket_event_t* events, int max_events, bool block) {
+    if (!events || max_events <= 0) {
+        return -1;
+    }
+
+    int count = -1;
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    for (;;) {
+        socket_poll_t* poll = socket_poll_get(poll_id);
+        if (!poll) {
+            break;
+        }
+
+        // Reported sockets go back on the end, to be checked again next time
+        socket_t* reported_head = NULL;
+        socket_t* reported_tail = NULL;
+        count = 0;
+        while (count < max_events && poll->ready_head) {
+            socket_t* socket = poll->ready_head;
+            poll->ready_head = socket->ready_next;
+            if (!poll->ready_head) {
+                poll->ready_tail = NULL;
+            }
+            socket->ready_next = NULL;
+            socket->on_ready_list = false;
+
+            uint32_t ready = socket_ready_events(socket) & (socket->poll_events | SOCKET_EVENT_HANGUP);
+            if (!ready) {
+                continue;   // Drained since it was queued
+            }
+            events[count].socket_id = socket->socket_id;
+            events[count].events = ready;
+            count++;
+
+            socket->on_ready_list = true;
+            if (reported_tail) {
+                reported_tail->ready_next = socket;
+            } else {
+                reported_head = socket;
+            }
+            reported_tail = socket;
+        }
+        if (reported_head) {
+            if (poll->ready_tail) {
+                poll->ready_tail->ready_next = reported_head;
+            } else {
+                poll->ready_head = reported_head;
+            }
+            poll->ready_tail = reported_tail;
+        }
+
+        if (count || !block) {
+            finish_wait(&poll->wait);
+            break;
+        }
+        prepare_to_wait(&poll->wait);
+        spin_unlock_irqrestore(&socket_lock, flags);
+        block_current_process();
+        flags = spin_lock_irqsave(&socket_lock);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return count;
+}
+
+/*
+ * Destroy a readiness set, dropping its sockets from it
+ */
+void socket_poll_destroy(int poll_id) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_poll_t* poll = socket_poll_get(poll_id);
+    if (poll) {
+        for (uint32_t i = 0; i < MAX_SOCKETS; i++) {
+            socket_t* socket = socket_table[i];
+            if (socket && socket->poll == poll) {
+                socket->on_ready_list = false;
+                socket->ready_next = NULL;
+                socket->poll = NULL;
+            }
+        }
+        poll->used = false;
+        wake_up_all(&poll->wait);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+}
+
+/*
+ * Close every socket
+ * Listeners go first: releasing one releases its accept queue, which
+ * would otherwise free a queued child a second time.
+ */
+void socket_shutdown(void) {
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    for (uint32_t i = 0; i < MAX_SOCKETS; i++) {
+        if (socket_table[i] && socket_table[i]->is_listening) {
+            socket_release(socket_table[i]);
+        }
+    }
+    for (uint32_t i = 0; i < MAX_SOCKETS; i++) {
+        if (socket_table[i]) {
+            socket_release(socket_table[i]);
+        }
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+}
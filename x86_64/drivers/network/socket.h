@@ -0,0 +1,128 @@
+/*
+ * HellOS Socket Internals Header
+ * What the transports see of a socket: its queues, its waiters, its ports
+ */
+
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../kernel/process.h"
+#include "protocols.h"
+#include "pbuf.h"
+
+#define MAX_SOCKETS             256     // Slots, a power of two
+#define SOCKET_SLOT_BITS        8       // Low bits of a socket id
+#define SOCKET_DATAGRAM_QUEUE   64      // Datagrams held per socket, a power of two
+#define SOCKET_STREAM_BUFFER    65536   // Stream bytes each way, a power of two
+#define SOCKET_BACKLOG_MAX      32      // Connections waiting for accept, a power of two
+#define SOCKET_PORT_BUCKETS     64
+#define SOCKET_POLL_SETS        8
+#define EPHEMERAL_PORT_FIRST    49152
+
+// Socket states
+typedef enum {
+    SOCKET_STATE_CLOSED,
+    SOCKET_STATE_LISTENING,
+    SOCKET_STATE_CONNECTING,
+    SOCKET_STATE_CONNECTED,
+    SOCKET_STATE_CLOSING
+} socket_state_t;
+
+// Socket types
+typedef enum {
+    SOCKET_TYPE_TCP,
+    SOCKET_TYPE_UDP,
+    SOCKET_TYPE_RAW
+} socket_type_t;
+
+// A byte ring; head and tail count bytes ever written and read, so they
+// wrap freely and their difference is what is queued
+typedef struct {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+} byte_ring_t;
+
+struct socket_poll_s;
+
+// Socket structure
+// Everything below socket_id is guarded by socket_lock.
+struct socket_s {
+    int socket_id;              // Slot in the low bits, generation above
+    socket_type_t type;
+    socket_state_t state;
+    ip_address_t local_ip;
+    uint16_t local_port;
+    ip_address_t remote_ip;
+    uint16_t remote_port;
+    bool is_listening;
+    bool is_connected;
+    bool blocking;
+    bool peer_closed;           // No more data will arrive
+    bool orphaned;              // Closed, or not yet accepted: no id reaches it
+
+    // Received datagrams, oldest first
+    pbuf_t* datagrams[SOCKET_DATAGRAM_QUEUE];
+    uint32_t datagram_head;
+    uint32_t datagram_tail;
+
+    // Stream data, for TCP
+    byte_ring_t rx_stream;
+    byte_ring_t tx_stream;
+
+    // Established connections waiting for accept
+    struct socket_s* accept_queue[SOCKET_BACKLOG_MAX];
+    uint32_t accept_head;
+    uint32_t accept_tail;
+    uint32_t backlog;
+    uint32_t half_open;         // Children still handshaking, counted against the backlog
+
+    // Processes blocked in receive, send or accept
+    wait_queue_t wait;
+
+    // Readiness reporting
+    struct socket_poll_s* poll;
+    uint32_t poll_events;
+    bool on_ready_list;
+    struct socket_s* ready_next;
+
+    struct socket_s* port_next; // Port hash chain, while bound
+    bool hashed;
+    void* transport;            // Protocol control block
+};
+
+// Held around any socket state the bottom half and callers share
+extern spinlock_t socket_lock;
+
+// Byte rings
+static inline uint32_t byte_ring_used(const byte_ring_t* ring) {
+    return ring->head - ring->tail;
+}
+
+static inline uint32_t byte_ring_free(const byte_ring_t* ring) {
+    return ring->size - (ring->head - ring->tail);
+}
+
+uint32_t byte_ring_write(byte_ring_t* ring, const void* data, uint32_t length);
+uint32_t byte_ring_peek(const byte_ring_t* ring, uint32_t offset, void* dest, uint32_t length);
+void byte_ring_consume(byte_ring_t* ring, uint32_t length);
+
+// Socket internals, called with socket_lock held
+socket_t* socket_get(int socket_id);
+socket_t* socket_lookup(socket_type_t type, uint16_t local_port,
+                        const ip_address_t* remote_ip, uint16_t remote_port);
+socket_t* socket_alloc(socket_type_t type);
+void socket_release(socket_t* socket);
+bool socket_bind_port(socket_t* socket, uint16_t port);
+bool socket_queue_connection(socket_t* listener, socket_t* child);
+void socket_notify(socket_t* socket);
+uint32_t socket_ready_events(const socket_t* socket);
+
+// Socket setup (socket.c)
+int socket_init(void);
+void socket_shutdown(void);
+
+#endif // SOCKET_H
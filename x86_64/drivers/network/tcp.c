@@ -0,0 +1,1243 @@
+/*
+ * HellOS TCP
+ * Streams that keep their promises: handshakes, sliding windows,
+ * retransmission and NewReno congestion control
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/process.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/wakeup.h"
+#include "network.h"
+#include "protocols.h"
+#include "socket.h"
+#include "nic.h"
+#include <stdint.h>
+
+#define TCP_MSS                 (MAX_PACKET_SIZE - sizeof(ip_header_t) - sizeof(tcp_header_t))
+#define TCP_DEFAULT_MSS         536     // Peers that send no MSS option (RFC 1122)
+#define TCP_WINDOW_SCALE        2       // Our receive ring is bigger than 64K >> 2
+#define TCP_INITIAL_WINDOW      10      // Segments (RFC 6928)
+#define TCP_RTO_INITIAL_MS      1000
+#define TCP_RTO_MIN_MS          200
+#define TCP_RTO_MAX_MS          60000
+#define TCP_DELAYED_ACK_MS      40
+#define TCP_TIME_WAIT_MS        10000
+#define TCP_FIN_WAIT_MS         30000   // Orphans the peer never finishes with
+#define TCP_MAX_RETRIES         8
+#define TCP_DUPACK_THRESHOLD    3
+
+// Header flags
+#define TCP_FIN                 0x01
+#define TCP_SYN                 0x02
+#define TCP_RST                 0x04
+#define TCP_PSH                 0x08
+#define TCP_ACK                 0x10
+
+// Options
+#define TCP_OPTION_END          0
+#define TCP_OPTION_NOP          1
+#define TCP_OPTION_MSS          2
+#define TCP_OPTION_WINDOW_SCALE 3
+#define TCP_SYN_OPTIONS_LENGTH  8       // MSS, NOP, window scale
+#define TCP_MSS_OPTION_LENGTH   4       // MSS alone
+
+// Sequence space comparisons, correct across wraparound
+#define SEQ_LT(a, b)            ((int32_t)((a) - (b)) < 0)
+#define SEQ_LE(a, b)            ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)            ((int32_t)((a) - (b)) > 0)
+#define SEQ_GE(a, b)            ((int32_t)((a) - (b)) >= 0)
+
+// Connection states (RFC 793)
+typedef enum {
+    TCP_CLOSED,
+    TCP_SYN_SENT,
+    TCP_SYN_RECEIVED,
+    TCP_ESTABLISHED,
+    TCP_FIN_WAIT_1,
+    TCP_FIN_WAIT_2,
+    TCP_CLOSE_WAIT,
+    TCP_CLOSING,
+    TCP_LAST_ACK,
+    TCP_TIME_WAIT
+} tcp_state_t;
+
+// A connection, hung off its socket's transport pointer
+// The socket's tx ring holds everything unacknowledged and unsent, its
+// tail at snd_data; its rx ring holds what arrived in order and unread.
+typedef struct tcp_pcb {
+    socket_t* socket;
+    tcp_state_t state;
+    int listener_id;            // Passive opens: who gets us once established, 0 after
+
+    // Send sequence space
+    uint32_t iss;
+    uint32_t snd_una;           // Oldest unacknowledged
+    uint32_t snd_nxt;           // Next to send, pulled back on timeout
+    uint32_t snd_max;           // Highest ever sent
+    uint32_t snd_data;          // Sequence number of the tx ring's tail
+    uint32_t snd_wnd;           // Peer's window in bytes, already scaled
+    uint32_t snd_wl1;           // Segment that last updated it
+    uint32_t snd_wl2;
+    uint16_t mss;               // Largest segment the peer takes
+    uint8_t snd_wscale;
+    uint8_t rcv_wscale;
+    bool window_scaling;        // Until the peer's SYN shows it didn't offer it
+
+    // Receive sequence space
+    uint32_t irs;
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;           // Right edge of the window last advertised
+
+    // NewReno (RFC 5681, RFC 6582)
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t dupacks;
+    uint32_t recover;           // snd_max when loss recovery began
+    bool in_recovery;
+
+    // Round trip (RFC 6298), srtt scaled by 8 and rttvar by 4
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+    uint32_t rtt_min;
+    uint32_t rtt_samples;
+    bool rtt_timing;            // One segment timed at a time, never a resent one
+    uint32_t rtt_seq;
+    uint64_t rtt_start;
+
+    // Deadlines in system time, 0 when not running
+    uint64_t retransmit_at;
+    uint64_t delayed_ack_at;
+    uint64_t linger_at;         // TIME_WAIT, or FIN_WAIT_2 for an orphan
+    uint32_t retries;           // Timeouts since the last forward progress
+    uint32_t retransmits;
+
+    bool fin_queued;            // Closed: a FIN follows the last queued byte
+    bool ack_now;
+    uint32_t unacked_segments;  // Received since we last acknowledged
+
+    struct tcp_pcb* next;
+} tcp_pcb_t;
+
+// A received segment, parsed
+typedef struct {
+    const ip_header_t* ip;
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t flags;
+    uint16_t window;            // As sent, unscaled
+    uint16_t mss;               // 0 if no option
+    int wscale;                 // -1 if no option
+    const uint8_t* data;
+    uint32_t length;
+} tcp_segment_t;
+
+// Connections, guarded by socket_lock like the sockets they hang off
+static kmem_cache_t* tcp_pcb_cache = NULL;
+static tcp_pcb_t* tcp_pcbs = NULL;
+static int tcp_wakeup = -1;
+static uint64_t tcp_timer_deadline = 0;    // Earliest the wakeup is armed for
+
+static void tcp_output(tcp_pcb_t* pcb);
+
+/*
+ * Smaller of two lengths
+ */
+static inline uint32_t tcp_min(uint32_t a, uint32_t b) {
+    return (a < b) ? a : b;
+}
+
+/*
+ * Make sure the timer wakeup fires by deadline
+ * A later deadline than the armed one is picked up when that fires.
+ */
+static void tcp_arm_timer(uint64_t deadline) {
+    if (!tcp_timer_deadline || deadline < tcp_timer_deadline) {
+        tcp_timer_deadline = deadline;
+        wakeup_at(tcp_wakeup, deadline);
+    }
+}
+
+/*
+ * Start the retransmission timer unless it is already running
+ */
+static void tcp_start_retransmit_timer(tcp_pcb_t* pcb) {
+    if (!pcb->retransmit_at) {
+        pcb->retransmit_at = get_system_time() + pcb->rto;
+        tcp_arm_timer(pcb->retransmit_at);
+    }
+}
+
+/*
+ * Bytes of receive ring free, the window we can offer
+ */
+static uint32_t tcp_receive_window(const tcp_pcb_t* pcb) {
+    return byte_ring_free(&pcb->socket->rx_stream);
+}
+
+/*
+ * Bytes in flight, sent and not yet acknowledged
+ */
+static inline uint32_t tcp_flight_size(const tcp_pcb_t* pcb) {
+    return pcb->snd_max - pcb->snd_una;
+}
+
+/*
+ * Fill in the checksum, or leave it to the card
+ */
+static void tcp_checksum(pbuf_t* p, tcp_header_t* tcp, const ip_address_t* dest_ip) {
+    const ip_address_t* src_ip = &get_network_interface()->ip_address;
+    tcp->checksum = 0;
+    if (network_has_offload(NIC_OFFLOAD_TX_CSUM)) {
+        tcp->checksum = (uint16_t)~checksum_fold(ip_pseudo_header_sum(src_ip, dest_ip, PROTOCOL_TCP,
+                                                                       (uint16_t)p->length));
+        p->flags |= PBUF_CSUM_PARTIAL;
+        p->csum_start = (uint8_t*)tcp;
+        p->csum_offset = offsetof(tcp_header_t, checksum);
+    } else {
+        tcp->checksum = ip_pseudo_checksum(src_ip, dest_ip, PROTOCOL_TCP, p);
+    }
+}
+
+/*
+ * Answer a segment nobody wants with a reset (RFC 793 "Reset Generation")
+ */
+static void tcp_send_reset(const tcp_segment_t* segment) {
+    if (segment->flags & TCP_RST) {
+        return;     // Never reset a reset
+    }
+    pbuf_t* p = pbuf_alloc();
+    if (!p) {
+        return;
+    }
+    tcp_header_t* tcp = (tcp_header_t*)pbuf_push(p, sizeof(tcp_header_t));
+    memset(tcp, 0, sizeof(tcp_header_t));
+    tcp->src_port = htons(segment->dest_port);
+    tcp->dest_port = htons(segment->src_port);
+    tcp->data_offset_reserved = (sizeof(tcp_header_t) / 4) << 4;
+    if (segment->flags & TCP_ACK) {
+        tcp->sequence_number = htonl(segment->ack);
+        tcp->flags = TCP_RST;
+    } else {
+        uint32_t length = segment->length + ((segment->flags & TCP_SYN) ? 1 : 0) +
+                          ((segment->flags & TCP_FIN) ? 1 : 0);
+        tcp->acknowledgment_number = htonl(segment->seq + length);
+        tcp->flags = TCP_RST | TCP_ACK;
+    }
+    tcp_checksum(p, tcp, &segment->ip->src_ip);
+    get_network_stats()->tcp_resets++;
+    ip_output(p, &segment->ip->src_ip, PROTOCOL_TCP);
+}
+
+/*
+ * Build and send one segment: length bytes from the tx ring at seq
+ * Every segment but a SYN carries our latest ACK and window, so sending
+ * anything settles a pending acknowledgment.
+ */
+static void tcp_send_segment(tcp_pcb_t* pcb, uint8_t flags, uint32_t seq, uint32_t length) {
+    socket_t* socket = pcb->socket;
+    pbuf_t* p = pbuf_alloc();
+    if (!p) {
+        // The retransmission timer tries again
+        get_network_stats()->dropped_packets++;
+        tcp_start_retransmit_timer(pcb);
+        return;
+    }
+
+    if (length) {
+        byte_ring_peek(&socket->tx_stream, seq - pcb->snd_data, pbuf_put(p, (uint16_t)length), length);
+    }
+
+    // A SYN-ACK only offers window scale back to a SYN that offered it
+    uint32_t option_length = 0;
+    if (flags & TCP_SYN) {
+        option_length = pcb->window_scaling ? TCP_SYN_OPTIONS_LENGTH : TCP_MSS_OPTION_LENGTH;
+    }
+    tcp_header_t* tcp = (tcp_header_t*)pbuf_push(p, (uint16_t)(sizeof(tcp_header_t) + option_length));
+    if (option_length) {
+        uint8_t* options = (uint8_t*)(tcp + 1);
+        options[0] = TCP_OPTION_MSS;
+        options[1] = 4;
+        options[2] = (uint8_t)(TCP_MSS >> 8);
+        options[3] = (uint8_t)TCP_MSS;
+        if (option_length == TCP_SYN_OPTIONS_LENGTH) {
+            options[4] = TCP_OPTION_NOP;
+            options[5] = TCP_OPTION_WINDOW_SCALE;
+            options[6] = 3;
+            options[7] = pcb->rcv_wscale;
+        }
+    }
+
+    // Windows in a SYN are never scaled
+    uint32_t window = tcp_receive_window(pcb);
+    uint32_t advertised = (flags & TCP_SYN) ? window : (window >> pcb->rcv_wscale);
+    if (advertised > 0xFFFF) {
+        advertised = 0xFFFF;
+    }
+    if (!(flags & TCP_SYN)) {
+        flags |= TCP_ACK;
+    }
+
+    tcp->src_port = htons(socket->local_port);
+    tcp->dest_port = htons(socket->remote_port);
+    tcp->sequence_number = htonl(seq);
+    tcp->acknowledgment_number = (flags & TCP_ACK) ? htonl(pcb->rcv_nxt) : 0;
+    tcp->data_offset_reserved = (uint8_t)(((sizeof(tcp_header_t) + option_length) / 4) << 4);
+    tcp->flags = flags;
+    tcp->window_size = htons((uint16_t)advertised);
+    tcp->urgent_pointer = 0;
+    tcp_checksum(p, tcp, &socket->remote_ip);
+
+    if (flags & TCP_ACK) {
+        pcb->rcv_adv = pcb->rcv_nxt + (advertised << ((flags & TCP_SYN) ? 0 : pcb->rcv_wscale));
+        pcb->ack_now = false;
+        pcb->delayed_ack_at = 0;
+        pcb->unacked_segments = 0;
+    }
+
+    // Time the first new segment out of each flight
+    uint32_t sequence_length = length + ((flags & (TCP_SYN | TCP_FIN)) ? 1 : 0);
+    if (sequence_length) {
+        if (!pcb->rtt_timing && seq == pcb->snd_max) {
+            pcb->rtt_timing = true;
+            pcb->rtt_seq = seq;
+            pcb->rtt_start = get_system_time();
+        }
+        if (SEQ_LT(seq, pcb->snd_max)) {
+            pcb->retransmits++;
+            get_network_stats()->tcp_retransmits++;
+        }
+        tcp_start_retransmit_timer(pcb);
+    }
+
+    get_network_stats()->tcp_packets++;
+    ip_output(p, &socket->remote_ip, PROTOCOL_TCP);
+}
+
+/*
+ * Send our SYN, or SYN-ACK for a passive open
+ */
+static void tcp_send_syn(tcp_pcb_t* pcb) {
+    uint8_t flags = TCP_SYN | ((pcb->state == TCP_SYN_RECEIVED) ? TCP_ACK : 0);
+    tcp_send_segment(pcb, flags, pcb->iss, 0);
+    pcb->snd_nxt = pcb->iss + 1;
+    if (SEQ_GT(pcb->snd_nxt, pcb->snd_max)) {
+        pcb->snd_max = pcb->snd_nxt;
+    }
+}
+
+/*
+ * Whether the state lets us send data and FIN
+ */
+static bool tcp_can_send(const tcp_pcb_t* pcb) {
+    switch (pcb->state) {
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+        case TCP_FIN_WAIT_1:
+        case TCP_CLOSING:
+        case TCP_LAST_ACK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Send whatever the windows allow, then any ACK still owed
+ * The usable window is the smaller of the peer's and the congestion
+ * window, less what is already in flight; data goes out in full sized
+ * segments while there is that much of it.
+ */
+static void tcp_output(tcp_pcb_t* pcb) {
+    socket_t* socket = pcb->socket;
+
+    if (tcp_can_send(pcb)) {
+        for (;;) {
+            uint32_t queued = byte_ring_used(&socket->tx_stream);
+            uint32_t offset = pcb->snd_nxt - pcb->snd_data;
+            uint32_t unsent = (offset < queued) ? queued - offset : 0;
+            uint32_t window = tcp_min(pcb->snd_wnd, pcb->cwnd);
+            uint32_t in_flight = pcb->snd_nxt - pcb->snd_una;
+            uint32_t usable = (window > in_flight) ? window - in_flight : 0;
+            uint32_t length = tcp_min(tcp_min(unsent, usable), pcb->mss);
+
+            // The FIN rides on the last byte, or alone once everything went
+            bool fin = pcb->fin_queued && offset <= queued && offset + length == queued;
+            if (!length && !fin) {
+                // Peer's window shut with data waiting: the timer probes it
+                if (unsent && !pcb->snd_wnd && !in_flight) {
+                    tcp_start_retransmit_timer(pcb);
+                }
+                break;
+            }
+
+            uint8_t flags = TCP_ACK;
+            if (fin) {
+                flags |= TCP_FIN;
+            }
+            if (length && offset + length == queued) {
+                flags |= TCP_PSH;
+            }
+            tcp_send_segment(pcb, flags, pcb->snd_nxt, length);
+            pcb->snd_nxt += length + (fin ? 1 : 0);
+            if (SEQ_GT(pcb->snd_nxt, pcb->snd_max)) {
+                pcb->snd_max = pcb->snd_nxt;
+            }
+            if (fin) {
+                break;
+            }
+        }
+    }
+
+    if (pcb->ack_now && pcb->state != TCP_SYN_SENT && pcb->state != TCP_CLOSED) {
+        tcp_send_segment(pcb, TCP_ACK, pcb->snd_nxt, 0);
+    }
+}
+
+/*
+ * Resend the oldest unacknowledged segment
+ */
+static void tcp_retransmit(tcp_pcb_t* pcb) {
+    if (pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RECEIVED) {
+        tcp_send_syn(pcb);
+        return;
+    }
+
+    socket_t* socket = pcb->socket;
+    uint32_t queued = byte_ring_used(&socket->tx_stream);
+    uint32_t offset = pcb->snd_una - pcb->snd_data;
+    uint32_t length = (offset < queued) ? tcp_min(queued - offset, pcb->mss) : 0;
+    bool fin = pcb->fin_queued && offset + length == queued && SEQ_LT(pcb->snd_una, pcb->snd_max);
+
+    if (length || fin) {
+        tcp_send_segment(pcb, TCP_ACK | (fin ? TCP_FIN : 0), pcb->snd_una, length);
+    }
+}
+
+/*
+ * Fold a round trip sample into the estimators (RFC 6298)
+ */
+static void tcp_rtt_sample(tcp_pcb_t* pcb, uint32_t sample) {
+    network_stats_t* stats = get_network_stats();
+
+    if (!pcb->rtt_samples) {
+        pcb->srtt = sample << 3;
+        pcb->rttvar = sample << 1;
+    } else {
+        // srtt += (sample - srtt) / 8, rttvar += (|delta| - rttvar) / 4
+        int32_t delta = (int32_t)sample - (int32_t)(pcb->srtt >> 3);
+        pcb->srtt = (uint32_t)((int32_t)pcb->srtt + delta);
+        if (delta < 0) {
+            delta = -delta;
+        }
+        pcb->rttvar = (uint32_t)((int32_t)pcb->rttvar + delta - (int32_t)(pcb->rttvar >> 2));
+    }
+
+    // The 1 ms clock granularity stands in for G
+    uint32_t rto = (pcb->srtt >> 3) + (pcb->rttvar ? pcb->rttvar : 1);
+    pcb->rto = (rto < TCP_RTO_MIN_MS) ? TCP_RTO_MIN_MS : (rto > TCP_RTO_MAX_MS) ? TCP_RTO_MAX_MS : rto;
+
+    if (!pcb->rtt_samples || sample < pcb->rtt_min) {
+        pcb->rtt_min = sample;
+    }
+    pcb->rtt_samples++;
+
+    stats->tcp_rtt_samples++;
+    stats->tcp_srtt_ms = pcb->srtt >> 3;
+    if (stats->tcp_rtt_samples == 1 || sample < stats->tcp_rtt_min_ms) {
+        stats->tcp_rtt_min_ms = sample;
+    }
+    if (sample > stats->tcp_rtt_max_ms) {
+        stats->tcp_rtt_max_ms = sample;
+    }
+}
+
+/*
+ * Take the peer's MSS and window scale options from its SYN
+ * Scaling is only on if both sides offered it (RFC 7323).
+ */
+static void tcp_apply_syn_options(tcp_pcb_t* pcb, const tcp_segment_t* segment) {
+    uint16_t mss = segment->mss ? segment->mss : TCP_DEFAULT_MSS;
+    pcb->mss = (mss < TCP_MSS) ? mss : (uint16_t)TCP_MSS;
+    if (segment->wscale >= 0) {
+        pcb->snd_wscale = (uint8_t)((segment->wscale > 14) ? 14 : segment->wscale);
+    } else {
+        pcb->snd_wscale = 0;
+        pcb->rcv_wscale = 0;
+        pcb->window_scaling = false;
+    }
+    pcb->snd_wnd = segment->window;
+    pcb->snd_wl1 = segment->seq;
+    pcb->snd_wl2 = segment->ack;
+    pcb->irs = segment->seq;
+    pcb->rcv_nxt = segment->seq + 1;
+
+    // Initial window: the MSS is only known now
+    pcb->cwnd = TCP_INITIAL_WINDOW * pcb->mss;
+}
+
+/*
+ * Allocate a connection for a socket
+ */
+static tcp_pcb_t* tcp_pcb_create(socket_t* socket, tcp_state_t state) {
+    tcp_pcb_t* pcb = kmem_cache_alloc(tcp_pcb_cache);
+    if (!pcb) {
+        return NULL;
+    }
+    memset(pcb, 0, sizeof(tcp_pcb_t));
+    pcb->socket = socket;
+    pcb->state = state;
+    pcb->iss = (uint32_t)(rdtsc() >> 4);
+    pcb->snd_una = pcb->iss;
+    pcb->snd_nxt = pcb->iss;
+    pcb->snd_max = pcb->iss;
+    pcb->snd_data = pcb->iss + 1;
+    pcb->recover = pcb->iss;     // Else upper-half sequences never fast retransmit (RFC 6582)
+    pcb->mss = TCP_DEFAULT_MSS;
+    pcb->rcv_wscale = TCP_WINDOW_SCALE;
+    pcb->window_scaling = true;
+    pcb->cwnd = TCP_INITIAL_WINDOW * TCP_DEFAULT_MSS;
+    pcb->ssthresh = 0xFFFFFFFF;
+    pcb->rto = TCP_RTO_INITIAL_MS;
+
+    socket->transport = pcb;
+    pcb->next = tcp_pcbs;
+    tcp_pcbs = pcb;
+    return pcb;
+}
+
+/*
+ * The connection reached ESTABLISHED
+ */
+static void tcp_established(tcp_pcb_t* pcb) {
+    pcb->state = TCP_ESTABLISHED;
+    pcb->socket->state = SOCKET_STATE_CONNECTED;
+    pcb->socket->is_connected = true;
+    get_network_stats()->tcp_connections++;
+}
+
+/*
+ * The connection is over; an orphaned socket goes with it
+ * Returns false if the socket and the connection were freed.
+ */
+static bool tcp_finish(tcp_pcb_t* pcb) {
+    socket_t* socket = pcb->socket;
+    pcb->state = TCP_CLOSED;
+    pcb->retransmit_at = 0;
+    pcb->delayed_ack_at = 0;
+    pcb->linger_at = 0;
+    socket->state = SOCKET_STATE_CLOSED;
+    socket->is_connected = false;
+    socket->peer_closed = true;
+    if (socket->orphaned) {
+        socket_release(socket);
+        return false;
+    }
+    socket_notify(socket);
+    return true;
+}
+
+/*
+ * Tear the connection down after a reset or too many timeouts
+ */
+static bool tcp_abort(tcp_pcb_t* pcb, bool send_reset) {
+    if (send_reset && pcb->state != TCP_SYN_SENT) {
+        tcp_send_segment(pcb, TCP_RST | TCP_ACK, pcb->snd_nxt, 0);
+    }
+    return tcp_finish(pcb);
+}
+
+/*
+ * Enter TIME_WAIT, holding the port long enough to soak up stray segments
+ */
+static void tcp_enter_time_wait(tcp_pcb_t* pcb) {
+    pcb->state = TCP_TIME_WAIT;
+    pcb->retransmit_at = 0;
+    pcb->linger_at = get_system_time() + TCP_TIME_WAIT_MS;
+    tcp_arm_timer(pcb->linger_at);
+}
+
+/*
+ * Congestion response to a lost segment (RFC 5681 equation 4)
+ */
+static void tcp_halve_ssthresh(tcp_pcb_t* pcb) {
+    uint32_t half = tcp_flight_size(pcb) / 2;
+    pcb->ssthresh = (half > 2U * pcb->mss) ? half : 2U * pcb->mss;
+}
+
+/*
+ * Process the acknowledgment field of a segment
+ * Returns false if it completed the close and the connection is gone.
+ */
+static bool tcp_process_ack(tcp_pcb_t* pcb, const tcp_segment_t* segment) {
+    socket_t* socket = pcb->socket;
+    uint32_t ack = segment->ack;
+
+    if (SEQ_GT(ack, pcb->snd_max)) {
+        pcb->ack_now = true;    // Acknowledges what we never sent
+        return true;
+    }
+
+    // Window update, from segments no older than the last one used
+    bool window_changed = false;
+    if (SEQ_LT(pcb->snd_wl1, segment->seq) ||
+        (pcb->snd_wl1 == segment->seq && SEQ_LE(pcb->snd_wl2, ack))) {
+        uint32_t window = (uint32_t)segment->window << pcb->snd_wscale;
+        window_changed = (window != pcb->snd_wnd);
+        pcb->snd_wnd = window;
+        pcb->snd_wl1 = segment->seq;
+        pcb->snd_wl2 = ack;
+    }
+
+    if (SEQ_LE(ack, pcb->snd_una)) {
+        // A duplicate counts only if it carries nothing else (RFC 5681)
+        if (ack != pcb->snd_una || segment->length || (segment->flags & (TCP_SYN | TCP_FIN)) ||
+            window_changed || !tcp_flight_size(pcb)) {
+            return true;
+        }
+        pcb->dupacks++;
+        if (pcb->in_recovery) {
+            // Each duplicate is a segment that left the network
+            pcb->cwnd += pcb->mss;
+        } else if (pcb->dupacks == TCP_DUPACK_THRESHOLD && SEQ_GT(ack, pcb->recover)) {
+            // Fast retransmit, then fast recovery (RFC 6582)
+            tcp_halve_ssthresh(pcb);
+            pcb->recover = pcb->snd_max;
+            pcb->in_recovery = true;
+            pcb->rtt_timing = false;
+            get_network_stats()->tcp_fast_retransmits++;
+            tcp_retransmit(pcb);
+            pcb->cwnd = pcb->ssthresh + TCP_DUPACK_THRESHOLD * pcb->mss;
+        }
+        return true;
+    }
+
+    // New data acknowledged
+    uint32_t acked = ack - pcb->snd_una;
+    if (pcb->rtt_timing && SEQ_GT(ack, pcb->rtt_seq)) {
+        pcb->rtt_timing = false;
+        tcp_rtt_sample(pcb, (uint32_t)(get_system_time() - pcb->rtt_start));
+    }
+
+    // Acknowledged bytes leave the tx ring; sends may be waiting for room
+    uint32_t data_end = pcb->snd_data + byte_ring_used(&socket->tx_stream);
+    uint32_t acked_to = SEQ_LT(ack, data_end) ? ack : data_end;
+    if (SEQ_GT(acked_to, pcb->snd_data)) {
+        byte_ring_consume(&socket->tx_stream, acked_to - pcb->snd_data);
+        pcb->snd_data = acked_to;
+    }
+    pcb->snd_una = ack;
+    if (SEQ_LT(pcb->snd_nxt, ack)) {
+        pcb->snd_nxt = ack;
+    }
+
+    if (pcb->in_recovery) {
+        if (SEQ_GE(ack, pcb->recover)) {
+            // Full acknowledgment: deflate and leave recovery
+            uint32_t flight = tcp_flight_size(pcb) + pcb->mss;
+            pcb->cwnd = tcp_min(pcb->ssthresh, flight);
+            pcb->in_recovery = false;
+            pcb->dupacks = 0;
+        } else {
+            // Partial acknowledgment: the next hole is lost too
+            tcp_retransmit(pcb);
+            pcb->cwnd = (pcb->cwnd > acked) ? pcb->cwnd - acked : 0;
+            pcb->cwnd += pcb->mss;
+        }
+    } else {
+        pcb->dupacks = 0;
+        if (pcb->cwnd < pcb->ssthresh) {
+            pcb->cwnd += tcp_min(acked, pcb->mss);
+        } else {
+            uint32_t increase = (uint32_t)pcb->mss * pcb->mss / pcb->cwnd;
+            pcb->cwnd += increase ? increase : 1;
+        }
+    }
+
+    // Progress: forget the backoff and time what is still out there
+    pcb->retries = 0;
+    pcb->retransmit_at = 0;
+    if (tcp_flight_size(pcb)) {
+        tcp_start_retransmit_timer(pcb);
+    }
+
+    // Has our FIN gone through?
+    bool fin_acked = pcb->fin_queued && !byte_ring_used(&socket->tx_stream) &&
+                     pcb->snd_una == pcb->snd_data + 1;
+    if (fin_acked) {
+        switch (pcb->state) {
+            case TCP_FIN_WAIT_1:
+                pcb->state = TCP_FIN_WAIT_2;
+                if (socket->orphaned) {
+                    pcb->linger_at = get_system_time() + TCP_FIN_WAIT_MS;
+                    tcp_arm_timer(pcb->linger_at);
+                }
+                break;
+            case TCP_CLOSING:
+                tcp_enter_time_wait(pcb);
+                break;
+            case TCP_LAST_ACK:
+                return tcp_finish(pcb);
+            default:
+                break;
+        }
+    }
+
+    socket_notify(socket);
+    return true;
+}
+
+/*
+ * Take in a segment's data and FIN
+ * Only in-order data is kept: anything past a hole is dropped and
+ * answered with a duplicate ACK right away, which is what drives the
+ * sender's fast retransmit.
+ */
+static void tcp_process_data(tcp_pcb_t* pcb, tcp_segment_t* segment) {
+    socket_t* socket = pcb->socket;
+
+    // Trim anything we already have off the front. A resent segment
+    // usually means our ACK was lost, so it is answered right away.
+    if (SEQ_LT(segment->seq, pcb->rcv_nxt)) {
+        uint32_t duplicate = pcb->rcv_nxt - segment->seq;
+        pcb->ack_now = true;
+        if (duplicate > segment->length) {
+            // Entirely old; a retransmitted FIN is acknowledged again
+            return;
+        }
+        segment->data += duplicate;
+        segment->length -= duplicate;
+        segment->seq = pcb->rcv_nxt;
+    }
+
+    bool receiving = (pcb->state == TCP_ESTABLISHED || pcb->state == TCP_FIN_WAIT_1 ||
+                      pcb->state == TCP_FIN_WAIT_2);
+    if (segment->seq != pcb->rcv_nxt) {
+        if (segment->length || (segment->flags & TCP_FIN)) {
+            pcb->ack_now = true;
+        }
+        return;
+    }
+
+    bool complete = true;
+    if (segment->length && receiving) {
+        uint32_t written = byte_ring_write(&socket->rx_stream, segment->data, segment->length);
+        pcb->rcv_nxt += written;
+        complete = (written == segment->length);
+
+        // Every second segment is acknowledged at once (RFC 1122)
+        pcb->unacked_segments++;
+        if (!complete || pcb->unacked_segments >= 2) {
+            pcb->ack_now = true;
+        } else if (!pcb->delayed_ack_at) {
+            pcb->delayed_ack_at = get_system_time() + TCP_DELAYED_ACK_MS;
+            tcp_arm_timer(pcb->delayed_ack_at);
+        }
+        if (written) {
+            socket_notify(socket);
+        }
+    }
+
+    if (!(segment->flags & TCP_FIN) || !complete) {
+        return;
+    }
+
+    // The peer is done sending
+    pcb->rcv_nxt++;
+    pcb->ack_now = true;
+    socket->peer_closed = true;
+    switch (pcb->state) {
+        case TCP_ESTABLISHED:
+            pcb->state = TCP_CLOSE_WAIT;
+            break;
+        case TCP_FIN_WAIT_1:
+            // Our FIN still out, or both crossed and ours was just acked
+            if (pcb->snd_una == pcb->snd_max) {
+                tcp_enter_time_wait(pcb);
+            } else {
+                pcb->state = TCP_CLOSING;
+            }
+            break;
+        case TCP_FIN_WAIT_2:
+            tcp_enter_time_wait(pcb);
+            break;
+        default:
+            break;
+    }
+    socket_notify(socket);
+}
+
+/*
+ * Segment for a socket in SYN_SENT, our active open
+ */
+static void tcp_syn_sent_input(tcp_pcb_t* pcb, const tcp_segment_t* segment) {
+    bool has_ack = (segment->flags & TCP_ACK) != 0;
+    if (has_ack && (SEQ_LE(segment->ack, pcb->iss) || SEQ_GT(segment->ack, pcb->snd_max))) {
+        tcp_send_reset(segment);
+        return;
+    }
+    if (segment->flags & TCP_RST) {
+        if (has_ack) {
+            tcp_finish(pcb);    // Refused
+        }
+        return;
+    }
+    if (!(segment->flags & TCP_SYN) || !has_ack) {
+        return;     // Simultaneous open isn't supported
+    }
+
+    tcp_apply_syn_options(pcb, segment);
+    pcb->snd_una = segment->ack;
+    if (pcb->rtt_timing) {
+        pcb->rtt_timing = false;
+        tcp_rtt_sample(pcb, (uint32_t)(get_system_time() - pcb->rtt_start));
+    }
+    pcb->retries = 0;
+    pcb->retransmit_at = 0;
+    tcp_established(pcb);
+    pcb->ack_now = true;
+    tcp_output(pcb);
+    socket_notify(pcb->socket);
+}
+
+/*
+ * A passive open stops counting against its listener's backlog
+ * Returns the listener, if it is still there.
+ */
+static socket_t* tcp_leave_listener(tcp_pcb_t* pcb) {
+    socket_t* listener = socket_get(pcb->listener_id);
+    if (listener && listener->half_open) {
+        listener->half_open--;
+    }
+    pcb->listener_id = 0;
+    return listener;
+}
+
+/*
+ * Segment for a listening socket: a SYN opens a child connection
+ * The child answers with SYN-ACK and joins the accept queue once the
+ * handshake completes. Children still handshaking count against the
+ * backlog along with queued ones, and a SYN the backlog has no room for
+ * is dropped; the peer simply tries again.
+ */
+static void tcp_listen_input(socket_t* listener, const tcp_segment_t* segment) {
+    if (segment->flags & TCP_RST) {
+        return;
+    }
+    if (segment->flags & TCP_ACK) {
+        tcp_send_reset(segment);
+        return;
+    }
+    if (!(segment->flags & TCP_SYN) ||
+        listener->accept_head - listener->accept_tail + listener->half_open >= listener->backlog) {
+        return;
+    }
+
+    socket_t* child = socket_alloc(SOCKET_TYPE_TCP);
+    if (!child) {
+        get_network_stats()->dropped_packets++;
+        return;
+    }
+    child->local_ip = segment->ip->dest_ip;
+    child->remote_ip = segment->ip->src_ip;
+    child->remote_port = segment->src_port;
+    child->state = SOCKET_STATE_CONNECTING;
+    child->orphaned = true;     // Nobody owns it until it is queued
+    tcp_pcb_t* pcb = socket_bind_port(child, listener->local_port) ?
+                     tcp_pcb_create(child, TCP_SYN_RECEIVED) : NULL;
+    if (!pcb) {
+        socket_release(child);
+        return;
+    }
+    pcb->listener_id = listener->socket_id;
+    listener->half_open++;
+    tcp_apply_syn_options(pcb, segment);
+    tcp_send_syn(pcb);
+}
+
+/*
+ * Segment for a synchronized connection (RFC 793 "SEGMENT ARRIVES")
+ */
+static void tcp_connection_input(tcp_pcb_t* pcb, tcp_segment_t* segment) {
+    socket_t* socket = pcb->socket;
+
+    // A reset counts only if it starts inside the receive window
+    uint32_t window = tcp_receive_window(pcb);
+    bool in_window = window ? (segment->seq - pcb->rcv_nxt < window) : (segment->seq == pcb->rcv_nxt);
+    if (segment->flags & TCP_RST) {
+        if (in_window) {
+            tcp_finish(pcb);
+        }
+        return;
+    }
+
+    // Anything else starting in the window or before it is looked at,
+    // old bytes being trimmed off; the rest just gets our ACK
+    if (!in_window && !SEQ_LT(segment->seq, pcb->rcv_nxt)) {
+        pcb->ack_now = true;
+        tcp_output(pcb);
+        return;
+    }
+
+    if (segment->flags & TCP_SYN) {
+        // A retransmitted SYN lost our SYN-ACK; anything else gets restated
+        if (pcb->state == TCP_SYN_RECEIVED) {
+            tcp_send_syn(pcb);
+        } else {
+            pcb->ack_now = true;
+            tcp_output(pcb);
+        }
+        return;
+    }
+    if (!(segment->flags & TCP_ACK)) {
+        return;
+    }
+
+    if (pcb->state == TCP_SYN_RECEIVED) {
+        if (SEQ_LE(segment->ack, pcb->snd_una) || SEQ_GT(segment->ack, pcb->snd_max)) {
+            tcp_send_reset(segment);
+            return;
+        }
+        socket_t* listener = tcp_leave_listener(pcb);
+        if (!listener || !listener->is_listening || !socket_queue_connection(listener, socket)) {
+            tcp_abort(pcb, true);
+            return;
+        }
+        socket->orphaned = false;    // The accept queue has it now
+        tcp_established(pcb);
+    }
+
+    if (!tcp_process_ack(pcb, segment)) {
+        return;
+    }
+    if (pcb->state != TCP_TIME_WAIT) {
+        tcp_process_data(pcb, segment);
+    } else if (segment->flags & TCP_FIN) {
+        // Our last ACK was lost; answer and start the wait over
+        pcb->ack_now = true;
+        tcp_enter_time_wait(pcb);
+    }
+    tcp_output(pcb);
+}
+
+/*
+ * Read the options of a SYN
+ */
+static void tcp_parse_options(tcp_segment_t* segment, const uint8_t* options, uint32_t length) {
+    uint32_t i = 0;
+    while (i < length) {
+        uint8_t kind = options[i];
+        if (kind == TCP_OPTION_END) {
+            break;
+        }
+        if (kind == TCP_OPTION_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= length || options[i + 1] < 2 || i + options[i + 1] > length) {
+            break;
+        }
+        uint8_t option_length = options[i + 1];
+        if (kind == TCP_OPTION_MSS && option_length == 4) {
+            segment->mss = (uint16_t)((options[i + 2] << 8) | options[i + 3]);
+        } else if (kind == TCP_OPTION_WINDOW_SCALE && option_length == 3) {
+            segment->wscale = options[i + 2];
+        }
+        i += option_length;
+    }
+}
+
+/*
+ * Handle a received segment, the TCP header at the front of the buffer
+ */
+void tcp_input(pbuf_t* p, const ip_header_t* ip) {
+    network_stats_t* stats = get_network_stats();
+    const tcp_header_t* tcp = (const tcp_header_t*)p->data;
+
+    if (p->length < sizeof(tcp_header_t)) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+    uint32_t header_length = (uint32_t)(tcp->data_offset_reserved >> 4) * 4;
+    if (header_length < sizeof(tcp_header_t) || header_length > p->length ||
+        (!(p->flags & PBUF_CSUM_VERIFIED) &&
+         ip_pseudo_checksum(&ip->src_ip, &ip->dest_ip, PROTOCOL_TCP, p) != 0)) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+
+    tcp_segment_t segment;
+    segment.ip = ip;
+    segment.src_port = ntohs(tcp->src_port);
+    segment.dest_port = ntohs(tcp->dest_port);
+    segment.seq = ntohl(tcp->sequence_number);
+    segment.ack = ntohl(tcp->acknowledgment_number);
+    segment.flags = tcp->flags;
+    segment.window = ntohs(tcp->window_size);
+    segment.mss = 0;
+    segment.wscale = -1;
+    if (segment.flags & TCP_SYN) {
+        tcp_parse_options(&segment, (const uint8_t*)(tcp + 1), header_length - sizeof(tcp_header_t));
+    }
+    pbuf_pull(p, (uint16_t)header_length);
+    segment.data = p->data;
+    segment.length = p->length;
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_lookup(SOCKET_TYPE_TCP, segment.dest_port, &ip->src_ip, segment.src_port);
+    if (socket && socket->is_listening) {
+        tcp_listen_input(socket, &segment);
+    } else if (socket && socket->transport) {
+        tcp_pcb_t* pcb = (tcp_pcb_t*)socket->transport;
+        if (pcb->state == TCP_SYN_SENT) {
+            tcp_syn_sent_input(pcb, &segment);
+        } else if (pcb->state != TCP_CLOSED) {
+            tcp_connection_input(pcb, &segment);
+        } else {
+            tcp_send_reset(&segment);
+        }
+    } else {
+        tcp_send_reset(&segment);
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+
+    pbuf_free(p);
+}
+
+/*
+ * A timed-out retransmission: back off and go back to snd_una
+ * With the peer's window shut and nothing in flight this is the persist
+ * timer instead, and an ACK from below the window makes the peer restate it.
+ * Probes don't count towards giving up: a peer answering them with a
+ * closed window is alive, however long it keeps it closed (RFC 1122
+ * 4.2.2.17).
+ * Returns false if the connection gave up and is gone.
+ */
+static bool tcp_retransmit_timeout(tcp_pcb_t* pcb) {
+    pcb->retransmit_at = 0;
+    pcb->rto = (pcb->rto * 2 > TCP_RTO_MAX_MS) ? TCP_RTO_MAX_MS : pcb->rto * 2;
+
+    if (!tcp_flight_size(pcb)) {
+        if (pcb->snd_wnd == 0 && tcp_can_send(pcb)) {
+            tcp_send_segment(pcb, TCP_ACK, pcb->snd_una - 1, 0);
+            tcp_start_retransmit_timer(pcb);
+        }
+        return true;
+    }
+
+    if (++pcb->retries > TCP_MAX_RETRIES) {
+        return tcp_abort(pcb, true);
+    }
+
+    get_network_stats()->tcp_timeouts++;
+    tcp_halve_ssthresh(pcb);
+    pcb->cwnd = pcb->mss;
+    pcb->in_recovery = false;
+    pcb->recover = pcb->snd_max;
+    pcb->dupacks = 0;
+    pcb->rtt_timing = false;    // Karn: resent segments aren't timed
+
+    if (pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RECEIVED) {
+        tcp_send_syn(pcb);
+    } else {
+        pcb->snd_nxt = pcb->snd_una;
+        tcp_output(pcb);
+    }
+    return true;
+}
+
+/*
+ * Run a connection's expired timers
+ */
+static void tcp_run_timers(tcp_pcb_t* pcb, uint64_t now) {
+    if (pcb->linger_at && now >= pcb->linger_at) {
+        tcp_finish(pcb);
+        return;
+    }
+    if (pcb->retransmit_at && now >= pcb->retransmit_at && !tcp_retransmit_timeout(pcb)) {
+        return;
+    }
+    if (pcb->delayed_ack_at && now >= pcb->delayed_ack_at) {
+        pcb->delayed_ack_at = 0;
+        pcb->ack_now = true;
+        tcp_output(pcb);
+    }
+}
+
+/*
+ * Timer wakeup: run what expired and re-arm for the earliest deadline left
+ */
+static void tcp_timer_handler(void) {
+    uint64_t now = get_system_time();
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    tcp_timer_deadline = 0;
+    tcp_pcb_t* pcb = tcp_pcbs;
+    while (pcb) {
+        tcp_pcb_t* next = pcb->next;   // The connection may be freed
+        tcp_run_timers(pcb, now);
+        pcb = next;
+    }
+
+    uint64_t deadline = 0;
+    for (pcb = tcp_pcbs; pcb; pcb = pcb->next) {
+        uint64_t timers[3] = {pcb->retransmit_at, pcb->delayed_ack_at, pcb->linger_at};
+        for (int i = 0; i < 3; i++) {
+            if (timers[i] && (!deadline || timers[i] < deadline)) {
+                deadline = timers[i];
+            }
+        }
+    }
+    tcp_timer_deadline = deadline;
+    wakeup_at(tcp_wakeup, deadline);
+    spin_unlock_irqrestore(&socket_lock, flags);
+}
+
+/*
+ * Set up the connection cache and the timer wakeup
+ */
+int tcp_init(void) {
+    tcp_pcb_cache = kmem_cache_create("tcp_pcb_t", sizeof(tcp_pcb_t), 0);
+    if (!tcp_pcb_cache) {
+        return HELL_ERROR_MEMORY;
+    }
+    tcp_pcbs = NULL;
+    tcp_timer_deadline = 0;
+    tcp_wakeup = wakeup_register("tcp", tcp_timer_handler);
+    return (tcp_wakeup >= 0) ? HELL_SUCCESS : HELL_ERROR_GENERAL;
+}
+
+/*
+ * Start an active open, sending the SYN
+ * Called with socket_lock held, the socket bound and its remote set.
+ */
+int tcp_connect(socket_t* socket) {
+    if (socket->transport || !tcp_pcb_cache) {
+        return HELL_ERROR_GENERAL;
+    }
+    tcp_pcb_t* pcb = tcp_pcb_create(socket, TCP_SYN_SENT);
+    if (!pcb) {
+        return HELL_ERROR_MEMORY;
+    }
+    socket->state = SOCKET_STATE_CONNECTING;
+    tcp_send_syn(pcb);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Push out data newly queued on the tx ring
+ */
+void tcp_send_queued(socket_t* socket) {
+    if (socket->transport) {
+        tcp_output((tcp_pcb_t*)socket->transport);
+    }
+}
+
+/*
+ * The reader drained the rx ring: tell the peer once the window has grown
+ * Updates wait for two segments' worth or half the ring, so a slow reader
+ * doesn't provoke a stream of tiny ones.
+ */
+void tcp_receive_window_opened(socket_t* socket) {
+    tcp_pcb_t* pcb = (tcp_pcb_t*)socket->transport;
+    if (!pcb || !tcp_can_send(pcb)) {
+        return;
+    }
+    uint32_t right_edge = pcb->rcv_nxt + tcp_receive_window(pcb);
+    uint32_t threshold = tcp_min(2U * pcb->mss, socket->rx_stream.size / 2);
+    if (SEQ_GE(right_edge, pcb->rcv_adv + threshold)) {
+        pcb->ack_now = true;
+        tcp_output(pcb);
+    }
+}
+
+/*
+ * The owner closed the socket: send a FIN after the queued data
+ * Returns true if the connection lives on to finish the close, the
+ * socket then being the connection's to release.
+ */
+bool tcp_close(socket_t* socket) {
+    tcp_pcb_t* pcb = (tcp_pcb_t*)socket->transport;
+    if (!pcb) {
+        return false;
+    }
+
+    switch (pcb->state) {
+        case TCP_ESTABLISHED:
+            pcb->state = TCP_FIN_WAIT_1;
+            break;
+        case TCP_CLOSE_WAIT:
+            pcb->state = TCP_LAST_ACK;
+            break;
+        case TCP_FIN_WAIT_1:
+        case TCP_FIN_WAIT_2:
+        case TCP_CLOSING:
+        case TCP_LAST_ACK:
+        case TCP_TIME_WAIT:
+            return true;
+        default:
+            return false;
+    }
+    pcb->fin_queued = true;
+    socket->state = SOCKET_STATE_CLOSING;
+    socket->is_connected = false;
+    tcp_output(pcb);
+    return true;
+}
+
+/*
+ * Free a socket's connection, the socket itself being released
+ */
+void tcp_detach(socket_t* socket) {
+    tcp_pcb_t* pcb = (tcp_pcb_t*)socket->transport;
+    if (!pcb) {
+        return;
+    }
+    if (pcb->listener_id) {
+        tcp_leave_listener(pcb);    // Aborted before the handshake completed
+    }
+    tcp_pcb_t** link = &tcp_pcbs;
+    while (*link && *link != pcb) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = pcb->next;
+    }
+    socket->transport = NULL;
+    kmem_cache_free(tcp_pcb_cache, pcb);
+}
+
+/*
+ * Report a TCP socket's connection state and round trip estimates
+ */
+int socket_get_tcp_info(int socket_id, tcp_info_t* info) {
+    if (!info) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&socket_lock);
+    socket_t* socket = socket_get(socket_id);
+    tcp_pcb_t* pcb = socket ? (tcp_pcb_t*)socket->transport : NULL;
+    if (pcb) {
+        info->state = (uint32_t)pcb->state;
+        info->srtt_ms = pcb->srtt >> 3;
+        info->rttvar_ms = pcb->rttvar >> 2;
+        info->rto_ms = pcb->rto;
+        info->rtt_min_ms = pcb->rtt_min;
+        info->rtt_samples = pcb->rtt_samples;
+        info->mss = pcb->mss;
+        info->cwnd = pcb->cwnd;
+        info->ssthresh = pcb->ssthresh;
+        info->send_window = pcb->snd_wnd;
+        info->receive_window = tcp_receive_window(pcb);
+        info->retransmits = pcb->retransmits;
+    }
+    spin_unlock_irqrestore(&socket_lock, flags);
+    return pcb ? 0 : -1;
+}
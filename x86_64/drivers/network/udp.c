@@ -0,0 +1,78 @@
+/*
+ * HellOS UDP
+ * Datagrams flung into the void, no promise any of them land
+ */
+
+#include "../../kernel/kernel.h"
+#include "protocols.h"
+#include "nic.h"
+#include <stdint.h>
+
+/*
+ * Handle a received datagram, the UDP header at the front of the buffer
+ */
+void udp_input(pbuf_t* p, const ip_header_t* ip) {
+    network_stats_t* stats = get_network_stats();
+    const udp_header_t* udp = (const udp_header_t*)p->data;
+
+    if (p->length < sizeof(udp_header_t)) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+    uint16_t length = ntohs(udp->length);
+    if (length < sizeof(udp_header_t) || length > p->length) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+    p->length = length;
+
+    // A zero checksum means the sender didn't compute one
+    if (udp->checksum && !(p->flags & PBUF_CSUM_VERIFIED) &&
+        ip_pseudo_checksum(&ip->src_ip, &ip->dest_ip, PROTOCOL_UDP, p) != 0) {
+        stats->malformed_packets++;
+        pbuf_free(p);
+        return;
+    }
+
+    uint16_t src_port = ntohs(udp->src_port);
+    uint16_t dest_port = ntohs(udp->dest_port);
+    pbuf_pull(p, sizeof(udp_header_t));
+    if (!socket_deliver_udp(dest_port, p, &ip->src_ip, src_port)) {
+        stats->dropped_packets++;
+        pbuf_free(p);
+    }
+}
+
+/*
+ * Send a datagram, prepending the UDP header in place
+ */
+int udp_output(pbuf_t* p, uint16_t src_port, const ip_address_t* dest_ip, uint16_t dest_port) {
+    uint32_t length = pbuf_chain_length(p) + sizeof(udp_header_t);
+    udp_header_t* udp = (udp_header_t*)pbuf_push(p, sizeof(udp_header_t));
+    if (!udp || length > MAX_PACKET_SIZE) {
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
+    }
+
+    udp->src_port = htons(src_port);
+    udp->dest_port = htons(dest_port);
+    udp->length = htons((uint16_t)length);
+    udp->checksum = 0;
+
+    const ip_address_t* src_ip = &get_network_interface()->ip_address;
+    if (network_has_offload(NIC_OFFLOAD_TX_CSUM)) {
+        // The card sums the payload on top of the pseudo header seed
+        udp->checksum = (uint16_t)~checksum_fold(ip_pseudo_header_sum(src_ip, dest_ip, PROTOCOL_UDP,
+                                                                       (uint16_t)length));
+        p->flags |= PBUF_CSUM_PARTIAL;
+        p->csum_start = (uint8_t*)udp;
+        p->csum_offset = offsetof(udp_header_t, checksum);
+    } else {
+        uint16_t checksum = ip_pseudo_checksum(src_ip, dest_ip, PROTOCOL_UDP, p);
+        udp->checksum = checksum ? checksum : 0xFFFF;   // Zero would mean none
+    }
+
+    return ip_output(p, dest_ip, PROTOCOL_UDP);
+}
@@ -0,0 +1,457 @@
+/*
+ * HellOS Virtio Network Driver
+ * Legacy virtio-pci network card: split virtqueues fed straight from the
+ * packet buffer pool, so frames are never copied on their way through
+ */
+
+#include "../../kernel/kernel.h"
+#include "../../kernel/memory.h"
+#include "../../kernel/paging.h"
+#include "../../kernel/interrupts.h"
+#include "../../kernel/spinlock.h"
+#include "../../kernel/pci.h"
+#include "../../kernel/debug.h"
+#include "nic.h"
+#include "pbuf.h"
+#include <stdint.h>
+
+#define VIRTIO_VENDOR_ID        0x1AF4
+#define VIRTIO_NET_DEVICE_ID    0x1000      // Transitional device, legacy interface
+
+// Legacy registers, in BAR0 I/O space
+#define VIRTIO_DEVICE_FEATURES  0x00
+#define VIRTIO_GUEST_FEATURES   0x04
+#define VIRTIO_QUEUE_ADDRESS    0x08        // Page frame number of the ring
+#define VIRTIO_QUEUE_SIZE       0x0C
+#define VIRTIO_QUEUE_SELECT     0x0E
+#define VIRTIO_QUEUE_NOTIFY     0x10
+#define VIRTIO_DEVICE_STATUS    0x12
+#define VIRTIO_ISR_STATUS       0x13        // Reading acknowledges the interrupt
+#define VIRTIO_NET_MAC          0x14
+
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+#define VIRTIO_ISR_QUEUE            0x01
+
+// Feature bits
+#define VIRTIO_NET_F_CSUM       (1U << 0)   // Device finishes partial checksums we send
+#define VIRTIO_NET_F_GUEST_CSUM (1U << 1)   // Device vouches for checksums it hands us
+#define VIRTIO_NET_F_MAC        (1U << 5)
+#define VIRTIO_F_ANY_LAYOUT     (1U << 27)  // Header and frame may share a descriptor
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+#define VIRTIO_QUEUE_RX         0
+#define VIRTIO_QUEUE_TX         1
+
+// Split ring layout, fixed by the legacy interface
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed)) vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t length;
+} __attribute__((packed)) vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    vring_used_elem_t ring[];
+} __attribute__((packed)) vring_used_t;
+
+// Prepended to every frame in both directions
+typedef struct {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t header_length;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} __attribute__((packed)) virtio_net_header_t;
+
+// One queue; buffers holds the pbuf posted at each chain's head descriptor
+typedef struct {
+    uint16_t index;
+    uint16_t size;              // Entries, a power of two
+    uint16_t free_head;
+    uint16_t free_count;
+    uint16_t avail_index;       // Our copy of avail->index
+    uint16_t last_used;         // Used entries consumed
+    volatile vring_desc_t* desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t* used;
+    pbuf_t** buffers;
+} virtqueue_t;
+
+static uint16_t io_base = 0;
+static virtqueue_t rx_queue;
+static virtqueue_t tx_queue;
+static uint32_t descs_per_frame = 2;    // 1 with ANY_LAYOUT
+static spinlock_t tx_lock = SPINLOCK_INIT;
+static nic_stats_t virtio_stats = {0};
+
+static int virtio_net_transmit(pbuf_t* p);
+static uint32_t virtio_net_poll(uint32_t budget);
+static bool virtio_net_enable_interrupts(void);
+
+// Offloads are filled in once the features are agreed
+static nic_ops_t virtio_net_ops = {
+    .name = "virtio-net",
+    .offloads = 0,
+    .transmit = virtio_net_transmit,
+    .poll = virtio_net_poll,
+    .enable_interrupts = virtio_net_enable_interrupts,
+    .stats = &virtio_stats,
+};
+
+/*
+ * Allocate and register one queue
+ */
+static int setup_queue(virtqueue_t* queue, uint16_t index) {
+    outw(io_base + VIRTIO_QUEUE_SELECT, index);
+    uint16_t size = inw(io_base + VIRTIO_QUEUE_SIZE);
+    if (!size || (size & (size - 1))) {
+        return HELL_ERROR_GENERAL;
+    }
+
+    // Descriptors and the available ring, then the used ring on its own page
+    uint32_t avail_offset = size * sizeof(vring_desc_t);
+    uint32_t used_offset = ALIGN_UP(avail_offset + 6 + 2 * size, PAGE_SIZE);
+    uint32_t bytes = used_offset + ALIGN_UP(6 + sizeof(vring_used_elem_t) * size, PAGE_SIZE);
+    uintptr_t ring = pfa_alloc_frames(bytes / PAGE_SIZE);
+    if (!ring) {
+        return HELL_ERROR_MEMORY;
+    }
+    queue->buffers = malloc(size * sizeof(pbuf_t*));
+    if (!queue->buffers) {
+        pfa_free_frames(ring, bytes / PAGE_SIZE);
+        return HELL_ERROR_MEMORY;
+    }
+    memset((void*)ring, 0, bytes);
+    memset(queue->buffers, 0, size * sizeof(pbuf_t*));
+
+    queue->index = index;
+    queue->size = size;
+    queue->desc = (volatile vring_desc_t*)ring;
+    queue->avail = (volatile vring_avail_t*)(ring + avail_offset);
+    queue->used = (volatile vring_used_t*)(ring + used_offset);
+    queue->avail_index = 0;
+    queue->last_used = 0;
+
+    // Every descriptor starts on the free chain
+    for (uint16_t i = 0; i < size; i++) {
+        queue->desc[i].next = i + 1;
+    }
+    queue->free_head = 0;
+    queue->free_count = size;
+
+    outl(io_base + VIRTIO_QUEUE_ADDRESS, ring / PAGE_SIZE);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Take a chain of count descriptors off the free list, returns its head
+ * The caller fills in addresses and lengths; the links are already set.
+ */
+static uint16_t alloc_chain(virtqueue_t* queue, uint32_t count) {
+    uint16_t head = queue->free_head;
+    uint16_t last = head;
+    for (uint32_t i = 1; i < count; i++) {
+        queue->desc[last].flags = VRING_DESC_F_NEXT;
+        last = queue->desc[last].next;
+    }
+    queue->desc[last].flags = 0;
+    queue->free_head = queue->desc[last].next;
+    queue->free_count -= count;
+    return head;
+}
+
+/*
+ * Return a used chain to the free list
+ */
+static void free_chain(virtqueue_t* queue, uint16_t head) {
+    uint16_t last = head;
+    uint32_t count = 1;
+    while (queue->desc[last].flags & VRING_DESC_F_NEXT) {
+        last = queue->desc[last].next;
+        count++;
+    }
+    queue->desc[last].next = queue->free_head;
+    queue->free_head = head;
+    queue->free_count += count;
+}
+
+/*
+ * Make a chain visible to the device
+ */
+static void publish_chain(virtqueue_t* queue, uint16_t head) {
+    queue->avail->ring[queue->avail_index & (queue->size - 1)] = head;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    queue->avail->index = ++queue->avail_index;
+}
+
+/*
+ * Tell the device about new chains, unless it said it is already looking
+ */
+static void kick_queue(virtqueue_t* queue) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(queue->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(io_base + VIRTIO_QUEUE_NOTIFY, queue->index);
+    }
+}
+
+/*
+ * Post an empty buffer for the device to receive into
+ * The header lands just before the usual data start, so the frame ends up
+ * where pbuf_alloc would have put it.
+ */
+static void post_rx_buffer(pbuf_t* p) {
+    uint8_t* frame = p->buffer + PBUF_HEADROOM;
+    uint8_t* header = frame - sizeof(virtio_net_header_t);
+    uint16_t head = alloc_chain(&rx_queue, descs_per_frame);
+    volatile vring_desc_t* desc = &rx_queue.desc[head];
+
+    desc->address = (uintptr_t)header;
+    if (descs_per_frame == 1) {
+        desc->length = PBUF_SIZE - (PBUF_HEADROOM - sizeof(virtio_net_header_t));
+        desc->flags |= VRING_DESC_F_WRITE;
+    } else {
+        desc->length = sizeof(virtio_net_header_t);
+        desc->flags |= VRING_DESC_F_WRITE;
+        desc = &rx_queue.desc[desc->next];
+        desc->address = (uintptr_t)frame;
+        desc->length = PBUF_SIZE - PBUF_HEADROOM;
+        desc->flags |= VRING_DESC_F_WRITE;
+    }
+
+    rx_queue.buffers[head] = p;
+    publish_chain(&rx_queue, head);
+}
+
+/*
+ * Keep the receive ring full, as far as the pool allows
+ */
+static void refill_rx_queue(void) {
+    uint32_t posted = 0;
+    while (rx_queue.free_count >= descs_per_frame) {
+        pbuf_t* p = pbuf_alloc();
+        if (!p) {
+            virtio_stats.rx_no_buffer++;
+            break;
+        }
+        post_rx_buffer(p);
+        posted++;
+    }
+    if (posted) {
+        kick_queue(&rx_queue);
+    }
+}
+
+/*
+ * Free buffers the device has finished sending
+ * Called with tx_lock held.
+ */
+static void reclaim_tx_queue(void) {
+    while (tx_queue.last_used != tx_queue.used->index) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint16_t head = (uint16_t)tx_queue.used->ring[tx_queue.last_used & (tx_queue.size - 1)].id;
+        tx_queue.last_used++;
+
+        pbuf_free(tx_queue.buffers[head]);
+        tx_queue.buffers[head] = NULL;
+        free_chain(&tx_queue, head);
+    }
+}
+
+/*
+ * Queue a frame for sending
+ * Each segment of a chained frame gets its own descriptor, so the device
+ * gathers the pieces itself. Send completions don't interrupt; finished
+ * buffers are reclaimed when later frames go out and on every poll.
+ */
+static int virtio_net_transmit(pbuf_t* p) {
+    uint32_t segments = 0;
+    for (pbuf_t* segment = p; segment; segment = segment->chain) {
+        segments++;
+    }
+    uint32_t descs = segments + descs_per_frame - 1;
+
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    reclaim_tx_queue();
+    if (tx_queue.free_count < descs) {
+        virtio_stats.tx_ring_full++;
+        spin_unlock_irqrestore(&tx_lock, flags);
+        pbuf_free(p);
+        return HELL_ERROR_GENERAL;
+    }
+
+    virtio_net_header_t* header = (virtio_net_header_t*)(p->data - sizeof(virtio_net_header_t));
+    memset(header, 0, sizeof(virtio_net_header_t));
+    if (p->flags & PBUF_CSUM_PARTIAL) {
+        header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        header->csum_start = (uint16_t)(p->csum_start - p->data);
+        header->csum_offset = p->csum_offset;
+    }
+
+    uint16_t head = alloc_chain(&tx_queue, descs);
+    volatile vring_desc_t* desc = &tx_queue.desc[head];
+    desc->address = (uintptr_t)header;
+    desc->length = sizeof(virtio_net_header_t);
+    pbuf_t* segment = p;
+    if (descs_per_frame == 1) {
+        desc->length += segment->length;
+        segment = segment->chain;
+    }
+    for (; segment; segment = segment->chain) {
+        desc = &tx_queue.desc[desc->next];
+        desc->address = (uintptr_t)segment->data;
+        desc->length = segment->length;
+    }
+
+    tx_queue.buffers[head] = p;
+    publish_chain(&tx_queue, head);
+    kick_queue(&tx_queue);
+    virtio_stats.tx_frames++;
+    spin_unlock_irqrestore(&tx_lock, flags);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Hand up to budget received frames to the stack, then refill the ring
+ */
+static uint32_t virtio_net_poll(uint32_t budget) {
+    uint32_t count = 0;
+
+    virtio_stats.polls++;
+    while (count < budget && rx_queue.last_used != rx_queue.used->index) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        volatile vring_used_elem_t* used = &rx_queue.used->ring[rx_queue.last_used & (rx_queue.size - 1)];
+        uint16_t head = (uint16_t)used->id;
+        uint32_t length = used->length;
+        rx_queue.last_used++;
+
+        pbuf_t* p = rx_queue.buffers[head];
+        rx_queue.buffers[head] = NULL;
+        free_chain(&rx_queue, head);
+
+        if (length <= sizeof(virtio_net_header_t)) {
+            pbuf_free(p);
+            continue;
+        }
+        // A partial checksum only comes from the host itself, so it is
+        // as good as a verified one
+        const virtio_net_header_t* header =
+            (const virtio_net_header_t*)(p->buffer + PBUF_HEADROOM - sizeof(virtio_net_header_t));
+        if (header->flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID)) {
+            p->flags |= PBUF_CSUM_VERIFIED;
+        }
+        p->data = p->buffer + PBUF_HEADROOM;
+        p->length = (uint16_t)(length - sizeof(virtio_net_header_t));
+        virtio_stats.rx_frames++;
+        network_input(p);
+        count++;
+    }
+    refill_rx_queue();
+
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    reclaim_tx_queue();
+    spin_unlock_irqrestore(&tx_lock, flags);
+    return count;
+}
+
+/*
+ * Unmask receive interrupts once the ring is drained
+ * A frame that arrived just before unmasking raised no interrupt, so the
+ * caller polls again when this returns true.
+ */
+static bool virtio_net_enable_interrupts(void) {
+    rx_queue.avail->flags = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return rx_queue.last_used != rx_queue.used->index;
+}
+
+/*
+ * Card interrupt: mask receive interrupts and leave the ring to the
+ * bottom half until it catches up
+ */
+static void virtio_net_interrupt(void) {
+    uint8_t isr = inb(io_base + VIRTIO_ISR_STATUS);
+    if (!(isr & VIRTIO_ISR_QUEUE)) {
+        return;     // Shared line, or a config change we don't track
+    }
+    virtio_stats.interrupts++;
+    rx_queue.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    network_signal_rx();
+}
+
+/*
+ * Find and bring up a virtio network card
+ */
+int virtio_net_probe(const nic_ops_t** ops, uint8_t mac[6]) {
+    const pci_device_t* device = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_NET_DEVICE_ID);
+    if (!device) {
+        return HELL_ERROR_GENERAL;
+    }
+    io_base = pci_io_base(device, 0);
+    if (!io_base) {
+        return HELL_ERROR_GENERAL;
+    }
+    pci_enable_device(device);
+
+    // Reset, then announce ourselves
+    outb(io_base + VIRTIO_DEVICE_STATUS, 0);
+    outb(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl(io_base + VIRTIO_DEVICE_FEATURES);
+    uint32_t wanted = features & (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM |
+                                  VIRTIO_NET_F_MAC | VIRTIO_F_ANY_LAYOUT);
+    outl(io_base + VIRTIO_GUEST_FEATURES, wanted);
+    descs_per_frame = (wanted & VIRTIO_F_ANY_LAYOUT) ? 1 : 2;
+    virtio_net_ops.offloads = ((wanted & VIRTIO_NET_F_CSUM) ? NIC_OFFLOAD_TX_CSUM : 0) |
+                              ((wanted & VIRTIO_NET_F_GUEST_CSUM) ? NIC_OFFLOAD_RX_CSUM : 0);
+
+    if (setup_queue(&rx_queue, VIRTIO_QUEUE_RX) != HELL_SUCCESS ||
+        setup_queue(&tx_queue, VIRTIO_QUEUE_TX) != HELL_SUCCESS) {
+        outb(io_base + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return HELL_ERROR_MEMORY;
+    }
+    tx_queue.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+    // Without a MAC from the device the caller's default stands
+    if (wanted & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < 6; i++) {
+            mac[i] = inb(io_base + VIRTIO_NET_MAC + i);
+        }
+    }
+
+    if (device->irq < 16) {
+        register_irq_handler(device->irq, virtio_net_interrupt);
+    }
+    outb(io_base + VIRTIO_DEVICE_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    refill_rx_queue();
+
+    DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "virtio-net at I/O %x IRQ %d, %d+%d descriptors",
+                  io_base, device->irq, rx_queue.size, tx_queue.size);
+    *ops = &virtio_net_ops;
+    return HELL_SUCCESS;
+}
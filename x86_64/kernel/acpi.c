@@ -0,0 +1,114 @@
+/*
+ * HellOS ACPI
+ * Reading the firmware's scriptures: RSDP, RSDT/XSDT and table lookup
+ */
+
+#include "kernel.h"
+#include "acpi.h"
+#include "memory.h"
+#include "debug.h"
+#include <stdint.h>
+
+// Where the BIOS may leave the RSDP (16-byte aligned)
+#define EBDA_SEGMENT_PTR    0x40E
+#define EBDA_SEARCH_SIZE    0x400
+#define BIOS_SEARCH_START   0xE0000
+#define BIOS_SEARCH_END     0x100000
+
+// ACPI state
+static acpi_sdt_header_t* root_table = NULL;   // RSDT or XSDT
+static bool root_is_xsdt = false;
+
+/*
+ * Sum a table; valid tables sum to zero
+ */
+static bool acpi_checksum_ok(const void* table, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/*
+ * Scan a physical range for the RSDP signature
+ */
+static acpi_rsdp_t* acpi_scan_rsdp(uintptr_t start, uintptr_t end) {
+    for (uintptr_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Find the RSDP and the root table
+ * Firmware tables sit in identity-mapped memory below 4GB, so they are
+ * read in place.
+ */
+bool init_acpi(void) {
+    // Read the BIOS data area through asm: to GCC an access this close to
+    // address zero looks like a null dereference
+    uint16_t ebda_segment;
+    __asm__ volatile ("movw (%1), %0" : "=r"(ebda_segment) : "r"(EBDA_SEGMENT_PTR));
+    uintptr_t ebda = (uintptr_t)ebda_segment << 4;
+    acpi_rsdp_t* rsdp = NULL;
+    if (ebda) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + EBDA_SEARCH_SIZE);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(BIOS_SEARCH_START, BIOS_SEARCH_END);
+    }
+    if (!rsdp) {
+        DEBUG_KERNEL(DEBUG_LEVEL_WARN, "ACPI: no RSDP found");
+        return false;
+    }
+
+    // Prefer the XSDT when the firmware provides one we can reach
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && (rsdp->xsdt_address >> 32) == 0 &&
+        acpi_checksum_ok(rsdp, rsdp->length)) {
+        root_table = (acpi_sdt_header_t*)(uintptr_t)rsdp->xsdt_address;
+        root_is_xsdt = true;
+    } else {
+        root_table = (acpi_sdt_header_t*)(uintptr_t)rsdp->rsdt_address;
+        root_is_xsdt = false;
+    }
+
+    if (!acpi_checksum_ok(root_table, root_table->length)) {
+        DEBUG_KERNEL(DEBUG_LEVEL_WARN, "ACPI: root table checksum mismatch");
+        root_table = NULL;
+        return false;
+    }
+
+    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "ACPI: %s at 0x%x", root_is_xsdt ? "XSDT" : "RSDT", (uint32_t)(uintptr_t)root_table);
+    return true;
+}
+
+/*
+ * Find a system description table by its four character signature
+ */
+acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (!root_table) {
+        return NULL;
+    }
+
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t entries = (root_table->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t* entry = (uint8_t*)root_table + sizeof(acpi_sdt_header_t);
+
+    for (uint32_t i = 0; i < entries; i++, entry += entry_size) {
+        uint64_t address = root_is_xsdt ? *(uint64_t*)entry : *(uint32_t*)entry;
+        if (address == 0 || (address >> 32) != 0) {
+            continue;
+        }
+
+        acpi_sdt_header_t* table = (acpi_sdt_header_t*)(uintptr_t)address;
+        if (memcmp(table->signature, signature, 4) == 0 && acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,75 @@
+/*
+ * HellOS ACPI Header
+ * Locating the firmware's ACPI tables
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Root System Description Pointer
+typedef struct {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;           // 0 for ACPI 1.0, 2 and later add the XSDT
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// Multiple APIC Description Table
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+// MADT entry types
+#define ACPI_MADT_LAPIC             0
+#define ACPI_MADT_IOAPIC            1
+#define ACPI_MADT_LAPIC_OVERRIDE    5
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) acpi_madt_lapic_override_t;
+
+#define ACPI_LAPIC_ENABLED          0x1
+#define ACPI_LAPIC_ONLINE_CAPABLE   0x2
+
+// ACPI functions
+bool init_acpi(void);
+acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+#endif // ACPI_H
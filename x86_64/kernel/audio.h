@@ -9,20 +9,44 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Mixer configuration
+#define AUDIO_VOICES            8       // Notes that can sound at once
+#define AUDIO_SAMPLE_RATE       44100
+#define AUDIO_BLOCK_SAMPLES     1024    // Mixed per completion interrupt, half the DMA stream
+
+// Sequencer: each sequence plays its notes one after another on a voice
+// of its own, so there are as many sequences as voices
+#define AUDIO_SEQUENCES         AUDIO_VOICES
+#define AUDIO_SEQUENCE_NOTES    32      // Notes copied per sequence
+#define AUDIO_SEQUENCE_VOLUME   128     // Volume of the system sounds
+#define AUDIO_NO_SEQUENCE       -1
+
+// Where mixed audio goes
+typedef enum {
+    AUDIO_OUTPUT_PC_SPEAKER,    // No DMA device: voice 0 drives the speaker, nothing is mixed
+    AUDIO_OUTPUT_SB16           // 16-bit mono auto-init DMA
+} audio_output_t;
+
 // Audio state structure
 typedef struct {
     uint32_t sample_rate;
-    uint8_t channels;
-    uint16_t buffer_size;
+    uint8_t channels;           // Voices
+    uint16_t buffer_size;       // Samples per block
     bool initialized;
+    audio_output_t output;
+    uint16_t dsp_version;       // SB16 DSP major.minor, 0 without one
+    bool streaming;             // DMA running, paused while every voice is silent
+    uint32_t blocks_mixed;
 } audio_state_t;
 
-// Audio channel structure
+// Audio channel structure, one voice of the mixer
 typedef struct {
     uint16_t frequency;
     uint8_t waveform;
     uint8_t volume;
-    uint32_t phase;
+    uint32_t phase;             // 8.24 fixed point index into a 256 entry period
+    uint32_t phase_increment;   // Added per sample, set when the note starts
+    int32_t gain;               // Volume in 1/256ths
     bool active;
 } audio_channel_t;
 
@@ -33,10 +57,18 @@ void play_note(int channel, uint16_t frequency, uint8_t waveform, uint8_t volume
 void stop_note(int channel);
 void set_pc_speaker_frequency(uint16_t frequency);
 void silence_pc_speaker(void);
-int16_t generate_sample(int channel);
-void create_demonic_growl(int channel);
-void create_fire_crackling(int channel);
+void audio_mix(int16_t* out, uint32_t samples);
 void shutdown_audio_driver(void);
 audio_state_t* get_audio_state(void);
 
-#endif // AUDIO_H 
\ No newline at end of file
+// Sequencer functions
+void init_audio_sequencer(void);
+int audio_play_sequence(const audio_note_t* notes, uint8_t volume, int after);
+bool audio_cancel_sequence(int id);
+void audio_cancel_all_sequences(void);
+bool audio_sequence_playing(int id);
+bool audio_sequencer_idle(void);
+int create_demonic_growl(void);
+int create_fire_crackling(void);
+
+#endif // AUDIO_H 
@@ -0,0 +1,370 @@
+/*
+ * HellOS Micro-benchmarks
+ * Times the kernel's hot paths in RDTSC cycles, for tools/bench_compare
+ * to hold against a baseline
+ */
+
+#include "kernel.h"
+#include "bench.h"
+#include "debug.h"
+#include "memory.h"
+#include "process.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "graphics.h"
+#include "audio.h"
+#include "../drivers/network/network.h"
+#include <stdint.h>
+
+#define BENCH_BUFFER_SIZE   65536   // Largest copy, fill and checksum
+#define BENCH_SURFACE_SIZE  256     // Off-screen drawing target, square
+#define BENCH_YIELD_TRIES   64      // Yields to wait for the partner to come and go
+
+// A benchmark times run(ops, arg) once per sample, after one untimed
+// warm-up pass. setup may decline, and the benchmark is skipped.
+typedef struct {
+    const char* name;
+    uint32_t ops;
+    uint32_t arg;
+    void (*run)(uint32_t ops, uint32_t arg);
+    bool (*setup)(void);
+    void (*teardown)(void);
+} bench_t;
+
+// Working state, only while bench_run_all runs
+static uint8_t* bench_source;
+static uint8_t* bench_dest;
+static surface_t* bench_surface;
+static volatile uint32_t bench_sink;        // Keeps results from being optimized out
+
+// The yield benchmark's other half
+static volatile bool partner_stop;
+static volatile bool partner_running;
+
+/*
+ * Allocation churn: eight mixed sizes out, then back in another order
+ * One operation is a malloc and its free.
+ */
+static void bench_malloc_free(uint32_t ops, uint32_t arg) {
+    static const uint32_t sizes[8] = {16, 48, 128, 24, 512, 64, 2048, 256};
+    void* held[8];
+    (void)arg;
+    
+    for (uint32_t i = 0; i < ops; i += 8) {
+        for (uint32_t j = 0; j < 8; j++) {
+            held[j] = malloc(sizes[j]);
+        }
+        for (uint32_t j = 0; j < 8; j++) {
+            free(held[(j * 5) & 7]);
+        }
+    }
+}
+
+/*
+ * Copies between the two buffers, cache hot
+ */
+static void bench_memcpy(uint32_t ops, uint32_t size) {
+    for (uint32_t i = 0; i < ops; i++) {
+        memcpy(bench_dest, bench_source, size);
+    }
+}
+
+/*
+ * Fills of the destination buffer
+ */
+static void bench_memset(uint32_t ops, uint32_t size) {
+    for (uint32_t i = 0; i < ops; i++) {
+        memset(bench_dest, (int)i, size);
+    }
+}
+
+/*
+ * Yield partner: hands the CPU straight back until told to stop
+ */
+static void yield_partner(void) {
+    partner_running = true;
+    while (!partner_stop) {
+        yield_process();
+    }
+    partner_running = false;
+}
+
+/*
+ * Start the partner at the kernel process's own priority, so each yield
+ * is a switch to it and one back
+ */
+static bool yield_setup(void) {
+    if (partner_running) {
+        return false;
+    }
+    partner_stop = false;
+    if (!create_process("bench_yield", (uintptr_t)yield_partner, PRIORITY_OVERLORD, true)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < BENCH_YIELD_TRIES && !partner_running; i++) {
+        yield_process();
+    }
+    return partner_running;
+}
+
+/*
+ * Stop the partner and let it exit
+ */
+static void yield_teardown(void) {
+    partner_stop = true;
+    for (uint32_t i = 0; i < BENCH_YIELD_TRIES && partner_running; i++) {
+        yield_process();
+    }
+}
+
+/*
+ * One operation is a yield round trip: two context switches
+ */
+static void bench_yield(uint32_t ops, uint32_t arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        yield_process();
+    }
+}
+
+/*
+ * Interrupt entry, dispatch and iret, through the software vector
+ */
+static void bench_interrupt(uint32_t ops, uint32_t arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        __asm__ volatile("int %0" : : "i"(SOFTWARE_INTERRUPT_VECTOR) : "memory");
+    }
+}
+
+/*
+ * Drawing goes to an off-screen surface through the same paths
+ * draw_rectangle and draw_text take to the back buffer, so nothing
+ * reaches the screen
+ */
+static bool surface_setup(void) {
+    bench_surface = surface_create(BENCH_SURFACE_SIZE, BENCH_SURFACE_SIZE);
+    return bench_surface != NULL;
+}
+
+/*
+ * Free the drawing target
+ */
+static void surface_teardown(void) {
+    surface_destroy(bench_surface);
+    bench_surface = NULL;
+}
+
+/*
+ * One operation is a square of the given side
+ */
+static void bench_fill_rect(uint32_t ops, uint32_t side) {
+    for (uint32_t i = 0; i < ops; i++) {
+        surface_fill_rect(bench_surface, 0, 0, (int)side, (int)side, (uint8_t)(i & 0x1F));
+    }
+}
+
+/*
+ * One operation is a 31 character line of text
+ */
+static void bench_draw_text(uint32_t ops, uint32_t arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < ops; i++) {
+        surface_draw_text(bench_surface, "Abandon all hope, ye who enter.", 0, (int)(i & 0x7F),
+                          COLOR_BONE_WHITE);
+    }
+}
+
+/*
+ * Sound every voice, silently, so the mixer does its full work
+ * Not while the sequencer is playing: the voices are its. Without a
+ * card voice 0 would drive the PC Speaker, so it sits out.
+ */
+static bool audio_setup(void) {
+    audio_state_t* state = get_audio_state();
+    if (!state->initialized || !audio_sequencer_idle()) {
+        return false;
+    }
+    int first = state->output == AUDIO_OUTPUT_PC_SPEAKER ? 1 : 0;
+    for (int voice = first; voice < AUDIO_VOICES; voice++) {
+        play_note(voice, (uint16_t)(110 << (voice & 3)), (uint8_t)(voice % 3), 0);
+    }
+    return true;
+}
+
+/*
+ * Silence the voices again
+ */
+static void audio_teardown(void) {
+    for (int voice = 0; voice < AUDIO_VOICES; voice++) {
+        stop_note(voice);
+    }
+}
+
+/*
+ * One operation is a block of the given number of samples
+ */
+static void bench_audio_mix(uint32_t ops, uint32_t samples) {
+    for (uint32_t i = 0; i < ops; i++) {
+        audio_mix((int16_t*)bench_dest, samples);
+    }
+}
+
+/*
+ * Internet checksums over the source buffer
+ */
+static void bench_checksum(uint32_t ops, uint32_t length) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        sum += calculate_ip_checksum(bench_source, length);
+    }
+    bench_sink = sum;
+}
+
+static const bench_t benchmarks[] = {
+    {"malloc_free",      512,  0,     bench_malloc_free, NULL,          NULL},
+    {"memcpy_64",        4096, 64,    bench_memcpy,      NULL,          NULL},
+    {"memcpy_1k",        1024, 1024,  bench_memcpy,      NULL,          NULL},
+    {"memcpy_4k",        256,  4096,  bench_memcpy,      NULL,          NULL},
+    {"memcpy_64k",       16,   65536, bench_memcpy,      NULL,          NULL},
+    {"memset_64",        4096, 64,    bench_memset,      NULL,          NULL},
+    {"memset_1k",        1024, 1024,  bench_memset,      NULL,          NULL},
+    {"memset_4k",        256,  4096,  bench_memset,      NULL,          NULL},
+    {"memset_64k",       16,   65536, bench_memset,      NULL,          NULL},
+    {"yield_roundtrip",  256,  0,     bench_yield,       yield_setup,   yield_teardown},
+    {"irq_roundtrip",    1024, 0,     bench_interrupt,   NULL,          NULL},
+    {"fill_rect_16",     1024, 16,    bench_fill_rect,   surface_setup, surface_teardown},
+    {"fill_rect_256",    16,   256,   bench_fill_rect,   surface_setup, surface_teardown},
+    {"draw_text_line",   128,  0,     bench_draw_text,   surface_setup, surface_teardown},
+    {"audio_mix_block",  16,   AUDIO_BLOCK_SAMPLES, bench_audio_mix, audio_setup, audio_teardown},
+    {"checksum_1500",    1024, 1500,  bench_checksum,    NULL,          NULL},
+    {"checksum_64k",     16,   65536, bench_checksum,    NULL,          NULL},
+    {NULL, 0, 0, NULL, NULL, NULL}
+};
+
+/*
+ * Append text to a line being built, stopping short of its end
+ */
+static char* bench_append(char* out, char* end, const char* text) {
+    while (*text && out < end - 1) {
+        *out++ = *text++;
+    }
+    *out = '\0';
+    return out;
+}
+
+/*
+ * Append a space and an unsigned decimal
+ */
+static char* bench_append_number(char* out, char* end, uint32_t value) {
+    char digits[11];
+    int count = 0;
+    
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    
+    if (out < end - 1) {
+        *out++ = ' ';
+    }
+    while (count && out < end - 1) {
+        *out++ = digits[--count];
+    }
+    *out = '\0';
+    return out;
+}
+
+/*
+ * Write one serial line: the tag, a word and up to five numbers
+ */
+static void bench_emit(const char* word, const uint32_t* values, uint32_t count) {
+    char line[96];
+    char* end = line + sizeof(line) - 1;     // Room kept for the newline
+    char* out = bench_append(line, end, BENCH_TAG " ");
+    
+    out = bench_append(out, end, word);
+    for (uint32_t i = 0; i < count; i++) {
+        out = bench_append_number(out, end, values[i]);
+    }
+    out[0] = '\n';
+    out[1] = '\0';
+    debug_output_serial(line);
+}
+
+/*
+ * Time one benchmark into result
+ */
+static void bench_measure(const bench_t* bench, bench_result_t* result) {
+    uint32_t samples[BENCH_SAMPLES];
+    
+    bench->run(bench->ops, bench->arg);     // Warm caches, fault nothing in mid-sample
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = rdtsc();
+        bench->run(bench->ops, bench->arg);
+        uint64_t cycles = div64_32(rdtsc() - start, bench->ops);
+        uint32_t sample = cycles > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (uint32_t)cycles;
+        
+        // Insertion sort as we go, for the median
+        uint32_t j = i;
+        while (j > 0 && samples[j - 1] > sample) {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = sample;
+    }
+    
+    result->name = bench->name;
+    result->ops = bench->ops;
+    result->min_cycles = samples[0];
+    result->median_cycles = samples[BENCH_SAMPLES / 2];
+    result->max_cycles = samples[BENCH_SAMPLES - 1];
+}
+
+/*
+ * Run the suite
+ */
+uint32_t bench_run_all(bench_report_t report, void* data) {
+    uint32_t header[2] = {BENCH_VERSION, timer_get_tsc_khz()};
+    uint32_t count = 0;
+    
+    bench_source = (uint8_t*)malloc(BENCH_BUFFER_SIZE);
+    bench_dest = (uint8_t*)malloc(BENCH_BUFFER_SIZE);
+    if (!bench_source || !bench_dest) {
+        free(bench_source);
+        free(bench_dest);
+        DEBUG_KERNEL(DEBUG_LEVEL_ERROR, "bench: no memory for the buffers");
+        return 0;
+    }
+    for (uint32_t i = 0; i < BENCH_BUFFER_SIZE; i++) {
+        bench_source[i] = (uint8_t)(i * 7);
+    }
+    
+    bench_emit("BEGIN", header, 2);
+    for (const bench_t* bench = benchmarks; bench->name; bench++) {
+        if (bench->setup && !bench->setup()) {
+            DEBUG_KERNEL(DEBUG_LEVEL_WARN, "bench: %s skipped", bench->name);
+            continue;
+        }
+        
+        bench_result_t result;
+        bench_measure(bench, &result);
+        if (bench->teardown) {
+            bench->teardown();
+        }
+        
+        uint32_t values[4] = {result.ops, result.min_cycles, result.median_cycles, result.max_cycles};
+        bench_emit(result.name, values, 4);
+        if (report) {
+            report(&result, data);
+        }
+        count++;
+    }
+    bench_emit("END", &count, 1);
+    
+    free(bench_source);
+    free(bench_dest);
+    bench_source = NULL;
+    bench_dest = NULL;
+    return count;
+}
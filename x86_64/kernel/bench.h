@@ -0,0 +1,41 @@
+/*
+ * HellOS Micro-benchmarks Header
+ * The benchmark suite, and its serial format shared with tools/bench_compare
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Over serial a run is one line per benchmark between BEGIN and END
+// markers, all fields decimal:
+//   [BENCH] BEGIN <version> <tsc_khz>
+//   [BENCH] <name> <ops per sample> <min> <median> <max>
+//   [BENCH] END <benchmarks>
+// min, median and max are RDTSC cycles per operation over the samples.
+#define BENCH_TAG           "[BENCH]"
+#define BENCH_VERSION       1
+#define BENCH_NAME_LENGTH   32      // Longest name, with its terminator
+#define BENCH_SAMPLES       15      // Timed samples per benchmark, odd for the median
+
+// QEMU's isa-debug-exit device, attached by make bench: a write ends the run
+#define QEMU_DEBUG_EXIT_PORT    0xF4
+
+typedef struct {
+    const char* name;
+    uint32_t ops;               // Operations timed per sample
+    uint32_t min_cycles;        // Per operation
+    uint32_t median_cycles;
+    uint32_t max_cycles;
+} bench_result_t;
+
+// Called once per finished benchmark
+typedef void (*bench_report_t)(const bench_result_t* result, void* data);
+
+// Run every benchmark, writing the results to serial and handing each to
+// report if there is one. Returns the number run. Process context only:
+// it yields, allocates and draws off-screen.
+uint32_t bench_run_all(bench_report_t report, void* data);
+
+#endif // BENCH_H
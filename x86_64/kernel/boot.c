@@ -0,0 +1,228 @@
+/*
+ * HellOS Boot Profiling and Init Tasks
+ * Timing the rise from the pit, and raising its pieces side by side
+ */
+
+#include "kernel.h"
+#include "boot.h"
+#include "process.h"
+#include "smp.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "debug.h"
+#include <stdint.h>
+
+// Boot phases, appended by any CPU
+static boot_phase_t boot_phases[BOOT_MAX_PHASES];
+static volatile uint32_t phase_count = 0;
+static uint64_t shell_ready_tsc = 0;
+
+// The task graph being run; started, done and the masks are task bits
+static spinlock_t init_lock = SPINLOCK_INIT;
+static const init_task_t* init_tasks = NULL;
+static uint32_t init_task_count = 0;
+static uint32_t foreground_mask = 0;
+static uint32_t background_mask = 0;
+static uint32_t started_mask = 0;
+static volatile uint32_t done_mask = 0;
+static process_t* boot_process = NULL;
+
+// Workers blocked until a dependency finishes
+static process_t* init_waiters[BOOT_INIT_WORKERS + 1];
+static uint32_t init_waiter_count = 0;
+
+/*
+ * Start timing a phase, returns its index for boot_phase_end
+ */
+int boot_phase_begin(const char* name) {
+    uint32_t index = __atomic_fetch_add(&phase_count, 1, __ATOMIC_RELAXED);
+    if (index >= BOOT_MAX_PHASES) {
+        phase_count = BOOT_MAX_PHASES;
+        return -1;
+    }
+
+    boot_phase_t* phase = &boot_phases[index];
+    phase->end_tsc = 0;
+    phase->cpu = this_cpu()->index;
+    phase->name = name;
+    phase->start_tsc = rdtsc();
+    return (int)index;
+}
+
+/*
+ * Finish timing a phase
+ */
+void boot_phase_end(int phase) {
+    if (phase >= 0 && phase < BOOT_MAX_PHASES) {
+        boot_phases[phase].end_tsc = rdtsc();
+    }
+}
+
+/*
+ * Number of phases recorded
+ */
+uint32_t boot_phase_count(void) {
+    return phase_count;
+}
+
+/*
+ * Get a recorded phase
+ */
+const boot_phase_t* boot_get_phase(uint32_t index) {
+    if (index >= phase_count) {
+        return NULL;
+    }
+    return &boot_phases[index];
+}
+
+/*
+ * Note the moment the shell can take input
+ */
+void boot_mark_shell_ready(void) {
+    shell_ready_tsc = rdtsc();
+}
+
+/*
+ * Microseconds from kernel entry to the shell, 0 before it is up
+ */
+uint64_t boot_get_shell_ready_us(void) {
+    if (!shell_ready_tsc) {
+        return 0;
+    }
+    return timer_tsc_to_us(shell_ready_tsc - timer_get_boot_tsc());
+}
+
+/*
+ * Claim a task of the given kind whose dependencies are done, or -1
+ * Called with init_lock held.
+ */
+static int claim_init_task(bool background) {
+    for (uint32_t i = 0; i < init_task_count; i++) {
+        const init_task_t* task = &init_tasks[i];
+        if ((started_mask & BOOT_TASK(i)) || task->background != background) {
+            continue;
+        }
+        if (task->depends & ~done_mask) {
+            continue;
+        }
+        started_mask |= BOOT_TASK(i);
+        return (int)i;
+    }
+    return -1;
+}
+
+/*
+ * Mark a task done and wake everyone who may have been waiting on it
+ */
+static void finish_init_task(uint32_t index) {
+    process_t* waiters[BOOT_INIT_WORKERS + 1];
+    uint32_t count;
+
+    uint32_t flags = spin_lock_irqsave(&init_lock);
+    done_mask |= BOOT_TASK(index);
+    count = init_waiter_count;
+    for (uint32_t i = 0; i < count; i++) {
+        waiters[i] = init_waiters[i];
+    }
+    init_waiter_count = 0;
+    bool foreground_done = (done_mask & foreground_mask) == foreground_mask;
+    spin_unlock_irqrestore(&init_lock, flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        wake_process(waiters[i]);
+    }
+    if (foreground_done) {
+        wake_process(boot_process);
+    }
+}
+
+/*
+ * Run tasks of one kind until all of them have been started
+ */
+static void run_init_worker(bool background) {
+    uint32_t mask = background ? background_mask : foreground_mask;
+
+    while (true) {
+        uint32_t flags = spin_lock_irqsave(&init_lock);
+        if ((started_mask & mask) == mask) {
+            spin_unlock_irqrestore(&init_lock, flags);
+            return;
+        }
+
+        int index = claim_init_task(background);
+        if (index < 0) {
+            // Nothing ready: sleep until a running task finishes
+            init_waiters[init_waiter_count++] = get_current_process();
+            spin_unlock_irqrestore(&init_lock, flags);
+            block_current_process();
+            continue;
+        }
+        spin_unlock_irqrestore(&init_lock, flags);
+
+        const init_task_t* task = &init_tasks[index];
+        DEBUG_KERNEL(DEBUG_LEVEL_DEBUG, "Init task %s on CPU %d", task->name, this_cpu()->index);
+        int phase = boot_phase_begin(task->name);
+        task->run();
+        boot_phase_end(phase);
+        finish_init_task((uint32_t)index);
+    }
+}
+
+static void init_worker_entry(void) {
+    run_init_worker(false);
+}
+
+static void init_background_entry(void) {
+    run_init_worker(true);
+}
+
+/*
+ * Run a task graph, returning once every foreground task has finished
+ * Foreground tasks are shared by up to BOOT_INIT_WORKERS demon processes,
+ * which the other CPUs steal as they come up; background tasks go to a
+ * single damned process and may still be running on return. Needs the
+ * scheduler running, and the tasks must stay valid until all are done.
+ */
+void run_init_tasks(const init_task_t* tasks, uint32_t count) {
+    if (count > BOOT_MAX_TASKS) {
+        kernel_panic("Too many init tasks");
+    }
+
+    uint32_t flags = spin_lock_irqsave(&init_lock);
+    init_tasks = tasks;
+    init_task_count = count;
+    foreground_mask = 0;
+    background_mask = 0;
+    started_mask = 0;
+    done_mask = 0;
+    init_waiter_count = 0;
+    boot_process = get_current_process();
+    for (uint32_t i = 0; i < count; i++) {
+        if (tasks[i].background) {
+            background_mask |= BOOT_TASK(i);
+        } else {
+            foreground_mask |= BOOT_TASK(i);
+        }
+    }
+    spin_unlock_irqrestore(&init_lock, flags);
+
+    uint32_t workers = 0;
+    for (uint32_t i = 0; i < count && workers < BOOT_INIT_WORKERS; i++) {
+        if (!tasks[i].background) {
+            workers++;
+        }
+    }
+    for (uint32_t i = 0; i < workers; i++) {
+        if (!create_process("init", (uintptr_t)init_worker_entry, PRIORITY_DEMON, true)) {
+            kernel_panic("Failed to start init workers");
+        }
+    }
+    if (background_mask &&
+        !create_process("init_bg", (uintptr_t)init_background_entry, PRIORITY_DAMNED, true)) {
+        kernel_panic("Failed to start background init worker");
+    }
+
+    while ((done_mask & foreground_mask) != foreground_mask) {
+        block_current_process();
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * HellOS Boot Header
+ * Boot phase timing and the dependency-ordered init task runner
+ */
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BOOT_MAX_PHASES     32
+#define BOOT_MAX_TASKS      32      // Dependencies are a bit mask of task indices
+#define BOOT_INIT_WORKERS   4       // Processes running foreground tasks
+
+// A timed stretch of boot, in raw TSC cycles
+typedef struct {
+    const char* name;
+    uint64_t start_tsc;
+    uint64_t end_tsc;           // 0 while the phase is still running
+    uint32_t cpu;
+} boot_phase_t;
+
+// An init task runs once every task in its depends mask has finished.
+// Failures are the task's to handle, usually with kernel_panic.
+// Background tasks run in one low priority process and run_init_tasks
+// doesn't wait for them, so nothing should depend on one.
+typedef struct {
+    const char* name;
+    void (*run)(void);
+    uint32_t depends;
+    bool background;
+} init_task_t;
+
+#define BOOT_TASK(index)    (1U << (index))
+
+// Boot phases
+int boot_phase_begin(const char* name);
+void boot_phase_end(int phase);
+uint32_t boot_phase_count(void);
+const boot_phase_t* boot_get_phase(uint32_t index);
+void boot_mark_shell_ready(void);
+uint64_t boot_get_shell_ready_us(void);
+
+// Init tasks
+void run_init_tasks(const init_task_t* tasks, uint32_t count);
+
+#endif // BOOT_H
@@ -0,0 +1,48 @@
+/*
+ * HellOS Console Header
+ * Text console: a cell grid drawn from the glyph atlas
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "graphics.h"
+
+// One character cell of the backing store
+typedef struct {
+    char character;
+    uint8_t color;
+} console_cell_t;
+
+// A console covers a fixed grid of GLYPH_CELL_WIDTH x GLYPH_CELL_HEIGHT
+// cells of a surface. The cells keep what is shown, so it can be redrawn
+// without the writer's help. Between console_begin_update and
+// console_end_update writes only touch the cells, and the rows they
+// changed are drawn once at the end.
+typedef struct {
+    surface_t* surface;
+    int x, y;                   // Surface position of the top left cell
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t cursor_column;
+    uint32_t cursor_row;
+    console_cell_t* cells;      // rows * columns, row major
+    bool initialized;
+    
+    // Deferred drawing
+    uint32_t update_depth;
+    uint32_t dirty_first;       // Rows changed, dirty_first > dirty_last if none
+    uint32_t dirty_last;
+} console_t;
+
+// Console functions
+int console_init(console_t* console, surface_t* surface, int x, int y, int width, int height);
+void console_write(console_t* console, const char* text, uint8_t color);
+void console_clear(console_t* console);
+void console_redraw(console_t* console);
+void console_begin_update(console_t* console);
+void console_end_update(console_t* console);
+
+#endif // CONSOLE_H
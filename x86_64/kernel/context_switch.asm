@@ -0,0 +1,49 @@
+; HellOS Context Switch
+; Swaps kernel stacks between processes
+
+[bits 32]
+
+section .text
+global switch_context
+global process_entry_trampoline
+extern exit_current_process
+extern schedule_tail
+
+; void switch_context(uint64_t* save_sp, uint32_t new_sp)
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer through save_sp (process_t.stack_pointer, low dword; the high
+; dword is cleared) and resumes whatever was saved on new_sp. Caller-saved
+; registers and EFLAGS are the caller's business, so the switch is just the
+; four pushes and a stack swap.
+switch_context:
+    mov eax, [esp + 4]         ; save_sp
+    mov edx, [esp + 8]         ; new_sp
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov dword [eax + 4], 0
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; First return target of a new process: the initial stack built by
+; create_process carries the entry point in EBX. schedule_tail finishes
+; the switch (drops the run queue lock the scheduler held across it), then
+; processes always start with interrupts on, whatever state the switch
+; happened in.
+process_entry_trampoline:
+    call schedule_tail
+    sti
+    call ebx
+    call exit_current_process
+.hang:
+    hlt
+    jmp .hang
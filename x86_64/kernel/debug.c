@@ -4,34 +4,63 @@
  */
 
 #include "debug.h"
+#include "memory.h"
 #include "memory_layout.h"
+#include "smp.h"
+#include "timer.h"
+#include "spinlock.h"
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
 
-// Port I/O functions (inline assembly)
-static inline void outb(uint16_t port, uint8_t value) {
-    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
-}
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t value;
-    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
-    return value;
-}
+// 16550 line status register
+#define DEBUG_SERIAL_LSR    (DEBUG_SERIAL_PORT + 5)
+#define DEBUG_SERIAL_THRE   0x20    // Transmit FIFO empty
+
+// Binary stream limits
+#define DEBUG_FORMAT_CACHE  64      // Format strings remembered as sent
+#define DEBUG_FORMAT_MAX    160     // Longer formats are sent truncated
+#define DEBUG_STREAM_BUFFER (sizeof(debug_stream_format_t) + DEBUG_FORMAT_MAX + \
+                             sizeof(debug_stream_dropped_t) + sizeof(debug_stream_record_t) + \
+                             DEBUG_RECORD_ARGS * 4 + 1 + DEBUG_RECORD_STRINGS)
+
+// A ring slot is published by storing its position + 1 in sequence, so
+// the drainer never reads a record that is still being written
+typedef struct {
+    volatile uint32_t sequence;
+    debug_record_t record;
+} debug_ring_slot_t;
+
+// Multi-producer, single-consumer ring. Producers reserve a position with
+// a compare-and-swap on head, which keeps logging lock-free even when an
+// interrupt handler logs over a half-written record or CPUs share a ring.
+typedef struct {
+    volatile uint32_t head;         // Next position to reserve
+    volatile uint32_t tail;         // Next position to drain
+    debug_ring_slot_t slots[DEBUG_RING_RECORDS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) debug_ring_t;
 
 // Forward declarations
-static int debug_sprintf(char* buffer, const char* format, ...);
-static int debug_vsprintf(char* buffer, const char* format, va_list args);
 static int debug_int_to_string(char* buffer, int value);
 static int debug_hex_to_string(char* buffer, unsigned int value);
 
 // Global debug state
-static debug_state_t g_debug_state = {0};
-static debug_log_entry_t g_debug_entries[1024];
+debug_state_t g_debug_state = {0};
+static debug_ring_t g_debug_rings[DEBUG_RING_CPUS];
 static char g_debug_memory_buffer[DEBUG_MEMORY_BUFFER_SIZE];
 static uint32_t g_debug_memory_offset = 0;
 
+// Drainer state, protected by the drain lock. The serial output in
+// flight is either the text line or the encoded stream frames.
+static spinlock_t g_drain_lock = SPINLOCK_INIT;
+static char g_drain_line[DEBUG_LINE_SIZE];
+static uint8_t g_drain_stream[DEBUG_STREAM_BUFFER];
+static const uint8_t* g_serial_data = NULL;
+static uint32_t g_serial_len = 0;
+static uint32_t g_serial_pos = 0;
+static const char* g_sent_formats[DEBUG_FORMAT_CACHE];
+static uint32_t g_dropped_sent = 0;
+
 // Subsystem names
 static const char* g_subsystem_names[] = {
     "BOOT", "KERNEL", "MEMORY", "INTERRUPTS", "PROCESS",
@@ -66,73 +95,92 @@ static char* debug_strcpy(char* dest, const char* src) {
     return dest;
 }
 
-static char* debug_strcat(char* dest, const char* src) {
-    int dest_len = debug_strlen(dest);
-    int i = 0;
-    while (src[i]) {
-        dest[dest_len + i] = src[i];
-        i++;
+// Append a string to a line, stopping at size
+static uint32_t debug_append(char* buffer, uint32_t pos, uint32_t size, const char* str) {
+    while (*str && pos < size) {
+        buffer[pos++] = *str++;
     }
-    dest[dest_len + i] = '\0';
-    return dest;
+    return pos;
 }
 
-// Simple sprintf implementation for debug messages
-static int debug_sprintf(char* buffer, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    int result = debug_vsprintf(buffer, format, args);
-    va_end(args);
-    return result;
+/*
+ * Format a record's message from its captured arguments
+ */
+static uint32_t debug_format_args(char* buffer, uint32_t pos, uint32_t size, const debug_record_t* record) {
+    const char* format = record->format;
+    uint32_t arg = 0;
+    char number[16];
+    
+    for (int i = 0; format[i] && pos < size; i++) {
+        if (format[i] != '%' || !format[i + 1]) {
+            buffer[pos++] = format[i];
+            continue;
+        }
+        
+        i++; // Skip '%'
+        uint32_t value = 0;
+        if (format[i] == 'd' || format[i] == 'x' || format[i] == 's' || format[i] == 'c') {
+            if (arg >= record->nargs) {
+                continue;   // Past the captured arguments
+            }
+            value = record->args[arg++];
+        }
+        
+        switch (format[i]) {
+            case 'd':
+                debug_int_to_string(number, (int)value);
+                pos = debug_append(buffer, pos, size, number);
+                break;
+            case 'x':
+                debug_hex_to_string(number, value);
+                pos = debug_append(buffer, pos, size, number);
+                break;
+            case 's':
+                if (value < record->strings_len) {
+                    pos = debug_append(buffer, pos, size, &record->strings[value]);
+                }
+                break;
+            case 'c':
+                buffer[pos++] = (char)value;
+                break;
+            default:
+                buffer[pos++] = format[i];
+                break;
+        }
+    }
+    return pos;
 }
 
-static int debug_vsprintf(char* buffer, const char* format, va_list args) {
-    int pos = 0;
-    int i = 0;
+/*
+ * Capture the arguments a format consumes into a record
+ * Strings are copied: the caller's buffers are gone by drain time.
+ */
+static void debug_capture_args(debug_record_t* record, const char* format, va_list args) {
+    uint32_t nargs = 0;
+    uint32_t used = 0;
     
-    while (format[i]) {
-        if (format[i] == '%' && format[i + 1]) {
-            i++; // Skip '%'
-            switch (format[i]) {
-                case 'd': {
-                    int value = va_arg(args, int);
-                    pos += debug_int_to_string(buffer + pos, value);
-                    break;
-                }
-                case 'x': {
-                    unsigned int value = va_arg(args, unsigned int);
-                    pos += debug_hex_to_string(buffer + pos, value);
-                    break;
-                }
-                case 's': {
-                    char* str = va_arg(args, char*);
-                    if (str) {
-                        while (*str) {
-                            buffer[pos++] = *str++;
-                        }
-                    }
-                    break;
-                }
-                case 'c': {
-                    char c = (char)va_arg(args, int);
-                    buffer[pos++] = c;
-                    break;
-                }
-                case '%': {
-                    buffer[pos++] = '%';
-                    break;
+    for (int i = 0; format[i] && nargs < DEBUG_RECORD_ARGS; i++) {
+        if (format[i] != '%' || !format[i + 1]) {
+            continue;
+        }
+        
+        i++; // Skip '%'
+        if (format[i] == 's') {
+            const char* str = va_arg(args, const char*);
+            record->args[nargs++] = used;
+            if (used < DEBUG_RECORD_STRINGS) {
+                while (str && *str && used < DEBUG_RECORD_STRINGS - 1) {
+                    record->strings[used++] = *str++;
                 }
-                default:
-                    buffer[pos++] = format[i];
-                    break;
+                record->strings[used++] = '\0';
             }
-        } else {
-            buffer[pos++] = format[i];
+        } else if (format[i] == 'd' || format[i] == 'x' || format[i] == 'c') {
+            record->args[nargs++] = va_arg(args, uint32_t);
         }
-        i++;
     }
-    buffer[pos] = '\0';
-    return pos;
+    
+    record->nargs = nargs;
+    record->strings_len = used;
 }
 
 static int debug_int_to_string(char* buffer, int value) {
@@ -208,20 +256,21 @@ void debug_early_init(void) {
     
     // Clear debug state
     g_debug_state.config.min_level = DEBUG_LEVEL_INFO;
+#ifdef DEBUG_BINARY_LOG
+    g_debug_state.config.output_mask = DEBUG_OUTPUT_BINARY | DEBUG_OUTPUT_VGA;
+#else
     g_debug_state.config.output_mask = DEBUG_OUTPUT_SERIAL | DEBUG_OUTPUT_VGA;
+#endif
     g_debug_state.config.subsystem_mask = 0xFFFFFFFF; // All subsystems
     g_debug_state.config.buffer_size = DEBUG_MEMORY_BUFFER_SIZE;
-    g_debug_state.config.max_entries = 1024;
+    g_debug_state.config.max_entries = DEBUG_RING_RECORDS;
     g_debug_state.config.color_enabled = 1;
     g_debug_state.config.timestamp_enabled = 1;
     g_debug_state.config.subsystem_names_enabled = 1;
     
     // Initialize buffer
-    g_debug_state.buffer.entries = g_debug_entries;
-    g_debug_state.buffer.head = 0;
-    g_debug_state.buffer.tail = 0;
-    g_debug_state.buffer.count = 0;
-    g_debug_state.buffer.max_entries = 1024;
+    g_debug_state.buffer.max_entries = DEBUG_RING_RECORDS;
+    g_debug_state.buffer.logged_count = 0;
     g_debug_state.buffer.dropped_count = 0;
     
     g_debug_state.boot_time = 0;
@@ -252,27 +301,97 @@ void debug_configure(const debug_config_t* config) {
 
 // Core logging function
 void debug_log(debug_level_t level, debug_subsystem_t subsystem, const char* format, ...) {
-    if (!g_debug_state.initialized) {
-        return;
-    }
-    
-    // Check if this log level and subsystem are enabled
-    if (level < g_debug_state.config.min_level) {
-        return;
-    }
-    
-    if (!(g_debug_state.config.subsystem_mask & (1 << subsystem))) {
-        return;
-    }
-    
     va_list args;
     va_start(args, format);
     debug_vlog(level, subsystem, format, args);
     va_end(args);
 }
 
-// Raw logging function
+// Raw logging function, the message is copied like a %s argument
 void debug_log_raw(debug_level_t level, debug_subsystem_t subsystem, const char* message) {
+    debug_log(level, subsystem, "%s", message);
+}
+
+/*
+ * Reserve the next slot of a ring, NULL when it is full
+ */
+static debug_ring_slot_t* debug_ring_reserve(debug_ring_t* ring, uint32_t* position) {
+    uint32_t head = ring->head;
+    do {
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= DEBUG_RING_RECORDS) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head, &head, head + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    
+    *position = head;
+    return &ring->slots[head % DEBUG_RING_RECORDS];
+}
+
+/*
+ * The oldest published record across all rings
+ * Rings drain in timestamp order so lines from different CPUs interleave
+ * the way they were logged.
+ */
+static debug_ring_t* debug_ring_oldest(void) {
+    debug_ring_t* oldest = NULL;
+    uint32_t oldest_time = 0;
+    
+    for (uint32_t i = 0; i < DEBUG_RING_CPUS; i++) {
+        debug_ring_t* ring = &g_debug_rings[i];
+        uint32_t tail = ring->tail;
+        debug_ring_slot_t* slot = &ring->slots[tail % DEBUG_RING_RECORDS];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != tail + 1) {
+            continue;
+        }
+        if (!oldest || (int32_t)(slot->record.timestamp - oldest_time) < 0) {
+            oldest = ring;
+            oldest_time = slot->record.timestamp;
+        }
+    }
+    return oldest;
+}
+
+/*
+ * Copy the oldest record out and free its slot (drain lock held)
+ */
+static bool debug_ring_take(debug_record_t* record) {
+    debug_ring_t* ring = debug_ring_oldest();
+    if (!ring) {
+        return false;
+    }
+    
+    uint32_t tail = ring->tail;
+    *record = ring->slots[tail % DEBUG_RING_RECORDS].record;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Buffer management
+void debug_buffer_clear(void) {
+    uint32_t flags = spin_lock_irqsave(&g_drain_lock);
+    debug_record_t record;
+    while (debug_ring_take(&record)) {
+    }
+    g_serial_pos = g_serial_len;
+    spin_unlock_irqrestore(&g_drain_lock, flags);
+}
+
+uint32_t debug_buffer_get_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < DEBUG_RING_CPUS; i++) {
+        count += g_debug_rings[i].head - g_debug_rings[i].tail;
+    }
+    return count;
+}
+
+/*
+ * Log a message: capture it into this CPU's ring and return
+ * Nothing is formatted or written here. A full ring is drained on the
+ * spot unless another context is already draining, and the record is
+ * dropped only if that doesn't free a slot.
+ */
+void debug_vlog(debug_level_t level, debug_subsystem_t subsystem, const char* format, va_list args) {
     if (!g_debug_state.initialized) {
         return;
     }
@@ -301,71 +420,208 @@ void debug_log_raw(debug_level_t level, debug_subsystem_t subsystem, const char*
             break;
     }
     
-    // Add to buffer
-    if (g_debug_state.buffer.count < g_debug_state.buffer.max_entries) {
-        debug_log_entry_t* entry = &g_debug_state.buffer.entries[g_debug_state.buffer.tail];
-        entry->timestamp = debug_get_timestamp();
-        entry->level = level;
-        entry->subsystem = subsystem;
-        debug_strcpy(entry->message, message);
-        
-        g_debug_state.buffer.tail = (g_debug_state.buffer.tail + 1) % g_debug_state.buffer.max_entries;
-        g_debug_state.buffer.count++;
-    } else {
-        g_debug_state.buffer.dropped_count++;
+    uint32_t cpu = this_cpu()->index;
+    debug_ring_t* ring = &g_debug_rings[cpu % DEBUG_RING_CPUS];
+    uint32_t position;
+    debug_ring_slot_t* slot = debug_ring_reserve(ring, &position);
+    if (!slot) {
+        debug_flush();
+        slot = debug_ring_reserve(ring, &position);
     }
-    
-    // Format and output message
-    char formatted_message[512];
-    debug_format_message(formatted_message, sizeof(formatted_message), level, subsystem, message);
-    
-    // Output to enabled targets
-    if (g_debug_state.config.output_mask & DEBUG_OUTPUT_VGA) {
-        debug_output_vga(formatted_message, level);
+    if (!slot) {
+        __atomic_add_fetch(&g_debug_state.buffer.dropped_count, 1, __ATOMIC_RELAXED);
+        return;
     }
     
-    if (g_debug_state.config.output_mask & DEBUG_OUTPUT_SERIAL) {
-        debug_output_serial(formatted_message);
-    }
+    debug_record_t* record = &slot->record;
+    record->timestamp = debug_get_timestamp();
+    record->format = format;
+    record->level = level;
+    record->subsystem = subsystem;
+    record->cpu = cpu;
+    debug_capture_args(record, format, args);
     
-    if (g_debug_state.config.output_mask & DEBUG_OUTPUT_MEMORY) {
-        debug_output_memory(formatted_message);
-    }
-}
-
-// Variable argument logging
-void debug_vlog(debug_level_t level, debug_subsystem_t subsystem, const char* format, va_list args) {
-    char message[256];
-    debug_vsprintf(message, format, args);
-    debug_log_raw(level, subsystem, message);
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_debug_state.buffer.logged_count, 1, __ATOMIC_RELAXED);
 }
 
-// Format message with timestamp and subsystem
-void debug_format_message(char* buffer, size_t buffer_size, debug_level_t level, debug_subsystem_t subsystem, const char* message) {
-    buffer[0] = '\0';
+/*
+ * Format a record as a text line with timestamp, level and subsystem
+ */
+static uint32_t debug_format_line(char* buffer, const debug_record_t* record) {
+    uint32_t size = DEBUG_LINE_SIZE - 2;    // Room for the newline and NUL
+    uint32_t pos = 0;
     
     // Add timestamp if enabled
     if (g_debug_state.config.timestamp_enabled) {
         char timestamp_str[16];
-        debug_sprintf(timestamp_str, "[%d] ", debug_get_timestamp());
-        debug_strcat(buffer, timestamp_str);
+        debug_int_to_string(timestamp_str, record->timestamp);
+        pos = debug_append(buffer, pos, size, "[");
+        pos = debug_append(buffer, pos, size, timestamp_str);
+        pos = debug_append(buffer, pos, size, "] ");
     }
     
     // Add level
-    debug_strcat(buffer, "[");
-    debug_strcat(buffer, debug_level_to_string(level));
-    debug_strcat(buffer, "] ");
+    pos = debug_append(buffer, pos, size, "[");
+    pos = debug_append(buffer, pos, size, debug_level_to_string(record->level));
+    pos = debug_append(buffer, pos, size, "] ");
     
     // Add subsystem if enabled
     if (g_debug_state.config.subsystem_names_enabled) {
-        debug_strcat(buffer, "[");
-        debug_strcat(buffer, debug_subsystem_to_string(subsystem));
-        debug_strcat(buffer, "] ");
+        pos = debug_append(buffer, pos, size, "[");
+        pos = debug_append(buffer, pos, size, debug_subsystem_to_string(record->subsystem));
+        pos = debug_append(buffer, pos, size, "] ");
     }
     
     // Add message
-    debug_strcat(buffer, message);
-    debug_strcat(buffer, "\n");
+    pos = debug_format_args(buffer, pos, size, record);
+    buffer[pos++] = '\n';
+    buffer[pos] = '\0';
+    return pos;
+}
+
+/*
+ * Encode a record as binary stream frames
+ * The format string goes out ahead of the first record that uses it; a
+ * small cache of sent formats keeps that to once per format in practice.
+ */
+static uint32_t debug_encode_record(uint8_t* buffer, const debug_record_t* record) {
+    uint32_t pos = 0;
+    uint32_t key = (uint32_t)(uintptr_t)record->format;
+    uint32_t slot = (key ^ (key >> 6)) % DEBUG_FORMAT_CACHE;
+    
+    if (g_sent_formats[slot] != record->format) {
+        debug_stream_format_t frame = { DEBUG_STREAM_SYNC, DEBUG_STREAM_FORMAT, key, 0 };
+        uint32_t length = debug_strlen(record->format);
+        frame.length = length < DEBUG_FORMAT_MAX ? length : DEBUG_FORMAT_MAX;
+        memcpy(buffer + pos, &frame, sizeof(frame));
+        pos += sizeof(frame);
+        memcpy(buffer + pos, record->format, frame.length);
+        pos += frame.length;
+        g_sent_formats[slot] = record->format;
+    }
+    
+    uint32_t dropped = g_debug_state.buffer.dropped_count;
+    if (dropped != g_dropped_sent) {
+        debug_stream_dropped_t frame = { DEBUG_STREAM_SYNC, DEBUG_STREAM_DROPPED, dropped - g_dropped_sent };
+        memcpy(buffer + pos, &frame, sizeof(frame));
+        pos += sizeof(frame);
+        g_dropped_sent = dropped;
+    }
+    
+    debug_stream_record_t frame = {
+        DEBUG_STREAM_SYNC, DEBUG_STREAM_RECORD, record->timestamp, key,
+        record->level, record->subsystem, record->cpu, record->nargs
+    };
+    memcpy(buffer + pos, &frame, sizeof(frame));
+    pos += sizeof(frame);
+    memcpy(buffer + pos, record->args, record->nargs * sizeof(uint32_t));
+    pos += record->nargs * sizeof(uint32_t);
+    buffer[pos++] = record->strings_len;
+    memcpy(buffer + pos, record->strings, record->strings_len);
+    pos += record->strings_len;
+    return pos;
+}
+
+/*
+ * Write a record to every enabled target (drain lock held)
+ * VGA and memory take the text line at once; serial output is queued
+ * for debug_serial_burst.
+ */
+static void debug_emit_record(const debug_record_t* record) {
+    debug_output_t mask = g_debug_state.config.output_mask;
+    uint32_t length = 0;
+    
+    if (mask & (DEBUG_OUTPUT_VGA | DEBUG_OUTPUT_MEMORY | DEBUG_OUTPUT_SERIAL)) {
+        length = debug_format_line(g_drain_line, record);
+    }
+    
+    if (mask & DEBUG_OUTPUT_VGA) {
+        debug_output_vga(g_drain_line, record->level);
+    }
+    
+    if (mask & DEBUG_OUTPUT_MEMORY) {
+        debug_output_memory(g_drain_line);
+    }
+    
+    if (mask & DEBUG_OUTPUT_BINARY) {
+        g_serial_data = g_drain_stream;
+        g_serial_len = debug_encode_record(g_drain_stream, record);
+        g_serial_pos = 0;
+    } else if (mask & DEBUG_OUTPUT_SERIAL) {
+        g_serial_data = (const uint8_t*)g_drain_line;
+        g_serial_len = length;
+        g_serial_pos = 0;
+    }
+}
+
+/*
+ * Fill the UART's transmit FIFO from the pending output
+ * Returns false while the FIFO still holds the previous burst.
+ */
+static bool debug_serial_burst(void) {
+    if (!(inb(DEBUG_SERIAL_LSR) & DEBUG_SERIAL_THRE)) {
+        return false;
+    }
+    
+    uint32_t count = g_serial_len - g_serial_pos;
+    if (count > DEBUG_SERIAL_FIFO) {
+        count = DEBUG_SERIAL_FIFO;
+    }
+    while (count--) {
+        outb(DEBUG_SERIAL_PORT, g_serial_data[g_serial_pos++]);
+    }
+    return true;
+}
+
+/*
+ * Move records to their targets until the rings are empty or the UART
+ * is busy (drain lock held), returns true if output is still pending
+ */
+static bool debug_drain_locked(void) {
+    for (;;) {
+        if (g_serial_pos == g_serial_len) {
+            debug_record_t record;
+            if (!debug_ring_take(&record)) {
+                return false;
+            }
+            debug_emit_record(&record);
+            continue;
+        }
+        if (!debug_serial_burst()) {
+            return true;
+        }
+    }
+}
+
+/*
+ * Drain what the UART will take right now without waiting
+ * Called from the idle loop; returns true while output is still pending
+ * so the caller polls again instead of halting. Returns false if another
+ * CPU is already draining.
+ */
+bool debug_drain(void) {
+    if (!spin_trylock(&g_drain_lock)) {
+        return false;
+    }
+    bool pending = debug_drain_locked();
+    spin_unlock(&g_drain_lock);
+    return pending;
+}
+
+/*
+ * Drain everything, waiting on the UART (full rings, panic)
+ * A context that interrupted the drainer gives up instead of deadlocking.
+ */
+void debug_flush(void) {
+    uint32_t flags = irq_save();
+    if (spin_trylock(&g_drain_lock)) {
+        while (debug_drain_locked()) {
+            __asm__ volatile ("pause");
+        }
+        spin_unlock(&g_drain_lock);
+    }
+    irq_restore(flags);
 }
 
 // VGA output
@@ -404,15 +660,23 @@ void debug_output_vga(const char* message, debug_level_t level) {
     }
 }
 
-// Serial output
+// Serial output, bypassing the rings
+// Flushes queued records first so the text doesn't land mid-line.
 void debug_output_serial(const char* message) {
-    int i = 0;
-    while (message[i]) {
-        // Wait for transmit buffer to be empty
-        while (!(inb(DEBUG_SERIAL_PORT + 5) & 0x20));
-        outb(DEBUG_SERIAL_PORT, message[i]);
-        i++;
+    uint32_t flags = spin_lock_irqsave(&g_drain_lock);
+    while (debug_drain_locked()) {
+        __asm__ volatile ("pause");
     }
+    
+    g_serial_data = (const uint8_t*)message;
+    g_serial_len = debug_strlen(message);
+    g_serial_pos = 0;
+    while (g_serial_pos < g_serial_len) {
+        if (!debug_serial_burst()) {
+            __asm__ volatile ("pause");
+        }
+    }
+    spin_unlock_irqrestore(&g_drain_lock, flags);
 }
 
 // Memory buffer output
@@ -439,11 +703,10 @@ const char* debug_subsystem_to_string(debug_subsystem_t subsystem) {
     return "UNKNOWN";
 }
 
-// Get timestamp (simple tick counter for now)
+// Get timestamp: microseconds since kernel entry from the TSC, wrapping
+// after about 71 minutes (the drainer compares them wrap-safe)
 uint32_t debug_get_timestamp(void) {
-    // TODO: Implement proper timestamp based on system timer
-    static uint32_t tick_counter = 0;
-    return tick_counter++;
+    return (uint32_t)timer_tsc_to_us(rdtsc() - timer_get_boot_tsc());
 }
 
 // Panic function
@@ -454,6 +717,9 @@ void debug_panic(const char* message) {
     // Disable interrupts
     __asm__ volatile("cli");
     
+    // Get the log out before stopping
+    debug_flush();
+    
     // Halt system
     while (1) {
         __asm__ volatile("hlt");
@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include "debug_stream.h"
 
 // Debug levels
 typedef enum {
@@ -40,6 +42,8 @@ typedef enum {
     DEBUG_OUTPUT_VGA = 0x01,
     DEBUG_OUTPUT_SERIAL = 0x02,
     DEBUG_OUTPUT_MEMORY = 0x04,
+    DEBUG_OUTPUT_BINARY = 0x08,     // Serial carries debug_stream.h frames instead of text,
+                                    // the default when built with -DDEBUG_BINARY_LOG
     DEBUG_OUTPUT_ALL = 0xFF
 } debug_output_t;
 
@@ -55,22 +59,25 @@ typedef struct {
     uint8_t subsystem_names_enabled;
 } debug_config_t;
 
-// Debug log entry
+// Binary log record: the format pointer and raw arguments, formatted
+// only when the drainer writes it out. Format strings must be literals.
 typedef struct {
     uint32_t timestamp;
-    debug_level_t level;
-    debug_subsystem_t subsystem;
-    char message[256];
-} debug_log_entry_t;
-
-// Debug buffer
+    const char* format;
+    uint8_t level;
+    uint8_t subsystem;
+    uint8_t cpu;
+    uint8_t nargs;
+    uint8_t strings_len;
+    uint32_t args[DEBUG_RECORD_ARGS];    // %s arguments are offsets into strings
+    char strings[DEBUG_RECORD_STRINGS];  // %s arguments, copied when logged
+} debug_record_t;
+
+// Log ring statistics; the records live in per-CPU rings in debug.c
 typedef struct {
-    debug_log_entry_t* entries;
-    uint32_t head;
-    uint32_t tail;
-    uint32_t count;
-    uint32_t max_entries;
-    uint32_t dropped_count;
+    uint32_t max_entries;               // Records per ring
+    volatile uint32_t logged_count;
+    volatile uint32_t dropped_count;    // Rings full and no drain possible
 } debug_buffer_t;
 
 // Global debug state
@@ -94,25 +101,56 @@ void debug_log(debug_level_t level, debug_subsystem_t subsystem, const char* for
 void debug_log_raw(debug_level_t level, debug_subsystem_t subsystem, const char* message);
 void debug_vlog(debug_level_t level, debug_subsystem_t subsystem, const char* format, va_list args);
 
+// Compile-time log filtering: calls below HELL_LOG_LEVEL or for subsystems
+// outside HELL_LOG_SUBSYSTEMS compile to nothing, arguments included. The
+// Makefile sets the level per build (0 TRACE .. 5 FATAL).
+#ifndef HELL_LOG_LEVEL
+#define HELL_LOG_LEVEL 0
+#endif
+
+#ifndef HELL_LOG_SUBSYSTEMS
+#define HELL_LOG_SUBSYSTEMS 0xFFFFFFFFU
+#endif
+
+// Read by the inline gate below; owned by debug.c
+extern debug_state_t g_debug_state;
+
+/*
+ * Runtime filter, checked before any argument is evaluated
+ * Nothing passes before debug_early_init sets a subsystem mask.
+ */
+static inline int debug_enabled(debug_level_t level, debug_subsystem_t subsystem) {
+    return level >= g_debug_state.config.min_level &&
+           (g_debug_state.config.subsystem_mask & (1U << subsystem));
+}
+
+#define DEBUG_LOG(level, subsystem, format, ...) \
+    do { \
+        if ((level) >= HELL_LOG_LEVEL && ((HELL_LOG_SUBSYSTEMS >> (subsystem)) & 1) && \
+            debug_enabled(level, subsystem)) { \
+            debug_log(level, subsystem, format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
 // Convenience macros for different log levels
-#define DEBUG_TRACE(subsystem, format, ...) debug_log(DEBUG_LEVEL_TRACE, subsystem, format, ##__VA_ARGS__)
-#define DEBUG_DEBUG(subsystem, format, ...) debug_log(DEBUG_LEVEL_DEBUG, subsystem, format, ##__VA_ARGS__)
-#define DEBUG_INFO(subsystem, format, ...) debug_log(DEBUG_LEVEL_INFO, subsystem, format, ##__VA_ARGS__)
-#define DEBUG_WARN(subsystem, format, ...) debug_log(DEBUG_LEVEL_WARN, subsystem, format, ##__VA_ARGS__)
-#define DEBUG_ERROR(subsystem, format, ...) debug_log(DEBUG_LEVEL_ERROR, subsystem, format, ##__VA_ARGS__)
-#define DEBUG_FATAL(subsystem, format, ...) debug_log(DEBUG_LEVEL_FATAL, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_TRACE(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_TRACE, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_DEBUG(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_DEBUG, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_INFO(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_INFO, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_WARN(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_WARN, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_ERROR(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_ERROR, subsystem, format, ##__VA_ARGS__)
+#define DEBUG_FATAL(subsystem, format, ...) DEBUG_LOG(DEBUG_LEVEL_FATAL, subsystem, format, ##__VA_ARGS__)
 
 // Subsystem-specific macros
-#define DEBUG_BOOT(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_BOOT, format, ##__VA_ARGS__)
-#define DEBUG_KERNEL(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_KERNEL, format, ##__VA_ARGS__)
-#define DEBUG_MEMORY(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_MEMORY, format, ##__VA_ARGS__)
-#define DEBUG_INTERRUPTS(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_INTERRUPTS, format, ##__VA_ARGS__)
-#define DEBUG_PROCESS(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_PROCESS, format, ##__VA_ARGS__)
-#define DEBUG_GRAPHICS(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_GRAPHICS, format, ##__VA_ARGS__)
-#define DEBUG_AUDIO(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_AUDIO, format, ##__VA_ARGS__)
-#define DEBUG_NETWORK(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_NETWORK, format, ##__VA_ARGS__)
-#define DEBUG_SHELL(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_SHELL, format, ##__VA_ARGS__)
-#define DEBUG_DRIVERS(level, format, ...) debug_log(level, DEBUG_SUBSYSTEM_DRIVERS, format, ##__VA_ARGS__)
+#define DEBUG_BOOT(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_BOOT, format, ##__VA_ARGS__)
+#define DEBUG_KERNEL(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_KERNEL, format, ##__VA_ARGS__)
+#define DEBUG_MEMORY(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_MEMORY, format, ##__VA_ARGS__)
+#define DEBUG_INTERRUPTS(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_INTERRUPTS, format, ##__VA_ARGS__)
+#define DEBUG_PROCESS(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_PROCESS, format, ##__VA_ARGS__)
+#define DEBUG_GRAPHICS(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_GRAPHICS, format, ##__VA_ARGS__)
+#define DEBUG_AUDIO(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_AUDIO, format, ##__VA_ARGS__)
+#define DEBUG_NETWORK(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_NETWORK, format, ##__VA_ARGS__)
+#define DEBUG_SHELL(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_SHELL, format, ##__VA_ARGS__)
+#define DEBUG_DRIVERS(level, format, ...) DEBUG_LOG(level, DEBUG_SUBSYSTEM_DRIVERS, format, ##__VA_ARGS__)
 
 // Memory dump functions
 void debug_dump_memory(const void* ptr, uint32_t size, const char* label);
@@ -123,7 +161,8 @@ void debug_dump_stack(uint32_t depth);
 void debug_buffer_clear(void);
 void debug_buffer_dump(void);
 uint32_t debug_buffer_get_count(void);
-debug_log_entry_t* debug_buffer_get_entry(uint32_t index);
+bool debug_drain(void);
+void debug_flush(void);
 
 // Output functions
 void debug_output_vga(const char* message, debug_level_t level);
@@ -150,7 +189,6 @@ void debug_shell_stats(void);
 const char* debug_level_to_string(debug_level_t level);
 const char* debug_subsystem_to_string(debug_subsystem_t subsystem);
 uint32_t debug_get_timestamp(void);
-void debug_format_message(char* buffer, size_t buffer_size, debug_level_t level, debug_subsystem_t subsystem, const char* message);
 
 // Color definitions for VGA output
 #define DEBUG_COLOR_TRACE   0x08    // Dark gray
@@ -163,10 +201,16 @@ void debug_format_message(char* buffer, size_t buffer_size, debug_level_t level,
 // Serial port definitions
 #define DEBUG_SERIAL_PORT   0x3F8   // COM1
 #define DEBUG_SERIAL_BAUD   115200
+#define DEBUG_SERIAL_FIFO   16      // 16550A transmit FIFO depth
 
 // Memory buffer size
 #define DEBUG_MEMORY_BUFFER_SIZE    (64 * 1024)  // 64KB debug buffer
 
+// Log rings: CPUs share a ring when there are more than DEBUG_RING_CPUS
+#define DEBUG_RING_CPUS             8
+#define DEBUG_RING_RECORDS          64      // Per ring, a power of two
+#define DEBUG_LINE_SIZE             256     // Longest formatted text line
+
 // Boot-time debugging (before full system init)
 void debug_boot_print(const char* message);
 void debug_boot_hex(uint32_t value);
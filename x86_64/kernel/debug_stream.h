@@ -0,0 +1,52 @@
+/*
+ * HellOS Binary Log Stream Format
+ * Serial framing for binary log records, shared by the kernel and tools/debug_viewer
+ */
+
+#ifndef DEBUG_STREAM_H
+#define DEBUG_STREAM_H
+
+#include <stdint.h>
+
+// Frames are interleaved with ordinary text on COM1 and start with a sync
+// byte that never appears in text. A format frame carries a format string
+// the first time the drainer sends it, keyed by its kernel address; record
+// frames refer to it by that key. Everything is little endian.
+#define DEBUG_STREAM_SYNC       0xFE
+#define DEBUG_STREAM_FORMAT     'F'     // debug_stream_format_t, then length bytes
+#define DEBUG_STREAM_RECORD     'R'     // debug_stream_record_t, then args and strings
+#define DEBUG_STREAM_DROPPED    'D'     // debug_stream_dropped_t
+
+// Limits of one record
+#define DEBUG_RECORD_ARGS       6       // Conversions captured per message
+#define DEBUG_RECORD_STRINGS    48      // Bytes of %s arguments, NUL terminated
+
+typedef struct {
+    uint8_t sync;
+    uint8_t type;
+    uint32_t format;                    // Key of the format string
+    uint16_t length;                    // Bytes of text that follow, no NUL
+} __attribute__((packed)) debug_stream_format_t;
+
+// Followed by nargs uint32_t arguments, a uint8_t strings length and that
+// many bytes of strings. A %s argument is an offset into the strings; one
+// at or past the strings length prints as empty.
+typedef struct {
+    uint8_t sync;
+    uint8_t type;
+    uint32_t timestamp;
+    uint32_t format;
+    uint8_t level;
+    uint8_t subsystem;
+    uint8_t cpu;
+    uint8_t nargs;
+} __attribute__((packed)) debug_stream_record_t;
+
+// Records lost to full rings since the previous dropped frame
+typedef struct {
+    uint8_t sync;
+    uint8_t type;
+    uint32_t count;
+} __attribute__((packed)) debug_stream_dropped_t;
+
+#endif // DEBUG_STREAM_H
@@ -0,0 +1,102 @@
+/*
+ * HellOS Deferred Work
+ * Interrupt handlers do the least they can and queue the rest here; the
+ * queue drains from the kernel main loop, outside interrupt context
+ */
+
+#include "kernel.h"
+#include "deferred.h"
+#include "interrupts.h"
+#include "spinlock.h"
+#include "wakeup.h"
+#include <stdint.h>
+
+// FIFO of queued work, so bottom halves run in the order they were raised
+static deferred_work_t* queue_head = NULL;
+static deferred_work_t* queue_tail = NULL;
+static spinlock_t queue_lock = SPINLOCK_INIT;
+static int deferred_wakeup = -1;
+
+static void deferred_wakeup_handler(void);
+
+/*
+ * Initialize the deferred work queue (after the wakeup registry)
+ */
+void init_deferred_work(void) {
+    queue_head = NULL;
+    queue_tail = NULL;
+    deferred_wakeup = wakeup_register("deferred", deferred_wakeup_handler);
+}
+
+/*
+ * Queue work for the main loop (interrupt safe)
+ * Returns false if the item was still queued from an earlier call.
+ */
+bool defer_work(deferred_work_t* work) {
+    if (!work || !work->handler) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&queue_lock);
+    if (work->queued) {
+        spin_unlock_irqrestore(&queue_lock, flags);
+        return false;
+    }
+
+    work->queued = true;
+    work->queued_at = rdtsc();
+    work->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = work;
+    } else {
+        queue_head = work;
+    }
+    queue_tail = work;
+    spin_unlock_irqrestore(&queue_lock, flags);
+
+    wakeup_signal(deferred_wakeup);
+    return true;
+}
+
+/*
+ * Run everything queued so far, returns how many items ran
+ * Items queued while draining wait for the next pass, so a handler that
+ * requeues itself cannot starve the main loop.
+ */
+uint32_t run_deferred_work(void) {
+    uint32_t flags = spin_lock_irqsave(&queue_lock);
+    deferred_work_t* work = queue_head;
+    queue_head = NULL;
+    queue_tail = NULL;
+    spin_unlock_irqrestore(&queue_lock, flags);
+
+    uint32_t ran = 0;
+    while (work) {
+        deferred_work_t* next = work->next;
+
+        // Clear first: the top half may queue it again while it runs
+        flags = spin_lock_irqsave(&queue_lock);
+        work->queued = false;
+        uint64_t queued_at = work->queued_at;
+        spin_unlock_irqrestore(&queue_lock, flags);
+
+        uint64_t start = rdtsc();
+        work->handler(work->data);
+        uint64_t end = rdtsc();
+
+        if (work->vector != DEFERRED_NO_VECTOR) {
+            interrupt_record_deferred(work->vector, start - queued_at, end - start);
+        }
+
+        work = next;
+        ran++;
+    }
+    return ran;
+}
+
+/*
+ * Wakeup source handler: the queue was signalled
+ */
+static void deferred_wakeup_handler(void) {
+    run_deferred_work();
+}
@@ -0,0 +1,36 @@
+/*
+ * HellOS Deferred Work Header
+ * Bottom halves: work an interrupt handler hands to the kernel main loop
+ */
+
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Vector for work that no interrupt handler queues (no latency stats)
+#define DEFERRED_NO_VECTOR  0xFFFFFFFF
+
+// Runs in the kernel main loop with interrupts on
+typedef void (*deferred_handler_t)(void* data);
+
+// A work item is queued at most once at a time; queueing it again before
+// it runs is a no-op, so handlers drain everything their top half left
+typedef struct deferred_work_s {
+    deferred_handler_t handler;
+    void* data;
+    uint32_t vector;                // Interrupt that queues it
+    volatile bool queued;
+    uint64_t queued_at;             // TSC when queued
+    struct deferred_work_s* next;
+} deferred_work_t;
+
+#define DEFERRED_WORK_INIT(handler, data, vector) { (handler), (data), (vector), false, 0, NULL }
+
+// Deferred work functions
+void init_deferred_work(void);
+bool defer_work(deferred_work_t* work);
+uint32_t run_deferred_work(void);
+
+#endif // DEFERRED_H
@@ -9,22 +9,129 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Damage tracking and presentation
+#define GRAPHICS_DIRTY_RECTS    16      // Damage rectangles kept between presents
+#define GRAPHICS_FRAME_MS       16      // Present at most this often (~60Hz)
+
+// Text cells drawn from the glyph atlas: an 8x8 glyph with line spacing
+#define GLYPH_CELL_WIDTH        8
+#define GLYPH_CELL_HEIGHT       12
+#define GLYPH_CELL_BACKGROUND   COLOR_VOID_BLACK
+
+// Pixel formats of video memory and the back buffer
+typedef enum {
+    PIXEL_FORMAT_INDEXED8,  // Palette index, colors set in the VGA DAC
+    PIXEL_FORMAT_RGB16,     // Direct color, fields from the VBE mode info
+    PIXEL_FORMAT_RGB32
+} pixel_format_t;
+
 // Graphics state structure
+// Drawing always targets a width x height screen (SCREEN_WIDTH x
+// SCREEN_HEIGHT), centered in the display mode when that is larger.
 typedef struct {
     uint32_t width;
     uint32_t height;
     uint8_t bpp;
     bool initialized;
+    bool write_combining;   // Video memory mapped write-combining
+    pixel_format_t format;
+    uint32_t pitch;         // Bytes per video memory row
+    uint32_t display_width; // Video mode resolution
+    uint32_t display_height;
+    uintptr_t video_address;
 } graphics_state_t;
 
+// VBE controller info, left at VBE_INFO_ADDR by the bootloader
+typedef struct {
+    char signature[4];      // "VESA"
+    uint16_t version;       // BCD, 0x0300 for VBE 3.0
+    uint32_t oem_string;
+    uint32_t capabilities;
+    uint32_t mode_list;     // Real mode far pointer
+    uint16_t total_memory;  // 64KB blocks
+} __attribute__((packed)) vbe_controller_info_t;
+
+// VBE mode info of the mode set, left at VBE_MODE_INFO_ADDR
+typedef struct {
+    uint16_t attributes;
+    uint8_t window_a;
+    uint8_t window_b;
+    uint16_t granularity;
+    uint16_t window_size;
+    uint16_t segment_a;
+    uint16_t segment_b;
+    uint32_t window_function;
+    uint16_t pitch;         // Bytes per scan line
+    uint16_t width;
+    uint16_t height;
+    uint8_t char_width;
+    uint8_t char_height;
+    uint8_t planes;
+    uint8_t bpp;
+    uint8_t banks;
+    uint8_t memory_model;
+    uint8_t bank_size;
+    uint8_t image_pages;
+    uint8_t reserved0;
+    uint8_t red_mask;       // Field sizes and positions, direct color
+    uint8_t red_position;
+    uint8_t green_mask;
+    uint8_t green_position;
+    uint8_t blue_mask;
+    uint8_t blue_position;
+    uint8_t reserved_mask;
+    uint8_t reserved_position;
+    uint8_t direct_color_attributes;
+    uint32_t framebuffer;   // Linear framebuffer physical address (VBE 2.0)
+    uint32_t off_screen_offset;
+    uint16_t off_screen_size;
+    uint16_t linear_pitch;  // Bytes per scan line in linear modes (VBE 3.0)
+} __attribute__((packed)) vbe_mode_info_t;
+
+// A drawing target in the video pixel format: the back buffer, or an
+// off-screen surface like a window's. Drawing reports what it touched to
+// the damage callback, in surface coordinates.
+typedef struct surface {
+    uint8_t* pixels;
+    int width;
+    int height;
+    uint32_t pitch;         // Bytes per row
+    void (*damage)(struct surface* surface, int x, int y, int width, int height);
+    void* owner;
+} surface_t;
+
+// Presentation statistics
+typedef struct {
+    uint32_t frames_presented;
+    uint32_t bytes_presented;   // Copied to video memory
+    uint32_t merges;            // Damage merged because the list was full
+} graphics_stats_t;
+
 // Function prototypes
 int setup_vga_mode(void);
 void setup_hell_palette(void);
+void fill_span(int x, int y, int length, uint8_t color);
+void fill_column(int x, int y, int length, uint8_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint8_t color);
 void draw_rectangle(int x, int y, int width, int height, uint8_t color);
 void draw_char(char c, int x, int y, uint8_t color);
 void draw_flame_effect(int x, int y, int width, int height);
+void draw_glyph_run(const char* text, uint32_t length, int x, int y, uint8_t color);
+void graphics_scroll(int x, int y, int width, int height, int lines, uint8_t fill);
 void shutdown_graphics_driver(void);
 graphics_state_t* get_graphics_state(void);
+void graphics_mark_dirty(int x, int y, int width, int height);
+void graphics_present(void);
+graphics_stats_t* get_graphics_stats(void);
+
+// Surfaces
+surface_t* graphics_screen_surface(void);
+surface_t* surface_create(int width, int height);
+void surface_destroy(surface_t* surface);
+void surface_fill_rect(surface_t* surface, int x, int y, int width, int height, uint8_t color);
+void surface_draw_text(surface_t* surface, const char* text, int x, int y, uint8_t color);
+void surface_draw_glyph_run(surface_t* surface, const char* text, uint32_t length, int x, int y, uint8_t color);
+void surface_scroll(surface_t* surface, int x, int y, int width, int height, int lines, uint8_t fill);
+void surface_blit(surface_t* dest, int x, int y, const surface_t* source, int source_x, int source_y, int width, int height);
 
 #endif // GRAPHICS_H 
\ No newline at end of file
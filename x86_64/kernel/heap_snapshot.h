@@ -0,0 +1,61 @@
+/*
+ * HellOS Heap Snapshot Format
+ * Binary heap snapshot layout shared by the kernel and tools/memory_analyzer
+ */
+
+#ifndef HEAP_SNAPSHOT_H
+#define HEAP_SNAPSHOT_H
+
+#include <stdint.h>
+
+// A snapshot is a header, the size histogram, one record per heap block
+// and one record per allocation call site, all little endian. Over serial
+// it travels as hex lines between HEAP_SNAPSHOT_TAG BEGIN and END markers,
+// with the byte length after BEGIN and an FNV-1a hash after END.
+#define HEAP_SNAPSHOT_MAGIC     0x50414548  // "HEAP"
+#define HEAP_SNAPSHOT_VERSION   1
+#define HEAP_SNAPSHOT_TAG       "[HEAPSNAP]"
+#define HEAP_SNAPSHOT_LINE      32          // Bytes per hex line
+
+// Histogram bucket i counts requests of at most (16 << i) bytes; the last
+// bucket also takes everything larger
+#define HEAP_HISTOGRAM_BUCKETS  16
+#define HEAP_HISTOGRAM_MIN      16
+
+// Header flags
+#define HEAP_SNAPSHOT_PROFILED  0x1         // Built with HEAP_PROFILING, callers are valid
+
+// Block flags
+#define HEAP_BLOCK_FREE         0x1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t flags;
+    uint32_t heap_start;
+    uint32_t heap_end;
+    uint32_t used_bytes;
+    uint32_t free_bytes;
+    uint32_t high_water_bytes;
+    uint32_t largest_free_block;
+    uint32_t block_count;
+    uint32_t site_count;
+    uint32_t histogram_buckets;
+} __attribute__((packed)) heap_snapshot_header_t;
+
+typedef struct {
+    uint32_t offset;    // From heap_start to the block header
+    uint32_t size;      // Payload bytes
+    uint32_t caller;    // Allocating call site, 0 if unknown
+    uint32_t flags;
+} __attribute__((packed)) heap_snapshot_block_t;
+
+typedef struct {
+    uint32_t caller;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live_bytes;
+} __attribute__((packed)) heap_snapshot_site_t;
+
+#endif // HEAP_SNAPSHOT_H
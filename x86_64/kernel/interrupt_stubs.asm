@@ -0,0 +1,124 @@
+; HellOS Interrupt Entry Stubs
+; Pushes a uniform frame for every vector and hands it to interrupt_dispatch
+
+[bits 32]
+
+section .text
+global interrupt_stub_table
+global default_interrupt_stub
+extern interrupt_dispatch
+
+; Exceptions without a CPU error code push a zero so the frame is uniform
+%macro ISR_NOERR 1
+isr_stub_%1:
+    push dword 0
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+%macro ISR_ERR 1
+isr_stub_%1:
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+; CPU exceptions 0-31
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_NOERR 21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_NOERR 29
+ISR_NOERR 30
+ISR_NOERR 31
+
+; PIC IRQs 0-15 remapped to 32-47
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+; Local APIC timer and reschedule IPI (smp.h)
+ISR_NOERR 48
+ISR_NOERR 49
+
+; Software interrupt (interrupts.h)
+ISR_NOERR 50
+
+; Everything above 50, including the local APIC spurious vector
+default_interrupt_stub:
+    push dword 0
+    push dword 255
+    jmp interrupt_common
+
+; Frame layout matches interrupt_frame_t in interrupts.h
+interrupt_common:
+    pushad
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, 0x10               ; Kernel data segment
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    cld                        ; C code assumes DF clear, memmove uses std
+
+    push esp                   ; interrupt_frame_t*
+    call interrupt_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popad
+    add esp, 8                 ; Vector and error code
+    iretd
+
+section .data
+align 4
+interrupt_stub_table:
+%assign vector 0
+%rep 51
+    dd isr_stub_%+vector
+%assign vector vector + 1
+%endrep
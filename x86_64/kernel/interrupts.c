@@ -5,12 +5,20 @@
 
 #include "kernel.h"
 #include "interrupts.h"
+#include "timer.h"
+#include "process.h"
+#include "smp.h"
+#include "deferred.h"
+#include "trace.h"
+#include "audio.h"
 #include <stdint.h>
 
 // IDT constants
 #define IDT_SIZE 256
 #define INTERRUPT_GATE 0x8E
 #define TRAP_GATE 0x8F
+#define PIC_VECTORS  48     // Exceptions plus the 16 remapped PIC IRQs
+#define STUB_VECTORS IRQ_STATS_VECTORS  // ... plus the local APIC vectors and the software one
 
 // Exception constants
 #define EXCEPTION_DIVIDE_BY_ZERO    0
@@ -74,78 +82,58 @@ struct interrupt_stats_s {
     uint32_t spurious_interrupts;
     uint32_t timer_ticks;
     uint32_t keyboard_interrupts;
+    uint32_t keyboard_overruns;     // Scancodes dropped, bottom half too slow
 };
 
 // Global interrupt state
 static idt_entry_t idt[IDT_SIZE];
 static idt_ptr_t idt_ptr;
 static interrupt_stats_t interrupt_stats = {0};
+static interrupt_vector_stats_t vector_stats[STUB_VECTORS];
 static bool interrupts_initialized = false;
 
-// Interrupt handler function pointer type
-typedef void (*interrupt_handler_t)(void);
-
-// Forward declarations
-void default_interrupt_handler(void);
-void exception_handler(uint32_t exception_num, uint32_t error_code);
-void hardware_interrupt_handler(uint32_t irq_num);
-
-// Exception handler functions
-void divide_by_zero_handler(void);
-void debug_handler(void);
-void nmi_handler(void);
-void breakpoint_handler(void);
-void overflow_handler(void);
-void bound_range_handler(void);
-void invalid_opcode_handler(void);
-void device_not_available_handler(void);
-void double_fault_handler(void);
-void invalid_tss_handler(void);
-void segment_not_present_handler(void);
-void stack_fault_handler(void);
-void general_protection_handler(void);
-void page_fault_handler(void);
-void fpu_error_handler(void);
-void alignment_check_handler(void);
-void machine_check_handler(void);
-void simd_fp_error_handler(void);
+// Entry stubs from interrupt_stubs.asm
+extern uint32_t interrupt_stub_table[STUB_VECTORS];
+extern void default_interrupt_stub(void);
 
 // Hardware interrupt handlers
 void timer_interrupt_handler(void);
 void keyboard_interrupt_handler(void);
 
+// Driver handlers for the PIC lines without a built-in one
+static irq_handler_t irq_handlers[16];
+
+// Scancodes queued by the keyboard IRQ for its bottom half. Single
+// producer (the IRQ, on the BSP) and single consumer (the main loop).
+#define KEYBOARD_BUFFER_SIZE 64     // Power of two
+static volatile uint8_t keyboard_buffer[KEYBOARD_BUFFER_SIZE];
+static volatile uint32_t keyboard_head = 0;
+static volatile uint32_t keyboard_tail = 0;
+
+// Bottom halves
+static void keyboard_bottom_half(void* data);
+static void timer_bottom_half(void* data);
+static deferred_work_t keyboard_work = DEFERRED_WORK_INIT(keyboard_bottom_half, NULL, IRQ_KEYBOARD);
+static deferred_work_t timer_work = DEFERRED_WORK_INIT(timer_bottom_half, NULL, IRQ_TIMER);
+
 /*
  * Initialize the interrupt system
  */
 void init_interrupt_system(void) {
     // Initialize IDT
     for (int i = 0; i < IDT_SIZE; i++) {
-        set_idt_entry(i, (uint32_t)default_interrupt_handler, 0x08, INTERRUPT_GATE);
+        set_idt_entry(i, (uint32_t)default_interrupt_stub, 0x08, INTERRUPT_GATE);
     }
     
-    // Set up exception handlers
-    set_idt_entry(EXCEPTION_DIVIDE_BY_ZERO, (uint32_t)divide_by_zero_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_DEBUG, (uint32_t)debug_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_NMI, (uint32_t)nmi_handler, 0x08, INTERRUPT_GATE);
-    set_idt_entry(EXCEPTION_BREAKPOINT, (uint32_t)breakpoint_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_OVERFLOW, (uint32_t)overflow_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_BOUND_RANGE, (uint32_t)bound_range_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_INVALID_OPCODE, (uint32_t)invalid_opcode_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_DEVICE_NOT_AVAIL, (uint32_t)device_not_available_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_DOUBLE_FAULT, (uint32_t)double_fault_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_INVALID_TSS, (uint32_t)invalid_tss_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_SEGMENT_NOT_PRES, (uint32_t)segment_not_present_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_STACK_FAULT, (uint32_t)stack_fault_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_GENERAL_PROT, (uint32_t)general_protection_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_PAGE_FAULT, (uint32_t)page_fault_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_FPU_ERROR, (uint32_t)fpu_error_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_ALIGNMENT_CHECK, (uint32_t)alignment_check_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_MACHINE_CHECK, (uint32_t)machine_check_handler, 0x08, TRAP_GATE);
-    set_idt_entry(EXCEPTION_SIMD_FP_ERROR, (uint32_t)simd_fp_error_handler, 0x08, TRAP_GATE);
+    // Exceptions use trap gates so they don't mask interrupts, except NMI
+    for (int i = 0; i < 32; i++) {
+        set_idt_entry(i, interrupt_stub_table[i], 0x08, i == EXCEPTION_NMI ? INTERRUPT_GATE : TRAP_GATE);
+    }
     
-    // Set up hardware interrupt handlers
-    set_idt_entry(IRQ_TIMER, (uint32_t)timer_interrupt_handler, 0x08, INTERRUPT_GATE);
-    set_idt_entry(IRQ_KEYBOARD, (uint32_t)keyboard_interrupt_handler, 0x08, INTERRUPT_GATE);
+    // Hardware interrupts run with interrupts masked
+    for (int i = IRQ_TIMER; i < STUB_VECTORS; i++) {
+        set_idt_entry(i, interrupt_stub_table[i], 0x08, INTERRUPT_GATE);
+    }
     
     // Initialize PIC (Programmable Interrupt Controller)
     init_pic();
@@ -158,6 +146,13 @@ void init_interrupt_system(void) {
     interrupts_initialized = true;
 }
 
+/*
+ * Load the shared IDT on an application processor
+ */
+void load_interrupt_table(void) {
+    load_idt(&idt_ptr);
+}
+
 /*
  * Set an IDT entry (32-bit)
  */
@@ -190,6 +185,22 @@ void init_pic(void) {
     outb(0xA1, 0xFF); // Slave PIC mask (disable all)
 }
 
+/*
+ * Mask a PIC IRQ line
+ */
+void pic_mask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? 0x21 : 0xA1;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+/*
+ * Unmask a PIC IRQ line
+ */
+void pic_unmask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? 0x21 : 0xA1;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
 /*
  * Load IDT
  */
@@ -208,20 +219,53 @@ void process_interrupts(void) {
     // This function is called from the main kernel loop
     // Hardware interrupts are handled automatically by the IDT
     // This is where we can do any periodic interrupt processing
-    
-    // Update interrupt statistics
+}
+
+/*
+ * Common C entry for every vector, called by the assembly stubs
+ * Handler time is measured before the preemption point at the end, which
+ * may switch away and only come back much later.
+ */
+void interrupt_dispatch(interrupt_frame_t* frame) {
+    uint64_t start = rdtsc();
+    uint32_t vector = frame->vector;
     interrupt_stats.total_interrupts++;
+    TRACE_BEGIN(TRACE_IRQ, vector);
+    
+    bool preempt = false;
+    if (vector < 32) {
+        exception_handler(vector, frame->error_code);
+    } else if (vector < PIC_VECTORS) {
+        hardware_interrupt_handler(vector);
+        preempt = vector == IRQ_TIMER;
+    } else if (vector == LAPIC_TIMER_VECTOR || vector == LAPIC_RESCHEDULE_VECTOR) {
+        // Per-CPU tick on the APs, or another CPU queued work for us
+        lapic_eoi();
+        preempt = true;
+    } else if (vector == SOFTWARE_INTERRUPT_VECTOR) {
+        // Nothing to acknowledge, it came from an int instruction
+        interrupt_stats.software_interrupts++;
+    } else {
+        default_interrupt_handler();
+    }
+    
+    if (vector < STUB_VECTORS) {
+        cycle_histogram_add(&vector_stats[vector].handler, rdtsc() - start);
+    }
+    TRACE_END(TRACE_IRQ, vector);
+    
+    if (preempt) {
+        process_scheduler();
+    }
 }
 
 /*
  * Default interrupt handler
  */
 void default_interrupt_handler(void) {
+    // Nothing is routed above the local APIC vectors; the APIC's own
+    // spurious vector lands here too and must not be acknowledged
     interrupt_stats.spurious_interrupts++;
-    
-    // Send EOI to PIC
-    outb(0x20, 0x20);
-    outb(0xA0, 0x20);
 }
 
 /*
@@ -264,10 +308,18 @@ void exception_handler(uint32_t exception_num, uint32_t error_code) {
 
 /*
  * Hardware interrupt handler
+ * End of interrupt goes out first: the timer handler may switch to another
+ * process, and the PIC must not wait for this one to be resumed.
  */
 void hardware_interrupt_handler(uint32_t irq_num) {
     interrupt_stats.hardware_interrupts++;
     
+    // Send EOI to PIC
+    if (irq_num >= 40) {
+        outb(0xA0, 0x20); // Send EOI to slave PIC
+    }
+    outb(0x20, 0x20); // Send EOI to master PIC
+    
     // Handle specific IRQs
     switch (irq_num) {
         case IRQ_TIMER:
@@ -277,112 +329,75 @@ void hardware_interrupt_handler(uint32_t irq_num) {
             keyboard_interrupt_handler();
             break;
         default:
-            // Unknown hardware interrupt
+            if (irq_handlers[irq_num - IRQ_TIMER]) {
+                irq_handlers[irq_num - IRQ_TIMER]();
+            }
             break;
     }
-    
-    // Send EOI to PIC
-    if (irq_num >= 40) {
-        outb(0xA0, 0x20); // Send EOI to slave PIC
-    }
-    outb(0x20, 0x20); // Send EOI to master PIC
-}
-
-// Exception handlers
-void divide_by_zero_handler(void) {
-    exception_handler(EXCEPTION_DIVIDE_BY_ZERO, 0);
-}
-
-void debug_handler(void) {
-    exception_handler(EXCEPTION_DEBUG, 0);
-}
-
-void nmi_handler(void) {
-    exception_handler(EXCEPTION_NMI, 0);
-}
-
-void breakpoint_handler(void) {
-    exception_handler(EXCEPTION_BREAKPOINT, 0);
-}
-
-void overflow_handler(void) {
-    exception_handler(EXCEPTION_OVERFLOW, 0);
-}
-
-void bound_range_handler(void) {
-    exception_handler(EXCEPTION_BOUND_RANGE, 0);
-}
-
-void invalid_opcode_handler(void) {
-    exception_handler(EXCEPTION_INVALID_OPCODE, 0);
-}
-
-void device_not_available_handler(void) {
-    exception_handler(EXCEPTION_DEVICE_NOT_AVAIL, 0);
-}
-
-void double_fault_handler(void) {
-    exception_handler(EXCEPTION_DOUBLE_FAULT, 0);
 }
 
-void invalid_tss_handler(void) {
-    exception_handler(EXCEPTION_INVALID_TSS, 0);
-}
-
-void segment_not_present_handler(void) {
-    exception_handler(EXCEPTION_SEGMENT_NOT_PRES, 0);
-}
-
-void stack_fault_handler(void) {
-    exception_handler(EXCEPTION_STACK_FAULT, 0);
-}
-
-void general_protection_handler(void) {
-    exception_handler(EXCEPTION_GENERAL_PROT, 0);
-}
-
-void page_fault_handler(void) {
-    exception_handler(EXCEPTION_PAGE_FAULT, 0);
-}
-
-void fpu_error_handler(void) {
-    exception_handler(EXCEPTION_FPU_ERROR, 0);
-}
-
-void alignment_check_handler(void) {
-    exception_handler(EXCEPTION_ALIGNMENT_CHECK, 0);
-}
-
-void machine_check_handler(void) {
-    exception_handler(EXCEPTION_MACHINE_CHECK, 0);
-}
-
-void simd_fp_error_handler(void) {
-    exception_handler(EXCEPTION_SIMD_FP_ERROR, 0);
+/*
+ * Route a PIC line to a driver's handler and unmask it
+ */
+void register_irq_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= 16) {
+        return;
+    }
+    irq_handlers[irq] = handler;
+    pic_unmask_irq(irq);
 }
 
 // Hardware interrupt handlers
 void timer_interrupt_handler(void) {
     interrupt_stats.timer_ticks++;
     
-    // Timer interrupt - used for scheduling
-    // This is where we would do process switching
-    
     // Play periodic hellish sounds
     if (interrupt_stats.timer_ticks % 1000 == 0) {
         // Every 1000 ticks, make a subtle demonic sound
-        play_note(2, NOTE_C1, WAVE_SAW, 50);
+        defer_work(&timer_work);
     }
+    
+    // Advance the clock; interrupt_dispatch preempts afterwards
+    timer_tick();
 }
 
 void keyboard_interrupt_handler(void) {
     interrupt_stats.keyboard_interrupts++;
     
-    // Read scancode from keyboard
+    // Read scancode from keyboard and leave the rest to the bottom half,
+    // the shell draws its echo from there
     uint8_t scancode = inb(0x60);
-    
-    // Process keyboard input
-    process_keyboard_input(scancode);
+    if (keyboard_head - keyboard_tail < KEYBOARD_BUFFER_SIZE) {
+        keyboard_buffer[keyboard_head % KEYBOARD_BUFFER_SIZE] = scancode;
+        keyboard_head++;
+    } else {
+        interrupt_stats.keyboard_overruns++;
+    }
+    defer_work(&keyboard_work);
+}
+
+/*
+ * Keyboard bottom half: feed every queued scancode to the shell
+ */
+static void keyboard_bottom_half(void* data) {
+    (void)data;
+    while (keyboard_tail != keyboard_head) {
+        uint8_t scancode = keyboard_buffer[keyboard_tail % KEYBOARD_BUFFER_SIZE];
+        keyboard_tail++;
+        process_keyboard_input(scancode);
+    }
+}
+
+/*
+ * Timer bottom half: the periodic demonic chime
+ */
+static void timer_bottom_half(void* data) {
+    (void)data;
+    static const audio_note_t chime[] = {
+        {NOTE_C1, WAVE_SAW, 200},
+        {0, 0, 0}
+    };
+    audio_play_sequence(chime, 50, AUDIO_NO_SEQUENCE);
 }
 
 /*
@@ -415,6 +430,71 @@ interrupt_stats_t* get_interrupt_stats(void) {
     return &interrupt_stats;
 }
 
+/*
+ * Get the timing histograms of one vector, NULL if it has no stub
+ */
+const interrupt_vector_stats_t* get_interrupt_vector_stats(uint32_t vector) {
+    return vector < STUB_VECTORS ? &vector_stats[vector] : NULL;
+}
+
+/*
+ * Record a bottom half run for the vector that queued it
+ */
+void interrupt_record_deferred(uint32_t vector, uint64_t latency, uint64_t duration) {
+    if (vector >= STUB_VECTORS) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    cycle_histogram_add(&vector_stats[vector].latency, latency);
+    cycle_histogram_add(&vector_stats[vector].deferred, duration);
+    irq_restore(flags);
+}
+
+/*
+ * Count a sample into its log2 bucket
+ * Counters are plain increments: exact per CPU, approximate when two
+ * CPUs take the same vector at once, which only the LAPIC vectors do.
+ */
+void cycle_histogram_add(cycle_histogram_t* histogram, uint64_t cycles) {
+    uint32_t sample = (cycles >> 32) ? 0xFFFFFFFF : (uint32_t)cycles;
+    uint32_t log2 = 31 - __builtin_clz(sample | 1);
+    uint32_t bucket = (log2 > IRQ_HISTOGRAM_SHIFT) ? log2 - IRQ_HISTOGRAM_SHIFT : 0;
+    if (bucket >= IRQ_HISTOGRAM_BUCKETS) {
+        bucket = IRQ_HISTOGRAM_BUCKETS - 1;
+    }
+    
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (sample > histogram->max_cycles) {
+        histogram->max_cycles = sample;
+    }
+}
+
+/*
+ * Upper bound in cycles of the bucket holding the given percentile
+ * The last bucket is open-ended, so its bound is the largest sample.
+ */
+uint32_t cycle_histogram_percentile(const cycle_histogram_t* histogram, uint32_t percent) {
+    if (!histogram->count) {
+        return 0;
+    }
+    
+    // Rank of the sample, rounded up (the 99th percentile of 10 is the
+    // 10th), split so the product stays within 32 bits
+    uint32_t count = histogram->count;
+    uint32_t rank = count / 100 * percent + (count % 100 * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < IRQ_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint32_t bound = 1U << (IRQ_HISTOGRAM_SHIFT + i + 1);
+            return bound < histogram->max_cycles ? bound : histogram->max_cycles;
+        }
+    }
+    return histogram->max_cycles;
+}
+
 /*
  * Enable interrupts
  */
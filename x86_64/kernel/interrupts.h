@@ -14,12 +14,53 @@ typedef struct idt_entry_s idt_entry_t;
 typedef struct idt_ptr_s idt_ptr_t;
 typedef struct interrupt_stats_s interrupt_stats_t;
 
+// Cycle histograms: log2 buckets, bucket 0 holds everything below
+// 2^(IRQ_HISTOGRAM_SHIFT + 1) cycles and the last bucket everything above
+#define IRQ_HISTOGRAM_BUCKETS   16
+#define IRQ_HISTOGRAM_SHIFT     8
+#define IRQ_STATS_VECTORS       51      // Vectors with an entry stub
+
+// Raised only by an explicit int, never by a device: the benchmarks time
+// the entry and exit path with it
+#define SOFTWARE_INTERRUPT_VECTOR   50
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint32_t buckets[IRQ_HISTOGRAM_BUCKETS];
+} cycle_histogram_t;
+
+// Where a vector's time goes: its handler, the wait until its deferred
+// work starts, and the deferred work itself (RDTSC cycles)
+typedef struct {
+    cycle_histogram_t handler;      // Top half, dispatch to return
+    cycle_histogram_t latency;      // Top half queueing to bottom half start
+    cycle_histogram_t deferred;     // Bottom half run time
+} interrupt_vector_stats_t;
+
+// A driver's handler for its PIC line, run after the EOI with interrupts
+// masked; it should do little more than acknowledge the device and hand
+// the rest to deferred work
+typedef void (*irq_handler_t)(void);
+
+// Register frame pushed by the entry stubs in interrupt_stubs.asm
+typedef struct {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // pushad
+    uint32_t vector;
+    uint32_t error_code;
+    uint32_t eip, cs, eflags;                         // Pushed by the CPU
+} __attribute__((packed)) interrupt_frame_t;
+
 // Interrupt system functions
 void init_interrupt_system(void);
 void process_interrupts(void);
 void set_idt_entry(int num, uint32_t handler, uint16_t selector, uint8_t flags);
 void init_pic(void);
+void pic_mask_irq(uint8_t irq);
+void pic_unmask_irq(uint8_t irq);
 void load_idt(idt_ptr_t* idt_ptr);
+void load_interrupt_table(void);
 
 // Interrupt control functions
 void enable_interrupts(void);
@@ -27,12 +68,18 @@ void disable_interrupts(void);
 bool interrupts_enabled(void);
 
 // Interrupt handlers
+void interrupt_dispatch(interrupt_frame_t* frame);
 void default_interrupt_handler(void);
 void exception_handler(uint32_t exception_num, uint32_t error_code);
 void hardware_interrupt_handler(uint32_t irq_num);
+void register_irq_handler(uint8_t irq, irq_handler_t handler);
 void process_keyboard_input(uint8_t scancode);
 
 // Statistics
 interrupt_stats_t* get_interrupt_stats(void);
+const interrupt_vector_stats_t* get_interrupt_vector_stats(uint32_t vector);
+void interrupt_record_deferred(uint32_t vector, uint64_t latency, uint64_t duration);
+void cycle_histogram_add(cycle_histogram_t* histogram, uint64_t cycles);
+uint32_t cycle_histogram_percentile(const cycle_histogram_t* histogram, uint32_t percent);
 
 #endif // INTERRUPTS_H 
\ No newline at end of file
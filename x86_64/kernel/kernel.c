@@ -6,9 +6,18 @@
 #include "kernel.h"
 #include "debug.h"
 #include "memory.h"
+#include "paging.h"
 #include "interrupts.h"
+#include "timer.h"
+#include "wakeup.h"
+#include "deferred.h"
+#include "smp.h"
+#include "trace.h"
+#include "boot.h"
 #include "graphics.h"
 #include "audio.h"
+#include "pci.h"
+#include "bench.h"
 
 // Global kernel state
 kernel_state_t kernel_state;
@@ -21,75 +30,117 @@ extern uint64_t framebuffer_base;
  * Called from bootloader after UEFI exit
  */
 void kernel_main(void) {
+    // Boot time counts from here, and the debug timestamps with it
+    timer_calibrate_tsc();
+    int boot_phase = boot_phase_begin("kernel");
+    
     // Initialize debug system first for early debugging
     debug_early_init();
     
     DEBUG_KERNEL(DEBUG_LEVEL_INFO, "HellOS kernel starting up...");
     
     // Initialize kernel state
-    kernel_state.boot_time = 0; // TODO: Get actual time
-    kernel_state.memory_size = 0; // TODO: Get from memory map
+    kernel_state.boot_time = timer_get_boot_tsc();
+    kernel_state.memory_size = 0;
     kernel_state.status = KERNEL_STATUS_INITIALIZING;
     
     DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Initializing core subsystems...");
     
     // Initialize core subsystems
+    int phase = boot_phase_begin("memory");
     init_memory_manager();
+    kernel_state.memory_size = (uint64_t)pfa_get_total_frames() * PAGE_SIZE;
+    boot_phase_end(phase);
     DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Memory manager initialized");
     
+    phase = boot_phase_begin("interrupts");
     init_interrupt_system();
+    init_wakeup_sources();
+    init_deferred_work();
+    boot_phase_end(phase);
     DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Interrupt system initialized");
     
+    phase = boot_phase_begin("processes");
     init_process_manager();
+    boot_phase_end(phase);
     DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Process manager initialized");
     
-    init_graphics_system();
-    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Graphics system initialized");
-    
-    init_audio_system();
-    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Audio system initialized");
-    
     // Full debug system initialization (after memory manager)
+    phase = boot_phase_begin("debug");
     debug_init();
+    boot_phase_end(phase);
     
-    // Display hellish boot screen
-    display_hell_screen();
+    // Start the scheduler tick and let preemption begin, so the driver
+    // init tasks can run side by side
+    init_timer(TIMER_HZ);
+    enable_interrupts();
+    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "Timer running at %d Hz", TIMER_HZ);
     
-    // Play demonic startup sound
-    play_startup_sound();
+    // The other CPUs calibrate against the running clock
+    phase = boot_phase_begin("smp");
+    init_smp();
+    boot_phase_end(phase);
     
-    // Initialize device drivers
+    // Initialize device drivers, the boot screen and the infernal shell
+    phase = boot_phase_begin("drivers");
     init_drivers();
+    boot_phase_end(phase);
+    boot_phase_end(boot_phase);
     
-    // Start the infernal shell
-    start_infernal_shell();
+#ifdef HELL_BENCH_AT_BOOT
+    // Benchmark build (make bench): measure the booted system with the
+    // startup sound silenced, then leave through QEMU's isa-debug-exit
+    audio_cancel_all_sequences();
+    bench_run_all(NULL, NULL);
+    outb(QEMU_DEBUG_EXIT_PORT, 0);
+#endif
     
     // Main kernel loop
     kernel_main_loop();
 }
 
 /*
- * Initialize all device drivers
+ * Init tasks
+ * Each wraps one step of bringing up the drivers and the shell. The
+ * startup sound is a background task so the shell doesn't wait for it.
  */
-void init_drivers(void) {
-    DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Initializing device drivers...");
-    
-    // Graphics driver
+enum {
+    BOOT_TASK_GRAPHICS,
+    BOOT_TASK_AUDIO,
+    BOOT_TASK_PCI,
+    BOOT_TASK_NETWORK,
+    BOOT_TASK_SPLASH,
+    BOOT_TASK_STARTUP_SOUND,
+    BOOT_TASK_SHELL,
+    BOOT_TASK_COUNT
+};
+
+static void init_graphics_task(void) {
+    init_graphics_system();
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Initializing graphics driver...");
     if (init_hell_graphics_driver() != 0) {
         DEBUG_DRIVERS(DEBUG_LEVEL_ERROR, "Failed to initialize graphics driver");
         kernel_panic("Failed to initialize graphics driver");
     }
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Graphics driver initialized successfully");
-    
-    // Audio driver
+}
+
+static void init_audio_task(void) {
+    init_audio_system();
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Initializing audio driver...");
     if (init_hell_audio_driver() != 0) {
         DEBUG_DRIVERS(DEBUG_LEVEL_ERROR, "Failed to initialize audio driver");
         kernel_panic("Failed to initialize audio driver");
     }
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Audio driver initialized successfully");
-    
+}
+
+static void init_pci_task(void) {
+    // Cards are looked up by the drivers that depend on this
+    pci_init();
+}
+
+static void init_network_task(void) {
     // Network driver (basic)
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Initializing network driver...");
     if (init_network_driver() != 0) {
@@ -97,15 +148,45 @@ void init_drivers(void) {
         kernel_panic("Failed to initialize network driver");
     }
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Network driver initialized successfully");
-    
+}
+
+static void init_shell_task(void) {
+    // Every driver is a dependency
     kernel_state.status = KERNEL_STATUS_DRIVERS_LOADED;
     DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "All device drivers loaded successfully");
+    
+    start_infernal_shell();
+    boot_mark_shell_ready();
+}
+
+static const init_task_t boot_tasks[BOOT_TASK_COUNT] = {
+    [BOOT_TASK_GRAPHICS] = {"graphics", init_graphics_task, 0, false},
+    [BOOT_TASK_AUDIO] = {"audio", init_audio_task, 0, false},
+    [BOOT_TASK_PCI] = {"pci", init_pci_task, 0, false},
+    [BOOT_TASK_NETWORK] = {"network", init_network_task, BOOT_TASK(BOOT_TASK_PCI), false},
+    [BOOT_TASK_SPLASH] = {"splash", display_hell_screen, BOOT_TASK(BOOT_TASK_GRAPHICS), false},
+    [BOOT_TASK_STARTUP_SOUND] = {"startup_sound", play_startup_sound, BOOT_TASK(BOOT_TASK_AUDIO), true},
+    [BOOT_TASK_SHELL] = {"shell", init_shell_task,
+                         BOOT_TASK(BOOT_TASK_GRAPHICS) | BOOT_TASK(BOOT_TASK_AUDIO) |
+                         BOOT_TASK(BOOT_TASK_NETWORK) | BOOT_TASK(BOOT_TASK_SPLASH), false},
+};
+
+/*
+ * Initialize all device drivers
+ * Independent drivers initialize concurrently; returns once the shell is
+ * up, with the startup sound possibly still playing.
+ */
+void init_drivers(void) {
+    DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "Initializing device drivers...");
+    run_init_tasks(boot_tasks, BOOT_TASK_COUNT);
 }
 
 /*
  * Display the hellish boot screen
  */
 void display_hell_screen(void) {
+    TRACE_BEGIN(TRACE_FRAME, 0);
+    
     // Clear screen with dark red background
     clear_screen(COLOR_HELL_RED);
     
@@ -120,6 +201,8 @@ void display_hell_screen(void) {
     
     // Draw flame effects around the border
     draw_flame_border();
+    
+    TRACE_END(TRACE_FRAME, 0);
 }
 
 /*
@@ -134,7 +217,7 @@ void play_startup_sound(void) {
         {0, 0, 0} // End marker
     };
     
-    play_audio_sequence(startup_chord, 3); // Use all 3 channels
+    audio_play_sequence(startup_chord, AUDIO_SEQUENCE_VOLUME, AUDIO_NO_SEQUENCE);
 }
 
 /*
@@ -158,25 +241,18 @@ void start_infernal_shell(void) {
 
 /*
  * Main kernel event loop
+ * Subsystems register wakeup sources and are run only when signalled by
+ * an interrupt or a deadline; with nothing pending the kernel process
+ * blocks and the idle process halts the CPU.
  */
 void kernel_main_loop(void) {
     kernel_state.status = KERNEL_STATUS_RUNNING;
     
     while (kernel_state.status == KERNEL_STATUS_RUNNING) {
-        // Process hardware interrupts
-        process_interrupts();
-        
-        // Update window manager
-        update_pandemonium_wm();
-        
-        // Update audio system
-        update_audio_system();
-        
-        // Process network packets
-        process_network_packets();
-        
-        // Yield to other processes (cooperative multitasking)
-        yield_cpu();
+        // Run whatever was signalled, sleep until something is
+        if (wakeup_run_pending() == 0) {
+            wakeup_wait();
+        }
         
         // Check for system shutdown
         if (check_shutdown_request()) {
@@ -209,9 +285,16 @@ void kernel_shutdown(void) {
     clear_screen(COLOR_VOID_BLACK);
     draw_text("The infernal realm is closing...", 10, 10, COLOR_HELL_RED);
     draw_text("All souls have been processed.", 10, 30, COLOR_HELL_RED);
+    graphics_present();
     
-    // Final shutdown sound
+    // Final shutdown sound; the main loop is done, so run the wakeups
+    // here until it has played out
     play_shutdown_sound();
+    while (!audio_sequencer_idle()) {
+        if (wakeup_run_pending() == 0) {
+            wakeup_wait();
+        }
+    }
     
     // Halt system
     kernel_state.status = KERNEL_STATUS_HALTED;
@@ -248,25 +331,15 @@ void draw_hell_logo(void) {
  */
 void draw_flame_border(void) {
     // Simple flame effect around screen border
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
-        // Top border
-        draw_pixel(x, 0, COLOR_FLAME_ORANGE);
-        draw_pixel(x, 1, COLOR_HELL_RED);
-        
-        // Bottom border
-        draw_pixel(x, SCREEN_HEIGHT - 1, COLOR_FLAME_ORANGE);
-        draw_pixel(x, SCREEN_HEIGHT - 2, COLOR_HELL_RED);
-    }
-    
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        // Left border
-        draw_pixel(0, y, COLOR_FLAME_ORANGE);
-        draw_pixel(1, y, COLOR_HELL_RED);
-        
-        // Right border
-        draw_pixel(SCREEN_WIDTH - 1, y, COLOR_FLAME_ORANGE);
-        draw_pixel(SCREEN_WIDTH - 2, y, COLOR_HELL_RED);
-    }
+    fill_span(0, 0, SCREEN_WIDTH, COLOR_FLAME_ORANGE);
+    fill_span(0, 1, SCREEN_WIDTH, COLOR_HELL_RED);
+    fill_span(0, SCREEN_HEIGHT - 1, SCREEN_WIDTH, COLOR_FLAME_ORANGE);
+    fill_span(0, SCREEN_HEIGHT - 2, SCREEN_WIDTH, COLOR_HELL_RED);
+    
+    fill_column(0, 0, SCREEN_HEIGHT, COLOR_FLAME_ORANGE);
+    fill_column(1, 0, SCREEN_HEIGHT, COLOR_HELL_RED);
+    fill_column(SCREEN_WIDTH - 1, 0, SCREEN_HEIGHT, COLOR_FLAME_ORANGE);
+    fill_column(SCREEN_WIDTH - 2, 0, SCREEN_HEIGHT, COLOR_HELL_RED);
 }
 
 /*
@@ -281,7 +354,7 @@ void play_error_sound(void) {
         {0, 0, 0}
     };
     
-    play_audio_sequence(error_sound, 3);
+    audio_play_sequence(error_sound, AUDIO_SEQUENCE_VOLUME, AUDIO_NO_SEQUENCE);
 }
 
 /*
@@ -296,5 +369,5 @@ void play_shutdown_sound(void) {
         {0, 0, 0}
     };
     
-    play_audio_sequence(shutdown_sound, 3);
+    audio_play_sequence(shutdown_sound, AUDIO_SEQUENCE_VOLUME, AUDIO_NO_SEQUENCE);
 } 
\ No newline at end of file
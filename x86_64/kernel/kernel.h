@@ -65,6 +65,7 @@ typedef struct {
 #define WAVE_SINE     0
 #define WAVE_SQUARE   1
 #define WAVE_SAW      2
+#define WAVE_REST     3     // Silence for the note's duration, any frequency
 
 // Musical notes (frequencies in Hz)
 #define NOTE_C1   33
@@ -85,8 +86,8 @@ typedef struct window {
     int width, height;
     bool visible;
     bool focused;
-    uint8_t* framebuffer;
-    struct window* next;
+    struct surface* surface;    // What the window shows, drawn by its owner
+    struct window* next;        // The window below, in front to back order
 } window_t;
 
 // Process structure
@@ -117,10 +118,21 @@ typedef struct process {
     uint64_t cpu_time;
     uint64_t last_scheduled;
     uint32_t time_slice;
+    uint32_t effective_priority;  // Ready queue level, raised by aging
+    uint64_t enqueue_time;        // When it joined its ready queue
+    bool on_run_queue;
+    struct process* run_next;     // Ready queue links
+    struct process* run_prev;
+    uint32_t cpu;                 // CPU whose queue holds it, or that last ran it
+    volatile bool on_cpu;         // Its stack is in use on some CPU
+    volatile bool wake_pending;   // Woken while still running, don't block
+    struct wait_queue* waiting_on;  // Wait queue it is parked on, if any
+    struct process* wait_next;
     
     // List management
     struct process* next;
     struct process* prev;
+    struct process* pid_next;     // PID hash chain
     
     // Process flags
     bool is_demon;        // System process
@@ -155,7 +167,6 @@ void draw_rectangle(int x, int y, int width, int height, uint8_t color);
 // Audio functions
 void play_error_sound(void);
 void play_shutdown_sound(void);
-void play_audio_sequence(audio_note_t* sequence, int channels);
 void play_note(int channel, uint16_t frequency, uint8_t waveform, uint8_t volume);
 
 // System functions
@@ -190,8 +201,7 @@ int init_network_driver(void);
 
 // System updates
 void process_interrupts(void);
-void update_audio_system(void);
-void process_network_packets(void);
+uint32_t process_network_packets(void);
 
 // Global kernel state
 extern kernel_state_t kernel_state;
@@ -227,6 +237,53 @@ static inline uint32_t inl(uint16_t port) {
     return ret;
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+// Model specific registers
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+// Time stamp counter, in CPU cycles since reset
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Unsigned 64 by 32-bit division without libgcc's __udivdi3
+static inline uint64_t div64_32(uint64_t dividend, uint32_t divisor) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotient_high = high / divisor;
+    uint32_t quotient_low;
+    high %= divisor;
+    // high < divisor, so the quotient fits in 32 bits
+    __asm__ ("divl %2" : "=a"(quotient_low), "+d"(high) : "rm"(divisor), "a"(low));
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+// Disable interrupts and return the previous EFLAGS for irq_restore
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
 // Memory management macros
 #define ALIGN_UP(addr, align) (((addr) + (align) - 1) & ~((align) - 1))
 #define ALIGN_DOWN(addr, align) ((addr) & ~((align) - 1))
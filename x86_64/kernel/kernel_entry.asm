@@ -6,6 +6,8 @@
 section .text
 global _start                   ; Entry point
 extern kernel_main              ; C kernel main function
+extern __bss_start              ; Linker script
+extern __bss_end
 
 _start:
     ; We're now in 32-bit protected mode
@@ -21,6 +23,13 @@ _start:
     mov esp, 0x90000           ; Set stack pointer
     mov ebp, esp
     
+    ; Zero .bss, which the image on disk doesn't carry
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    xor eax, eax
+    rep stosb
+    
     ; Clear screen with hellish message
     call clear_screen_hell
     
@@ -5,14 +5,25 @@
 
 #include "kernel.h"
 #include "memory.h"
+#include "paging.h"
+#include "debug.h"
+#include "spinlock.h"
+#include "trace.h"
 #include <stdint.h>
 
 // Memory constants
-#define PAGE_SIZE 4096
-#define HEAP_START 0x200000  // 2MB
-#define HEAP_SIZE 0x800000   // 8MB heap
 #define MAX_BLOCKS 1024
 
+// Segregated free list geometry (TLSF-style two-level bins)
+// First level splits sizes by power of two, second level splits each
+// power-of-two range into HEAP_SL_COUNT linear slices.
+#define HEAP_SL_LOG2        3
+#define HEAP_SL_COUNT       (1 << HEAP_SL_LOG2)
+#define HEAP_FL_SHIFT       (HEAP_SL_LOG2 + 4)
+#define HEAP_SMALL_BLOCK    (1 << HEAP_FL_SHIFT)   // Sizes below this share first-level bin 0
+#define HEAP_FL_COUNT       (32 - HEAP_FL_SHIFT + 1)
+#define MEMORY_BIN_COUNT    HEAP_FL_COUNT
+
 // Memory block structure for heap management
 struct memory_block_s {
     uint32_t size;
@@ -20,8 +31,21 @@ struct memory_block_s {
     struct memory_block_s* next;
     struct memory_block_s* prev;
     uint32_t magic;  // Magic number for corruption detection
+#ifdef HEAP_PROFILING
+    uint32_t caller; // Allocating call site
+#endif
 };
 
+// Free list links live in the payload of free blocks, so the header
+// does not grow and allocated blocks pay nothing for them
+typedef struct {
+    memory_block_t* next_free;
+    memory_block_t* prev_free;
+} free_links_t;
+
+#define BLOCK_FREE_LINKS(block) ((free_links_t*)((uint8_t*)(block) + sizeof(memory_block_t)))
+#define MIN_BLOCK_SIZE ALIGN_UP(sizeof(free_links_t), 8)
+
 // Memory statistics
 struct memory_stats_s {
     uint64_t total_memory;
@@ -30,13 +54,76 @@ struct memory_stats_s {
     uint32_t allocated_blocks;
     uint32_t free_blocks;
     uint32_t corrupted_blocks;
+    uint32_t bin_free_blocks[MEMORY_BIN_COUNT];  // Free blocks per first-level size class
+    uint64_t high_water_memory;                  // Peak of used_memory
+    uint32_t size_histogram[HEAP_HISTOGRAM_BUCKETS];  // Requests by size class
+};
+
+// Call site tracking, an open-addressed table keyed by return address
+#ifdef HEAP_PROFILING
+#define HEAP_PROFILE_SITES 128
+#define HEAP_CALLER() ((uint32_t)(uintptr_t)__builtin_return_address(0))
+static heap_snapshot_site_t heap_sites[HEAP_PROFILE_SITES];
+static uint32_t heap_site_count = 0;
+#else
+#define HEAP_CALLER() 0
+#endif
+
+// Slab header at the start of every chunk a cache carves objects from
+typedef struct kmem_slab_s {
+    struct kmem_slab_s* next;
+} kmem_slab_t;
+
+// Slab cache: objects are handed out from a per-cache free list that is
+// threaded through the first word of each free object, so objects carry
+// no header of their own
+struct kmem_cache_s {
+    char name[32];
+    uint32_t object_size;       // Rounded up to the alignment
+    uint32_t align;
+    uint32_t slab_size;         // Bytes requested from the heap per slab
+    uint32_t objects_per_slab;
+    spinlock_t lock;            // Each cache locks on its own, off the heap lock
+    void* free_objects;
+    kmem_slab_t* slabs;
+    uint32_t slab_count;
+    uint32_t total_objects;
+    uint32_t active_objects;
+};
+
+// Arena chunk: a header followed by the bump-allocated space
+typedef struct arena_chunk_s {
+    struct arena_chunk_s* prev;  // Older chunk, NULL for the base chunk
+    uint32_t size;               // Usable bytes after the header
+    uint32_t used;
+} arena_chunk_t;
+
+// Arena: allocations bump through the newest chunk and are only ever
+// released together, by a reset or by returning to a mark
+struct arena_s {
+    arena_chunk_t* current;
+    uint32_t chunk_size;
 };
 
 // Global memory state
 static memory_block_t* heap_start = NULL;
 static memory_block_t* heap_end = NULL;
+static memory_block_t* heap_sentinel = NULL;  // Zero-size allocated block closing the heap
 static memory_stats_t memory_stats = {0};
 static bool memory_initialized = false;
+static spinlock_t heap_lock = SPINLOCK_INIT;     // Bins, block list and statistics
+
+// Segregated free lists and their occupancy bitmaps
+static memory_block_t* free_lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[HEAP_FL_COUNT];
+
+// Forward declarations
+static void insert_free_block(memory_block_t* block);
+static void remove_free_block(memory_block_t* block);
+static bool heap_grow(size_t size);
+static void* heap_alloc(size_t size, uint32_t caller);
+static void* heap_alloc_locked(size_t size, uint32_t caller);
 
 // Magic numbers for corruption detection
 #define BLOCK_MAGIC_ALLOCATED 0xDEADBEEF
@@ -47,32 +134,232 @@ static bool memory_initialized = false;
  * Initialize the memory management system
  */
 void init_memory_manager(void) {
+    // Physical memory first: the heap is carved out of page frames
+    init_page_frame_allocator();
+    if (!pfa_claim_frames(HEAP_START, HEAP_INITIAL_SIZE / PAGE_SIZE)) {
+        return;  // Not enough RAM for even the initial heap
+    }
+    init_paging();
+    
     // Initialize heap
     heap_start = (memory_block_t*)HEAP_START;
-    heap_end = (memory_block_t*)(HEAP_START + HEAP_SIZE);
+    heap_end = (memory_block_t*)(HEAP_START + HEAP_INITIAL_SIZE);
+    heap_sentinel = (memory_block_t*)((uint8_t*)heap_end - sizeof(memory_block_t));
     
     // Create initial free block
-    heap_start->size = HEAP_SIZE - sizeof(memory_block_t);
+    heap_start->size = HEAP_INITIAL_SIZE - 2 * sizeof(memory_block_t);
     heap_start->is_free = true;
-    heap_start->next = NULL;
+    heap_start->next = heap_sentinel;
     heap_start->prev = NULL;
     heap_start->magic = BLOCK_MAGIC_FREE;
     
+    // The sentinel is never free, so coalescing stops at the heap end
+    heap_sentinel->size = 0;
+    heap_sentinel->is_free = false;
+    heap_sentinel->next = NULL;
+    heap_sentinel->prev = heap_start;
+    heap_sentinel->magic = BLOCK_MAGIC_ALLOCATED;
+    
+    // Reset the segregated free lists
+    for (int fl = 0; fl < HEAP_FL_COUNT; fl++) {
+        for (int sl = 0; sl < HEAP_SL_COUNT; sl++) {
+            free_lists[fl][sl] = NULL;
+        }
+        sl_bitmap[fl] = 0;
+        memory_stats.bin_free_blocks[fl] = 0;
+    }
+    fl_bitmap = 0;
+    
     // Initialize statistics
-    memory_stats.total_memory = HEAP_SIZE;
-    memory_stats.used_memory = sizeof(memory_block_t);
-    memory_stats.free_memory = HEAP_SIZE - sizeof(memory_block_t);
+    memory_stats.total_memory = HEAP_INITIAL_SIZE;
+    memory_stats.used_memory = 2 * sizeof(memory_block_t);
+    memory_stats.free_memory = heap_start->size;
     memory_stats.allocated_blocks = 0;
     memory_stats.free_blocks = 1;
     memory_stats.corrupted_blocks = 0;
+    memory_stats.high_water_memory = memory_stats.used_memory;
+    for (int i = 0; i < HEAP_HISTOGRAM_BUCKETS; i++) {
+        memory_stats.size_histogram[i] = 0;
+    }
+    
+    insert_free_block(heap_start);
     
     memory_initialized = true;
 }
 
+/*
+ * Index of the most significant set bit (x must be non-zero)
+ */
+static inline uint32_t heap_fls(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+/*
+ * Map a block size to the bin that holds it
+ */
+static void mapping_insert(uint32_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < HEAP_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size / (HEAP_SMALL_BLOCK / HEAP_SL_COUNT);
+    } else {
+        uint32_t f = heap_fls(size);
+        *sl = (size >> (f - HEAP_SL_LOG2)) ^ HEAP_SL_COUNT;
+        *fl = f - HEAP_FL_SHIFT + 1;
+    }
+}
+
+/*
+ * Map a request size to the first bin whose blocks are all large enough
+ */
+static void mapping_search(uint32_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < HEAP_SMALL_BLOCK) {
+        size = ALIGN_UP(size, HEAP_SMALL_BLOCK / HEAP_SL_COUNT);
+    } else {
+        size += (1U << (heap_fls(size) - HEAP_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+/*
+ * File a free block into its size-class bin
+ */
+static void insert_free_block(memory_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+    
+    free_links_t* links = BLOCK_FREE_LINKS(block);
+    links->prev_free = NULL;
+    links->next_free = free_lists[fl][sl];
+    if (links->next_free) {
+        BLOCK_FREE_LINKS(links->next_free)->prev_free = block;
+    }
+    free_lists[fl][sl] = block;
+    
+    fl_bitmap |= BIT(fl);
+    sl_bitmap[fl] |= BIT(sl);
+    memory_stats.bin_free_blocks[fl]++;
+}
+
+/*
+ * Unlink a free block from its size-class bin
+ */
+static void remove_free_block(memory_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+    
+    free_links_t* links = BLOCK_FREE_LINKS(block);
+    if (links->prev_free) {
+        BLOCK_FREE_LINKS(links->prev_free)->next_free = links->next_free;
+    } else {
+        free_lists[fl][sl] = links->next_free;
+    }
+    if (links->next_free) {
+        BLOCK_FREE_LINKS(links->next_free)->prev_free = links->prev_free;
+    }
+    
+    // Clear bitmap bits once the bin runs empty
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~BIT(sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~BIT(fl);
+        }
+    }
+    memory_stats.bin_free_blocks[fl]--;
+}
+
+#ifdef HEAP_PROFILING
+/*
+ * Find or add the profile entry for a call site
+ * Returns NULL once the table is full; those sites go untracked.
+ */
+static heap_snapshot_site_t* profile_site(uint32_t caller, bool create) {
+    uint32_t slot = ((caller >> 2) * 2654435761U) % HEAP_PROFILE_SITES;
+    for (uint32_t probe = 0; probe < HEAP_PROFILE_SITES; probe++) {
+        heap_snapshot_site_t* site = &heap_sites[(slot + probe) % HEAP_PROFILE_SITES];
+        if (site->caller == caller) {
+            return site;
+        }
+        if (site->caller == 0) {
+            if (!create) {
+                return NULL;
+            }
+            site->caller = caller;
+            heap_site_count++;
+            return site;
+        }
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Record an allocation in the heap profile
+ */
+static void profile_alloc(memory_block_t* block, size_t request, uint32_t caller) {
+    uint32_t bucket = 0;
+    if (request > HEAP_HISTOGRAM_MIN) {
+        bucket = heap_fls((uint32_t)request - 1) - 3;
+        if (bucket >= HEAP_HISTOGRAM_BUCKETS) {
+            bucket = HEAP_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+    memory_stats.size_histogram[bucket]++;
+    
+    if (memory_stats.used_memory > memory_stats.high_water_memory) {
+        memory_stats.high_water_memory = memory_stats.used_memory;
+    }
+    
+#ifdef HEAP_PROFILING
+    block->caller = caller;
+    heap_snapshot_site_t* site = profile_site(caller, true);
+    if (site) {
+        site->allocs++;
+        site->live_bytes += block->size;
+    }
+#else
+    (void)block;
+    (void)caller;
+#endif
+}
+
+/*
+ * Record a free in the heap profile
+ */
+static void profile_free(memory_block_t* block) {
+#ifdef HEAP_PROFILING
+    heap_snapshot_site_t* site = profile_site(block->caller, false);
+    if (site) {
+        site->frees++;
+        site->live_bytes -= block->size;
+    }
+#else
+    (void)block;
+#endif
+}
+
 /*
  * Allocate memory from the infernal heap
  */
 void* malloc(size_t size) {
+    return heap_alloc(size, HEAP_CALLER());
+}
+
+/*
+ * Allocate a block on behalf of a call site
+ */
+static void* heap_alloc(size_t size, uint32_t caller) {
+    TRACE_BEGIN(TRACE_MALLOC, size);
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc_locked(size, caller);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    TRACE_END(TRACE_MALLOC, size);
+    return ptr;
+}
+
+/*
+ * Allocate a block with the heap lock held
+ */
+static void* heap_alloc_locked(size_t size, uint32_t caller) {
     if (!memory_initialized) {
         return NULL;
     }
@@ -80,30 +367,42 @@ void* malloc(size_t size) {
     if (size == 0) {
         return NULL;
     }
+    size_t request = size;
     
-    // Align size to 8-byte boundary
+    // Align size to 8-byte boundary (free blocks must hold their list links)
     size = ALIGN_UP(size, 8);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
     
-    // Find a suitable free block
+    // Find a suitable free block, growing the heap if none fits
     memory_block_t* block = find_free_block(size);
     if (!block) {
-        return NULL;  // Out of memory
+        if (!heap_grow(size)) {
+            return NULL;  // Out of memory
+        }
+        block = find_free_block(size);
+        if (!block) {
+            return NULL;
+        }
     }
     
+    // Take the block out of its bin and mark it as allocated
+    remove_free_block(block);
+    block->is_free = false;
+    block->magic = BLOCK_MAGIC_ALLOCATED;
+    
     // Split block if necessary
-    if (block->size > size + sizeof(memory_block_t) + 8) {
+    if (block->size >= size + sizeof(memory_block_t) + MIN_BLOCK_SIZE) {
         split_block(block, size);
     }
     
-    // Mark block as allocated
-    block->is_free = false;
-    block->magic = BLOCK_MAGIC_ALLOCATED;
-    
     // Update statistics
     memory_stats.used_memory += block->size;
     memory_stats.free_memory -= block->size;
     memory_stats.allocated_blocks++;
     memory_stats.free_blocks--;
+    profile_alloc(block, request, caller);
     
     // Return pointer to data (after header)
     return (void*)((uint8_t*)block + sizeof(memory_block_t));
@@ -120,12 +419,19 @@ void free(void* ptr) {
     // Get block header
     memory_block_t* block = (memory_block_t*)((uint8_t*)ptr - sizeof(memory_block_t));
     
-    // Validate block
-    if (!validate_block(block)) {
+    TRACE_BEGIN(TRACE_FREE, 0);
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    
+    // Validate block (a block that is already free is a double free)
+    if (!validate_block(block) || block->is_free) {
         memory_stats.corrupted_blocks++;
+        spin_unlock_irqrestore(&heap_lock, flags);
+        TRACE_END(TRACE_FREE, 0);
         return;  // Corrupted block
     }
     
+    profile_free(block);
+    
     // Mark as free
     block->is_free = true;
     block->magic = BLOCK_MAGIC_FREE;
@@ -136,31 +442,102 @@ void free(void* ptr) {
     memory_stats.allocated_blocks--;
     memory_stats.free_blocks++;
     
-    // Coalesce with adjacent free blocks
+    // Coalesce with adjacent free blocks and file the result into its bin
     coalesce_blocks(block);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    TRACE_END(TRACE_FREE, 0);
+}
+
+/*
+ * Grow the heap by claiming the page frames directly above it
+ * The old sentinel becomes the header of the new free space and a fresh
+ * sentinel closes the heap again. The heap stays one contiguous range, so
+ * growth stops at the first frame that is reserved or already handed out.
+ */
+static bool heap_grow(size_t size) {
+    // A free tail block merges with the new space, so only the shortfall is needed
+    memory_block_t* tail = heap_sentinel->prev;
+    uint32_t needed = (uint32_t)size + sizeof(memory_block_t);
+    if (tail && tail->is_free && tail->size < size) {
+        needed = (uint32_t)size - tail->size;
+    }
+    
+    uint32_t grow_size = ALIGN_UP(needed, HEAP_GROW_SIZE);
+    if (grow_size < needed) {
+        return false;  // Overflow
+    }
+    
+    if (!pfa_claim_frames((uintptr_t)heap_end, grow_size / PAGE_SIZE)) {
+        return false;
+    }
+    
+    memory_block_t* block = heap_sentinel;
+    heap_end = (memory_block_t*)((uint8_t*)heap_end + grow_size);
+    heap_sentinel = (memory_block_t*)((uint8_t*)heap_end - sizeof(memory_block_t));
+    
+    heap_sentinel->size = 0;
+    heap_sentinel->is_free = false;
+    heap_sentinel->next = NULL;
+    heap_sentinel->prev = block;
+    heap_sentinel->magic = BLOCK_MAGIC_ALLOCATED;
+    
+    block->size = grow_size - sizeof(memory_block_t);
+    block->is_free = true;
+    block->next = heap_sentinel;
+    block->magic = BLOCK_MAGIC_FREE;
+    
+    memory_stats.total_memory += grow_size;
+    memory_stats.free_memory += block->size;
+    memory_stats.free_blocks++;
+    
+    // Merge with a free tail block and file the result
+    coalesce_blocks(block);
+    return true;
 }
 
 /*
  * Find a free block of sufficient size
+ * Constant time: two bitmap scans pick the smallest non-empty bin whose
+ * blocks are all guaranteed to fit. The block stays on its free list.
  */
 memory_block_t* find_free_block(size_t size) {
-    memory_block_t* current = heap_start;
+    uint32_t fl, sl;
+    mapping_search((uint32_t)size, &fl, &sl);
+    if (fl >= HEAP_FL_COUNT) {
+        return NULL;  // Larger than any bin
+    }
     
-    while (current && current < heap_end) {
-        if (current->is_free && current->size >= size) {
-            return current;
+    // Look for a non-empty slice in the same first-level bin
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        // Fall back to the next non-empty first-level bin
+        uint32_t fl_map = (fl + 1 < 32) ? (fl_bitmap & (~0U << (fl + 1))) : 0;
+        if (!fl_map) {
+            // Last resort: the bin the size itself maps to may still hold
+            // a block that fits, it just isn't guaranteed to
+            mapping_insert((uint32_t)size, &fl, &sl);
+            for (memory_block_t* block = free_lists[fl][sl]; block; block = BLOCK_FREE_LINKS(block)->next_free) {
+                if (block->size >= size) {
+                    return block;
+                }
+            }
+            return NULL;  // No suitable block found
         }
-        current = current->next;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
     }
+    sl = __builtin_ctz(sl_map);
     
-    return NULL;  // No suitable block found
+    return free_lists[fl][sl];
 }
 
 /*
  * Split a block into two parts
+ * The block must already be off the free lists; the tail is filed as a new
+ * free block.
  */
 void split_block(memory_block_t* block, size_t size) {
-    if (!block || block->size <= size + sizeof(memory_block_t)) {
+    if (!block || block->size < size + sizeof(memory_block_t) + MIN_BLOCK_SIZE) {
         return;
     }
     
@@ -181,11 +558,14 @@ void split_block(memory_block_t* block, size_t size) {
         new_block->next->prev = new_block;
     }
     
+    insert_free_block(new_block);
     memory_stats.free_blocks++;
 }
 
 /*
  * Coalesce adjacent free blocks
+ * Takes a free block that is not on any free list, merges it with free
+ * neighbours (pulling them out of their bins) and files the result.
  */
 void coalesce_blocks(memory_block_t* block) {
     if (!block || !block->is_free) {
@@ -193,25 +573,33 @@ void coalesce_blocks(memory_block_t* block) {
     }
     
     // Coalesce with next block
-    if (block->next && block->next->is_free) {
-        block->size += block->next->size + sizeof(memory_block_t);
-        memory_block_t* next = block->next;
+    memory_block_t* next = block->next;
+    if (next && next->is_free) {
+        remove_free_block(next);
+        block->size += next->size + sizeof(memory_block_t);
         block->next = next->next;
         if (next->next) {
             next->next->prev = block;
         }
+        next->magic = 0;
         memory_stats.free_blocks--;
     }
     
     // Coalesce with previous block
-    if (block->prev && block->prev->is_free) {
-        block->prev->size += block->size + sizeof(memory_block_t);
-        block->prev->next = block->next;
+    memory_block_t* prev = block->prev;
+    if (prev && prev->is_free) {
+        remove_free_block(prev);
+        prev->size += block->size + sizeof(memory_block_t);
+        prev->next = block->next;
         if (block->next) {
-            block->next->prev = block->prev;
+            block->next->prev = prev;
         }
+        block->magic = 0;
+        block = prev;
         memory_stats.free_blocks--;
     }
+    
+    insert_free_block(block);
 }
 
 /*
@@ -232,6 +620,11 @@ bool validate_block(memory_block_t* block) {
         return false;
     }
     
+    // Magic must agree with the free flag, or the bins are out of sync
+    if (block->is_free != (block->magic == BLOCK_MAGIC_FREE)) {
+        return false;
+    }
+    
     return true;
 }
 
@@ -243,114 +636,255 @@ memory_stats_t* get_memory_stats(void) {
 }
 
 /*
- * Memory set function
+ * Create a slab cache for objects of a fixed size
+ * align of 0 selects cache-line alignment.
  */
-void* memset(void* ptr, int value, size_t size) {
-    uint8_t* p = (uint8_t*)ptr;
-    uint8_t val = (uint8_t)value;
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size, size_t align) {
+    if (!memory_initialized || object_size == 0) {
+        return NULL;
+    }
     
-    for (size_t i = 0; i < size; i++) {
-        p[i] = val;
+    if (align == 0) {
+        align = CACHE_LINE_SIZE;
+    }
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) {
+        return NULL;  // Alignment must be a power of two that fits a link
     }
     
-    return ptr;
+    kmem_cache_t* cache = (kmem_cache_t*)malloc(sizeof(kmem_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    
+    strncpy(cache->name, name ? name : "anonymous", sizeof(cache->name) - 1);
+    cache->name[sizeof(cache->name) - 1] = '\0';
+    cache->align = (uint32_t)align;
+    cache->object_size = (uint32_t)ALIGN_UP(object_size, align);
+    
+    // Aim for at least eight objects per slab, in whole pages
+    cache->slab_size = PAGE_SIZE;
+    if (cache->object_size * 8 > PAGE_SIZE) {
+        cache->slab_size = ALIGN_UP(cache->object_size * 8, PAGE_SIZE);
+    }
+    cache->objects_per_slab = (cache->slab_size - sizeof(kmem_slab_t) - (cache->align - 1)) / cache->object_size;
+    
+    cache->lock.locked = 0;
+    cache->free_objects = NULL;
+    cache->slabs = NULL;
+    cache->slab_count = 0;
+    cache->total_objects = 0;
+    cache->active_objects = 0;
+    
+    return cache;
 }
 
 /*
- * Memory copy function
+ * Carve a fresh slab into objects and push them onto the free list
  */
-void* memcpy(void* dest, const void* src, size_t size) {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
+static bool kmem_cache_grow(kmem_cache_t* cache) {
+    kmem_slab_t* slab = (kmem_slab_t*)malloc(cache->slab_size);
+    if (!slab) {
+        return false;
+    }
+    
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+    cache->slab_count++;
     
-    for (size_t i = 0; i < size; i++) {
-        d[i] = s[i];
+    uintptr_t object = ALIGN_UP((uintptr_t)slab + sizeof(kmem_slab_t), (uintptr_t)cache->align);
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+        *(void**)object = cache->free_objects;
+        cache->free_objects = (void*)object;
+        object += cache->object_size;
     }
+    cache->total_objects += cache->objects_per_slab;
     
-    return dest;
+    return true;
 }
 
 /*
- * Memory compare function
+ * Allocate an object from a slab cache
  */
-int memcmp(const void* ptr1, const void* ptr2, size_t size) {
-    const uint8_t* p1 = (const uint8_t*)ptr1;
-    const uint8_t* p2 = (const uint8_t*)ptr2;
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) {
+        return NULL;
+    }
     
-    for (size_t i = 0; i < size; i++) {
-        if (p1[i] != p2[i]) {
-            return p1[i] - p2[i];
-        }
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    if (!cache->free_objects && !kmem_cache_grow(cache)) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return NULL;  // Heap exhausted
+    }
+    
+    void* object = cache->free_objects;
+    cache->free_objects = *(void**)object;
+    cache->active_objects++;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    
+    return object;
+}
+
+/*
+ * Return an object to its slab cache
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    if (!cache || !object) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    *(void**)object = cache->free_objects;
+    cache->free_objects = object;
+    cache->active_objects--;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/*
+ * Destroy a slab cache and release all of its slabs
+ * Any objects still allocated from the cache become invalid.
+ */
+void kmem_cache_destroy(kmem_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    
+    kmem_slab_t* slab = cache->slabs;
+    while (slab) {
+        kmem_slab_t* next = slab->next;
+        free(slab);
+        slab = next;
     }
     
-    return 0;
+    free(cache);
 }
 
 /*
- * String length function
+ * Add a chunk of at least size bytes to an arena
  */
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len]) {
-        len++;
+static arena_chunk_t* arena_add_chunk(arena_t* arena, size_t size) {
+    if (size < arena->chunk_size) {
+        size = arena->chunk_size;
     }
-    return len;
+    
+    arena_chunk_t* chunk = (arena_chunk_t*)malloc(sizeof(arena_chunk_t) + size);
+    if (!chunk) {
+        return NULL;
+    }
+    
+    chunk->prev = arena->current;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->current = chunk;
+    return chunk;
 }
 
 /*
- * String compare function
+ * Create an arena
+ * chunk_size of 0 selects ARENA_DEFAULT_CHUNK. The first chunk is
+ * allocated up front and kept across resets.
  */
-int strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2 && *str1 == *str2) {
-        str1++;
-        str2++;
+arena_t* arena_create(size_t chunk_size) {
+    arena_t* arena = (arena_t*)malloc(sizeof(arena_t));
+    if (!arena) {
+        return NULL;
     }
-    return *str1 - *str2;
+    
+    arena->current = NULL;
+    arena->chunk_size = chunk_size ? ALIGN_UP(chunk_size, 8) : ARENA_DEFAULT_CHUNK;
+    
+    if (!arena_add_chunk(arena, arena->chunk_size)) {
+        free(arena);
+        return NULL;
+    }
+    
+    return arena;
 }
 
 /*
- * String compare function (limited)
+ * Allocate from an arena
+ * Requests that do not fit the current chunk start a new one, sized for
+ * the request if it is larger than the arena's chunk size.
  */
-int strncmp(const char* str1, const char* str2, size_t n) {
-    for (size_t i = 0; i < n; i++) {
-        if (str1[i] != str2[i] || str1[i] == '\0') {
-            return str1[i] - str2[i];
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (!arena || size == 0) {
+        return NULL;
+    }
+    
+    size = ALIGN_UP(size, 8);
+    arena_chunk_t* chunk = arena->current;
+    if (chunk->size - chunk->used < size) {
+        chunk = arena_add_chunk(arena, size);
+        if (!chunk) {
+            return NULL;
         }
     }
-    return 0;
+    
+    void* ptr = (uint8_t*)chunk + sizeof(arena_chunk_t) + chunk->used;
+    chunk->used += size;
+    return ptr;
 }
 
 /*
- * String copy function
+ * Release every chunk newer than the given one
  */
-char* strcpy(char* dest, const char* src) {
-    char* d = dest;
-    while ((*d++ = *src++));
-    return dest;
+static void arena_drop_chunks(arena_t* arena, arena_chunk_t* keep) {
+    while (arena->current != keep && arena->current->prev) {
+        arena_chunk_t* prev = arena->current->prev;
+        free(arena->current);
+        arena->current = prev;
+    }
 }
 
 /*
- * String copy function (limited)
+ * Free everything allocated from an arena in one step
+ * Only the base chunk survives, so a reset arena costs one chunk.
  */
-char* strncpy(char* dest, const char* src, size_t n) {
-    size_t i;
-    for (i = 0; i < n && src[i]; i++) {
-        dest[i] = src[i];
+void arena_reset(arena_t* arena) {
+    if (!arena) {
+        return;
     }
-    for (; i < n; i++) {
-        dest[i] = '\0';
+    
+    arena_drop_chunks(arena, NULL);
+    arena->current->used = 0;
+}
+
+/*
+ * Destroy an arena and all of its chunks
+ */
+void arena_destroy(arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+    
+    arena_drop_chunks(arena, NULL);
+    free(arena->current);
+    free(arena);
+}
+
+/*
+ * Record the current arena position for a nested scope
+ */
+arena_mark_t arena_mark(arena_t* arena) {
+    arena_mark_t mark = {NULL, 0};
+    if (arena) {
+        mark.chunk = arena->current;
+        mark.offset = arena->current->used;
     }
-    return dest;
+    return mark;
 }
 
 /*
- * String concatenate function
+ * Release everything allocated since a mark was taken
  */
-char* strcat(char* dest, const char* src) {
-    char* d = dest;
-    while (*d) d++;
-    while ((*d++ = *src++));
-    return dest;
+void arena_release(arena_t* arena, arena_mark_t mark) {
+    if (!arena || !mark.chunk) {
+        return;
+    }
+    
+    arena_drop_chunks(arena, (arena_chunk_t*)mark.chunk);
+    if (arena->current == mark.chunk && arena->current->used >= mark.offset) {
+        arena->current->used = mark.offset;
+    }
 }
 
 /*
@@ -358,7 +892,7 @@ char* strcat(char* dest, const char* src) {
  */
 void* calloc(size_t num, size_t size) {
     size_t total_size = num * size;
-    void* ptr = malloc(total_size);
+    void* ptr = heap_alloc(total_size, HEAP_CALLER());
     
     if (ptr) {
         memset(ptr, 0, total_size);
@@ -372,7 +906,7 @@ void* calloc(size_t num, size_t size) {
  */
 void* realloc(void* ptr, size_t size) {
     if (!ptr) {
-        return malloc(size);
+        return heap_alloc(size, HEAP_CALLER());
     }
     
     if (size == 0) {
@@ -393,7 +927,7 @@ void* realloc(void* ptr, size_t size) {
     }
     
     // Allocate new block
-    void* new_ptr = malloc(size);
+    void* new_ptr = heap_alloc(size, HEAP_CALLER());
     if (!new_ptr) {
         return NULL;
     }
@@ -408,16 +942,12 @@ void* realloc(void* ptr, size_t size) {
 }
 
 /*
- * Display memory usage (for debugging)
+ * Recount the block list into memory_stats
+ * Called with heap_lock held: another CPU may be splitting or merging
+ * blocks.
  */
-void display_memory_info(void) {
-    if (!memory_initialized) {
-        return;
-    }
-    
-    // This would normally print to console
-    // For now, just update statistics
-    memory_stats.total_memory = HEAP_SIZE;
+static void count_blocks_locked(void) {
+    memory_stats.total_memory = (uint8_t*)heap_end - (uint8_t*)heap_start;
     
     // Walk through blocks to get accurate stats
     memory_block_t* current = heap_start;
@@ -426,9 +956,16 @@ void display_memory_info(void) {
     uint64_t free_bytes = 0;
     uint64_t allocated_bytes = 0;
     
-    while (current && current < heap_end) {
+    for (int fl = 0; fl < MEMORY_BIN_COUNT; fl++) {
+        memory_stats.bin_free_blocks[fl] = 0;
+    }
+    
+    while (current && current != heap_sentinel) {
         if (validate_block(current)) {
             if (current->is_free) {
+                uint32_t fl, sl;
+                mapping_insert(current->size, &fl, &sl);
+                memory_stats.bin_free_blocks[fl]++;
                 free_count++;
                 free_bytes += current->size;
             } else {
@@ -443,4 +980,291 @@ void display_memory_info(void) {
     memory_stats.allocated_blocks = allocated_count;
     memory_stats.free_memory = free_bytes;
     memory_stats.used_memory = allocated_bytes;
-} 
\ No newline at end of file
+}
+
+/*
+ * Display memory usage (for debugging)
+ */
+void display_memory_info(void) {
+    if (!memory_initialized) {
+        return;
+    }
+    
+    // This would normally print to console
+    // For now, just update statistics
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    count_blocks_locked();
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+/*
+ * Find the largest free block, with heap_lock held
+ * Only the highest non-empty first-level bin can hold it.
+ */
+static uint32_t largest_free_block_locked(void) {
+    if (!fl_bitmap) {
+        return 0;
+    }
+    
+    uint32_t fl = heap_fls(fl_bitmap);
+    uint32_t largest = 0;
+    for (uint32_t sl = 0; sl < HEAP_SL_COUNT; sl++) {
+        for (memory_block_t* block = free_lists[fl][sl]; block; block = BLOCK_FREE_LINKS(block)->next_free) {
+            if (block->size > largest) {
+                largest = block->size;
+            }
+        }
+    }
+    return largest;
+}
+
+/*
+ * Fill in the heap profile summary, with heap_lock held
+ */
+static void heap_profile_locked(heap_profile_t* profile) {
+    if (memory_initialized) {
+        count_blocks_locked();
+    }
+    
+    profile->total_bytes = (uint32_t)memory_stats.total_memory;
+    profile->used_bytes = (uint32_t)memory_stats.used_memory;
+    profile->free_bytes = (uint32_t)memory_stats.free_memory;
+    profile->high_water_bytes = (uint32_t)memory_stats.high_water_memory;
+    profile->largest_free_block = largest_free_block_locked();
+    profile->allocated_blocks = memory_stats.allocated_blocks;
+    profile->free_blocks = memory_stats.free_blocks;
+    for (int i = 0; i < HEAP_HISTOGRAM_BUCKETS; i++) {
+        profile->histogram[i] = memory_stats.size_histogram[i];
+    }
+#ifdef HEAP_PROFILING
+    profile->sites_tracked = true;
+#else
+    profile->sites_tracked = false;
+#endif
+}
+
+/*
+ * Fill in the heap profile summary
+ */
+void heap_get_profile(heap_profile_t* profile) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    heap_profile_locked(profile);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+/*
+ * Get the call sites holding the most live memory, largest first
+ */
+uint32_t heap_get_top_sites(heap_snapshot_site_t* sites, uint32_t max) {
+    uint32_t count = 0;
+#ifdef HEAP_PROFILING
+    // Insertion sort into the caller's array; the table is small
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        if (heap_sites[i].caller == 0) {
+            continue;
+        }
+        
+        uint32_t pos = count;
+        while (pos > 0 && sites[pos - 1].live_bytes < heap_sites[i].live_bytes) {
+            if (pos < max) {
+                sites[pos] = sites[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max) {
+            sites[pos] = heap_sites[i];
+            if (count < max) {
+                count++;
+            }
+        }
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+#else
+    (void)sites;
+    (void)max;
+#endif
+    return count;
+}
+
+// Snapshot serial framing state
+static uint8_t snapshot_line[HEAP_SNAPSHOT_LINE];
+static uint32_t snapshot_line_len = 0;
+static uint32_t snapshot_hash = 0;
+
+// Snapshot copies: retried this often if the heap keeps outgrowing the
+// record buffer, which is sized this many blocks over the count
+#define SNAPSHOT_ATTEMPTS       4
+#define SNAPSHOT_SLACK_BLOCKS   16
+#ifdef HEAP_PROFILING
+static heap_snapshot_site_t snapshot_sites[HEAP_PROFILE_SITES];
+#endif
+
+/*
+ * Write the buffered snapshot bytes as one hex line
+ */
+static void snapshot_flush(void) {
+    static const char hex[] = "0123456789abcdef";
+    char text[sizeof(HEAP_SNAPSHOT_TAG) + HEAP_SNAPSHOT_LINE * 2 + 2];
+    uint32_t pos = 0;
+    
+    if (!snapshot_line_len) {
+        return;
+    }
+    
+    memcpy(text, HEAP_SNAPSHOT_TAG " ", sizeof(HEAP_SNAPSHOT_TAG));
+    pos = sizeof(HEAP_SNAPSHOT_TAG);
+    for (uint32_t i = 0; i < snapshot_line_len; i++) {
+        text[pos++] = hex[snapshot_line[i] >> 4];
+        text[pos++] = hex[snapshot_line[i] & 0xF];
+    }
+    text[pos++] = '\n';
+    text[pos] = '\0';
+    
+    debug_output_serial(text);
+    snapshot_line_len = 0;
+}
+
+/*
+ * Append bytes to the snapshot stream
+ */
+static void snapshot_emit(const void* data, uint32_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (uint32_t i = 0; i < size; i++) {
+        snapshot_hash = (snapshot_hash ^ bytes[i]) * 16777619U;  // FNV-1a
+        snapshot_line[snapshot_line_len++] = bytes[i];
+        if (snapshot_line_len == HEAP_SNAPSHOT_LINE) {
+            snapshot_flush();
+        }
+    }
+}
+
+/*
+ * Write a framing line with a hex value
+ */
+static void snapshot_marker(const char* marker, uint32_t value) {
+    static const char hex[] = "0123456789abcdef";
+    char text[24];
+    
+    debug_output_serial(HEAP_SNAPSHOT_TAG " ");
+    debug_output_serial(marker);
+    for (int i = 0; i < 8; i++) {
+        text[i] = hex[(value >> (28 - i * 4)) & 0xF];
+    }
+    text[8] = '\n';
+    text[9] = '\0';
+    debug_output_serial(" ");
+    debug_output_serial(text);
+}
+
+/*
+ * Copy the block list and site table out for a snapshot, with heap_lock
+ * held, so the export can go to serial after unlocking
+ * Returns false if the blocks no longer fit in capacity.
+ */
+static bool snapshot_copy_locked(heap_profile_t* profile, heap_snapshot_block_t* blocks,
+                                 uint32_t capacity, uint32_t* site_count) {
+    heap_profile_locked(profile);
+    if (profile->allocated_blocks + profile->free_blocks > capacity) {
+        return false;
+    }
+    
+    // Blocks in address order, matching the counts heap_profile_locked took
+    uint32_t count = 0;
+    for (memory_block_t* block = heap_start; block && block != heap_sentinel; block = block->next) {
+        if (!validate_block(block)) {
+            continue;
+        }
+        heap_snapshot_block_t* record = &blocks[count++];
+        record->offset = (uint32_t)((uint8_t*)block - (uint8_t*)heap_start);
+        record->size = block->size;
+#ifdef HEAP_PROFILING
+        record->caller = block->is_free ? 0 : block->caller;
+#else
+        record->caller = 0;
+#endif
+        record->flags = block->is_free ? HEAP_BLOCK_FREE : 0;
+    }
+    
+    *site_count = 0;
+#ifdef HEAP_PROFILING
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        if (heap_sites[i].caller) {
+            snapshot_sites[(*site_count)++] = heap_sites[i];
+        }
+    }
+#endif
+    return true;
+}
+
+/*
+ * Export a binary heap snapshot over serial
+ * See heap_snapshot.h for the layout; tools/memory_analyzer -H decodes it.
+ * The records are copied out under the heap lock into a buffer that is
+ * itself a heap block, so it shows in the snapshot; it is sized with
+ * some slack and retaken if the heap outgrew it meanwhile.
+ */
+void heap_export_snapshot(void) {
+    if (!memory_initialized) {
+        return;
+    }
+    
+    heap_profile_t profile;
+    heap_snapshot_block_t* blocks = NULL;
+    uint32_t site_count = 0;
+    bool copied = false;
+    
+    for (int attempt = 0; attempt < SNAPSHOT_ATTEMPTS && !copied; attempt++) {
+        heap_get_profile(&profile);
+        uint32_t capacity = profile.allocated_blocks + profile.free_blocks + SNAPSHOT_SLACK_BLOCKS;
+        blocks = (heap_snapshot_block_t*)malloc(capacity * sizeof(heap_snapshot_block_t));
+        if (!blocks) {
+            return;
+        }
+        
+        uint32_t flags = spin_lock_irqsave(&heap_lock);
+        copied = snapshot_copy_locked(&profile, blocks, capacity, &site_count);
+        spin_unlock_irqrestore(&heap_lock, flags);
+        if (!copied) {
+            free(blocks);
+            blocks = NULL;
+        }
+    }
+    if (!copied) {
+        return;
+    }
+    
+    heap_snapshot_header_t header;
+    header.magic = HEAP_SNAPSHOT_MAGIC;
+    header.version = HEAP_SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.flags = profile.sites_tracked ? HEAP_SNAPSHOT_PROFILED : 0;
+    header.heap_start = (uint32_t)(uintptr_t)heap_start;
+    header.heap_end = (uint32_t)(uintptr_t)heap_end;
+    header.used_bytes = profile.used_bytes;
+    header.free_bytes = profile.free_bytes;
+    header.high_water_bytes = profile.high_water_bytes;
+    header.largest_free_block = profile.largest_free_block;
+    header.block_count = profile.allocated_blocks + profile.free_blocks;
+    header.site_count = site_count;
+    header.histogram_buckets = HEAP_HISTOGRAM_BUCKETS;
+    
+    uint32_t total = sizeof(header) + HEAP_HISTOGRAM_BUCKETS * sizeof(uint32_t) +
+                     header.block_count * sizeof(heap_snapshot_block_t) +
+                     header.site_count * sizeof(heap_snapshot_site_t);
+    
+    snapshot_line_len = 0;
+    snapshot_hash = 2166136261U;
+    snapshot_marker("BEGIN", total);
+    
+    snapshot_emit(&header, sizeof(header));
+    snapshot_emit(profile.histogram, sizeof(profile.histogram));
+    snapshot_emit(blocks, header.block_count * sizeof(heap_snapshot_block_t));
+#ifdef HEAP_PROFILING
+    snapshot_emit(snapshot_sites, site_count * sizeof(heap_snapshot_site_t));
+#endif
+    
+    snapshot_flush();
+    snapshot_marker("END", snapshot_hash);
+    free(blocks);
+}
@@ -8,10 +8,25 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "heap_snapshot.h"
 
 // Forward declarations
 typedef struct memory_block_s memory_block_t;
 typedef struct memory_stats_s memory_stats_t;
+typedef struct kmem_cache_s kmem_cache_t;
+typedef struct arena_s arena_t;
+
+// Slab cache constants
+#define CACHE_LINE_SIZE 64
+
+// Arena constants
+#define ARENA_DEFAULT_CHUNK 4096
+
+// Arena position, used to release everything allocated in a nested scope
+typedef struct {
+    void* chunk;
+    size_t offset;
+} arena_mark_t;
 
 // Memory management functions
 void init_memory_manager(void);
@@ -20,9 +35,42 @@ void free(void* ptr);
 void* calloc(size_t num, size_t size);
 void* realloc(void* ptr, size_t size);
 
+// Slab caches for fixed-size kernel objects
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size, size_t align);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+// Bump-pointer arenas for transient allocations
+arena_t* arena_create(size_t chunk_size);
+void* arena_alloc(arena_t* arena, size_t size);
+void arena_reset(arena_t* arena);
+void arena_destroy(arena_t* arena);
+arena_mark_t arena_mark(arena_t* arena);
+void arena_release(arena_t* arena, arena_mark_t mark);
+
+// Heap profile summary
+typedef struct {
+    uint32_t total_bytes;
+    uint32_t used_bytes;
+    uint32_t free_bytes;
+    uint32_t high_water_bytes;
+    uint32_t largest_free_block;
+    uint32_t allocated_blocks;
+    uint32_t free_blocks;
+    uint32_t histogram[HEAP_HISTOGRAM_BUCKETS];
+    bool sites_tracked;     // Call sites need a HEAP_PROFILING build
+} heap_profile_t;
+
+// Heap profiling and snapshots
+void heap_get_profile(heap_profile_t* profile);
+uint32_t heap_get_top_sites(heap_snapshot_site_t* sites, uint32_t max);
+void heap_export_snapshot(void);
+
 // Memory utility functions
 void* memset(void* ptr, int value, size_t size);
 void* memcpy(void* dest, const void* src, size_t size);
+void* memmove(void* dest, const void* src, size_t size);
 int memcmp(const void* ptr1, const void* ptr2, size_t size);
 
 // String functions
@@ -11,7 +11,7 @@
 #define BOOTLOADER_STACK_ADDR   0x7C00      // Stack grows down from bootloader
 #define KERNEL_LOAD_ADDR        0x8000      // Where kernel is loaded (32KB)
 #define KERNEL_STACK_ADDR       0x90000     // Kernel stack (576KB)
-#define KERNEL_MAX_SIZE         0x10000     // Maximum kernel size (64KB)
+#define KERNEL_MAX_SIZE         0x80000     // Image and .bss, up to the stack (512KB)
 
 // Memory Regions
 #define REAL_MODE_IVT_START     0x0000      // Real mode interrupt vector table
@@ -47,13 +47,33 @@
 #define CODE_SEG                0x08        // Code segment selector
 #define DATA_SEG                0x10        // Data segment selector
 
-// Page Directory/Table Addresses (for future paging implementation)
-#define PAGE_DIRECTORY_ADDR     0x100000    // 1MB mark
-#define PAGE_TABLE_ADDR         0x101000    // After page directory
-
-// Heap Management (for future implementation)
+// BIOS E820 memory map (collected by the bootloader before protected mode)
+#define E820_MAP_ADDR           0x5000      // uint16_t entry count
+#define E820_ENTRIES_ADDR       0x5008      // 24-byte entries follow the count
+#define E820_MAX_ENTRIES        64
+
+// VBE linear framebuffer (mode set by the bootloader's extension sector)
+#define VBE_INFO_ADDR           0x5800      // Controller info block, 512 bytes
+#define VBE_MODE_INFO_ADDR      0x5A00      // Mode info block of the mode set, 256 bytes
+#define VBE_MODE_ADDR           0x5B00      // uint16_t mode number set, 0 = still VGA
+
+// Application processor startup (real mode code, 4KB aligned below 1MB)
+#define SMP_TRAMPOLINE_ADDR     0x6000      // Copied here before each SIPI
+
+// Paging Structures (PAE, identity mapped)
+#define PAGE_SIZE               0x1000      // 4KB page
+#define LARGE_PAGE_SIZE         0x200000    // 2MB large page
+#define PAGE_DIRECTORY_ADDR     0x100000    // 1MB mark: page directory pointer table
+#define PAGE_DIRECTORIES_ADDR   0x101000    // Four page directories covering 4GB
+#define PAGE_TABLE_ADDR         0x105000    // 4KB page table for the first 2MB
+#define PAGE_FRAME_BITMAP_ADDR  0x106000    // Page frame bitmap (up to 128KB for 4GB)
+#define AUDIO_DMA_ADDR          0x140000    // ISA DMA stream: below 16MB, within one 128KB page
+#define PAGING_RESERVED_END     0x200000    // Everything below here is never handed out
+
+// Heap Management
 #define HEAP_START              0x200000    // 2MB mark
 #define HEAP_INITIAL_SIZE       0x100000    // 1MB initial heap
+#define HEAP_GROW_SIZE          0x100000    // Heap grows in 1MB steps
 
 // Memory Layout Validation Macros
 #define IS_VALID_KERNEL_ADDR(addr) \
@@ -0,0 +1,451 @@
+/*
+ * HellOS Paging System
+ * Physical page frame allocator and identity-mapped PAE page tables
+ */
+
+#include "kernel.h"
+#include "paging.h"
+#include "memory.h"
+#include "debug.h"
+#include "spinlock.h"
+
+// Page frame geometry
+#define FRAME_BITS          32          // Frames per bitmap word
+#define PAGE_ENTRIES        512         // Entries per PAE table or directory
+#define PAGE_DIRECTORIES    4           // Page directories behind the PDPT
+#define ADDRESS_LIMIT       0x100000000ULL
+
+// CPU feature and control register bits
+#define CPUID_FEATURE_PAE   BIT(6)
+#define CPUID_FEATURE_PAT   BIT(16)
+#define CR0_PAGING          0x80000000
+#define CR4_PAE             0x00000020
+
+// Page attribute table: eight one-byte memory types
+#define MSR_PAT             0x277
+#define PAT_WRITE_COMBINING 0x01
+#define PAT_WC_ENTRY        4           // Selected by PAGE_PAT alone
+
+// CMOS ports and extended memory registers (fallback when E820 is missing)
+#define CMOS_INDEX_PORT     0x70
+#define CMOS_DATA_PORT      0x71
+#define CMOS_EXT_MEM_LOW    0x30        // KB above 1MB
+#define CMOS_EXT_MEM_HIGH   0x31
+#define CMOS_HIGH_MEM_LOW   0x34        // 64KB blocks above 16MB
+#define CMOS_HIGH_MEM_HIGH  0x35
+
+// Page frame allocator state: one bit per frame, set means in use
+static uint32_t* frame_bitmap = (uint32_t*)PAGE_FRAME_BITMAP_ADDR;
+static uint32_t frame_limit = 0;    // Frames covered by the bitmap
+static uint32_t total_frames = 0;   // Usable frames reported by the firmware
+static uint32_t free_frames = 0;
+static spinlock_t frame_lock = SPINLOCK_INIT;   // Bitmap and counts
+
+// PAE paging structures
+static uint64_t* page_directory_pointers = (uint64_t*)PAGE_DIRECTORY_ADDR;
+static uint64_t* page_directories = (uint64_t*)PAGE_DIRECTORIES_ADDR;
+static uint64_t* low_page_table = (uint64_t*)PAGE_TABLE_ADDR;
+static bool pat_available = false;
+static bool paging_enabled = false;
+static spinlock_t table_lock = SPINLOCK_INIT;   // Page table updates and splits
+
+static inline bool frame_in_use(uint32_t frame) {
+    return (frame_bitmap[frame / FRAME_BITS] >> (frame % FRAME_BITS)) & 1;
+}
+
+static inline void set_frame(uint32_t frame) {
+    frame_bitmap[frame / FRAME_BITS] |= 1U << (frame % FRAME_BITS);
+}
+
+static inline void clear_frame(uint32_t frame) {
+    frame_bitmap[frame / FRAME_BITS] &= ~(1U << (frame % FRAME_BITS));
+}
+
+static inline void load_page_directory(uintptr_t pdpt) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(pdpt) : "memory");
+}
+
+static inline void invalidate_page(uintptr_t virt) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static uint8_t read_cmos(uint8_t reg) {
+    outb(CMOS_INDEX_PORT, reg);
+    return inb(CMOS_DATA_PORT);
+}
+
+/*
+ * Estimate the top of RAM from the CMOS extended memory registers
+ */
+static uint64_t cmos_memory_top(void) {
+    uint32_t high_blocks = read_cmos(CMOS_HIGH_MEM_LOW) | ((uint32_t)read_cmos(CMOS_HIGH_MEM_HIGH) << 8);
+    if (high_blocks) {
+        return 0x1000000ULL + (uint64_t)high_blocks * 0x10000;
+    }
+
+    uint32_t ext_kb = read_cmos(CMOS_EXT_MEM_LOW) | ((uint32_t)read_cmos(CMOS_EXT_MEM_HIGH) << 8);
+    return 0x100000ULL + (uint64_t)ext_kb * 1024;
+}
+
+/*
+ * Release the whole frames inside a physical range
+ */
+static void mark_range_free(uint64_t base, uint64_t length) {
+    uint64_t end = base + length;
+    if (end > ADDRESS_LIMIT) {
+        end = ADDRESS_LIMIT;
+    }
+
+    uint32_t first = (uint32_t)(ALIGN_UP(base, PAGE_SIZE) >> 12);
+    uint32_t last = (uint32_t)(end >> 12);
+    if (last > frame_limit) {
+        last = frame_limit;
+    }
+
+    for (uint32_t frame = first; frame < last; frame++) {
+        // Overlapping map entries must not count a frame twice
+        if (frame_in_use(frame)) {
+            clear_frame(frame);
+            free_frames++;
+            total_frames++;
+        }
+    }
+}
+
+/*
+ * Reserve every frame touching a physical range
+ */
+static void mark_range_used(uint32_t base, uint32_t length) {
+    uint32_t first = base >> 12;
+    uint32_t last = ALIGN_UP(base + length, PAGE_SIZE) >> 12;
+    if (last > frame_limit) {
+        last = frame_limit;
+    }
+
+    for (uint32_t frame = first; frame < last; frame++) {
+        if (!frame_in_use(frame)) {
+            set_frame(frame);
+            free_frames--;
+        }
+    }
+}
+
+/*
+ * Initialize the page frame allocator from the bootloader's E820 map
+ */
+void init_page_frame_allocator(void) {
+    uint32_t entry_count = *(volatile uint16_t*)E820_MAP_ADDR;
+    e820_entry_t* entries = (e820_entry_t*)E820_ENTRIES_ADDR;
+
+    if (entry_count > E820_MAX_ENTRIES) {
+        entry_count = E820_MAX_ENTRIES;
+    }
+
+    // The highest usable address sizes the bitmap
+    uint64_t memory_top = 0;
+    for (uint32_t i = 0; i < entry_count; i++) {
+        if (entries[i].type == E820_TYPE_USABLE && entries[i].base + entries[i].length > memory_top) {
+            memory_top = entries[i].base + entries[i].length;
+        }
+    }
+
+    bool have_e820 = memory_top != 0;
+    if (!have_e820) {
+        memory_top = cmos_memory_top();
+    }
+    if (memory_top > ADDRESS_LIMIT) {
+        memory_top = ADDRESS_LIMIT;
+    }
+
+    frame_limit = (uint32_t)(memory_top >> 12);
+    total_frames = 0;
+    free_frames = 0;
+
+    // Everything starts out in use; usable ranges are released below
+    memset(frame_bitmap, 0xFF, ALIGN_UP(frame_limit, FRAME_BITS) / 8);
+
+    if (have_e820) {
+        for (uint32_t i = 0; i < entry_count; i++) {
+            if (entries[i].type == E820_TYPE_USABLE) {
+                mark_range_free(entries[i].base, entries[i].length);
+            }
+        }
+    } else {
+        mark_range_free(0x100000, memory_top - 0x100000);
+    }
+
+    // Low memory, the kernel image and the paging structures are never handed out
+    mark_range_used(0, PAGING_RESERVED_END);
+
+    DEBUG_MEMORY(DEBUG_LEVEL_INFO, "Page frames: %d usable, %d free (%s)",
+                 total_frames, free_frames, have_e820 ? "E820" : "CMOS");
+}
+
+/*
+ * Allocate physically contiguous frames
+ * Searches top-down so the frames directly above the heap stay available
+ * for heap growth. Returns the physical address, or 0 when out of memory.
+ */
+uintptr_t pfa_alloc_frames(uint32_t count) {
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    if (count == 0 || count > free_frames) {
+        spin_unlock_irqrestore(&frame_lock, flags);
+        return 0;
+    }
+
+    uint32_t run = 0;
+    uint32_t frame = frame_limit;
+    while (frame > 0) {
+        frame--;
+
+        // Skip whole words of used frames
+        if (frame % FRAME_BITS == FRAME_BITS - 1 && frame_bitmap[frame / FRAME_BITS] == 0xFFFFFFFF) {
+            run = 0;
+            frame -= FRAME_BITS - 1;
+            continue;
+        }
+
+        if (frame_in_use(frame)) {
+            run = 0;
+            continue;
+        }
+
+        if (++run == count) {
+            // frame is now the lowest frame of the run
+            for (uint32_t i = 0; i < count; i++) {
+                set_frame(frame + i);
+            }
+            free_frames -= count;
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return (uintptr_t)frame * PAGE_SIZE;
+        }
+    }
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return 0;
+}
+
+/*
+ * Claim a specific range of frames, failing if any of them is taken
+ */
+bool pfa_claim_frames(uintptr_t addr, uint32_t count) {
+    uint32_t first = addr >> 12;
+    if ((addr & (PAGE_SIZE - 1)) || first + count > frame_limit || first + count < first) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    for (uint32_t frame = first; frame < first + count; frame++) {
+        if (frame_in_use(frame)) {
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return false;
+        }
+    }
+
+    for (uint32_t frame = first; frame < first + count; frame++) {
+        set_frame(frame);
+    }
+    free_frames -= count;
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return true;
+}
+
+/*
+ * Return frames to the allocator
+ */
+void pfa_free_frames(uintptr_t addr, uint32_t count) {
+    uint32_t first = addr >> 12;
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    for (uint32_t frame = first; frame < first + count && frame < frame_limit; frame++) {
+        if (frame < (PAGING_RESERVED_END >> 12)) {
+            continue;  // Reserved memory is never released
+        }
+        if (frame_in_use(frame)) {
+            clear_frame(frame);
+            free_frames++;
+        }
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+/*
+ * Get the number of usable frames
+ */
+uint32_t pfa_get_total_frames(void) {
+    return total_frames;
+}
+
+/*
+ * Get the number of free frames
+ */
+uint32_t pfa_get_free_frames(void) {
+    return free_frames;
+}
+
+/*
+ * Build the identity mapping and turn paging on
+ * The whole 4GB space is mapped with 2MB pages so RAM and MMIO alike cost
+ * one TLB entry per 2MB; the first 2MB uses 4KB pages so the BIOS, VGA
+ * and kernel areas can carry their own attributes.
+ */
+void init_paging(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_FEATURE_PAE)) {
+        DEBUG_MEMORY(DEBUG_LEVEL_WARN, "CPU lacks PAE, running without paging");
+        return;
+    }
+
+    for (uint32_t i = 0; i < PAGE_DIRECTORIES; i++) {
+        page_directory_pointers[i] = (PAGE_DIRECTORIES_ADDR + i * PAGE_SIZE) | PAGE_PRESENT;
+    }
+
+    for (uint32_t i = 0; i < PAGE_DIRECTORIES * PAGE_ENTRIES; i++) {
+        page_directories[i] = ((uint64_t)i * LARGE_PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE;
+    }
+
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+        low_page_table[i] = (i * PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE;
+    }
+    page_directories[0] = PAGE_TABLE_ADDR | PAGE_PRESENT | PAGE_WRITABLE;
+
+    load_page_directory(PAGE_DIRECTORY_ADDR);
+
+    uint32_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PAE;
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+
+    uint32_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_PAGING;
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+
+    paging_enabled = true;
+    DEBUG_MEMORY(DEBUG_LEVEL_INFO, "Paging enabled: 4GB identity mapped with 2MB pages");
+
+    if (!paging_init_pat()) {
+        DEBUG_MEMORY(DEBUG_LEVEL_WARN, "CPU lacks PAT, no write-combining");
+    }
+}
+
+/*
+ * Check whether paging is active
+ */
+bool paging_is_enabled(void) {
+    return paging_enabled;
+}
+
+/*
+ * Get the 4KB page table covering an address
+ * A 2MB page is split into a table of 4KB pages with the same attributes
+ * the first time one of its pages needs mapping on its own.
+ */
+static uint64_t* get_page_table(uintptr_t virt) {
+    uint64_t* pde = &page_directories[virt >> 21];
+    if (!(*pde & PAGE_PRESENT)) {
+        return NULL;
+    }
+
+    if (*pde & PAGE_LARGE) {
+        uintptr_t table_frame = pfa_alloc_frames(1);
+        if (!table_frame) {
+            return NULL;
+        }
+
+        uint64_t* table = (uint64_t*)table_frame;
+        uint32_t base = (uint32_t)*pde & ~(LARGE_PAGE_SIZE - 1);
+        uint32_t attributes = (uint32_t)*pde & (PAGE_WRITABLE | PAGE_USER | PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE | PAGE_GLOBAL);
+        for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+            table[i] = (base + i * PAGE_SIZE) | attributes | PAGE_PRESENT;
+        }
+
+        *pde = table_frame | PAGE_PRESENT | PAGE_WRITABLE;
+        load_page_directory(PAGE_DIRECTORY_ADDR);  // Flush the stale 2MB translation
+    }
+
+    return (uint64_t*)((uint32_t)*pde & ~(PAGE_SIZE - 1));
+}
+
+/*
+ * Map a single 4KB page
+ */
+int paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
+    if (!paging_enabled) {
+        return HELL_ERROR_GENERAL;
+    }
+
+    uint32_t irq_flags = spin_lock_irqsave(&table_lock);
+    uint64_t* table = get_page_table(virt);
+    if (!table) {
+        spin_unlock_irqrestore(&table_lock, irq_flags);
+        return HELL_ERROR_MEMORY;
+    }
+
+    table[(virt >> 12) & (PAGE_ENTRIES - 1)] = (phys & ~(PAGE_SIZE - 1)) | (flags & (PAGE_SIZE - 1)) | PAGE_PRESENT;
+    invalidate_page(virt);
+    spin_unlock_irqrestore(&table_lock, irq_flags);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Unmap a single 4KB page
+ */
+int paging_unmap_page(uintptr_t virt) {
+    if (!paging_enabled) {
+        return HELL_ERROR_GENERAL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&table_lock);
+    uint64_t* table = get_page_table(virt);
+    if (!table) {
+        spin_unlock_irqrestore(&table_lock, flags);
+        return HELL_ERROR_MEMORY;
+    }
+
+    table[(virt >> 12) & (PAGE_ENTRIES - 1)] = 0;
+    invalidate_page(virt);
+    spin_unlock_irqrestore(&table_lock, flags);
+    return HELL_SUCCESS;
+}
+
+/*
+ * Make PAT entry 4 write-combining on this CPU
+ * Every CPU must run this before touching a write-combining mapping.
+ * No mapping selects entry 4 beforehand, so no cache flush is needed.
+ */
+bool paging_init_pat(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_FEATURE_PAT)) {
+        return false;
+    }
+
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat &= ~(0xFFULL << (PAT_WC_ENTRY * 8));
+    pat |= (uint64_t)PAT_WRITE_COMBINING << (PAT_WC_ENTRY * 8);
+    wrmsr(MSR_PAT, pat);
+    pat_available = true;
+    return true;
+}
+
+/*
+ * Map a range write-combining, for framebuffers
+ * Stores are gathered into bursts instead of going out one at a time;
+ * a locked instruction or fence drains them.
+ */
+int paging_map_write_combining(uintptr_t base, uint32_t size) {
+    if (!pat_available) {
+        return HELL_ERROR_GENERAL;
+    }
+
+    uintptr_t end = ALIGN_UP(base + size, PAGE_SIZE);
+    for (uintptr_t page = ALIGN_DOWN(base, PAGE_SIZE); page < end; page += PAGE_SIZE) {
+        int result = paging_map_page(page, page, PAGE_WRITABLE | PAGE_WRITE_COMBINING);
+        if (result != HELL_SUCCESS) {
+            return result;
+        }
+    }
+    return HELL_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/*
+ * HellOS Paging Header
+ * Physical page frame allocator and page table management
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// E820 memory map entry as stored by the bootloader
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi_attributes;
+} __attribute__((packed)) e820_entry_t;
+
+// E820 region types
+#define E820_TYPE_USABLE        1
+#define E820_TYPE_RESERVED      2
+#define E820_TYPE_ACPI_RECLAIM  3
+#define E820_TYPE_ACPI_NVS      4
+#define E820_TYPE_BAD           5
+
+// Page table entry flags
+#define PAGE_PRESENT            0x001
+#define PAGE_WRITABLE           0x002
+#define PAGE_USER               0x004
+#define PAGE_WRITE_THROUGH      0x008
+#define PAGE_CACHE_DISABLE      0x010
+#define PAGE_ACCESSED           0x020
+#define PAGE_DIRTY              0x040
+#define PAGE_LARGE              0x080   // 2MB page (page directory entries only)
+#define PAGE_GLOBAL             0x100
+#define PAGE_PAT                0x080   // PAT index bit (4KB page tables only)
+
+// PAT entry 4 (PAT bit alone) is reprogrammed from write-back to
+// write-combining by paging_init_pat
+#define PAGE_WRITE_COMBINING    PAGE_PAT
+
+// Page frame allocator
+void init_page_frame_allocator(void);
+uintptr_t pfa_alloc_frames(uint32_t count);
+bool pfa_claim_frames(uintptr_t addr, uint32_t count);
+void pfa_free_frames(uintptr_t addr, uint32_t count);
+uint32_t pfa_get_total_frames(void);
+uint32_t pfa_get_free_frames(void);
+
+// Page tables
+void init_paging(void);
+bool paging_is_enabled(void);
+int paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags);
+int paging_unmap_page(uintptr_t virt);
+
+// Memory types
+bool paging_init_pat(void);
+int paging_map_write_combining(uintptr_t base, uint32_t size);
+
+#endif // PAGING_H
@@ -0,0 +1,41 @@
+/*
+ * HellOS Pandemonium Window Manager Header
+ * Windows over the desktop, each drawn into its own surface
+ */
+
+#ifndef PANDEMONIUM_H
+#define PANDEMONIUM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+
+#define WM_DAMAGE_RECTS     16      // Screen damage kept between composites
+#define WM_TITLE_HEIGHT     12      // Title bar at the top of every window
+#define WM_BORDER           1
+
+// Window colors
+#define WM_FRAME_COLOR          COLOR_DARK_RED
+#define WM_TITLE_COLOR          COLOR_DEEP_CRIMSON
+#define WM_FOCUSED_TITLE_COLOR  COLOR_HELL_RED
+#define WM_TITLE_TEXT_COLOR     COLOR_BONE_WHITE
+#define WM_CLIENT_COLOR         COLOR_VOID_BLACK
+
+// Compositing statistics
+typedef struct {
+    uint32_t composites;        // Passes that had damage
+    uint32_t rects;             // Damage rectangles composited
+    uint32_t blits;             // Visible window pieces copied
+    uint32_t pixels;            // Pixels copied to the back buffer
+    uint32_t collapses;         // Damage folded into one rectangle, list full
+} wm_stats_t;
+
+// Window functions, create_window and the WM entry points are in kernel.h
+void destroy_window(window_t* window);
+void move_window(window_t* window, int x, int y);
+void raise_window(window_t* window);
+void show_window(window_t* window, bool visible);
+window_t* get_desktop_window(void);
+wm_stats_t* get_wm_stats(void);
+
+#endif // PANDEMONIUM_H
@@ -0,0 +1,150 @@
+/*
+ * HellOS PCI Bus
+ * Walking the bus once at boot, so drivers just look their device up
+ */
+
+#include "kernel.h"
+#include "pci.h"
+#include "spinlock.h"
+#include "debug.h"
+#include <stdint.h>
+
+// Functions found by pci_init
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static uint32_t pci_count = 0;
+
+// The address and data ports are one shared window
+static spinlock_t pci_lock = SPINLOCK_INIT;
+
+/*
+ * Read a configuration dword by location
+ */
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    uint32_t address = 0x80000000U | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+                       ((uint32_t)function << 8) | (offset & 0xFC);
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, address);
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return value;
+}
+
+/*
+ * Write a configuration dword by location
+ */
+static void config_write(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t address = 0x80000000U | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+                       ((uint32_t)function << 8) | (offset & 0xFC);
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, address);
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+uint32_t pci_read_config32(const pci_device_t* device, uint8_t offset) {
+    return config_read(device->bus, device->slot, device->function, offset);
+}
+
+uint16_t pci_read_config16(const pci_device_t* device, uint8_t offset) {
+    return (uint16_t)(pci_read_config32(device, offset) >> ((offset & 2) * 8));
+}
+
+void pci_write_config32(const pci_device_t* device, uint8_t offset, uint32_t value) {
+    config_write(device->bus, device->slot, device->function, offset, value);
+}
+
+void pci_write_config16(const pci_device_t* device, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_read_config32(device, offset);
+    dword = (dword & ~(0xFFFFU << shift)) | ((uint32_t)value << shift);
+    pci_write_config32(device, offset, dword);
+}
+
+/*
+ * Record one function
+ */
+static void add_function(uint8_t bus, uint8_t slot, uint8_t function) {
+    if (pci_count == PCI_MAX_DEVICES) {
+        return;
+    }
+    
+    pci_device_t* device = &pci_devices[pci_count++];
+    uint32_t id = config_read(bus, slot, function, PCI_VENDOR_ID);
+    uint32_t class_revision = config_read(bus, slot, function, PCI_CLASS_REVISION);
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendor_id = (uint16_t)id;
+    device->device_id = (uint16_t)(id >> 16);
+    device->class_code = (uint8_t)(class_revision >> 24);
+    device->subclass = (uint8_t)(class_revision >> 16);
+    device->subsystem_id = (uint16_t)(config_read(bus, slot, function, PCI_SUBSYSTEM_ID & 0xFC) >> 16);
+    uint8_t line = (uint8_t)config_read(bus, slot, function, PCI_INTERRUPT_LINE);
+    device->irq = line < 16 ? line : 0xFF;
+    for (int i = 0; i < 6; i++) {
+        device->bar[i] = config_read(bus, slot, function, (uint8_t)(PCI_BAR0 + i * 4));
+    }
+    
+    DEBUG_DRIVERS(DEBUG_LEVEL_DEBUG, "PCI %d:%d.%d %x:%x class %x irq %d", bus, slot, function,
+                  device->vendor_id, device->device_id, device->class_code, line);
+}
+
+/*
+ * Enumerate every function on every bus
+ * The firmware has already assigned resources; they are only read here.
+ */
+void pci_init(void) {
+    pci_count = 0;
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if ((uint16_t)config_read((uint8_t)bus, slot, 0, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+                continue;
+            }
+            // Bit 7 of the header type marks a multi-function device
+            bool multi = (config_read((uint8_t)bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16) & 0x80;
+            for (uint8_t function = 0; function < (multi ? 8 : 1); function++) {
+                if ((uint16_t)config_read((uint8_t)bus, slot, function, PCI_VENDOR_ID) != PCI_VENDOR_NONE) {
+                    add_function((uint8_t)bus, slot, function);
+                }
+            }
+        }
+    }
+    DEBUG_DRIVERS(DEBUG_LEVEL_INFO, "PCI: %d functions", pci_count);
+}
+
+/*
+ * Turn on I/O, memory decoding and bus mastering
+ */
+void pci_enable_device(const pci_device_t* device) {
+    uint16_t command = pci_read_config16(device, PCI_COMMAND);
+    pci_write_config16(device, PCI_COMMAND,
+                       command | PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+}
+
+/*
+ * Port base of an I/O space BAR, 0 if it isn't one
+ */
+uint16_t pci_io_base(const pci_device_t* device, int bar) {
+    uint32_t value = device->bar[bar];
+    return (value & PCI_BAR_IO) ? (uint16_t)(value & ~3U) : 0;
+}
+
+/*
+ * First function with the given IDs
+ */
+const pci_device_t* pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+    for (uint32_t i = 0; i < pci_count; i++) {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t pci_device_count(void) {
+    return pci_count;
+}
+
+const pci_device_t* pci_get_device(uint32_t index) {
+    return index < pci_count ? &pci_devices[index] : NULL;
+}
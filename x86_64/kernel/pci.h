@@ -0,0 +1,59 @@
+/*
+ * HellOS PCI Header
+ * Configuration space access and the devices found at boot
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+#define PCI_MAX_DEVICES     32
+
+// Configuration space registers
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_CLASS_REVISION  0x08
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_SUBSYSTEM_ID    0x2E
+#define PCI_INTERRUPT_LINE  0x3C
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+#define PCI_BAR_IO              0x1     // Bit 0 of an I/O space BAR
+#define PCI_VENDOR_NONE         0xFFFF
+
+// A function found on the bus
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t irq;                // Legacy interrupt line, 0xFF if none
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t subsystem_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint32_t bar[6];            // Raw BAR values
+} pci_device_t;
+
+// PCI functions
+void pci_init(void);
+uint32_t pci_read_config32(const pci_device_t* device, uint8_t offset);
+uint16_t pci_read_config16(const pci_device_t* device, uint8_t offset);
+void pci_write_config32(const pci_device_t* device, uint8_t offset, uint32_t value);
+void pci_write_config16(const pci_device_t* device, uint8_t offset, uint16_t value);
+void pci_enable_device(const pci_device_t* device);
+uint16_t pci_io_base(const pci_device_t* device, int bar);
+const pci_device_t* pci_find_device(uint16_t vendor_id, uint16_t device_id);
+uint32_t pci_device_count(void);
+const pci_device_t* pci_get_device(uint32_t index);
+
+#endif // PCI_H
@@ -6,10 +6,14 @@
 #include "kernel.h"
 #include "process.h"
 #include "memory.h"
+#include "timer.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "debug.h"
+#include "trace.h"
 #include <stdint.h>
 
 // Process constants
-#define MAX_PROCESSES 64
 #define PROCESS_NAME_LENGTH 32
 
 // Process states
@@ -21,14 +25,29 @@ typedef enum {
     PROCESS_STATE_ZOMBIE
 } process_state_t;
 
-// Process management state
-static process_t processes[MAX_PROCESSES];
+// Process management state. process_lock covers the process and zombie
+// lists, pid allocation and the counts; each CPU's lock covers its ready
+// queues and its current process. Lock order is process_lock, then a CPU
+// lock, and a CPU lock is only ever taken with interrupts off.
+static kmem_cache_t* process_cache = NULL;
 static process_t* process_list = NULL;
-static process_t* current_process = NULL;
-static process_t* ready_queue = NULL;
+static process_t* zombie_list = NULL;    // Terminated while running, freed once switched away
 static uint32_t next_pid = 1;
 static uint32_t process_count = 0;
 static bool process_manager_initialized = false;
+static spinlock_t process_lock = SPINLOCK_INIT;
+
+// Processes by PID, chained through pid_next, so lookups don't walk the
+// whole process list
+#define PID_HASH_SIZE 64    // A power of two
+static process_t* pid_hash[PID_HASH_SIZE];
+static volatile uint32_t idle_cpus = 0;  // CPUs halted in their idle loop
+
+// Ready queues live in each CPU's cpu_t: one FIFO per priority level and a
+// bitmap of the non-empty levels, so enqueue, dequeue and picking the next
+// process are O(1). A CPU that runs dry steals from the busiest other CPU.
+#define PROCESS_AGING_THRESHOLD 100    // Wait (system time units) before promotion
+#define PROCESS_AGING_CEILING   PRIORITY_DEMON  // Aging never reaches OVERLORD
 
 // Process statistics
 struct process_stats_s {
@@ -39,38 +58,71 @@ struct process_stats_s {
     uint32_t zombie_processes;
     uint64_t context_switches;
     uint64_t total_cpu_time;
+    uint32_t aging_promotions;
+    uint32_t steals;            // Summed from the per-CPU counters
+    uint32_t online_cpus;
 };
 
 static process_stats_t process_stats = {0};
 
+// Stack switch and first-run entry from context_switch.asm
+extern void switch_context(uint64_t* save_sp, uint32_t new_sp);
+extern void process_entry_trampoline(void);
+
+// Forward declarations
+static void prepare_initial_stack(process_t* process);
+static void release_process(process_t* process);
+static void wait_queue_unlink(wait_queue_t* queue, process_t* process);
+static void reap_zombies(void);
+static cpu_t* lock_process_cpu(process_t* process);
+static void run_queue_add(cpu_t* cpu, process_t* process);
+static void run_queue_remove(cpu_t* cpu, process_t* process);
+static process_t* pick_next_process(cpu_t* cpu);
+static process_t* steal_process(cpu_t* cpu);
+static void age_ready_queues(cpu_t* cpu, uint64_t now);
+static void schedule_locked(cpu_t* cpu, uint32_t flags);
+static void kick_cpu(cpu_t* cpu);
+static void idle_loop(void);
+static void pid_hash_insert(process_t* process);
+static void pid_hash_remove(process_t* process);
+
 /*
  * Initialize the process management system
  */
 void init_process_manager(void) {
-    // Initialize process array
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        processes[i].pid = 0;
-        processes[i].state = PROCESS_STATE_TERMINATED;
-        processes[i].next = NULL;
-        processes[i].prev = NULL;
+    // Process descriptors come from a dedicated slab cache
+    process_cache = kmem_cache_create("process_t", sizeof(process_t), 0);
+    if (!process_cache) {
+        return;
     }
     
-    // Create kernel process (PID 0)
+    // Boot runs on the first CPU until init_smp brings up the rest
+    cpu_t* cpu = get_cpu(0);
+    
+    // Create kernel process (PID 0), adopted by the boot code
     process_t* kernel_process = create_process("kernel_daemon", 0, PRIORITY_OVERLORD, true);
     if (kernel_process) {
+        pid_hash_remove(kernel_process);
         kernel_process->pid = 0;
+        pid_hash_insert(kernel_process);
         kernel_process->state = PROCESS_STATE_RUNNING;
-        current_process = kernel_process;
+        kernel_process->on_cpu = true;
+        cpu->current = kernel_process;
+    }
+    
+    // Idle process, switched to only when nothing else is ready
+    process_t* idle_process = create_process("idle", (uintptr_t)idle_loop, PRIORITY_DAMNED, true);
+    if (idle_process) {
+        remove_from_ready_queue(idle_process);
+        cpu->idle_process = idle_process;
     }
     
     // Initialize statistics
-    process_stats.total_processes = 1;
-    process_stats.active_processes = 1;
-    process_stats.demon_processes = 1;
-    process_stats.soul_processes = 0;
     process_stats.zombie_processes = 0;
     process_stats.context_switches = 0;
     process_stats.total_cpu_time = 0;
+    process_stats.aging_promotions = 0;
+    process_stats.steals = 0;
     
     process_manager_initialized = true;
 }
@@ -79,25 +131,18 @@ void init_process_manager(void) {
  * Create a new process (summon a soul or demon)
  */
 process_t* create_process(const char* name, uint64_t entry_point, process_priority_t priority, bool is_demon) {
-    if (!process_manager_initialized || process_count >= MAX_PROCESSES) {
+    if (!process_cache) {
         return NULL;
     }
     
-    // Find free process slot
-    process_t* process = NULL;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].pid == 0) {
-            process = &processes[i];
-            break;
-        }
-    }
-    
+    // Grab a process descriptor
+    process_t* process = kmem_cache_alloc(process_cache);
     if (!process) {
         return NULL;
     }
+    memset(process, 0, sizeof(process_t));
     
     // Initialize process
-    process->pid = next_pid++;
     strncpy(process->name, name, PROCESS_NAME_LENGTH - 1);
     process->name[PROCESS_NAME_LENGTH - 1] = '\0';
     process->state = PROCESS_STATE_READY;
@@ -109,7 +154,7 @@ process_t* create_process(const char* name, uint64_t entry_point, process_priori
     // Set up memory
     process->stack_base = (uintptr_t)malloc(STACK_SIZE);
     if (!process->stack_base) {
-        process->pid = 0;
+        kmem_cache_free(process_cache, process);
         return NULL;
     }
     process->stack_pointer = process->stack_base + STACK_SIZE;
@@ -122,10 +167,14 @@ process_t* create_process(const char* name, uint64_t entry_point, process_priori
     for (int i = 0; i < 16; i++) {
         process->registers[i] = 0;
     }
+    if (entry_point) {
+        prepare_initial_stack(process);
+    }
     
     // Set up process relationships
-    process->parent_pid = current_process ? current_process->pid : 0;
-    process->parent = current_process;
+    process_t* parent = get_current_process();
+    process->parent_pid = parent ? parent->pid : 0;
+    process->parent = parent;
     process->children = NULL;
     process->next_sibling = NULL;
     
@@ -135,8 +184,20 @@ process_t* create_process(const char* name, uint64_t entry_point, process_priori
     process->time_slice = (priority == PRIORITY_OVERLORD) ? 100 : 
                          (priority == PRIORITY_DEMON) ? 50 : 
                          (priority == PRIORITY_SOUL) ? 25 : 10;
+    process->effective_priority = priority;
+    process->on_run_queue = false;
+    process->run_next = NULL;
+    process->run_prev = NULL;
+    process->on_cpu = false;
+    process->wake_pending = false;
+    process->waiting_on = NULL;
+    process->wait_next = NULL;
+    process->creation_time = get_system_time();
     
     // Add to process list
+    uint32_t flags = spin_lock_irqsave(&process_lock);
+    process->pid = next_pid++;
+    pid_hash_insert(process);
     process->next = process_list;
     process->prev = NULL;
     if (process_list) {
@@ -144,9 +205,6 @@ process_t* create_process(const char* name, uint64_t entry_point, process_priori
     }
     process_list = process;
     
-    // Add to ready queue
-    add_to_ready_queue(process);
-    
     // Update statistics
     process_count++;
     process_stats.total_processes++;
@@ -157,32 +215,109 @@ process_t* create_process(const char* name, uint64_t entry_point, process_priori
         process_stats.soul_processes++;
     }
     
-    process->creation_time = get_system_time();
+    // Start on the creating CPU; idle CPUs steal it from there. Without an
+    // entry point there is no stack to switch to and the caller adopts it.
+    process->cpu = this_cpu()->index;
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    if (entry_point) {
+        add_to_ready_queue(process);
+    }
     
     return process;
 }
 
+/*
+ * Build the frame switch_context pops on a process's first run
+ * Callee-saved registers come first with the entry point in EBX, then the
+ * return address into process_entry_trampoline.
+ */
+static void prepare_initial_stack(process_t* process) {
+    uint32_t* sp = (uint32_t*)(uintptr_t)(process->stack_base + STACK_SIZE);
+    
+    *--sp = (uint32_t)(uintptr_t)process_entry_trampoline;  // Return address
+    *--sp = 0;                                              // EBP
+    *--sp = (uint32_t)process->entry_point;                 // EBX
+    *--sp = 0;                                              // ESI
+    *--sp = 0;                                              // EDI
+    
+    process->stack_pointer = (uintptr_t)sp;
+}
+
 /*
  * Terminate a process (banish a soul or demon)
  */
 void terminate_process(uint32_t pid) {
+    uint32_t flags = spin_lock_irqsave(&process_lock);
     process_t* process = find_process_by_pid(pid);
-    if (!process || process->state == PROCESS_STATE_TERMINATED) {
+    
+    // Cannot terminate kernel or idle processes
+    if (!process || process->pid == 0 || process == get_cpu(process->cpu)->idle_process) {
+        spin_unlock_irqrestore(&process_lock, flags);
         return;
     }
     
-    // Cannot terminate kernel process
-    if (process->pid == 0) {
-        return;
+    // Update statistics
+    process_stats.active_processes--;
+    if (process->is_demon) {
+        process_stats.demon_processes--;
+    } else {
+        process_stats.soul_processes--;
+    }
+    
+    // Unlink from the process list
+    if (process->prev) {
+        process->prev->next = process->next;
+    } else {
+        process_list = process->next;
+    }
+    if (process->next) {
+        process->next->prev = process->prev;
+    }
+    process->next = NULL;
+    process->prev = NULL;
+    pid_hash_remove(process);
+    process_count--;
+    
+    // Nothing may wake it once it is gone
+    wait_queue_t* queue = process->waiting_on;
+    if (queue) {
+        spin_lock(&queue->lock);
+        wait_queue_unlink(queue, process);
+        spin_unlock(&queue->lock);
     }
     
-    // Mark as terminated
-    process->state = PROCESS_STATE_TERMINATED;
+    // Off the ready queue and out of the scheduler's hands
+    cpu_t* cpu = lock_process_cpu(process);
+    run_queue_remove(cpu, process);
+    bool running = process->on_cpu;
+    bool is_current = running && cpu == this_cpu();
+    process->state = running ? PROCESS_STATE_ZOMBIE : PROCESS_STATE_TERMINATED;
+    spin_unlock(&cpu->lock);
     
-    // Remove from ready queue
-    remove_from_ready_queue(process);
+    // Still running on its stack, here or on another CPU: park as a zombie
+    // until it has been switched away from
+    if (running) {
+        process->next = zombie_list;
+        zombie_list = process;
+        process_stats.zombie_processes++;
+        if (!is_current) {
+            kick_cpu(cpu);
+        }
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
     
-    // Free memory
+    if (!running) {
+        release_process(process);
+    } else if (is_current) {
+        schedule_next_process();
+    }
+}
+
+/*
+ * Free a terminated process's memory and return its descriptor
+ */
+static void release_process(process_t* process) {
     if (process->stack_base) {
         free((void*)(uintptr_t)process->stack_base);
         process->stack_base = 0;
@@ -193,147 +328,655 @@ void terminate_process(uint32_t pid) {
         process->heap_start = 0;
     }
     
-    // Update statistics
-    process_stats.active_processes--;
-    if (process->is_demon) {
-        process_stats.demon_processes--;
-    } else {
-        process_stats.soul_processes--;
+    kmem_cache_free(process_cache, process);
+}
+
+/*
+ * Release zombies that no CPU is running on any more
+ */
+static void reap_zombies(void) {
+    uint32_t flags = spin_lock_irqsave(&process_lock);
+    process_t** link = &zombie_list;
+    while (*link) {
+        process_t* zombie = *link;
+        if (zombie->on_cpu) {
+            link = &zombie->next;
+            continue;
+        }
+        *link = zombie->next;
+        process_stats.zombie_processes--;
+        release_process(zombie);
     }
-    
-    // If this is the current process, schedule next
-    if (process == current_process) {
-        schedule_next_process();
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+/*
+ * Add a process to the PID hash, with process_lock held
+ */
+static void pid_hash_insert(process_t* process) {
+    process_t** bucket = &pid_hash[process->pid & (PID_HASH_SIZE - 1)];
+    process->pid_next = *bucket;
+    *bucket = process;
+}
+
+/*
+ * Take a process out of the PID hash, with process_lock held
+ */
+static void pid_hash_remove(process_t* process) {
+    process_t** link = &pid_hash[process->pid & (PID_HASH_SIZE - 1)];
+    while (*link && *link != process) {
+        link = &(*link)->pid_next;
     }
-    
-    // Clean up process entry
-    process->pid = 0;
-    process_count--;
+    if (*link) {
+        *link = process->pid_next;
+    }
+    process->pid_next = NULL;
 }
 
 /*
  * Find process by PID
  */
 process_t* find_process_by_pid(uint32_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].pid == pid) {
-            return &processes[i];
+    for (process_t* process = pid_hash[pid & (PID_HASH_SIZE - 1)]; process; process = process->pid_next) {
+        if (process->pid == pid) {
+            return process;
         }
     }
     return NULL;
 }
 
 /*
- * Add process to ready queue
+ * Lock the ready queues of the CPU a process belongs to
+ * The process can be stolen while we wait for the lock, so check it still
+ * belongs to the CPU we got. Interrupts must be off.
  */
-void add_to_ready_queue(process_t* process) {
-    if (!process || process->state != PROCESS_STATE_READY) {
+static cpu_t* lock_process_cpu(process_t* process) {
+    for (;;) {
+        cpu_t* cpu = get_cpu(process->cpu);
+        spin_lock(&cpu->lock);
+        if (process->cpu == cpu->index) {
+            return cpu;
+        }
+        spin_unlock(&cpu->lock);
+    }
+}
+
+/*
+ * Append a process to its level on a CPU's ready queues (CPU lock held)
+ */
+static void run_queue_add(cpu_t* cpu, process_t* process) {
+    run_queue_t* queue = &cpu->run_queues[process->effective_priority];
+    process->run_next = NULL;
+    process->run_prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->run_next = process;
+    } else {
+        queue->head = process;
+    }
+    queue->tail = process;
+    
+    cpu->ready_bitmap |= 1U << process->effective_priority;
+    cpu->nr_ready++;
+    process->enqueue_time = get_system_time();
+    process->on_run_queue = true;
+}
+
+/*
+ * Unlink a process from a CPU's ready queues (CPU lock held)
+ */
+static void run_queue_remove(cpu_t* cpu, process_t* process) {
+    if (!process->on_run_queue) {
         return;
     }
     
-    // Insert based on priority (higher priority first)
-    if (!ready_queue || process->priority < ready_queue->priority) {
-        process->next = ready_queue;
-        ready_queue = process;
+    run_queue_t* queue = &cpu->run_queues[process->effective_priority];
+    if (process->run_prev) {
+        process->run_prev->run_next = process->run_next;
     } else {
-        process_t* current = ready_queue;
-        while (current->next && current->next->priority <= process->priority) {
-            current = current->next;
-        }
-        process->next = current->next;
-        current->next = process;
+        queue->head = process->run_next;
+    }
+    if (process->run_next) {
+        process->run_next->run_prev = process->run_prev;
+    } else {
+        queue->tail = process->run_prev;
     }
+    
+    if (!queue->head) {
+        cpu->ready_bitmap &= ~(1U << process->effective_priority);
+    }
+    cpu->nr_ready--;
+    
+    process->run_next = NULL;
+    process->run_prev = NULL;
+    process->on_run_queue = false;
+}
+
+/*
+ * Add process to the tail of its ready queue
+ */
+void add_to_ready_queue(process_t* process) {
+    if (!process) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    cpu_t* cpu = lock_process_cpu(process);
+    bool queued = process->state == PROCESS_STATE_READY && !process->on_run_queue;
+    if (queued) {
+        run_queue_add(cpu, process);
+    }
+    spin_unlock(&cpu->lock);
+    
+    if (queued) {
+        kick_cpu(cpu);
+    }
+    irq_restore(flags);
 }
 
 /*
- * Remove process from ready queue
+ * Remove process from its ready queue
  */
 void remove_from_ready_queue(process_t* process) {
-    if (!process || !ready_queue) {
+    if (!process) {
         return;
     }
     
-    if (ready_queue == process) {
-        ready_queue = process->next;
-    } else {
-        process_t* current = ready_queue;
-        while (current->next && current->next != process) {
-            current = current->next;
+    uint32_t flags = irq_save();
+    cpu_t* cpu = lock_process_cpu(process);
+    run_queue_remove(cpu, process);
+    spin_unlock(&cpu->lock);
+    irq_restore(flags);
+}
+
+/*
+ * Take the first process of the highest non-empty priority level
+ */
+static process_t* pick_next_process(cpu_t* cpu) {
+    if (!cpu->ready_bitmap) {
+        return NULL;
+    }
+    
+    process_t* process = cpu->run_queues[__builtin_ctz(cpu->ready_bitmap)].head;
+    run_queue_remove(cpu, process);
+    return process;
+}
+
+/*
+ * Take work from the CPU with the most queued processes (own lock held)
+ * The victim's lock is only tried, never waited for: two CPUs stealing
+ * from each other can't deadlock, and a busy victim is simply skipped
+ * until the next attempt.
+ */
+static process_t* steal_process(cpu_t* cpu) {
+    cpu_t* victim = NULL;
+    uint32_t most_ready = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* other = get_cpu(i);
+        if (other != cpu && other->online && other->nr_ready > most_ready) {
+            victim = other;
+            most_ready = other->nr_ready;
+        }
+    }
+    
+    if (!victim || !spin_trylock(&victim->lock)) {
+        return NULL;
+    }
+    
+    // The victim's most urgent waiter; one still on its way off the
+    // victim's stack (resumed before it was switched out) stays put
+    process_t* process = NULL;
+    if (victim->ready_bitmap) {
+        process = victim->run_queues[__builtin_ctz(victim->ready_bitmap)].head;
+        if (process->on_cpu) {
+            process = NULL;
+        } else {
+            run_queue_remove(victim, process);
+            process->cpu = cpu->index;
+            cpu->stats.steals++;
         }
-        if (current->next) {
-            current->next = process->next;
+    }
+    spin_unlock(&victim->lock);
+    return process;
+}
+
+/*
+ * Promote processes that have waited too long
+ * Queues are FIFO, so only each level's head can be the longest waiter;
+ * checking the heads keeps aging constant time per scheduling decision.
+ */
+static void age_ready_queues(cpu_t* cpu, uint64_t now) {
+    for (uint32_t level = PROCESS_AGING_CEILING + 1; level < PRIORITY_LEVELS; level++) {
+        process_t* process = cpu->run_queues[level].head;
+        if (process && now - process->enqueue_time >= PROCESS_AGING_THRESHOLD) {
+            run_queue_remove(cpu, process);
+            process->effective_priority = level - 1;
+            run_queue_add(cpu, process);
+            cpu->stats.aging_promotions++;
         }
     }
+}
+
+/*
+ * Get another CPU to look at the queue a process was just put on
+ * A remote owner may be idle or running something less urgent, so it
+ * gets a reschedule IPI. Work queued behind our own running process goes
+ * to an idle CPU to steal instead. Interrupts must be off.
+ */
+static void kick_cpu(cpu_t* cpu) {
+    if (cpu != this_cpu()) {
+        smp_send_reschedule(cpu);
+        return;
+    }
     
-    process->next = NULL;
+    if (!idle_cpus || !cpu->nr_ready) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* other = get_cpu(i);
+        if (other != cpu && other->online && other->idle) {
+            // Cleared here so the next kick picks a different CPU
+            other->idle = false;
+            smp_send_reschedule(other);
+            return;
+        }
+    }
 }
 
 /*
  * Schedule next process
+ * A still-runnable current process goes back on its queue at its base
+ * priority first, so it only keeps the CPU if nothing better is waiting.
+ * Runs with interrupts off; each process gets its own interrupt state back
+ * when it is switched in again.
  */
 void schedule_next_process(void) {
-    if (!ready_queue) {
+    if (!process_manager_initialized) {
         return;
     }
     
-    process_t* next_process = ready_queue;
-    ready_queue = ready_queue->next;
-    next_process->next = NULL;
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    spin_lock(&cpu->lock);
+    schedule_locked(cpu, flags);
+}
+
+/*
+ * Pick and switch to the next process on this CPU
+ * Entered with the CPU's lock held and interrupts off. The lock stays held
+ * across switch_context and is dropped by schedule_tail on the other side,
+ * so nobody can steal or wake the previous process while its registers
+ * are still being saved.
+ */
+static void schedule_locked(cpu_t* cpu, uint32_t flags) {
+    process_t* current = cpu->current;
+    bool runnable = current->state == PROCESS_STATE_RUNNING;
     
-    // Context switch
-    if (current_process && current_process != next_process) {
-        // Save current process context
-        save_process_context(current_process);
-        
-        // If current process is still ready, add back to queue
-        if (current_process->state == PROCESS_STATE_RUNNING) {
-            current_process->state = PROCESS_STATE_READY;
-            add_to_ready_queue(current_process);
-        }
+    // Nothing queued here: a runnable process keeps the CPU; the idle
+    // process and anything that stopped running look further
+    if (!cpu->ready_bitmap && runnable && current != cpu->idle_process) {
+        spin_unlock(&cpu->lock);
+        irq_restore(flags);
+        return;
+    }
+    
+    age_ready_queues(cpu, get_system_time());
+    
+    if (runnable && current != cpu->idle_process) {
+        current->state = PROCESS_STATE_READY;
+        current->effective_priority = current->priority;
+        run_queue_add(cpu, current);
     }
     
+    process_t* next_process = pick_next_process(cpu);
+    if (!next_process) {
+        next_process = steal_process(cpu);
+    }
+    if (!next_process) {
+        next_process = cpu->idle_process;
+    }
+    
+    // Nothing better was waiting: keep running with a fresh time slice
+    if (!next_process || next_process == current) {
+        current->state = PROCESS_STATE_RUNNING;
+        current->last_scheduled = get_system_time();
+        spin_unlock(&cpu->lock);
+        irq_restore(flags);
+        return;
+    }
+    
+    // Save current process context
+    save_process_context(current);
+    
     // Switch to next process
-    current_process = next_process;
-    current_process->state = PROCESS_STATE_RUNNING;
-    current_process->last_scheduled = get_system_time();
+    cpu->current = next_process;
+    next_process->state = PROCESS_STATE_RUNNING;
+    next_process->on_cpu = true;
+    load_process_context(next_process);
     
-    // Load process context
-    load_process_context(current_process);
+    cpu->stats.context_switches++;
+    cpu->switch_prev = current;
+    TRACE_INSTANT(TRACE_CONTEXT_SWITCH, next_process->pid);
     
-    process_stats.context_switches++;
+    switch_context(&current->stack_pointer, (uint32_t)next_process->stack_pointer);
+    
+    // Running as current again, possibly much later and on another CPU
+    schedule_tail();
+    irq_restore(flags);
+}
+
+/*
+ * Finish a switch on the new process's stack
+ * The previous process is off its stack now, so it may be stolen, woken or
+ * freed. New processes get here from process_entry_trampoline.
+ */
+void schedule_tail(void) {
+    cpu_t* cpu = this_cpu();
+    process_t* previous = cpu->switch_prev;
+    cpu->switch_prev = NULL;
+    if (previous) {
+        previous->on_cpu = false;
+    }
+    spin_unlock(&cpu->lock);
+    
+    // Anything that terminated while it was running can go now
+    if (zombie_list) {
+        reap_zombies();
+    }
 }
 
 /*
  * Save process context
+ * Registers and the stack pointer are saved by switch_context; this
+ * charges the CPU time used since the process was scheduled.
  */
 void save_process_context(process_t* process) {
     if (!process) {
         return;
     }
     
-    // Save registers (simplified - would use assembly in real implementation)
-    // This is a placeholder for the actual context saving
-    process->cpu_time += get_system_time() - process->last_scheduled;
-    process_stats.total_cpu_time += get_system_time() - process->last_scheduled;
+    uint64_t now = get_system_time();
+    process->cpu_time += now - process->last_scheduled;
+    this_cpu()->stats.cpu_time += now - process->last_scheduled;
 }
 
 /*
  * Load process context
+ * Starts the process's time slice; switch_context restores its registers.
  */
 void load_process_context(process_t* process) {
     if (!process) {
         return;
     }
     
-    // Load registers (simplified - would use assembly in real implementation)
-    // This is a placeholder for the actual context loading
+    process->last_scheduled = get_system_time();
+}
+
+/*
+ * Block the running process until wake_process
+ * A wakeup that raced in from another CPU while we were still running
+ * is consumed instead of blocking.
+ */
+void block_current_process(void) {
+    if (!process_manager_initialized) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    spin_lock(&cpu->lock);
+    process_t* current = cpu->current;
+    
+    if (current->wake_pending) {
+        current->wake_pending = false;
+        spin_unlock(&cpu->lock);
+        irq_restore(flags);
+        return;
+    }
+    
+    if (!cpu->ready_bitmap && !cpu->idle_process) {
+        // Nowhere to switch to: wait for the waking interrupt in place
+        spin_unlock(&cpu->lock);
+        __asm__ volatile ("sti; hlt; cli");
+        irq_restore(flags);
+        return;
+    }
+    
+    current->state = PROCESS_STATE_WAITING;
+    schedule_locked(cpu, flags);
+}
+
+/*
+ * Make a blocked process runnable again (interrupt safe)
+ * It goes back on the queue of the CPU it last ran on, whose cache is
+ * most likely to still hold its working set.
+ */
+void wake_process(process_t* process) {
+    if (!process) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    cpu_t* cpu = lock_process_cpu(process);
+    bool queued = false;
+    if (process->state == PROCESS_STATE_WAITING && !process->is_suspended) {
+        process->state = PROCESS_STATE_READY;
+        process->effective_priority = process->priority;
+        run_queue_add(cpu, process);
+        queued = true;
+    } else if (process->state == PROCESS_STATE_RUNNING) {
+        // About to block on another CPU
+        process->wake_pending = true;
+    }
+    spin_unlock(&cpu->lock);
+    
+    if (queued) {
+        kick_cpu(cpu);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Set up an empty wait queue
+ */
+void wait_queue_init(wait_queue_t* queue) {
+    queue->lock = (spinlock_t)SPINLOCK_INIT;
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+/*
+ * Remove a process from a queue it may be on
+ * Called with the queue's lock held.
+ */
+static void wait_queue_unlink(wait_queue_t* queue, process_t* process) {
+    if (process->waiting_on != queue) {
+        return;
+    }
+    process_t** link = &queue->head;
+    process_t* prev = NULL;
+    while (*link && *link != process) {
+        prev = *link;
+        link = &(*link)->wait_next;
+    }
+    if (*link) {
+        *link = process->wait_next;
+        if (queue->tail == process) {
+            queue->tail = prev;
+        }
+    }
+    process->wait_next = NULL;
+    process->waiting_on = NULL;
+}
+
+/*
+ * Join a wait queue ahead of checking the condition waited on
+ * Repeat calls while already queued keep the process's place.
+ */
+void prepare_to_wait(wait_queue_t* queue) {
+    process_t* current = get_current_process();
+    if (!current) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    if (current->waiting_on != queue) {
+        current->waiting_on = queue;
+        current->wait_next = NULL;
+        if (queue->tail) {
+            queue->tail->wait_next = current;
+        } else {
+            queue->head = current;
+        }
+        queue->tail = current;
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+/*
+ * Leave a wait queue once the condition holds
+ * A wakeup that raced the final check may still cut a later block short,
+ * which is why every blocker rechecks its condition in a loop.
+ */
+void finish_wait(wait_queue_t* queue) {
+    process_t* current = get_current_process();
+    if (!current) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    wait_queue_unlink(queue, current);
+    spin_unlock_irqrestore(&queue->lock, flags);
 }
 
 /*
- * Get current process
+ * Wake the longest waiting process (interrupt safe)
+ */
+void wake_up_one(wait_queue_t* queue) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    process_t* process = queue->head;
+    if (process) {
+        wait_queue_unlink(queue, process);
+        wake_process(process);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+/*
+ * Wake every waiting process (interrupt safe)
+ */
+void wake_up_all(wait_queue_t* queue) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    while (queue->head) {
+        process_t* process = queue->head;
+        wait_queue_unlink(queue, process);
+        wake_process(process);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+/*
+ * Idle process body, one per CPU
+ * Looks for local or stealable work, drains the log rings, then halts
+ * until the next interrupt.
+ * The BSP's timer goes one-shot to the next wakeup deadline once every
+ * CPU is idle, and APs stop their local APIC timers while halted, so an
+ * idle system takes a handful of interrupts a second instead of TIMER_HZ
+ * per CPU. sti;hlt is atomic: a wakeup that arrives after the ready check
+ * still ends the halt.
+ */
+static void idle_loop(void) {
+    for (;;) {
+        schedule_next_process();
+        
+        // Idle time drains the log; keep polling while the UART is busy
+        if (debug_drain()) {
+            continue;
+        }
+        
+        disable_interrupts();
+        cpu_t* cpu = this_cpu();
+        if (cpu->ready_bitmap) {
+            enable_interrupts();
+            continue;
+        }
+        
+        bool bsp = smp_is_bsp();
+        bool tickless = false;
+        cpu->idle = true;
+        uint32_t idle = __atomic_add_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+        if (!bsp) {
+            lapic_timer_stop();
+        } else if (TIMER_TICKLESS && idle == smp_online_count()) {
+            timer_enter_idle();
+            tickless = true;
+        }
+        
+        __asm__ volatile ("sti; hlt; cli");
+        
+        if (tickless) {
+            timer_exit_idle();
+        } else if (!bsp) {
+            lapic_timer_start();
+        }
+        cpu->idle = false;
+        __atomic_sub_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+        
+        // The system clock runs on the BSP; bring it out of one-shot mode
+        // now that this CPU has work
+        if (!bsp && get_cpu(0)->idle) {
+            smp_send_reschedule(get_cpu(0));
+        }
+        enable_interrupts();
+    }
+}
+
+/*
+ * Create the idle process an AP boots on
+ * The AP starts on its stack directly and calls run_idle_process, so it
+ * needs no initial switch frame and never sits on a ready queue.
+ */
+process_t* create_ap_idle_process(cpu_t* cpu) {
+    process_t* idle_process = create_process("idle", 0, PRIORITY_DAMNED, true);
+    if (!idle_process) {
+        return NULL;
+    }
+    
+    idle_process->cpu = cpu->index;
+    idle_process->state = PROCESS_STATE_RUNNING;
+    idle_process->on_cpu = true;
+    cpu->current = idle_process;
+    cpu->idle_process = idle_process;
+    return idle_process;
+}
+
+/*
+ * Enter this CPU's idle loop (AP startup, never returns)
+ */
+void run_idle_process(void) {
+    this_cpu()->current->last_scheduled = get_system_time();
+    idle_loop();
+}
+
+/*
+ * Terminate the running process (first-run trampoline calls this when
+ * the entry point returns)
+ */
+void exit_current_process(void) {
+    process_t* process = get_current_process();
+    if (process) {
+        terminate_process(process->pid);
+    }
+}
+
+/*
+ * Get current process (of the calling CPU)
  */
 process_t* get_current_process(void) {
-    return current_process;
+    uint32_t flags = irq_save();
+    process_t* process = this_cpu()->current;
+    irq_restore(flags);
+    return process;
 }
 
 /*
@@ -344,9 +987,27 @@ process_t* get_process_list(void) {
 }
 
 /*
- * Get process statistics
+ * Get process statistics, with the per-CPU scheduler counters summed
  */
 process_stats_t* get_process_stats(void) {
+    uint64_t context_switches = 0;
+    uint64_t cpu_time = 0;
+    uint32_t aging_promotions = 0;
+    uint32_t steals = 0;
+    
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_sched_stats_t* stats = &get_cpu(i)->stats;
+        context_switches += stats->context_switches;
+        cpu_time += stats->cpu_time;
+        aging_promotions += stats->aging_promotions;
+        steals += stats->steals;
+    }
+    
+    process_stats.context_switches = context_switches;
+    process_stats.total_cpu_time = cpu_time;
+    process_stats.aging_promotions = aging_promotions;
+    process_stats.steals = steals;
+    process_stats.online_cpus = smp_online_count();
     return &process_stats;
 }
 
@@ -354,25 +1015,37 @@ process_stats_t* get_process_stats(void) {
  * Yield CPU to next process
  */
 void yield_process(void) {
-    if (current_process) {
-        current_process->state = PROCESS_STATE_READY;
-        schedule_next_process();
-    }
+    schedule_next_process();
 }
 
 /*
  * Suspend a process
+ * A process running on another CPU is descheduled by its reschedule IPI.
  */
 void suspend_process(uint32_t pid) {
+    uint32_t flags = spin_lock_irqsave(&process_lock);
     process_t* process = find_process_by_pid(pid);
-    if (process && process->state == PROCESS_STATE_RUNNING) {
+    cpu_t* cpu = NULL;
+    bool running = false;
+    if (process && !process->is_suspended &&
+        (process->state == PROCESS_STATE_RUNNING || process->state == PROCESS_STATE_READY)) {
+        cpu = lock_process_cpu(process);
         process->is_suspended = true;
         process->state = PROCESS_STATE_WAITING;
-        remove_from_ready_queue(process);
-        
-        if (process == current_process) {
-            schedule_next_process();
-        }
+        run_queue_remove(cpu, process);
+        running = process->on_cpu;
+        spin_unlock(&cpu->lock);
+    }
+    spin_unlock(&process_lock);
+    
+    bool is_current = running && cpu == this_cpu();
+    if (running && !is_current) {
+        kick_cpu(cpu);
+    }
+    irq_restore(flags);
+    
+    if (is_current) {
+        schedule_next_process();
     }
 }
 
@@ -380,40 +1053,65 @@ void suspend_process(uint32_t pid) {
  * Resume a suspended process
  */
 void resume_process(uint32_t pid) {
+    uint32_t flags = spin_lock_irqsave(&process_lock);
     process_t* process = find_process_by_pid(pid);
+    cpu_t* cpu = NULL;
+    bool queued = false;
     if (process && process->is_suspended) {
+        cpu = lock_process_cpu(process);
         process->is_suspended = false;
-        process->state = PROCESS_STATE_READY;
-        add_to_ready_queue(process);
+        if (process->on_cpu) {
+            // Never got switched out: just carry on
+            process->state = PROCESS_STATE_RUNNING;
+        } else {
+            process->state = PROCESS_STATE_READY;
+            process->effective_priority = process->priority;
+            run_queue_add(cpu, process);
+            queued = true;
+        }
+        spin_unlock(&cpu->lock);
     }
+    spin_unlock(&process_lock);
+    
+    if (queued) {
+        kick_cpu(cpu);
+    }
+    irq_restore(flags);
 }
 
 /*
- * Get system time (placeholder)
+ * Get system time in milliseconds since the timer started
  */
 uint64_t get_system_time(void) {
-    // In a real implementation, this would get the actual system time
-    // For now, return a simple counter
-    static uint64_t time_counter = 0;
-    return ++time_counter;
+    return timer_get_milliseconds();
 }
 
 /*
- * Process scheduler (called from timer interrupt)
+ * Process scheduler (called from the timer interrupt of each CPU)
  */
 void process_scheduler(void) {
-    if (!process_manager_initialized || !current_process) {
+    if (!process_manager_initialized) {
         return;
     }
     
-    // Check if current process has exceeded its time slice
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    if (!current) {
+        return;
+    }
+    
+    // Preempt once the time slice is used up or something of higher
+    // priority was woken; a process that stopped running without
+    // switching away (exit with nothing ready) goes too
     uint64_t current_time = get_system_time();
-    if (current_time - current_process->last_scheduled >= current_process->time_slice) {
-        // Time slice expired, schedule next process
-        if (current_process->state == PROCESS_STATE_RUNNING) {
-            current_process->state = PROCESS_STATE_READY;
-            schedule_next_process();
-        }
+    if (current->state != PROCESS_STATE_RUNNING ||
+        current == cpu->idle_process ||
+        (cpu->ready_bitmap && (uint32_t)__builtin_ctz(cpu->ready_bitmap) < current->effective_priority) ||
+        current_time - current->last_scheduled >= current->time_slice) {
+        schedule_next_process();
+    } else if (cpu->nr_ready && idle_cpus) {
+        // Work is waiting behind us while another CPU sleeps
+        kick_cpu(cpu);
     }
 }
 
@@ -8,10 +8,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "spinlock.h"
 
 // Forward declarations
 typedef struct process process_t;
 typedef struct process_stats_s process_stats_t;
+typedef struct cpu_s cpu_t;
 
 // Process priority levels
 typedef enum {
@@ -21,6 +23,27 @@ typedef enum {
     PRIORITY_DAMNED = 3       // Lowest priority (background processes)
 } process_priority_t;
 
+#define PRIORITY_LEVELS 4
+
+// Processes blocked until some condition holds, woken in arrival order.
+// A waiter joins with prepare_to_wait, checks its condition, and only
+// then blocks; a wakeup between the check and the block is not lost,
+// since wake_process on a running process makes its next block return.
+//
+//     for (;;) {
+//         prepare_to_wait(&queue);
+//         if (condition) break;
+//         block_current_process();
+//     }
+//     finish_wait(&queue);
+typedef struct wait_queue {
+    spinlock_t lock;
+    process_t* head;
+    process_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
 // Process management functions
 void init_process_manager(void);
 process_t* create_process(const char* name, uint64_t entry_point, process_priority_t priority, bool is_demon);
@@ -33,6 +56,21 @@ void yield_process(void);
 void suspend_process(uint32_t pid);
 void resume_process(uint32_t pid);
 void process_scheduler(void);
+void exit_current_process(void);
+void block_current_process(void);
+void wake_process(process_t* process);
+void schedule_tail(void);
+
+// Wait queues
+void wait_queue_init(wait_queue_t* queue);
+void prepare_to_wait(wait_queue_t* queue);
+void finish_wait(wait_queue_t* queue);
+void wake_up_one(wait_queue_t* queue);
+void wake_up_all(wait_queue_t* queue);
+
+// Per-CPU scheduling
+process_t* create_ap_idle_process(cpu_t* cpu);
+void run_idle_process(void);
 
 // Process context management
 void save_process_context(process_t* process);
@@ -0,0 +1,357 @@
+/*
+ * HellOS SMP
+ * Raising the other demons: local APIC setup and application processor
+ * startup through the INIT-SIPI-SIPI sequence
+ */
+
+#include "kernel.h"
+#include "smp.h"
+#include "acpi.h"
+#include "paging.h"
+#include "interrupts.h"
+#include "process.h"
+#include "timer.h"
+#include "memory.h"
+#include "debug.h"
+#include <stdint.h>
+
+// CPUID leaf 1 EDX: on-chip local APIC
+#define CPUID_FEATURE_APIC      BIT(9)
+
+// Startup timing (milliseconds)
+#define AP_INIT_DELAY_MS        10
+#define AP_SIPI_DELAY_MS        1
+#define AP_ONLINE_TIMEOUT_MS    100
+#define LAPIC_CALIBRATE_MS      10
+
+#define APIC_ID_NONE            0xFF
+
+// Trampoline image from smp_trampoline.asm
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+// SMP state. cpus[0] is the BSP and usable before init_smp: this_cpu()
+// returns it until the local APIC is mapped.
+static cpu_t cpus[MAX_CPUS];
+static uint32_t cpu_count = 1;                  // Slots in cpus[], online or not
+static volatile uint32_t online_count = 1;
+static volatile uint32_t* lapic_base = NULL;
+static uint8_t apic_to_index[256];              // APIC ID to cpus[] index
+static uint32_t lapic_ticks_per_ms = 0;
+
+/*
+ * Local APIC register access
+ */
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+/*
+ * Busy wait on the system clock (interrupts on)
+ */
+static void smp_delay_ms(uint32_t ms) {
+    // The clock has millisecond granularity, so wait one extra to cover
+    // at least the full interval
+    uint64_t end = get_system_time() + ms + 1;
+    while (get_system_time() < end) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/*
+ * Send an interprocessor interrupt and wait for the APIC to accept it
+ * ICR high and low must be written back to back, so interrupts are off
+ * in between.
+ */
+static void lapic_send_ipi(uint8_t apic_id, uint32_t command) {
+    uint32_t flags = irq_save();
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Software-enable this CPU's local APIC
+ * The BSP keeps receiving the 8259's interrupts through LINT0 (virtual
+ * wire mode); the APs only take their timer and IPIs.
+ */
+static void lapic_enable(bool bsp) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, bsp ? LAPIC_DELIVERY_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, bsp ? LAPIC_DELIVERY_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * Measure the local APIC timer against the PIT-driven system clock
+ * All APs share the bus clock the BSP measures here.
+ */
+static void lapic_calibrate_timer(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // Start on a clock edge so the interval is a whole number of ms
+    uint64_t start = get_system_time();
+    while (get_system_time() == start) {
+        __asm__ volatile ("pause");
+    }
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    smp_delay_ms(LAPIC_CALIBRATE_MS - 1);
+    uint32_t remaining = lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    lapic_ticks_per_ms = (0xFFFFFFFF - remaining) / LAPIC_CALIBRATE_MS;
+}
+
+/*
+ * Read the MADT: local APIC address and the enabled processors
+ */
+static uintptr_t smp_parse_madt(void) {
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    if (!madt) {
+        return LAPIC_DEFAULT_BASE;
+    }
+
+    uintptr_t base = madt->lapic_address;
+    uint8_t* entry = (uint8_t*)madt + sizeof(acpi_madt_t);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+
+    while (entry + sizeof(acpi_madt_entry_t) <= end) {
+        acpi_madt_entry_t* header = (acpi_madt_entry_t*)entry;
+        if (header->length < sizeof(acpi_madt_entry_t)) {
+            break;  // Malformed, don't loop forever
+        }
+
+        if (header->type == ACPI_MADT_LAPIC) {
+            acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*)entry;
+            if ((lapic->flags & ACPI_LAPIC_ENABLED) && cpu_count < MAX_CPUS &&
+                lapic->apic_id != APIC_ID_NONE && apic_to_index[lapic->apic_id] == APIC_ID_NONE) {
+                cpus[cpu_count].index = cpu_count;
+                cpus[cpu_count].apic_id = lapic->apic_id;
+                apic_to_index[lapic->apic_id] = (uint8_t)cpu_count;
+                cpu_count++;
+            }
+        } else if (header->type == ACPI_MADT_LAPIC_OVERRIDE) {
+            acpi_madt_lapic_override_t* override = (acpi_madt_lapic_override_t*)entry;
+            if ((override->address >> 32) == 0) {
+                base = (uintptr_t)override->address;
+            }
+        }
+
+        entry += header->length;
+    }
+
+    return base;
+}
+
+/*
+ * First C code on an application processor
+ * Entered from the trampoline on the stack of the CPU's idle process.
+ */
+static void ap_entry(uint32_t cpu_index) {
+    cpu_t* cpu = &cpus[cpu_index];
+
+    load_interrupt_table();
+    paging_init_pat();
+    lapic_enable(false);
+
+    cpu->online = true;
+    __atomic_add_fetch(&online_count, 1, __ATOMIC_SEQ_CST);
+
+    lapic_timer_start();
+    run_idle_process();
+}
+
+/*
+ * Start one application processor
+ */
+static bool smp_start_ap(cpu_t* cpu) {
+    process_t* idle_process = create_ap_idle_process(cpu);
+    if (!idle_process) {
+        return false;
+    }
+
+    // Fresh copy each time: the previous AP is done with it once online
+    uint32_t size = (uint32_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, size);
+
+    smp_trampoline_params_t* params = (smp_trampoline_params_t*)(SMP_TRAMPOLINE_ADDR +
+        (uint32_t)(smp_trampoline_params - smp_trampoline_start));
+    uint32_t cr3 = 0;
+    if (paging_is_enabled()) {
+        __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    }
+    params->cr3 = cr3;
+    params->stack = (uint32_t)(idle_process->stack_base + STACK_SIZE);
+    params->entry = (uint32_t)(uintptr_t)ap_entry;
+    params->cpu_index = cpu->index;
+
+    // INIT, then startup IPIs pointing at the trampoline's page. The
+    // second SIPI is only needed by CPUs that missed the first.
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT);
+    smp_delay_ms(AP_INIT_DELAY_MS);
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        smp_delay_ms(AP_SIPI_DELAY_MS);
+    }
+
+    uint64_t deadline = get_system_time() + AP_ONLINE_TIMEOUT_MS;
+    while (!cpu->online && get_system_time() < deadline) {
+        __asm__ volatile ("pause");
+    }
+    return cpu->online;
+}
+
+/*
+ * Bring up the local APIC and every other processor the MADT lists
+ * Runs on the BSP with interrupts on, after the timer and the process
+ * manager. The BSP keeps the PIT as the system clock; the APs take their
+ * scheduler ticks from their local APIC timers.
+ */
+void init_smp(void) {
+    cpus[0].index = 0;
+    cpus[0].online = true;
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_FEATURE_APIC)) {
+        DEBUG_KERNEL(DEBUG_LEVEL_INFO, "SMP: no local APIC, running on one CPU");
+        return;
+    }
+
+    memset(apic_to_index, APIC_ID_NONE, sizeof(apic_to_index));
+    uint8_t bsp_apic_id = (uint8_t)(ebx >> 24);
+    cpus[0].apic_id = bsp_apic_id;
+    apic_to_index[bsp_apic_id] = 0;
+
+    uintptr_t base = LAPIC_DEFAULT_BASE;
+    if (init_acpi()) {
+        base = smp_parse_madt();
+    }
+
+    // The APIC page is MMIO: uncached, on its own 4KB mapping
+    if (paging_is_enabled() &&
+        paging_map_page(base, base, PAGE_WRITABLE | PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE) != HELL_SUCCESS) {
+        DEBUG_KERNEL(DEBUG_LEVEL_WARN, "SMP: cannot map local APIC at 0x%x", (uint32_t)base);
+        return;
+    }
+    lapic_base = (volatile uint32_t*)base;
+
+    lapic_enable(true);
+    lapic_calibrate_timer();
+    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "SMP: %d CPUs listed, LAPIC timer %d ticks/ms", cpu_count, lapic_ticks_per_ms);
+
+    for (uint32_t i = 1; i < cpu_count; i++) {
+        if (!smp_start_ap(&cpus[i])) {
+            DEBUG_KERNEL(DEBUG_LEVEL_WARN, "SMP: CPU %d (APIC %d) did not come up", i, cpus[i].apic_id);
+        }
+    }
+
+    DEBUG_KERNEL(DEBUG_LEVEL_INFO, "SMP: %d CPUs online", online_count);
+}
+
+/*
+ * Per-CPU data of the calling CPU (interrupts off, or the answer may be
+ * stale by the time it is used)
+ */
+cpu_t* this_cpu(void) {
+    if (!lapic_base) {
+        return &cpus[0];
+    }
+
+    uint8_t index = apic_to_index[lapic_read(LAPIC_ID) >> 24];
+    return &cpus[index == APIC_ID_NONE ? 0 : index];
+}
+
+/*
+ * Per-CPU data by index
+ */
+cpu_t* get_cpu(uint32_t index) {
+    return &cpus[index < MAX_CPUS ? index : 0];
+}
+
+/*
+ * Number of cpus[] slots, including CPUs that failed to start
+ */
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+/*
+ * Number of CPUs running the scheduler
+ */
+uint32_t smp_online_count(void) {
+    return online_count;
+}
+
+/*
+ * Check whether the caller runs on the bootstrap processor
+ */
+bool smp_is_bsp(void) {
+    return this_cpu() == &cpus[0];
+}
+
+/*
+ * Make another CPU run its scheduler
+ */
+void smp_send_reschedule(cpu_t* cpu) {
+    if (!lapic_base || !cpu || !cpu->online || cpu == this_cpu()) {
+        return;
+    }
+    lapic_send_ipi(cpu->apic_id, LAPIC_RESCHEDULE_VECTOR);
+}
+
+/*
+ * Check whether the local APIC is mapped and enabled
+ */
+bool lapic_available(void) {
+    return lapic_base != NULL;
+}
+
+/*
+ * Acknowledge a local APIC interrupt
+ */
+void lapic_eoi(void) {
+    if (lapic_base) {
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+/*
+ * Start this CPU's periodic scheduler tick at TIMER_HZ
+ */
+void lapic_timer_start(void) {
+    if (!lapic_base || !lapic_ticks_per_ms) {
+        return;
+    }
+
+    uint32_t initial = lapic_ticks_per_ms * 1000 / TIMER_HZ;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, initial ? initial : 1);
+}
+
+/*
+ * Stop this CPU's tick (idle halts wait for an IPI instead)
+ */
+void lapic_timer_stop(void) {
+    if (!lapic_base) {
+        return;
+    }
+
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
@@ -0,0 +1,105 @@
+/*
+ * HellOS SMP Header
+ * Local APIC, application processor startup and per-CPU data
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+#include "process.h"
+#include "spinlock.h"
+#include "memory.h"
+
+#define MAX_CPUS                64
+
+// Local APIC registers (offsets from the MMIO base)
+#define LAPIC_DEFAULT_BASE      0xFEE00000
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INITIAL     0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_DIVIDE_16   0x3
+#define LAPIC_DELIVERY_NMI      0x400
+#define LAPIC_DELIVERY_EXTINT   0x700
+#define LAPIC_ICR_INIT          0x4500
+#define LAPIC_ICR_STARTUP       0x4600
+#define LAPIC_ICR_PENDING       0x1000
+
+// Interrupt vectors owned by the local APIC
+#define LAPIC_TIMER_VECTOR      48
+#define LAPIC_RESCHEDULE_VECTOR 49
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+// Parameters the BSP leaves in the trampoline for each AP
+typedef struct {
+    uint32_t cr3;               // 0 when paging is off
+    uint32_t stack;
+    uint32_t entry;             // void ap_entry(uint32_t cpu_index)
+    uint32_t cpu_index;
+} __attribute__((packed)) smp_trampoline_params_t;
+
+// A ready queue level
+typedef struct {
+    process_t* head;
+    process_t* tail;
+} run_queue_t;
+
+// Scheduler statistics, kept per CPU and summed by get_process_stats
+typedef struct {
+    uint64_t context_switches;
+    uint64_t cpu_time;
+    uint32_t aging_promotions;
+    uint32_t steals;            // Processes taken from other CPUs' queues
+} cpu_sched_stats_t;
+
+// Per-CPU data, one cache line aligned block per processor. The
+// scheduler fields are owned by process.c and protected by lock.
+typedef struct cpu_s {
+    uint32_t index;
+    uint8_t apic_id;
+    volatile bool online;
+    volatile bool idle;         // Halted in the idle loop
+
+    spinlock_t lock;
+    process_t* current;
+    process_t* idle_process;
+    process_t* switch_prev;     // Process being switched away from
+    run_queue_t run_queues[PRIORITY_LEVELS];
+    uint32_t ready_bitmap;
+    uint32_t nr_ready;
+    cpu_sched_stats_t stats;
+} __attribute__((aligned(CACHE_LINE_SIZE))) cpu_t;
+
+// SMP functions
+void init_smp(void);
+cpu_t* this_cpu(void);
+cpu_t* get_cpu(uint32_t index);
+uint32_t smp_cpu_count(void);
+uint32_t smp_online_count(void);
+bool smp_is_bsp(void);
+void smp_send_reschedule(cpu_t* cpu);
+
+// Local APIC
+bool lapic_available(void);
+void lapic_eoi(void);
+void lapic_timer_start(void);
+void lapic_timer_stop(void);
+
+#endif // SMP_H
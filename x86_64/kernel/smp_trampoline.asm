@@ -0,0 +1,80 @@
+; HellOS AP Startup Trampoline
+; init_smp copies this to SMP_TRAMPOLINE_ADDR; a startup IPI starts each
+; application processor here in real mode with CS = address >> 4
+
+[bits 16]
+
+%define SMP_TRAMPOLINE_ADDR 0x6000      ; memory_layout.h
+%define CR0_PROTECTED       0x00000001
+%define CR0_PAGING          0x80000000
+%define CR4_PAE             0x00000020
+
+; Offsets within the copy, valid whatever CS the AP starts with
+%define REL(label) (label - smp_trampoline_start)
+%define ABS(label) (SMP_TRAMPOLINE_ADDR + REL(label))
+
+section .text
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+smp_trampoline_start:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    lgdt [REL(trampoline_gdt_descriptor)]
+
+    mov eax, cr0
+    or eax, CR0_PROTECTED
+    mov cr0, eax
+    jmp dword 0x08:ABS(trampoline_protected)
+
+[bits 32]
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov ebx, ABS(smp_trampoline_params)
+
+    ; Share the BSP's identity-mapped PAE tables when paging is on
+    mov eax, [ebx]                  ; cr3
+    test eax, eax
+    jz .paging_done
+    mov ecx, cr4
+    or ecx, CR4_PAE
+    mov cr4, ecx
+    mov cr3, eax
+    mov ecx, cr0
+    or ecx, CR0_PAGING
+    mov cr0, ecx
+.paging_done:
+
+    ; ap_entry(cpu_index) on the idle process's stack, never returns
+    mov esp, [ebx + 4]              ; stack
+    push dword [ebx + 12]           ; cpu_index
+    push dword 0                    ; No return address
+    jmp [ebx + 8]                   ; entry
+
+; Flat code and data segments, same selectors as the bootloader's GDT
+align 8
+trampoline_gdt:
+    dq 0x0000000000000000
+    dq 0x00CF9A000000FFFF           ; 0x08: code, 4GB, 32-bit
+    dq 0x00CF92000000FFFF           ; 0x10: data, 4GB
+trampoline_gdt_descriptor:
+    dw trampoline_gdt_descriptor - trampoline_gdt - 1
+    dd ABS(trampoline_gdt)
+
+; smp_trampoline_params_t, filled in by the BSP before each startup IPI
+align 4
+smp_trampoline_params:
+    dd 0                            ; cr3
+    dd 0                            ; stack
+    dd 0                            ; entry
+    dd 0                            ; cpu_index
+smp_trampoline_end:
@@ -0,0 +1,271 @@
+/*
+ * HellOS String Functions
+ * Word-wide and rep-string versions of the mem and str primitives
+ */
+
+#include "kernel.h"
+#include "memory.h"
+
+// Keep GCC from turning the byte loops below back into calls to these
+// very functions
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+// Below this size a rep string costs more to start than it saves
+#define STRING_SMALL_SIZE   16
+
+// CPUID leaf 7 EBX: enhanced REP MOVSB/STOSB
+#define CPUID_EXT_ERMSB     BIT(9)
+
+// Word access that may alias anything; the unaligned flavour is for
+// comparing two buffers that cannot both be aligned
+typedef uint32_t __attribute__((may_alias)) word_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+// Nonzero when a word contains a zero byte
+#define HAS_ZERO_BYTE(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
+// Whether rep movsb/stosb is the fastest bulk path (-1 until first use)
+static int8_t ermsb_state = -1;
+
+/*
+ * Check for enhanced rep movsb/stosb support
+ */
+static bool cpu_has_ermsb(void) {
+    if (ermsb_state < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        ermsb_state = 0;
+        if (eax >= 7) {
+            cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+            ermsb_state = (ebx & CPUID_EXT_ERMSB) ? 1 : 0;
+        }
+    }
+    return ermsb_state;
+}
+
+/*
+ * Memory set function
+ * Small sizes go byte by byte; larger ones use rep stosb on ERMSB parts
+ * and otherwise align the destination and fill with rep stosd.
+ */
+void* memset(void* ptr, int value, size_t size) {
+    uint8_t* p = (uint8_t*)ptr;
+    uint8_t val = (uint8_t)value;
+    
+    if (size < STRING_SMALL_SIZE) {
+        while (size--) {
+            *p++ = val;
+        }
+        return ptr;
+    }
+    
+    if (cpu_has_ermsb()) {
+        __asm__ volatile ("rep stosb" : "+D"(p), "+c"(size) : "a"(val) : "memory");
+        return ptr;
+    }
+    
+    // Byte head up to a word boundary
+    size_t head = (-(uintptr_t)p) & 3;
+    size -= head;
+    while (head--) {
+        *p++ = val;
+    }
+    
+    // Whole words
+    size_t words = size >> 2;
+    __asm__ volatile ("rep stosl" : "+D"(p), "+c"(words) : "a"(val * 0x01010101U) : "memory");
+    
+    // Byte tail
+    size &= 3;
+    while (size--) {
+        *p++ = val;
+    }
+    
+    return ptr;
+}
+
+/*
+ * Memory copy function
+ * Same strategy as memset: rep movsb on ERMSB parts, otherwise an aligned
+ * rep movsd between a byte head and tail.
+ */
+void* memcpy(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    
+    if (size < STRING_SMALL_SIZE) {
+        while (size--) {
+            *d++ = *s++;
+        }
+        return dest;
+    }
+    
+    if (cpu_has_ermsb()) {
+        __asm__ volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(size) : : "memory");
+        return dest;
+    }
+    
+    // Byte head up to a destination word boundary
+    size_t head = (-(uintptr_t)d) & 3;
+    size -= head;
+    while (head--) {
+        *d++ = *s++;
+    }
+    
+    // Whole words
+    size_t words = size >> 2;
+    __asm__ volatile ("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    
+    // Byte tail
+    size &= 3;
+    while (size--) {
+        *d++ = *s++;
+    }
+    
+    return dest;
+}
+
+/*
+ * Memory move function
+ * Overlap-safe copy: forward when the destination is below the source,
+ * otherwise backward with the direction flag set.
+ */
+void* memmove(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    
+    if (d == s || size == 0) {
+        return dest;
+    }
+    
+    // A forward rep movs reads every element before overwriting it
+    if (d < s || d >= s + size) {
+        return memcpy(dest, src, size);
+    }
+    
+    // Backward: the byte tail first, then whole words from the top down
+    d += size;
+    s += size;
+    size_t tail = size & 3;
+    while (tail--) {
+        *--d = *--s;
+    }
+    
+    size_t words = size >> 2;
+    if (words) {
+        d -= 4;
+        s -= 4;
+        __asm__ volatile ("std\n\trep movsl\n\tcld" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    }
+    
+    return dest;
+}
+
+/*
+ * Memory compare function
+ * Skips equal words, then finds the differing byte.
+ */
+int memcmp(const void* ptr1, const void* ptr2, size_t size) {
+    const uint8_t* p1 = (const uint8_t*)ptr1;
+    const uint8_t* p2 = (const uint8_t*)ptr2;
+    
+    while (size >= 4 && *(const unaligned_word_t*)p1 == *(const unaligned_word_t*)p2) {
+        p1 += 4;
+        p2 += 4;
+        size -= 4;
+    }
+    
+    for (size_t i = 0; i < size; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * String length function
+ * Scans a word at a time once aligned; aligned reads never run into the
+ * next page, so reading past the terminator is harmless.
+ */
+size_t strlen(const char* str) {
+    const char* p = str;
+    
+    // Bytes up to a word boundary
+    while ((uintptr_t)p & 3) {
+        if (!*p) {
+            return p - str;
+        }
+        p++;
+    }
+    
+    // Whole words until one holds the terminator
+    const word_t* w = (const word_t*)p;
+    while (!HAS_ZERO_BYTE(*w)) {
+        w++;
+    }
+    
+    // Find the terminator within that word
+    p = (const char*)w;
+    while (*p) {
+        p++;
+    }
+    return p - str;
+}
+
+/*
+ * String compare function
+ */
+int strcmp(const char* str1, const char* str2) {
+    while (*str1 && *str2 && *str1 == *str2) {
+        str1++;
+        str2++;
+    }
+    return *str1 - *str2;
+}
+
+/*
+ * String compare function (limited)
+ */
+int strncmp(const char* str1, const char* str2, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (str1[i] != str2[i] || str1[i] == '\0') {
+            return str1[i] - str2[i];
+        }
+    }
+    return 0;
+}
+
+/*
+ * String copy function
+ */
+char* strcpy(char* dest, const char* src) {
+    char* d = dest;
+    while ((*d++ = *src++));
+    return dest;
+}
+
+/*
+ * String copy function (limited)
+ */
+char* strncpy(char* dest, const char* src, size_t n) {
+    size_t i;
+    for (i = 0; i < n && src[i]; i++) {
+        dest[i] = src[i];
+    }
+    for (; i < n; i++) {
+        dest[i] = '\0';
+    }
+    return dest;
+}
+
+/*
+ * String concatenate function
+ */
+char* strcat(char* dest, const char* src) {
+    char* d = dest;
+    while (*d) d++;
+    while ((*d++ = *src++));
+    return dest;
+}
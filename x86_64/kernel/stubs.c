@@ -5,24 +5,11 @@
 
 #include "kernel.h"
 #include "debug.h"
-
-// Window manager stubs
-void init_pandemonium_wm(void) {
-    DEBUG_GRAPHICS(DEBUG_LEVEL_INFO, "Pandemonium window manager initialized (stub)");
-}
-
-void update_pandemonium_wm(void) {
-    // Stub - no operation
-}
-
-window_t* create_window(const char* title, int x, int y, int width, int height) {
-    DEBUG_GRAPHICS(DEBUG_LEVEL_INFO, "Creating window: %s at (%d,%d) size %dx%d (stub)", title, x, y, width, height);
-    return (window_t*)0x12345678; // Return fake window handle
-}
+#include "process.h"
 
 // Process management stubs
 void yield_cpu(void) {
-    // Stub - no operation (no multitasking yet)
+    yield_process();
 }
 
 bool check_shutdown_request(void) {
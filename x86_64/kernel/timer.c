@@ -0,0 +1,290 @@
+/*
+ * HellOS Timer
+ * The infernal metronome: PIT channel 0 at TIMER_HZ, one-shot when idle
+ */
+
+#include "kernel.h"
+#include "timer.h"
+#include "interrupts.h"
+#include "process.h"
+#include "wakeup.h"
+#include <stdint.h>
+
+// Time is kept in PIT input clock counts: each interrupt adds the counts
+// that elapsed since the previous one, which is the periodic divisor in
+// normal operation and the programmed one-shot length after an idle
+// period. Milliseconds advance with the remainder carried, so the clock
+// stays exact at any rate without 64-bit division.
+static uint32_t timer_frequency = 0;
+static uint16_t periodic_divisor = 0;
+static uint16_t oneshot_counts = 0;
+static bool oneshot_armed = false;
+static uint64_t timer_ticks = 0;
+static uint64_t timer_milliseconds = 0;
+static uint32_t count_remainder = 0;        // Leftover counts * 1000, below PIT_BASE_FREQUENCY
+static timer_stats_t timer_stats = {0};
+
+// TSC rate, measured once on the BSP before anything else runs
+static uint32_t tsc_khz = 0;
+static uint64_t boot_tsc = 0;
+
+// Only the BSP's timer interrupt writes the clock; readers on any CPU
+// retry while the sequence is odd or changed under them, so the two halves
+// of a 64-bit value are never torn
+static volatile uint32_t clock_sequence = 0;
+
+static inline void clock_write_begin(void) {
+    clock_sequence++;
+    __asm__ volatile ("" : : : "memory");
+}
+
+static inline void clock_write_end(void) {
+    __asm__ volatile ("" : : : "memory");
+    clock_sequence++;
+}
+
+/*
+ * Program channel 0 with a mode and 16-bit count
+ */
+static void pit_program(uint8_t mode, uint16_t count) {
+    outb(PIT_COMMAND, mode);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+/*
+ * Read channel 0's current count
+ */
+static uint16_t pit_read_count(void) {
+    outb(PIT_COMMAND, PIT_LATCH);
+    uint8_t low = inb(PIT_CHANNEL0);
+    uint8_t high = inb(PIT_CHANNEL0);
+    return (uint16_t)(low | (high << 8));
+}
+
+/*
+ * Advance the clock by elapsed PIT counts
+ */
+static void timer_advance(uint32_t counts) {
+    clock_write_begin();
+    count_remainder += counts * 1000;
+    timer_milliseconds += count_remainder / PIT_BASE_FREQUENCY;
+    count_remainder %= PIT_BASE_FREQUENCY;
+    clock_write_end();
+}
+
+/*
+ * Program PIT channel 0 as a periodic rate generator
+ */
+void init_timer(uint32_t hz) {
+    if (hz == 0) {
+        hz = TIMER_HZ;
+    }
+
+    // The divisor is 16 bits; 0 would mean 65536
+    uint32_t divisor = PIT_BASE_FREQUENCY / hz;
+    if (divisor == 0) {
+        divisor = 1;
+    } else if (divisor > 0xFFFF) {
+        divisor = 0xFFFF;
+    }
+
+    timer_frequency = hz;
+    periodic_divisor = (uint16_t)divisor;
+    oneshot_armed = false;
+    timer_ticks = 0;
+    timer_milliseconds = 0;
+    count_remainder = 0;
+
+    pit_program(PIT_MODE_RATE, periodic_divisor);
+    pic_unmask_irq(0);
+}
+
+/*
+ * Timer tick (IRQ 0, end of interrupt already sent)
+ * interrupt_dispatch runs the scheduler once the handler returns.
+ */
+void timer_tick(void) {
+    if (oneshot_armed) {
+        // Idle deadline reached: account for it and resume ticking
+        oneshot_armed = false;
+        timer_advance(oneshot_counts);
+        pit_program(PIT_MODE_RATE, periodic_divisor);
+        timer_stats.oneshot_expiries++;
+    } else {
+        timer_advance(periodic_divisor);
+    }
+    clock_write_begin();
+    timer_ticks++;
+    clock_write_end();
+
+    wakeup_check_deadlines(timer_milliseconds);
+}
+
+/*
+ * Stop periodic ticks while the idle process halts (interrupts off)
+ * The PIT is reprogrammed to fire once at the next wakeup deadline, or
+ * after the longest one-shot it can count when there is none.
+ */
+void timer_enter_idle(void) {
+#if TIMER_TICKLESS
+    if (!timer_frequency || oneshot_armed) {
+        return;
+    }
+
+    uint32_t counts = 0xFFFF;
+    uint64_t deadline = wakeup_next_deadline();
+    if (deadline) {
+        if (deadline <= timer_milliseconds) {
+            return;     // Already due, the next periodic tick delivers it
+        }
+        uint64_t delta = deadline - timer_milliseconds;
+        if (delta < TIMER_ONESHOT_MAX_MS) {
+            counts = (uint32_t)delta * PIT_BASE_FREQUENCY / 1000;
+        }
+    }
+
+    // Time already spent in the current periodic tick
+    uint16_t count = pit_read_count();
+    if (count <= periodic_divisor) {
+        timer_advance(periodic_divisor - count);
+    }
+
+    oneshot_counts = (uint16_t)counts;
+    oneshot_armed = true;
+    pit_program(PIT_MODE_ONESHOT, oneshot_counts);
+    timer_stats.idle_entries++;
+#endif
+}
+
+/*
+ * Resume periodic ticks after the idle halt (interrupts off)
+ * If some other interrupt ended the halt, only the counts that actually
+ * elapsed are added to the clock.
+ */
+void timer_exit_idle(void) {
+#if TIMER_TICKLESS
+    if (!oneshot_armed) {
+        return;     // The one-shot fired and timer_tick already resumed
+    }
+
+    // Expired with its interrupt still pending: leave it to timer_tick
+    outb(0x20, 0x0A);   // Read master PIC IRR
+    if (inb(0x20) & 0x01) {
+        return;
+    }
+
+    // Mode 0 counts down to 0 and wraps, so anything above the
+    // programmed length means it already expired
+    uint16_t count = pit_read_count();
+    uint32_t elapsed = (count <= oneshot_counts) ? (uint32_t)(oneshot_counts - count) : oneshot_counts;
+
+    oneshot_armed = false;
+    timer_advance(elapsed);
+    pit_program(PIT_MODE_RATE, periodic_divisor);
+    timer_stats.early_wakeups++;
+#endif
+}
+
+/*
+ * Get configured timer frequency
+ */
+uint32_t timer_get_frequency(void) {
+    return timer_frequency;
+}
+
+/*
+ * Get ticks since init_timer
+ */
+uint64_t timer_get_ticks(void) {
+    uint32_t sequence;
+    uint64_t ticks;
+    do {
+        sequence = clock_sequence;
+        __asm__ volatile ("" : : : "memory");
+        ticks = timer_ticks;
+        __asm__ volatile ("" : : : "memory");
+    } while ((sequence & 1) || sequence != clock_sequence);
+    return ticks;
+}
+
+/*
+ * Get milliseconds since init_timer
+ */
+uint64_t timer_get_milliseconds(void) {
+    uint32_t sequence;
+    uint64_t ms;
+    do {
+        sequence = clock_sequence;
+        __asm__ volatile ("" : : : "memory");
+        ms = timer_milliseconds;
+        __asm__ volatile ("" : : : "memory");
+    } while ((sequence & 1) || sequence != clock_sequence);
+    return ms;
+}
+
+/*
+ * Measure the TSC against PIT channel 2
+ * Called first thing in kernel_main; the TSC reading taken here is the
+ * zero of boot time. Assumes an invariant TSC shared by all CPUs.
+ */
+void timer_calibrate_tsc(void) {
+    uint32_t counts = PIT_BASE_FREQUENCY / 1000 * TSC_CALIBRATE_MS;
+    uint8_t gate = inb(PIT_GATE_PORT);
+
+    boot_tsc = rdtsc();
+
+    // Gate low while loading, then raise it to start the count
+    outb(PIT_GATE_PORT, gate & ~(PIT_GATE_CH2 | PIT_GATE_SPEAKER));
+    outb(PIT_COMMAND, PIT_MODE_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, counts & 0xFF);
+    outb(PIT_CHANNEL2, (counts >> 8) & 0xFF);
+    outb(PIT_GATE_PORT, (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_CH2);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_GATE_OUT2)) {
+        __asm__ volatile ("pause");
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_GATE_PORT, gate);
+
+    // The truncated counts per ms make the interval short by under 0.02%
+    tsc_khz = (uint32_t)div64_32(cycles, TSC_CALIBRATE_MS);
+    if (tsc_khz == 0) {
+        tsc_khz = 1;
+    }
+}
+
+/*
+ * TSC rate in kHz, cycles per millisecond
+ */
+uint32_t timer_get_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/*
+ * TSC reading at kernel entry
+ */
+uint64_t timer_get_boot_tsc(void) {
+    return boot_tsc;
+}
+
+/*
+ * Convert a cycle count to microseconds
+ */
+uint64_t timer_tsc_to_us(uint64_t cycles) {
+    if (!tsc_khz) {
+        return 0;
+    }
+    uint64_t ms = div64_32(cycles, tsc_khz);
+    uint32_t rest = (uint32_t)(cycles - ms * tsc_khz);
+    return ms * 1000 + div64_32((uint64_t)rest * 1000, tsc_khz);
+}
+
+/*
+ * Get timer statistics
+ */
+timer_stats_t* get_timer_stats(void) {
+    return &timer_stats;
+}
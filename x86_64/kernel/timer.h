@@ -0,0 +1,63 @@
+/*
+ * HellOS Timer Header
+ * Programmable interval timer driving the scheduler tick
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Scheduler tick rate, override with -DTIMER_HZ=<n>
+#ifndef TIMER_HZ
+#define TIMER_HZ            1000
+#endif
+
+// Stop periodic ticks while idle, -DTIMER_TICKLESS=0 keeps them running
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS      1
+#endif
+
+// 8253/8254 PIT
+#define PIT_BASE_FREQUENCY  1193182
+#define PIT_CHANNEL0        0x40
+#define PIT_COMMAND         0x43
+#define PIT_MODE_RATE       0x34    // Channel 0, lo/hi byte, mode 2 (rate generator)
+#define PIT_MODE_ONESHOT    0x30    // Channel 0, lo/hi byte, mode 0 (interrupt on terminal count)
+#define PIT_LATCH           0x00    // Latch channel 0 count
+#define TIMER_ONESHOT_MAX_MS 54     // 0xFFFF counts is just under 55ms
+
+// TSC calibration runs PIT channel 2 (the speaker's) gated, speaker off,
+// and polls its output through port 0x61, so it needs no interrupts
+#define PIT_CHANNEL2        0x42
+#define PIT_MODE_CH2_ONESHOT 0xB0   // Channel 2, lo/hi byte, mode 0
+#define PIT_GATE_PORT       0x61
+#define PIT_GATE_CH2        0x01    // Channel 2 gate
+#define PIT_GATE_SPEAKER    0x02    // Speaker data enable
+#define PIT_GATE_OUT2       0x20    // Channel 2 output, read only
+#define TSC_CALIBRATE_MS    10
+
+// Timer statistics
+typedef struct {
+    uint32_t idle_entries;      // One-shot programmed for an idle period
+    uint32_t oneshot_expiries;  // Idle period ended by the one-shot
+    uint32_t early_wakeups;     // Idle period ended by another interrupt
+} timer_stats_t;
+
+// Timer functions
+void init_timer(uint32_t hz);
+void timer_tick(void);
+void timer_enter_idle(void);
+void timer_exit_idle(void);
+uint32_t timer_get_frequency(void);
+uint64_t timer_get_ticks(void);
+uint64_t timer_get_milliseconds(void);
+
+// Time stamp counter
+void timer_calibrate_tsc(void);
+uint32_t timer_get_tsc_khz(void);
+uint64_t timer_get_boot_tsc(void);
+uint64_t timer_tsc_to_us(uint64_t cycles);
+timer_stats_t* get_timer_stats(void);
+
+#endif // TIMER_H
@@ -0,0 +1,180 @@
+/*
+ * HellOS Tracepoints
+ * Marking the damned's every step: per-CPU event buffers and their serial dump
+ */
+
+#include "kernel.h"
+#include "trace.h"
+#include "smp.h"
+#include "process.h"
+#include "memory.h"
+#include "debug.h"
+#include <stdint.h>
+
+// Cycles trace_dump waits for tracepoints already past the enabled check
+#define TRACE_SETTLE_CYCLES     100000
+
+// A flight recorder: writers claim slots with an atomic increment and
+// overwrite the oldest events once the buffer wraps, so a tracepoint never
+// blocks and interrupt handlers can trace over a half-written event
+typedef struct {
+    volatile uint32_t head;     // Events ever recorded
+    trace_event_t events[TRACE_EVENTS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) trace_buffer_t;
+
+// Trace state
+volatile bool trace_enabled = false;
+static trace_buffer_t trace_buffers[TRACE_CPUS];
+static uint64_t trace_tsc_start = 0;
+static uint32_t trace_ms_start = 0;
+
+// Dump serial framing state
+static uint8_t dump_line[TRACE_DUMP_LINE];
+static uint32_t dump_line_len = 0;
+static uint32_t dump_hash = 0;
+
+/*
+ * Record one event in this CPU's buffer
+ */
+void trace_record(uint32_t point, uint32_t phase, uint32_t arg) {
+    uint32_t cpu = this_cpu()->index;
+    trace_buffer_t* buffer = &trace_buffers[cpu % TRACE_CPUS];
+    uint32_t slot = __atomic_fetch_add(&buffer->head, 1, __ATOMIC_RELAXED) % TRACE_EVENTS;
+
+    trace_event_t* event = &buffer->events[slot];
+    event->tsc = rdtsc();
+    event->point = point;
+    event->phase = phase;
+    event->cpu = cpu;
+    event->arg = arg;
+}
+
+/*
+ * Clear the buffers and start recording
+ */
+void trace_start(void) {
+    trace_enabled = false;
+    for (uint32_t i = 0; i < TRACE_CPUS; i++) {
+        trace_buffers[i].head = 0;
+    }
+    trace_tsc_start = rdtsc();
+    trace_ms_start = (uint32_t)get_system_time();
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Stop recording, keeping what was recorded
+ */
+void trace_stop(void) {
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Events held across all buffers
+ */
+uint32_t trace_event_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < TRACE_CPUS; i++) {
+        uint32_t head = trace_buffers[i].head;
+        count += head < TRACE_EVENTS ? head : TRACE_EVENTS;
+    }
+    return count;
+}
+
+/*
+ * Write the buffered dump bytes as one hex line
+ */
+static void dump_flush(void) {
+    static const char hex[] = "0123456789abcdef";
+    char text[sizeof(TRACE_DUMP_TAG) + TRACE_DUMP_LINE * 2 + 2];
+    uint32_t pos = 0;
+
+    if (!dump_line_len) {
+        return;
+    }
+
+    memcpy(text, TRACE_DUMP_TAG " ", sizeof(TRACE_DUMP_TAG));
+    pos = sizeof(TRACE_DUMP_TAG);
+    for (uint32_t i = 0; i < dump_line_len; i++) {
+        text[pos++] = hex[dump_line[i] >> 4];
+        text[pos++] = hex[dump_line[i] & 0xF];
+    }
+    text[pos++] = '\n';
+    text[pos] = '\0';
+
+    debug_output_serial(text);
+    dump_line_len = 0;
+}
+
+/*
+ * Append bytes to the dump stream
+ */
+static void dump_emit(const void* data, uint32_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (uint32_t i = 0; i < size; i++) {
+        dump_hash = (dump_hash ^ bytes[i]) * 16777619U;  // FNV-1a
+        dump_line[dump_line_len++] = bytes[i];
+        if (dump_line_len == TRACE_DUMP_LINE) {
+            dump_flush();
+        }
+    }
+}
+
+/*
+ * Write a framing line with a hex value
+ */
+static void dump_marker(const char* marker, uint32_t value) {
+    static const char hex[] = "0123456789abcdef";
+    char text[24];
+
+    debug_output_serial(TRACE_DUMP_TAG " ");
+    debug_output_serial(marker);
+    for (int i = 0; i < 8; i++) {
+        text[i] = hex[(value >> (28 - i * 4)) & 0xF];
+    }
+    text[8] = '\n';
+    text[9] = '\0';
+    debug_output_serial(" ");
+    debug_output_serial(text);
+}
+
+/*
+ * Stop tracing and send every buffered event over serial
+ * See trace_format.h for the layout; tools/debug_viewer -t decodes it.
+ */
+void trace_dump(void) {
+    trace_stop();
+
+    // Let tracepoints that saw trace_enabled before it cleared finish
+    uint64_t settle = rdtsc();
+    while (rdtsc() - settle < TRACE_SETTLE_CYCLES) {
+        __asm__ volatile ("pause");
+    }
+
+    trace_dump_header_t header;
+    header.magic = TRACE_DUMP_MAGIC;
+    header.version = TRACE_DUMP_VERSION;
+    header.header_size = sizeof(header);
+    header.cpus = TRACE_CPUS;
+    header.event_count = trace_event_count();
+    header.tsc_start = trace_tsc_start;
+    header.tsc_end = rdtsc();
+    header.ms_start = trace_ms_start;
+    header.ms_end = (uint32_t)get_system_time();
+
+    dump_line_len = 0;
+    dump_hash = 2166136261U;
+    dump_marker("BEGIN", sizeof(header) + header.event_count * sizeof(trace_event_t));
+    dump_emit(&header, sizeof(header));
+
+    for (uint32_t i = 0; i < TRACE_CPUS; i++) {
+        uint32_t head = trace_buffers[i].head;
+        uint32_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+        for (uint32_t n = head - count; n != head; n++) {
+            dump_emit(&trace_buffers[i].events[n % TRACE_EVENTS], sizeof(trace_event_t));
+        }
+    }
+
+    dump_flush();
+    dump_marker("END", dump_hash);
+}
@@ -0,0 +1,47 @@
+/*
+ * HellOS Tracepoints Header
+ * RDTSC-stamped events recorded into per-CPU flight recorder buffers
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace_format.h"
+
+// Tracepoints compile to nothing with HELL_TRACE set to 0
+#ifndef HELL_TRACE
+#define HELL_TRACE 1
+#endif
+
+// CPUs share a buffer when there are more than TRACE_CPUS
+#define TRACE_CPUS              8
+#define TRACE_EVENTS            512     // Per buffer, a power of two
+
+// Set by trace_start; a tracepoint is a load and a branch while clear
+extern volatile bool trace_enabled;
+
+#if HELL_TRACE
+#define TRACE_EVENT(point, phase, arg) \
+    do { \
+        if (trace_enabled) { \
+            trace_record(point, phase, (uint32_t)(arg)); \
+        } \
+    } while (0)
+#else
+#define TRACE_EVENT(point, phase, arg) do { } while (0)
+#endif
+
+#define TRACE_BEGIN(point, arg)   TRACE_EVENT(point, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(point, arg)     TRACE_EVENT(point, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(point, arg) TRACE_EVENT(point, TRACE_PHASE_INSTANT, arg)
+
+// Trace functions
+void trace_record(uint32_t point, uint32_t phase, uint32_t arg);
+void trace_start(void);
+void trace_stop(void);
+uint32_t trace_event_count(void);
+void trace_dump(void);
+
+#endif // TRACE_H
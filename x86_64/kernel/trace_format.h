@@ -0,0 +1,61 @@
+/*
+ * HellOS Trace Dump Format
+ * Tracepoint event layout shared by the kernel and tools/debug_viewer
+ */
+
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+
+// A dump is a header followed by every buffered event, each CPU's events
+// oldest first, all little endian. Over serial it travels as hex lines
+// between TRACE_DUMP_TAG BEGIN and END markers, with the byte length
+// after BEGIN and an FNV-1a hash after END, like a heap snapshot.
+#define TRACE_DUMP_MAGIC        0x45435254  // "TRCE"
+#define TRACE_DUMP_VERSION      1
+#define TRACE_DUMP_TAG          "[TRACE]"
+#define TRACE_DUMP_LINE         32          // Bytes per hex line
+
+// Tracepoints
+typedef enum {
+    TRACE_CONTEXT_SWITCH = 0,   // Instant, arg = pid switched to
+    TRACE_IRQ = 1,              // Span, arg = vector
+    TRACE_MALLOC = 2,           // Span, arg = size requested
+    TRACE_FREE = 3,             // Span
+    TRACE_SOCKET_SEND = 4,      // Span, arg = socket id
+    TRACE_SOCKET_RECEIVE = 5,   // Span, arg = socket id
+    TRACE_FRAME = 6,            // Span around rendering a frame
+    TRACE_POINT_COUNT = 7
+} trace_point_t;
+
+#define TRACE_POINT_NAMES { "switch", "irq", "malloc", "free", "socket_send", "socket_receive", "frame" }
+
+// Event phases, the Chrome trace event letters
+#define TRACE_PHASE_BEGIN       'B'
+#define TRACE_PHASE_END         'E'
+#define TRACE_PHASE_INSTANT     'i'
+
+// The TSC and system clock are sampled when tracing starts and when the
+// dump is taken, so readers can turn cycles into time
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t cpus;
+    uint32_t event_count;
+    uint64_t tsc_start;
+    uint64_t tsc_end;
+    uint32_t ms_start;
+    uint32_t ms_end;
+} __attribute__((packed)) trace_dump_header_t;
+
+typedef struct {
+    uint64_t tsc;
+    uint16_t point;             // trace_point_t
+    uint8_t phase;
+    uint8_t cpu;
+    uint32_t arg;
+} __attribute__((packed)) trace_event_t;
+
+#endif // TRACE_FORMAT_H
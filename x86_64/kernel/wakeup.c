@@ -0,0 +1,212 @@
+/*
+ * HellOS Wakeup Sources
+ * Subsystems are summoned when they have work instead of being polled
+ */
+
+#include "kernel.h"
+#include "wakeup.h"
+#include "process.h"
+#include "memory.h"
+#include "spinlock.h"
+#include <stdint.h>
+
+// A source becomes pending when signalled, directly from an interrupt
+// handler or through a deadline checked on every timer interrupt. The
+// kernel main loop runs pending handlers and sleeps when there are none.
+typedef struct {
+    const char* name;
+    wakeup_handler_t handler;
+    uint64_t deadline;      // System time in ms, valid while in deadline_mask
+    uint32_t signals;
+    uint32_t runs;
+} wakeup_source_t;
+
+// Wakeup state
+static wakeup_source_t sources[WAKEUP_MAX_SOURCES];
+static uint32_t source_count = 0;
+static volatile uint32_t pending_mask = 0;
+static uint32_t deadline_mask = 0;
+static process_t* waiter = NULL;    // Process blocked in wakeup_wait
+static spinlock_t wakeup_lock = SPINLOCK_INIT;
+
+/*
+ * Initialize the wakeup source registry
+ */
+void init_wakeup_sources(void) {
+    memset(sources, 0, sizeof(sources));
+    source_count = 0;
+    pending_mask = 0;
+    deadline_mask = 0;
+    waiter = NULL;
+}
+
+/*
+ * Register a wakeup source, returns its id or -1 when the table is full
+ */
+int wakeup_register(const char* name, wakeup_handler_t handler) {
+    if (!handler || source_count >= WAKEUP_MAX_SOURCES) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    int id = source_count++;
+    sources[id].name = name;
+    sources[id].handler = handler;
+    sources[id].deadline = 0;
+    sources[id].signals = 0;
+    sources[id].runs = 0;
+    spin_unlock_irqrestore(&wakeup_lock, flags);
+
+    return id;
+}
+
+/*
+ * Mark a source pending and take the waiter to wake (lock held)
+ * The waiter is woken after the lock is dropped, so the wakeup lock never
+ * nests around a run queue lock.
+ */
+static process_t* signal_locked(int id) {
+    pending_mask |= 1U << id;
+    sources[id].signals++;
+    process_t* process = waiter;
+    waiter = NULL;
+    return process;
+}
+
+/*
+ * Mark a source pending and wake the main loop (interrupt safe)
+ */
+void wakeup_signal(int id) {
+    if (id < 0 || (uint32_t)id >= source_count) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    process_t* process = signal_locked(id);
+    spin_unlock(&wakeup_lock);
+    if (process) {
+        wake_process(process);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Signal a source once system time reaches deadline_ms, 0 cancels
+ */
+void wakeup_at(int id, uint64_t deadline_ms) {
+    if (id < 0 || (uint32_t)id >= source_count) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    process_t* process = NULL;
+    if (deadline_ms == 0) {
+        deadline_mask &= ~(1U << id);
+    } else if (deadline_ms <= get_system_time()) {
+        deadline_mask &= ~(1U << id);
+        process = signal_locked(id);
+    } else {
+        sources[id].deadline = deadline_ms;
+        deadline_mask |= 1U << id;
+    }
+    spin_unlock(&wakeup_lock);
+    if (process) {
+        wake_process(process);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Signal every source whose deadline has passed (timer interrupt)
+ */
+void wakeup_check_deadlines(uint64_t now) {
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    process_t* process = NULL;
+    uint32_t mask = deadline_mask;
+    while (mask) {
+        int id = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (sources[id].deadline <= now) {
+            deadline_mask &= ~(1U << id);
+            process_t* woken = signal_locked(id);
+            if (woken) {
+                process = woken;
+            }
+        }
+    }
+    spin_unlock(&wakeup_lock);
+    if (process) {
+        wake_process(process);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Earliest armed deadline, 0 if none
+ */
+uint64_t wakeup_next_deadline(void) {
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    uint64_t next = 0;
+    uint32_t mask = deadline_mask;
+    while (mask) {
+        int id = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (next == 0 || sources[id].deadline < next) {
+            next = sources[id].deadline;
+        }
+    }
+    spin_unlock_irqrestore(&wakeup_lock, flags);
+    return next;
+}
+
+/*
+ * Run the handlers of all pending sources, returns how many ran
+ */
+uint32_t wakeup_run_pending(void) {
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    uint32_t mask = pending_mask;
+    pending_mask = 0;
+    spin_unlock_irqrestore(&wakeup_lock, flags);
+
+    uint32_t ran = 0;
+    while (mask) {
+        int id = __builtin_ctz(mask);
+        mask &= mask - 1;
+        sources[id].runs++;
+        sources[id].handler();
+        ran++;
+    }
+    return ran;
+}
+
+/*
+ * Block the calling process until a source is pending
+ * The check and the block happen with interrupts off, and a signal from
+ * another CPU between dropping the lock and blocking leaves the waiter
+ * wake_pending, so it cannot be lost either way.
+ */
+void wakeup_wait(void) {
+    uint32_t flags = spin_lock_irqsave(&wakeup_lock);
+    while (!pending_mask) {
+        waiter = get_current_process();
+        spin_unlock(&wakeup_lock);
+        block_current_process();
+        spin_lock(&wakeup_lock);
+    }
+    waiter = NULL;
+    spin_unlock_irqrestore(&wakeup_lock, flags);
+}
+
+/*
+ * Get statistics for one source
+ */
+bool wakeup_get_source_info(int id, wakeup_source_info_t* info) {
+    if (id < 0 || (uint32_t)id >= source_count || !info) {
+        return false;
+    }
+
+    info->name = sources[id].name;
+    info->signals = sources[id].signals;
+    info->runs = sources[id].runs;
+    return true;
+}
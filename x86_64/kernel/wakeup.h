@@ -0,0 +1,35 @@
+/*
+ * HellOS Wakeup Sources Header
+ * Event registry that replaces polling in the kernel main loop
+ */
+
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WAKEUP_MAX_SOURCES  16
+
+// Runs in the kernel main loop, never in interrupt context
+typedef void (*wakeup_handler_t)(void);
+
+// Per-source statistics
+typedef struct {
+    const char* name;
+    uint32_t signals;   // wakeup_signal calls, including expired deadlines
+    uint32_t runs;      // Handler invocations
+} wakeup_source_info_t;
+
+// Wakeup source functions
+void init_wakeup_sources(void);
+int wakeup_register(const char* name, wakeup_handler_t handler);
+void wakeup_signal(int id);
+void wakeup_at(int id, uint64_t deadline_ms);
+void wakeup_check_deadlines(uint64_t now);
+uint64_t wakeup_next_deadline(void);
+uint32_t wakeup_run_pending(void);
+void wakeup_wait(void);
+bool wakeup_get_source_info(int id, wakeup_source_info_t* info);
+
+#endif // WAKEUP_H
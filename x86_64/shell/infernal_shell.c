@@ -5,18 +5,33 @@
 
 #include "../kernel/kernel.h"
 #include "../kernel/memory.h"
+#include "../kernel/interrupts.h"
+#include "../kernel/trace.h"
+#include "../kernel/boot.h"
+#include "../kernel/timer.h"
+#include "../kernel/graphics.h"
+#include "../kernel/console.h"
+#include "../kernel/pandemonium.h"
+#include "../kernel/bench.h"
 #include "shell.h"
 #include <stdint.h>
+#include <stdarg.h>
 
 // Shell state
 static shell_state_t shell_state;
 static char command_buffer[256];
 static int command_pos = 0;
 static window_t* shell_window;
+static console_t shell_console;
 
-// Command history
-#define MAX_HISTORY 16
+// Scratch memory for the command being executed, reset when it returns
+#define SHELL_ARENA_SIZE 4096
+static arena_t* command_arena = NULL;
+
+// Command history, a ring: the newest entry overwrites the oldest
+#define MAX_HISTORY 16      // A power of two
 static char command_history[MAX_HISTORY][256];
+static uint32_t history_next = 0;   // Slot the next command goes in
 static int history_count = 0;
 static int history_pos = 0;
 
@@ -28,6 +43,7 @@ typedef struct {
 } shell_command_t;
 
 // Forward declarations
+static void dispatch_command(int argc, char** argv);
 void cmd_summon(int argc, char** argv);
 void cmd_banish(int argc, char** argv);
 void cmd_scry(int argc, char** argv);
@@ -37,6 +53,11 @@ void cmd_realm(int argc, char** argv);
 void cmd_souls(int argc, char** argv);
 void cmd_demons(int argc, char** argv);
 void cmd_inferno(int argc, char** argv);
+void cmd_entrails(int argc, char** argv);
+void cmd_torment(int argc, char** argv);
+void cmd_augury(int argc, char** argv);
+void cmd_genesis(int argc, char** argv);
+void cmd_bench(int argc, char** argv);
 void cmd_help(int argc, char** argv);
 void cmd_about(int argc, char** argv);
 
@@ -51,16 +72,76 @@ static shell_command_t builtin_commands[] = {
     {"souls", "List active souls (processes)", cmd_souls},
     {"demons", "List system demons (system processes)", cmd_demons},
     {"inferno", "System information", cmd_inferno},
+    {"entrails", "Inspect the heap ('entrails dump' sends a snapshot to serial)", cmd_entrails},
+    {"torment", "Interrupt timing ('torment <vector>' shows its histograms)", cmd_torment},
+    {"augury", "Kernel tracepoints ('augury on', 'augury off', 'augury dump')", cmd_augury},
+    {"genesis", "Boot phase timing", cmd_genesis},
+    {"bench", "Micro-benchmarks in cycles (results also go to serial)", cmd_bench},
     {"help", "Show available incantations", cmd_help},
     {"about", "About HellOS", cmd_about},
     {NULL, NULL, NULL}
 };
 
+// Commands by name: FNV-1a hashes in an open-addressed table built at
+// init, so dispatch costs one hash and nearly always a single strcmp
+#define COMMAND_SLOTS 64    // A power of two, well over the command count
+typedef struct {
+    uint32_t hash;
+    const shell_command_t* command;     // NULL for an empty slot
+} command_slot_t;
+static command_slot_t command_slots[COMMAND_SLOTS];
+
+/*
+ * FNV-1a hash of a command name
+ */
+static uint32_t command_hash(const char* name) {
+    uint32_t hash = 2166136261U;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Hash every built-in command into the lookup table
+ */
+static void build_command_table(void) {
+    memset(command_slots, 0, sizeof(command_slots));
+    for (int i = 0; builtin_commands[i].name; i++) {
+        uint32_t hash = command_hash(builtin_commands[i].name);
+        uint32_t slot = hash & (COMMAND_SLOTS - 1);
+        while (command_slots[slot].command) {
+            slot = (slot + 1) & (COMMAND_SLOTS - 1);
+        }
+        command_slots[slot].hash = hash;
+        command_slots[slot].command = &builtin_commands[i];
+    }
+}
+
+/*
+ * Find a built-in command by name, NULL if there is none
+ */
+static const shell_command_t* find_command(const char* name) {
+    uint32_t hash = command_hash(name);
+    for (uint32_t slot = hash & (COMMAND_SLOTS - 1); command_slots[slot].command;
+         slot = (slot + 1) & (COMMAND_SLOTS - 1)) {
+        if (command_slots[slot].hash == hash && strcmp(command_slots[slot].command->name, name) == 0) {
+            return command_slots[slot].command;
+        }
+    }
+    return NULL;
+}
+
 /*
  * Initialize the infernal shell
  */
 void init_infernal_shell(window_t* window) {
     shell_window = window;
+    if (window) {
+        console_init(&shell_console, window->surface, 10, WM_TITLE_HEIGHT + 6,
+                     window->width - 20, window->height - WM_TITLE_HEIGHT - 16);
+    }
     
     // Initialize shell state
     shell_state.current_realm = "/abyss";
@@ -75,14 +156,22 @@ void init_infernal_shell(window_t* window) {
     
     // Clear history
     memset(command_history, 0, sizeof(command_history));
+    history_next = 0;
     history_count = 0;
     history_pos = 0;
     
-    // Display welcome message
-    display_welcome_message();
+    build_command_table();
+    
+    // Per-command scratch arena
+    if (!command_arena) {
+        command_arena = arena_create(SHELL_ARENA_SIZE);
+    }
     
-    // Show initial prompt
+    // Display welcome message and initial prompt, drawn together
+    console_begin_update(&shell_console);
+    display_welcome_message();
     display_prompt();
+    console_end_update(&shell_console);
 }
 
 /*
@@ -105,10 +194,13 @@ void display_prompt(void) {
 
 /*
  * Process shell input
+ * Whatever a key prints, a whole command's output included, is drawn in
+ * one go once it has been handled.
  */
 void process_shell_input(char c) {
     if (!shell_state.initialized) return;
     
+    console_begin_update(&shell_console);
     switch (c) {
         case '\n':
         case '\r':
@@ -156,6 +248,7 @@ void process_shell_input(char c) {
             }
             break;
     }
+    console_end_update(&shell_console);
 }
 
 /*
@@ -165,9 +258,18 @@ void execute_command(const char* command) {
     // Parse command into arguments
     char* args[16];
     int argc = 0;
-    char cmd_copy[256];
     
-    strncpy(cmd_copy, command, sizeof(cmd_copy));
+    // The command line and anything the handler allocates with
+    // shell_alloc live in the arena until the command returns. A mark
+    // rather than a reset lets commands run nested commands.
+    arena_mark_t scope = arena_mark(command_arena);
+    size_t length = strlen(command);
+    char* cmd_copy = shell_alloc(length + 1);
+    if (!cmd_copy) {
+        shell_print("The abyss is out of memory\n", shell_state.error_color);
+        return;
+    }
+    memcpy(cmd_copy, command, length + 1);
     
     // Simple tokenization
     char* token = strtok(cmd_copy, " \t");
@@ -178,96 +280,120 @@ void execute_command(const char* command) {
     }
     args[argc] = NULL;
     
-    if (argc == 0) return;
+    if (argc > 0) {
+        dispatch_command(argc, args);
+    }
     
-    // Find and execute command
-    for (int i = 0; builtin_commands[i].name; i++) {
-        if (strcmp(args[0], builtin_commands[i].name) == 0) {
-            builtin_commands[i].handler(argc, args);
-            return;
-        }
+    arena_release(command_arena, scope);
+}
+
+/*
+ * Find and run a tokenized command
+ */
+static void dispatch_command(int argc, char** argv) {
+    const shell_command_t* command = find_command(argv[0]);
+    if (command) {
+        command->handler(argc, argv);
+        return;
     }
     
     // Command not found
     shell_print("Unknown incantation: ", shell_state.error_color);
-    shell_print(args[0], shell_state.error_color);
+    shell_print(argv[0], shell_state.error_color);
     shell_print("\nType 'help' for available commands\n", shell_state.text_color);
 }
 
+/*
+ * Allocate scratch memory for the running command
+ * Freed automatically when the command returns; never pass it to free().
+ */
+void* shell_alloc(size_t size) {
+    return arena_alloc(command_arena, size);
+}
+
 /*
  * Add command to history
  */
 void add_to_history(const char* command) {
+    char* entry = command_history[history_next];
+    strncpy(entry, command, sizeof(command_history[0]) - 1);
+    entry[sizeof(command_history[0]) - 1] = '\0';
+    history_next = (history_next + 1) & (MAX_HISTORY - 1);
     if (history_count < MAX_HISTORY) {
-        strncpy(command_history[history_count], command, sizeof(command_history[0]));
         history_count++;
-    } else {
-        // Shift history
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            strncpy(command_history[i], command_history[i + 1], sizeof(command_history[0]));
-        }
-        strncpy(command_history[MAX_HISTORY - 1], command, sizeof(command_history[0]));
     }
     history_pos = history_count;
 }
 
 /*
  * Attempt tab completion
+ * Completes the command name as far as every matching command agrees;
+ * when that adds nothing and several match, they are listed instead.
  */
 void attempt_tab_completion(void) {
-    // Simple completion for built-in commands
+    // Only the command name completes, not its arguments
+    if (strchr(command_buffer, ' ')) {
+        return;
+    }
+    
+    const char* first = NULL;
+    size_t common = 0;
+    int matches = 0;
+    for (int i = 0; builtin_commands[i].name; i++) {
+        const char* name = builtin_commands[i].name;
+        if (strncmp(command_buffer, name, command_pos) != 0) {
+            continue;
+        }
+        if (!first) {
+            first = name;
+            common = strlen(name);
+        } else {
+            size_t same = command_pos;
+            while (same < common && first[same] == name[same]) {
+                same++;
+            }
+            common = same;
+        }
+        matches++;
+    }
+    if (!matches) {
+        return;
+    }
+    
+    // Extend to what every candidate shares, a space after a whole name
+    int start = command_pos;
+    if (common + 1 >= sizeof(command_buffer)) {
+        return;
+    }
+    memcpy(command_buffer + command_pos, first + command_pos, common - command_pos);
+    command_pos = (int)common;
+    if (matches == 1) {
+        command_buffer[command_pos++] = ' ';
+    }
+    command_buffer[command_pos] = '\0';
+    if (command_pos > start) {
+        shell_print(command_buffer + start, COLOR_BONE_WHITE);
+        return;
+    }
+    
+    // Ambiguous: list the candidates and restate the line
+    shell_print("\n", COLOR_BONE_WHITE);
     for (int i = 0; builtin_commands[i].name; i++) {
         if (strncmp(command_buffer, builtin_commands[i].name, command_pos) == 0) {
-            // Complete the command
-            const char* completion = builtin_commands[i].name + command_pos;
-            shell_print(completion, COLOR_BONE_WHITE);
-            
-            strcat(command_buffer, completion);
-            command_pos = strlen(command_buffer);
-            break;
+            shell_print(builtin_commands[i].name, COLOR_FLAME_ORANGE);
+            shell_print("  ", COLOR_BONE_WHITE);
         }
     }
+    shell_print("\n", COLOR_BONE_WHITE);
+    display_prompt();
+    shell_print(command_buffer, COLOR_BONE_WHITE);
 }
 
 /*
  * Print text to shell window
  */
 void shell_print(const char* text, uint8_t color) {
-    // For now, just draw to the graphics buffer
-    // In a real implementation, this would be more sophisticated
-    static int cursor_x = 10;
-    static int cursor_y = 30;
-    
-    while (*text) {
-        if (*text == '\n') {
-            cursor_y += 12;
-            cursor_x = 10;
-        } else if (*text == '\b') {
-            if (cursor_x > 10) {
-                cursor_x -= 8;
-                draw_char(' ', cursor_x, cursor_y, COLOR_VOID_BLACK);
-            }
-        } else {
-            draw_char(*text, cursor_x, cursor_y, color);
-            cursor_x += 8;
-            
-            if (cursor_x > shell_window->width - 20) {
-                cursor_x = 10;
-                cursor_y += 12;
-            }
-        }
-        
-        // Scroll if needed
-        if (cursor_y > shell_window->height - 20) {
-            cursor_y = 30;
-            // Clear window (simplified)
-            draw_rectangle(shell_window->x, shell_window->y, 
-                          shell_window->width, shell_window->height, 
-                          COLOR_VOID_BLACK);
-        }
-        
-        text++;
-    }
+    console_write(&shell_console, text, color);
 }
 
 // Command implementations
@@ -387,6 +513,153 @@ void cmd_inferno(int argc, char** argv) {
     shell_print("Status: Burning bright 🔥\n", COLOR_HELL_RED);
 }
 
+void cmd_entrails(int argc, char** argv) {
+    char line[96];
+    
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        heap_export_snapshot();
+        shell_print("Heap snapshot sent to serial (decode with memory_analyzer -H)\n", shell_state.text_color);
+        return;
+    }
+    
+    heap_profile_t profile;
+    heap_get_profile(&profile);
+    
+    shell_print("=== HEAP ENTRAILS ===\n", COLOR_FLAME_ORANGE);
+    snprintf(line, sizeof(line), "Heap: %u KB, %u KB used, %u KB free, peak %u KB\n",
+             profile.total_bytes / 1024, profile.used_bytes / 1024,
+             profile.free_bytes / 1024, profile.high_water_bytes / 1024);
+    shell_print(line, shell_state.text_color);
+    snprintf(line, sizeof(line), "Blocks: %u allocated, %u free\n",
+             profile.allocated_blocks, profile.free_blocks);
+    shell_print(line, shell_state.text_color);
+    
+    // Largest free block as a share of all free memory: low means fragmented.
+    // Both are scaled down until the percentage fits 32-bit arithmetic.
+    uint32_t largest = profile.largest_free_block;
+    uint32_t free_bytes = profile.free_bytes;
+    while (largest > 0xFFFFFFFFU / 100) {
+        largest >>= 1;
+        free_bytes >>= 1;
+    }
+    uint32_t ratio = free_bytes ? largest * 100 / free_bytes : 0;
+    snprintf(line, sizeof(line), "Largest free block: %u bytes (%u%% of free)\n",
+             profile.largest_free_block, ratio);
+    shell_print(line, shell_state.text_color);
+    
+    shell_print("Request sizes:\n", COLOR_FLAME_ORANGE);
+    for (int i = 0; i < HEAP_HISTOGRAM_BUCKETS; i++) {
+        if (profile.histogram[i]) {
+            snprintf(line, sizeof(line), "  %s%7u  %u\n", (i == HEAP_HISTOGRAM_BUCKETS - 1) ? ">" : "<=",
+                     (uint32_t)HEAP_HISTOGRAM_MIN << (i == HEAP_HISTOGRAM_BUCKETS - 1 ? i - 1 : i),
+                     profile.histogram[i]);
+            shell_print(line, shell_state.text_color);
+        }
+    }
+    
+    if (!profile.sites_tracked) {
+        shell_print("Call sites: build with HEAP_PROFILING to track them\n", shell_state.text_color);
+        return;
+    }
+    
+    heap_snapshot_site_t sites[8];
+    uint32_t count = heap_get_top_sites(sites, 8);
+    shell_print("Top call sites:\n", COLOR_FLAME_ORANGE);
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(line, sizeof(line), "  0x%08x  %u allocs  %u frees  %u bytes live\n",
+                 sites[i].caller, sites[i].allocs, sites[i].frees, sites[i].live_bytes);
+        shell_print(line, shell_state.text_color);
+    }
+}
+
+/*
+ * Print one cycle histogram, non-empty buckets only
+ */
+static void print_cycle_histogram(const char* title, const cycle_histogram_t* histogram) {
+    char line[96];
+    
+    snprintf(line, sizeof(line), "%s: %u samples, max %u cycles\n", title, histogram->count, histogram->max_cycles);
+    shell_print(line, COLOR_FLAME_ORANGE);
+    for (int i = 0; i < IRQ_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i]) {
+            snprintf(line, sizeof(line), "  %s%9u  %u\n", (i == IRQ_HISTOGRAM_BUCKETS - 1) ? ">=" : "< ",
+                     1U << (IRQ_HISTOGRAM_SHIFT + (i == IRQ_HISTOGRAM_BUCKETS - 1 ? i : i + 1)),
+                     histogram->buckets[i]);
+            shell_print(line, shell_state.text_color);
+        }
+    }
+}
+
+/*
+ * Show where interrupt time goes (cycles): in the handler, waiting for
+ * the deferred work, and in the deferred work itself
+ */
+void cmd_torment(int argc, char** argv) {
+    char line[96];
+    
+    if (argc > 1) {
+        uint32_t vector = 0;
+        const char* digit = argv[1];
+        while (*digit >= '0' && *digit <= '9' && vector < IRQ_STATS_VECTORS) {
+            vector = vector * 10 + (uint32_t)(*digit++ - '0');
+        }
+        const interrupt_vector_stats_t* stats = get_interrupt_vector_stats(vector);
+        if (*digit || !stats) {
+            shell_print("Usage: torment [vector]\n", shell_state.error_color);
+            return;
+        }
+        print_cycle_histogram("Handler", &stats->handler);
+        print_cycle_histogram("Deferral latency", &stats->latency);
+        print_cycle_histogram("Bottom half", &stats->deferred);
+        return;
+    }
+    
+    shell_print("=== INTERRUPT TORMENT (cycles, p50/p99/max) ===\n", COLOR_FLAME_ORANGE);
+    for (uint32_t vector = 0; vector < IRQ_STATS_VECTORS; vector++) {
+        const interrupt_vector_stats_t* stats = get_interrupt_vector_stats(vector);
+        if (!stats->handler.count) {
+            continue;
+        }
+        
+        snprintf(line, sizeof(line), "%2u: %u x handler %u/%u/%u\n", vector, stats->handler.count,
+                 cycle_histogram_percentile(&stats->handler, 50),
+                 cycle_histogram_percentile(&stats->handler, 99), stats->handler.max_cycles);
+        shell_print(line, shell_state.text_color);
+        if (stats->latency.count) {
+            snprintf(line, sizeof(line), "    deferred %u x wait %u/%u/%u run %u/%u/%u\n", stats->latency.count,
+                     cycle_histogram_percentile(&stats->latency, 50),
+                     cycle_histogram_percentile(&stats->latency, 99), stats->latency.max_cycles,
+                     cycle_histogram_percentile(&stats->deferred, 50),
+                     cycle_histogram_percentile(&stats->deferred, 99), stats->deferred.max_cycles);
+            shell_print(line, shell_state.text_color);
+        }
+    }
+}
+
+/*
+ * Start, stop or dump the tracepoint buffers
+ */
+void cmd_augury(int argc, char** argv) {
+    char line[96];
+    
+    if (argc > 1 && strcmp(argv[1], "on") == 0) {
+        trace_start();
+        shell_print("Tracing started\n", shell_state.text_color);
+    } else if (argc > 1 && strcmp(argv[1], "off") == 0) {
+        trace_stop();
+        shell_print("Tracing stopped\n", shell_state.text_color);
+    } else if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        trace_dump();
+        shell_print("Trace sent to serial (decode with debug_viewer -t chrome or -t folded)\n", shell_state.text_color);
+    } else if (argc > 1) {
+        shell_print("Usage: augury [on|off|dump]\n", shell_state.error_color);
+    } else {
+        snprintf(line, sizeof(line), "Tracing %s, %u events buffered\n",
+                 trace_enabled ? "on" : "off", trace_event_count());
+        shell_print(line, shell_state.text_color);
+    }
+}
+
 void cmd_help(int argc, char** argv) {
     (void)argc; // Suppress unused parameter warning
     (void)argv; // Suppress unused parameter warning
@@ -417,6 +690,66 @@ void cmd_about(int argc, char** argv) {
     shell_print("\nFrom the depths of silicon and fire! 🔥\n", COLOR_HELL_RED);
 }
 
+/*
+ * Show when each boot phase started and how long it took (microseconds
+ * from kernel entry)
+ */
+void cmd_genesis(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    char line[96];
+    uint64_t boot_tsc = timer_get_boot_tsc();
+    
+    shell_print("=== GENESIS (us since kernel entry) ===\n", COLOR_FLAME_ORANGE);
+    shell_print("   Start   Duration  CPU  Phase\n", COLOR_FLAME_ORANGE);
+    for (uint32_t i = 0; i < boot_phase_count(); i++) {
+        const boot_phase_t* phase = boot_get_phase(i);
+        if (!phase || !phase->name) {
+            continue;
+        }
+        
+        uint32_t start = (uint32_t)timer_tsc_to_us(phase->start_tsc - boot_tsc);
+        if (phase->end_tsc) {
+            snprintf(line, sizeof(line), "%8u %10u  %3u  %s\n", start,
+                     (uint32_t)timer_tsc_to_us(phase->end_tsc - phase->start_tsc), phase->cpu, phase->name);
+        } else {
+            snprintf(line, sizeof(line), "%8u    running  %3u  %s\n", start, phase->cpu, phase->name);
+        }
+        shell_print(line, shell_state.text_color);
+    }
+    
+    snprintf(line, sizeof(line), "Time to shell: %u us (TSC at %u kHz)\n",
+             (uint32_t)boot_get_shell_ready_us(), timer_get_tsc_khz());
+    shell_print(line, shell_state.text_color);
+}
+
+/*
+ * Print one benchmark as it finishes
+ */
+static void print_bench_result(const bench_result_t* result, void* data) {
+    (void)data;
+    char line[96];
+    
+    snprintf(line, sizeof(line), "%8u %8u %8u  %s\n", result->min_cycles,
+             result->median_cycles, result->max_cycles, result->name);
+    shell_print(line, shell_state.text_color);
+}
+
+/*
+ * Bench command - run the micro-benchmarks
+ */
+void cmd_bench(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    
+    shell_print("=== BENCH (cycles per op) ===\n", COLOR_FLAME_ORANGE);
+    shell_print("     Min   Median      Max  Benchmark\n", COLOR_FLAME_ORANGE);
+    uint32_t count = bench_run_all(print_bench_result, NULL);
+    if (!count) {
+        shell_print("The benchmarks could not run\n", shell_state.error_color);
+    }
+}
+
 /*
  * Start shell process
  */
@@ -459,9 +792,102 @@ char* strchr(const char* str, int c) {
     return (c == '\0') ? (char*)str : NULL;
 }
 
+// Append one character, always leaving room for the terminator
+static void format_putc(char* str, size_t size, size_t* pos, char c) {
+    if (*pos + 1 < size) {
+        str[*pos] = c;
+    }
+    (*pos)++;
+}
+
+/*
+ * Minimal snprintf: %s %c %d %u %x and %%, with an optional zero flag and
+ * field width. Returns the length the full output would have had.
+ */
 int snprintf(char* str, size_t size, const char* format, ...) {
-    // Simplified implementation
-    // In a real OS, this would be much more complete
-    strncpy(str, format, size);
-    return strlen(str);
+    va_list args;
+    va_start(args, format);
+    size_t pos = 0;
+    
+    while (*format) {
+        if (*format != '%') {
+            format_putc(str, size, &pos, *format++);
+            continue;
+        }
+        format++;
+        
+        char pad = ' ';
+        if (*format == '0') {
+            pad = '0';
+            format++;
+        }
+        int width = 0;
+        while (*format >= '0' && *format <= '9') {
+            width = width * 10 + (*format++ - '0');
+        }
+        
+        char digits[12];
+        int count = 0;
+        const char* text = NULL;
+        switch (*format) {
+            case 's':
+                text = va_arg(args, const char*);
+                if (!text) {
+                    text = "(null)";
+                }
+                break;
+            case 'c':
+                digits[count++] = (char)va_arg(args, int);
+                break;
+            case 'd':
+            case 'u':
+            case 'x': {
+                uint32_t value;
+                bool negative = false;
+                if (*format == 'd') {
+                    int32_t signed_value = va_arg(args, int32_t);
+                    negative = signed_value < 0;
+                    value = negative ? (uint32_t)-signed_value : (uint32_t)signed_value;
+                } else {
+                    value = va_arg(args, uint32_t);
+                }
+                uint32_t base = (*format == 'x') ? 16 : 10;
+                do {
+                    digits[count++] = "0123456789abcdef"[value % base];
+                    value /= base;
+                } while (value);
+                if (negative) {
+                    digits[count++] = '-';
+                }
+                break;
+            }
+            case '%':
+                digits[count++] = '%';
+                break;
+            default:
+                continue;  // Unknown conversion, skip it
+        }
+        
+        int length = text ? (int)strlen(text) : count;
+        for (int i = length; i < width; i++) {
+            format_putc(str, size, &pos, pad);
+        }
+        if (text) {
+            while (*text) {
+                format_putc(str, size, &pos, *text++);
+            }
+        } else {
+            while (count) {
+                format_putc(str, size, &pos, digits[--count]);
+            }
+        }
+        format++;
+    }
+    
+    if (size) {
+        str[pos < size ? pos : size - 1] = '\0';
+    }
+    
+    va_end(args);
+    return (int)pos;
 } 
\ No newline at end of file
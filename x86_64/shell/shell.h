@@ -27,6 +27,7 @@ void execute_command(const char* command);
 void add_to_history(const char* command);
 void attempt_tab_completion(void);
 void shell_print(const char* text, uint8_t color);
+void* shell_alloc(size_t size);
 
 // String functions
 char* strtok(char* str, const char* delim);
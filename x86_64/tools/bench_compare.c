@@ -0,0 +1,324 @@
+/*
+ * HellOS Benchmark Comparison
+ * Turns the [BENCH] lines of a serial log into JSON and holds them against
+ * a stored baseline
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../kernel/bench.h"
+
+#define MAX_BENCHMARKS      64
+#define MAX_LINE            256
+#define MAX_BASELINE_SIZE   (256 * 1024)
+#define DEFAULT_THRESHOLD   10      // Percent the median may grow
+
+// Exit codes
+#define EXIT_PASS           0
+#define EXIT_ERROR          1
+#define EXIT_REGRESSION     2
+
+typedef struct {
+    char name[BENCH_NAME_LENGTH];
+    uint32_t ops;
+    uint32_t min;
+    uint32_t median;
+    uint32_t max;
+} bench_entry_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t tsc_khz;
+    uint32_t count;
+    bench_entry_t entries[MAX_BENCHMARKS];
+} bench_run_t;
+
+// Read the last complete run out of a serial log
+int load_serial_run(const char* filename, bench_run_t* run) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        perror("Failed to open serial log");
+        return 0;
+    }
+    
+    char line[MAX_LINE];
+    bench_run_t current;
+    int in_run = 0;
+    int complete = 0;
+    
+    while (fgets(line, sizeof(line), file)) {
+        char* tag = strstr(line, BENCH_TAG " ");
+        if (!tag) {
+            continue;
+        }
+        char* fields = tag + strlen(BENCH_TAG " ");
+        
+        char word[BENCH_NAME_LENGTH];
+        unsigned int values[4];
+        int found = sscanf(fields, "%31s %u %u %u %u", word, &values[0], &values[1], &values[2], &values[3]);
+        if (found < 1) {
+            continue;
+        }
+        
+        if (strcmp(word, "BEGIN") == 0 && found >= 3) {
+            memset(&current, 0, sizeof(current));
+            current.version = values[0];
+            current.tsc_khz = values[1];
+            in_run = 1;
+        } else if (strcmp(word, "END") == 0 && in_run && found >= 2) {
+            if (values[0] != current.count) {
+                fprintf(stderr, "Run in %s lost lines: %u benchmarks of %u\n",
+                        filename, current.count, values[0]);
+            } else {
+                *run = current;
+                complete = 1;
+            }
+            in_run = 0;
+        } else if (in_run && found == 5 && current.count < MAX_BENCHMARKS) {
+            bench_entry_t* entry = &current.entries[current.count++];
+            snprintf(entry->name, sizeof(entry->name), "%s", word);
+            entry->ops = values[0];
+            entry->min = values[1];
+            entry->median = values[2];
+            entry->max = values[3];
+        }
+    }
+    fclose(file);
+    
+    if (!complete) {
+        fprintf(stderr, "No complete benchmark run found in %s\n", filename);
+        return 0;
+    }
+    if (run->version != BENCH_VERSION) {
+        fprintf(stderr, "Not a version %d benchmark run\n", BENCH_VERSION);
+        return 0;
+    }
+    return 1;
+}
+
+// Write a run as JSON, one benchmark per line
+int write_json(const char* filename, const bench_run_t* run) {
+    FILE* file = filename ? fopen(filename, "w") : stdout;
+    if (!file) {
+        perror("Failed to create JSON file");
+        return 0;
+    }
+    
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": %u,\n", run->version);
+    fprintf(file, "  \"tsc_khz\": %u,\n", run->tsc_khz);
+    fprintf(file, "  \"benchmarks\": [\n");
+    for (uint32_t i = 0; i < run->count; i++) {
+        const bench_entry_t* entry = &run->entries[i];
+        fprintf(file, "    {\"name\": \"%s\", \"ops\": %u, \"min\": %u, \"median\": %u, \"max\": %u}%s\n",
+                entry->name, entry->ops, entry->min, entry->median, entry->max,
+                i + 1 < run->count ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 1;
+}
+
+// Find "key": in JSON text and read the unsigned number after it
+static int json_number(const char* text, const char* key, const char* limit, uint32_t* value) {
+    char pattern[48];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* found = strstr(text, pattern);
+    if (!found || (limit && found > limit)) {
+        return 0;
+    }
+    *value = (uint32_t)strtoul(found + strlen(pattern), NULL, 10);
+    return 1;
+}
+
+// Read a baseline written by write_json. Only our own layout is
+// understood: every benchmark object starts with its name.
+int load_baseline(const char* filename, bench_run_t* run) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        return 0;
+    }
+    
+    char* text = malloc(MAX_BASELINE_SIZE + 1);
+    if (!text) {
+        fclose(file);
+        return 0;
+    }
+    size_t length = fread(text, 1, MAX_BASELINE_SIZE, file);
+    text[length] = '\0';
+    fclose(file);
+    
+    memset(run, 0, sizeof(*run));
+    json_number(text, "version", NULL, &run->version);
+    json_number(text, "tsc_khz", NULL, &run->tsc_khz);
+    
+    const char* cursor = text;
+    while (run->count < MAX_BENCHMARKS && (cursor = strstr(cursor, "\"name\": \"")) != NULL) {
+        cursor += strlen("\"name\": \"");
+        const char* end = strchr(cursor, '"');
+        if (!end || (size_t)(end - cursor) >= BENCH_NAME_LENGTH) {
+            break;
+        }
+        
+        bench_entry_t* entry = &run->entries[run->count];
+        memcpy(entry->name, cursor, (size_t)(end - cursor));
+        entry->name[end - cursor] = '\0';
+        
+        // Fields must belong to this object, not the next one
+        const char* close = strchr(end, '}');
+        if (json_number(end, "ops", close, &entry->ops) &&
+            json_number(end, "min", close, &entry->min) &&
+            json_number(end, "median", close, &entry->median) &&
+            json_number(end, "max", close, &entry->max)) {
+            run->count++;
+        }
+        cursor = end;
+    }
+    free(text);
+
+    if (run->version != BENCH_VERSION || !run->count) {
+        fprintf(stderr, "%s is not a version %d benchmark baseline\n", filename, BENCH_VERSION);
+        return 0;
+    }
+    return 1;
+}
+
+// Find a benchmark by name
+static const bench_entry_t* find_entry(const bench_run_t* run, const char* name) {
+    for (uint32_t i = 0; i < run->count; i++) {
+        if (strcmp(run->entries[i].name, name) == 0) {
+            return &run->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Compare medians; returns the number of regressions
+int compare_runs(const bench_run_t* baseline, const bench_run_t* run, unsigned int threshold) {
+    int regressions = 0;
+
+    // Cycles only compare on like hardware
+    if (baseline->tsc_khz && run->tsc_khz) {
+        uint32_t low = baseline->tsc_khz < run->tsc_khz ? baseline->tsc_khz : run->tsc_khz;
+        uint32_t high = baseline->tsc_khz < run->tsc_khz ? run->tsc_khz : baseline->tsc_khz;
+        if ((uint64_t)(high - low) * 100 > (uint64_t)low * 10) {
+            printf("Warning: TSC at %u kHz, baseline taken at %u kHz\n", run->tsc_khz, baseline->tsc_khz);
+        }
+    }
+
+    printf("%-20s %10s %10s %8s\n", "Benchmark", "Baseline", "Median", "Change");
+    for (uint32_t i = 0; i < run->count; i++) {
+        const bench_entry_t* entry = &run->entries[i];
+        const bench_entry_t* base = find_entry(baseline, entry->name);
+        if (!base) {
+            printf("%-20s %10s %10u %8s\n", entry->name, "-", entry->median, "new");
+            continue;
+        }
+    
+        double change = base->median ? 100.0 * ((double)entry->median - base->median) / base->median : 0.0;
+        const char* verdict = "";
+        if (change > threshold) {
+            verdict = "  REGRESSION";
+            regressions++;
+        } else if (change < -(double)threshold) {
+            verdict = "  faster";
+        }
+        printf("%-20s %10u %10u %+7.1f%%%s\n", entry->name, base->median, entry->median, change, verdict);
+    }
+
+    // A benchmark that stopped reporting is worth knowing about too
+    for (uint32_t i = 0; i < baseline->count; i++) {
+        if (!find_entry(run, baseline->entries[i].name)) {
+            printf("%-20s %10u %10s %8s\n", baseline->entries[i].name, baseline->entries[i].median, "-", "missing");
+        }
+    }
+
+    printf("\n%d regression%s beyond %u%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+    return regressions;
+}
+
+// Show help
+void show_help(void) {
+    printf("HellOS Benchmark Comparison\n");
+    printf("Usage: bench_compare [options] <serial_log>\n\n");
+    printf("Options:\n");
+    printf("  -o <file>      Write the run as JSON (default: stdout without -b)\n");
+    printf("  -b <file>      Compare medians against a baseline JSON file\n");
+    printf("  -t <percent>   Median growth counted as a regression (default: %d)\n", DEFAULT_THRESHOLD);
+    printf("  -h             Show this help\n\n");
+    printf("Exit status is %d on a pass, %d on an error and %d on a regression.\n\n",
+           EXIT_PASS, EXIT_ERROR, EXIT_REGRESSION);
+    printf("Examples:\n");
+    printf("  bench_compare -o baseline.json serial.log\n");
+    printf("  bench_compare -b baseline.json -o results.json serial.log\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* output = NULL;
+    const char* baseline_file = NULL;
+    unsigned int threshold = DEFAULT_THRESHOLD;
+
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "o:b:t:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline_file = optarg;
+                break;
+            case 't':
+                threshold = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                show_help();
+                return EXIT_PASS;
+            default:
+                show_help();
+                return EXIT_ERROR;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Error: No serial log specified\n\n");
+        show_help();
+        return EXIT_ERROR;
+    }
+
+    bench_run_t* run = malloc(sizeof(bench_run_t));
+    bench_run_t* baseline = malloc(sizeof(bench_run_t));
+    if (!run || !baseline) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_ERROR;
+    }
+
+    int status = EXIT_PASS;
+    if (!load_serial_run(argv[optind], run)) {
+        status = EXIT_ERROR;
+    } else if ((output || !baseline_file) && !write_json(output, run)) {
+        status = EXIT_ERROR;
+    } else if (baseline_file) {
+        if (access(baseline_file, F_OK) != 0) {
+            printf("No baseline at %s yet; save one with -o %s\n", baseline_file, baseline_file);
+        } else if (!load_baseline(baseline_file, baseline)) {
+            status = EXIT_ERROR;
+        } else if (compare_runs(baseline, run, threshold)) {
+            status = EXIT_REGRESSION;
+        }
+    }
+
+    free(run);
+    free(baseline);
+    return status;
+}
@@ -3,14 +3,24 @@
  * Utility for analyzing debug output from HellOS
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include "../kernel/debug_stream.h"
+#include "../kernel/trace_format.h"
+
 #define MAX_LINE_LENGTH 1024
 #define MAX_LINES 10000
+#define MAX_FORMATS 1024    // Binary stream format strings, a power of two
+#define MAX_TRACE_SIZE (4 * 1024 * 1024)
+#define MAX_TRACE_DEPTH 16
+#define MAX_STACKS 4096     // Distinct folded stacks, a power of two
 
 typedef struct {
     char* line;
@@ -36,6 +46,21 @@ typedef struct {
 
 static log_buffer_t g_log_buffer = {0};
 
+// Format strings announced by the binary stream, keyed by kernel address
+typedef struct {
+    uint32_t key;
+    char* format;
+} stream_format_t;
+
+static stream_format_t g_formats[MAX_FORMATS];
+static unsigned long g_binary_records = 0;
+static unsigned long g_dropped_records = 0;
+
+static const char* g_subsystem_names[] = {
+    "BOOT", "KERNEL", "MEMORY", "INTERRUPTS", "PROCESS",
+    "GRAPHICS", "AUDIO", "NETWORK", "SHELL", "DRIVERS"
+};
+
 // Parse log level from string
 int parse_log_level(const char* level_str) {
     if (strncmp(level_str, "TRACE", 5) == 0) return 0;
@@ -118,33 +143,448 @@ int parse_log_line(const char* line, log_entry_t* entry) {
     return 1;
 }
 
+// Hash slot for a format key
+static stream_format_t* find_format_slot(uint32_t key) {
+    uint32_t index = (key * 2654435761u) & (MAX_FORMATS - 1);
+    for (int probe = 0; probe < MAX_FORMATS; probe++) {
+        stream_format_t* slot = &g_formats[(index + probe) & (MAX_FORMATS - 1)];
+        if (!slot->format || slot->key == key) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Read little endian values out of a frame
+static uint32_t read_u32(const unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_u16(const unsigned char* data) {
+    return data[0] | (data[1] << 8);
+}
+
+// Format a binary record's message the way the kernel's drainer does
+static void format_record(char* out, size_t size, const char* format,
+                          const uint32_t* args, int nargs,
+                          const char* strings, int strings_len) {
+    size_t pos = 0;
+    int arg = 0;
+    
+    for (int i = 0; format[i] && pos + 1 < size; i++) {
+        if (format[i] != '%' || !format[i + 1]) {
+            out[pos++] = format[i];
+            continue;
+        }
+        
+        char conversion = format[++i];
+        char text[MAX_LINE_LENGTH];
+        text[0] = '\0';
+        if (conversion == 'd' || conversion == 'x' || conversion == 's' || conversion == 'c') {
+            if (arg >= nargs) {
+                continue;
+            }
+            uint32_t value = args[arg++];
+            if (conversion == 'd') {
+                snprintf(text, sizeof(text), "%d", (int32_t)value);
+            } else if (conversion == 'x') {
+                snprintf(text, sizeof(text), "0x%X", value);
+            } else if (conversion == 's') {
+                if (value < (uint32_t)strings_len) {
+                    snprintf(text, sizeof(text), "%.*s", strings_len - (int)value, strings + value);
+                }
+            } else {
+                snprintf(text, sizeof(text), "%c", (char)value);
+            }
+        } else {
+            snprintf(text, sizeof(text), "%c", conversion);
+        }
+        
+        for (int j = 0; text[j] && pos + 1 < size; j++) {
+            out[pos++] = text[j];
+        }
+    }
+    out[pos] = '\0';
+}
+
+// Decode one binary frame at data, returns its length or 0 if truncated
+static size_t decode_frame(const unsigned char* data, size_t available) {
+    if (available < 2) {
+        return 0;
+    }
+    
+    switch (data[1]) {
+        case DEBUG_STREAM_FORMAT: {
+            if (available < sizeof(debug_stream_format_t)) {
+                return 0;
+            }
+            uint32_t key = read_u32(data + 2);
+            uint16_t length = read_u16(data + 6);
+            size_t frame_size = sizeof(debug_stream_format_t) + length;
+            if (available < frame_size) {
+                return 0;
+            }
+            stream_format_t* slot = find_format_slot(key);
+            if (slot) {
+                free(slot->format);
+                slot->key = key;
+                slot->format = strndup((const char*)data + sizeof(debug_stream_format_t), length);
+            }
+            return frame_size;
+        }
+        
+        case DEBUG_STREAM_DROPPED:
+            if (available < sizeof(debug_stream_dropped_t)) {
+                return 0;
+            }
+            g_dropped_records += read_u32(data + 2);
+            return sizeof(debug_stream_dropped_t);
+        
+        case DEBUG_STREAM_RECORD: {
+            if (available < sizeof(debug_stream_record_t)) {
+                return 0;
+            }
+            int nargs = data[13];
+            size_t frame_size = sizeof(debug_stream_record_t) + nargs * 4 + 1;
+            if (nargs > DEBUG_RECORD_ARGS || available < frame_size) {
+                return nargs > DEBUG_RECORD_ARGS ? 1 : 0;
+            }
+            int strings_len = data[frame_size - 1];
+            if (available < frame_size + strings_len) {
+                return 0;
+            }
+            
+            uint32_t args[DEBUG_RECORD_ARGS];
+            for (int i = 0; i < nargs; i++) {
+                args[i] = read_u32(data + sizeof(debug_stream_record_t) + i * 4);
+            }
+            
+            stream_format_t* slot = find_format_slot(read_u32(data + 6));
+            const char* format = slot && slot->format ? slot->format : "<unknown format>";
+            char message[MAX_LINE_LENGTH];
+            format_record(message, sizeof(message), format, args, nargs,
+                          (const char*)data + frame_size, strings_len);
+            
+            if (g_log_buffer.count < MAX_LINES) {
+                log_entry_t* entry = &g_log_buffer.entries[g_log_buffer.count++];
+                char timestamp[32];
+                int level = data[10] <= 5 ? data[10] : 2;
+                snprintf(timestamp, sizeof(timestamp), "%u", read_u32(data + 2));
+                entry->timestamp = strdup(timestamp);
+                entry->level = level;
+                entry->subsystem = strdup(data[11] < 10 ? g_subsystem_names[data[11]] : "UNKNOWN");
+                entry->message = strdup(message);
+                entry->line = strdup(message);
+            }
+            g_binary_records++;
+            return frame_size + strings_len;
+        }
+        
+        default:
+            return 1;   // Not a frame after all, skip the sync byte
+    }
+}
+
+// Add a text line to the buffer
+static void add_text_line(char* line) {
+    // Skip empty lines
+    if (strlen(line) == 0 || g_log_buffer.count >= MAX_LINES) {
+        return;
+    }
+    
+    if (parse_log_line(line, &g_log_buffer.entries[g_log_buffer.count])) {
+        g_log_buffer.count++;
+    }
+}
+
 // Load log file
+// Text lines and binary stream frames may be mixed in one capture.
 int load_log_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
+    FILE* file = fopen(filename, "rb");
     if (!file) {
         perror("Failed to open log file");
         return 0;
     }
     
+    size_t capacity = 1 << 16;
+    size_t size = 0;
+    unsigned char* data = malloc(capacity);
+    size_t got;
+    while (data && (got = fread(data + size, 1, capacity - size, file)) > 0) {
+        size += got;
+        if (size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    fclose(file);
+    if (!data) {
+        fprintf(stderr, "Out of memory reading %s\n", filename);
+        return 0;
+    }
+    
     char line[MAX_LINE_LENGTH];
+    size_t line_len = 0;
     g_log_buffer.count = 0;
     
-    while (fgets(line, sizeof(line), file) && g_log_buffer.count < MAX_LINES) {
-        // Remove newline
-        char* newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-        
-        // Skip empty lines
-        if (strlen(line) == 0) continue;
+    for (size_t pos = 0; pos < size;) {
+        if (data[pos] == DEBUG_STREAM_SYNC) {
+            size_t frame = decode_frame(data + pos, size - pos);
+            if (frame == 0) {
+                break;  // Capture ends mid-frame
+            }
+            pos += frame;
+            continue;
+        }
         
-        // Parse line
-        if (parse_log_line(line, &g_log_buffer.entries[g_log_buffer.count])) {
-            g_log_buffer.count++;
+        char c = (char)data[pos++];
+        if (c == '\n' || line_len == sizeof(line) - 1) {
+            line[line_len] = '\0';
+            add_text_line(line);
+            line_len = 0;
+        }
+        if (c != '\n' && c != '\r') {
+            line[line_len++] = c;
         }
     }
+    line[line_len] = '\0';
+    add_text_line(line);
+    free(data);
+    
+    printf("Loaded %d log entries from %s", g_log_buffer.count, filename);
+    if (g_binary_records) {
+        printf(" (%lu binary records, %lu dropped by the kernel)", g_binary_records, g_dropped_records);
+    }
+    printf("\n");
+    return 1;
+}
+
+// Decode one hex line of a framed dump
+static int decode_hex_line(const char* hex, uint8_t* out, size_t* pos, size_t limit) {
+    while (hex[0] && hex[1] && hex[0] != '\n' && hex[0] != '\r') {
+        unsigned int byte;
+        if (sscanf(hex, "%2x", &byte) != 1 || *pos >= limit) {
+            return 0;
+        }
+        out[(*pos)++] = (uint8_t)byte;
+        hex += 2;
+    }
+    return 1;
+}
+
+// Load the last complete trace dump from a serial log
+int load_trace_dump(const char* filename, uint8_t** data, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("Failed to open log file");
+        return 0;
+    }
     
+    uint8_t* buffer = malloc(MAX_TRACE_SIZE);
+    if (!buffer) {
+        perror("Failed to allocate memory for trace");
+        fclose(file);
+        return 0;
+    }
+    
+    char line[512];
+    const size_t tag_len = strlen(TRACE_DUMP_TAG);
+    size_t pos = 0;
+    unsigned int expected = 0;
+    int in_frame = 0;
+    int found = 0;
+    
+    while (fgets(line, sizeof(line), file)) {
+        char* tag = strstr(line, TRACE_DUMP_TAG);
+        if (!tag) {
+            continue;
+        }
+        char* body = tag + tag_len + 1;
+        
+        if (strncmp(body, "BEGIN ", 6) == 0) {
+            sscanf(body + 6, "%x", &expected);
+            pos = 0;
+            in_frame = 1;
+        } else if (strncmp(body, "END ", 4) == 0 && in_frame) {
+            unsigned int hash_expected;
+            sscanf(body + 4, "%x", &hash_expected);
+            uint32_t hash = 2166136261U;
+            for (size_t i = 0; i < pos; i++) {
+                hash = (hash ^ buffer[i]) * 16777619U;
+            }
+            if (pos != expected || hash != hash_expected) {
+                fprintf(stderr, "Trace frame damaged: %zu of %u bytes, hash %08X vs %08X\n",
+                        pos, expected, hash, hash_expected);
+            } else {
+                found = 1;
+                *size = pos;
+            }
+            in_frame = 0;
+        } else if (in_frame && !decode_hex_line(body, buffer, &pos, MAX_TRACE_SIZE)) {
+            fprintf(stderr, "Bad hex line in trace frame\n");
+            in_frame = 0;
+        }
+    }
     fclose(file);
-    printf("Loaded %d log entries from %s\n", g_log_buffer.count, filename);
+    
+    if (!found) {
+        fprintf(stderr, "No complete trace dump found in %s\n", filename);
+        free(buffer);
+        return 0;
+    }
+    
+    *data = buffer;
+    return 1;
+}
+
+// Order events by CPU, then time
+static int compare_trace_events(const void* a, const void* b) {
+    const trace_event_t* x = (const trace_event_t*)a;
+    const trace_event_t* y = (const trace_event_t*)b;
+    if (x->cpu != y->cpu) {
+        return x->cpu < y->cpu ? -1 : 1;
+    }
+    if (x->tsc != y->tsc) {
+        return x->tsc < y->tsc ? -1 : 1;
+    }
+    return 0;
+}
+
+// Check a dump and sort its events, returns the event count or -1
+static int prepare_trace(uint8_t* data, size_t size, trace_dump_header_t* header, trace_event_t** events) {
+    if (size < sizeof(*header)) {
+        fprintf(stderr, "Trace dump too short\n");
+        return -1;
+    }
+    memcpy(header, data, sizeof(*header));
+    if (header->magic != TRACE_DUMP_MAGIC || header->version != TRACE_DUMP_VERSION ||
+        header->header_size + (size_t)header->event_count * sizeof(trace_event_t) > size) {
+        fprintf(stderr, "Not a version %d trace dump\n", TRACE_DUMP_VERSION);
+        return -1;
+    }
+    
+    *events = (trace_event_t*)(data + header->header_size);
+    qsort(*events, header->event_count, sizeof(trace_event_t), compare_trace_events);
+    return (int)header->event_count;
+}
+
+// Name of a tracepoint
+static const char* trace_point_name(uint32_t point) {
+    static const char* names[] = TRACE_POINT_NAMES;
+    return point < TRACE_POINT_COUNT ? names[point] : "unknown";
+}
+
+// Write a dump as Chrome trace event JSON (chrome://tracing, Perfetto)
+int write_chrome_trace(uint8_t* data, size_t size) {
+    trace_dump_header_t header;
+    trace_event_t* events;
+    int count = prepare_trace(data, size, &header, &events);
+    if (count < 0) {
+        return 0;
+    }
+    
+    // Cycles per microsecond from the clock samples around the trace
+    double cycles_per_us = 1000.0;
+    if (header.ms_end > header.ms_start && header.tsc_end > header.tsc_start) {
+        cycles_per_us = (double)(header.tsc_end - header.tsc_start) / ((header.ms_end - header.ms_start) * 1000.0);
+    } else {
+        fprintf(stderr, "Trace too short to calibrate the TSC, assuming 1 GHz\n");
+    }
+    
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (uint32_t cpu = 0; cpu < header.cpus; cpu++) {
+        printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"cpu %u\"}},\n", cpu, cpu);
+    }
+    for (int i = 0; i < count; i++) {
+        const trace_event_t* event = &events[i];
+        double ts = event->tsc >= header.tsc_start ? (event->tsc - header.tsc_start) / cycles_per_us : 0.0;
+        printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,%s\"args\":{\"arg\":%u}}%s\n",
+               trace_point_name(event->point), event->phase, ts, event->cpu,
+               event->phase == TRACE_PHASE_INSTANT ? "\"s\":\"t\"," : "",
+               event->arg, i + 1 < count ? "," : "");
+    }
+    printf("]}\n");
+    return 1;
+}
+
+// Folded stack accumulator
+typedef struct {
+    char* stack;
+    unsigned long long cycles;
+} folded_stack_t;
+
+static folded_stack_t g_stacks[MAX_STACKS];
+
+static void add_folded_stack(const char* stack, unsigned long long cycles) {
+    uint32_t hash = 2166136261U;
+    for (const char* c = stack; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619U;
+    }
+    for (int probe = 0; probe < MAX_STACKS; probe++) {
+        folded_stack_t* slot = &g_stacks[(hash + probe) & (MAX_STACKS - 1)];
+        if (!slot->stack) {
+            slot->stack = strdup(stack);
+        }
+        if (strcmp(slot->stack, stack) == 0) {
+            slot->cycles += cycles;
+            return;
+        }
+    }
+}
+
+// Write a dump as folded stacks for flamegraph.pl, weighted in cycles
+// Each CPU's time between events goes to the spans open at that point,
+// under the process that was running.
+int write_folded_stacks(uint8_t* data, size_t size) {
+    trace_dump_header_t header;
+    trace_event_t* events;
+    int count = prepare_trace(data, size, &header, &events);
+    if (count < 0) {
+        return 0;
+    }
+    
+    char frames[MAX_TRACE_DEPTH][32];
+    int depth = 0;
+    int pid = -1;
+    
+    for (int i = 0; i < count; i++) {
+        const trace_event_t* event = &events[i];
+        if (i == 0 || events[i - 1].cpu != event->cpu) {
+            depth = 0;      // Next CPU
+            pid = -1;
+        }
+        
+        if (event->phase == TRACE_PHASE_BEGIN && depth < MAX_TRACE_DEPTH) {
+            if (event->point == TRACE_IRQ) {
+                snprintf(frames[depth++], sizeof(frames[0]), "irq %u", event->arg);
+            } else {
+                snprintf(frames[depth++], sizeof(frames[0]), "%s", trace_point_name(event->point));
+            }
+        } else if (event->phase == TRACE_PHASE_END && depth > 0) {
+            depth--;
+        } else if (event->phase == TRACE_PHASE_INSTANT && event->point == TRACE_CONTEXT_SWITCH) {
+            pid = (int)event->arg;
+        }
+        
+        // Time until this CPU's next event belongs to the current stack
+        if (i + 1 >= count || events[i + 1].cpu != event->cpu) {
+            continue;
+        }
+        char stack[MAX_LINE_LENGTH];
+        int pos = snprintf(stack, sizeof(stack), "cpu %u;", event->cpu);
+        pos += pid < 0 ? snprintf(stack + pos, sizeof(stack) - pos, "pid ?")
+                       : snprintf(stack + pos, sizeof(stack) - pos, "pid %d", pid);
+        for (int f = 0; f < depth && pos < (int)sizeof(stack); f++) {
+            pos += snprintf(stack + pos, sizeof(stack) - pos, ";%s", frames[f]);
+        }
+        add_folded_stack(stack, events[i + 1].tsc - event->tsc);
+    }
+    
+    for (int i = 0; i < MAX_STACKS; i++) {
+        if (g_stacks[i].stack && g_stacks[i].cycles) {
+            printf("%s %llu\n", g_stacks[i].stack, g_stacks[i].cycles);
+        }
+    }
     return 1;
 }
 
@@ -255,18 +695,22 @@ void show_statistics(void) {
 // Show help
 void show_help(void) {
     printf("HellOS Debug Log Viewer\n");
-    printf("Usage: debug_viewer [options] <log_file>\n\n");
+    printf("Usage: debug_viewer [options] <log_file>\n");
+    printf("The log may mix text lines with binary records (kernel built with DEBUG_BINARY_LOG)\n\n");
     printf("Options:\n");
     printf("  -l <level>     Minimum log level (0-5: TRACE, DEBUG, INFO, WARN, ERROR, FATAL)\n");
     printf("  -s <subsystem> Filter by subsystem (BOOT, KERNEL, MEMORY, etc.)\n");
     printf("  -c             Use colors in output\n");
     printf("  -S             Show statistics only\n");
+    printf("  -t <format>    Convert the last trace dump: chrome (trace event JSON) or folded (flame graph stacks)\n");
     printf("  -h             Show this help\n\n");
     printf("Examples:\n");
     printf("  debug_viewer serial.log\n");
     printf("  debug_viewer -l 3 -c serial.log    # Show warnings and errors with colors\n");
     printf("  debug_viewer -s BOOT serial.log    # Show only boot messages\n");
     printf("  debug_viewer -S serial.log         # Show statistics only\n");
+    printf("  debug_viewer -t chrome serial.log > trace.json\n");
+    printf("  debug_viewer -t folded serial.log | flamegraph.pl > kernel.svg\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -274,11 +718,12 @@ int main(int argc, char* argv[]) {
     char* subsystem_filter = NULL;
     int use_colors = 0;
     int show_stats_only = 0;
+    char* trace_format = NULL;
     char* filename = NULL;
     
     // Parse command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "l:s:cSh")) != -1) {
+    while ((opt = getopt(argc, argv, "l:s:t:cSh")) != -1) {
         switch (opt) {
             case 'l':
                 min_level = atoi(optarg);
@@ -296,6 +741,13 @@ int main(int argc, char* argv[]) {
             case 'S':
                 show_stats_only = 1;
                 break;
+            case 't':
+                trace_format = optarg;
+                if (strcmp(trace_format, "chrome") != 0 && strcmp(trace_format, "folded") != 0) {
+                    fprintf(stderr, "Invalid trace format: %s (must be chrome or folded)\n", trace_format);
+                    return 1;
+                }
+                break;
             case 'h':
                 show_help();
                 return 0;
@@ -313,6 +765,19 @@ int main(int argc, char* argv[]) {
     }
     filename = argv[optind];
     
+    // Trace conversion writes only the converted dump to stdout
+    if (trace_format) {
+        uint8_t* data;
+        size_t size;
+        if (!load_trace_dump(filename, &data, &size)) {
+            return 1;
+        }
+        int ok = strcmp(trace_format, "chrome") == 0 ? write_chrome_trace(data, size)
+                                                      : write_folded_stacks(data, size);
+        free(data);
+        return ok ? 0 : 1;
+    }
+    
     // Load log file
     if (!load_log_file(filename)) {
         return 1;
@@ -0,0 +1,275 @@
+/*
+ * HellOS Memory Primitive Benchmark
+ * Compares kernel/string.c against the original byte-at-a-time loops
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Pull in the kernel implementations under their own names
+#define memset  kernel_memset
+#define memcpy  kernel_memcpy
+#define memmove kernel_memmove
+#define memcmp  kernel_memcmp
+#define strlen  kernel_strlen
+#define strcmp  kernel_strcmp
+#define strncmp kernel_strncmp
+#define strcpy  kernel_strcpy
+#define strncpy kernel_strncpy
+#define strcat  kernel_strcat
+#include "../kernel/string.c"
+#undef memset
+#undef memcpy
+#undef memmove
+#undef memcmp
+#undef strlen
+#undef strcmp
+#undef strncmp
+#undef strcpy
+#undef strncpy
+#undef strcat
+
+#define MIN_SIZE        8
+#define MAX_SIZE        (1024 * 1024)
+#define BYTES_PER_RUN   (64 * 1024 * 1024)  // Work per measurement
+#define BYTE_LOOP       __attribute__((noinline, optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+
+// Original byte-at-a-time loops from kernel/memory.c
+BYTE_LOOP static void* byte_memset(void* ptr, int value, size_t size) {
+    uint8_t* p = (uint8_t*)ptr;
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)value;
+    }
+    return ptr;
+}
+
+BYTE_LOOP static void* byte_memcpy(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+    return dest;
+}
+
+BYTE_LOOP static void* byte_memmove(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    if (d < s) {
+        for (size_t i = 0; i < size; i++) {
+            d[i] = s[i];
+        }
+    } else {
+        for (size_t i = size; i > 0; i--) {
+            d[i - 1] = s[i - 1];
+        }
+    }
+    return dest;
+}
+
+BYTE_LOOP static int byte_memcmp(const void* ptr1, const void* ptr2, size_t size) {
+    const uint8_t* p1 = (const uint8_t*)ptr1;
+    const uint8_t* p2 = (const uint8_t*)ptr2;
+    for (size_t i = 0; i < size; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    return 0;
+}
+
+BYTE_LOOP static size_t byte_strlen(const char* str) {
+    size_t len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+// One primitive under test, called through volatile pointers so the
+// compiler cannot fold the loops away
+typedef struct {
+    const char* name;
+    void* (*volatile byte_fn)(void*, const void*, size_t);
+    void* (*volatile fast_fn)(void*, const void*, size_t);
+} bench_op_t;
+
+static uint8_t* g_src;
+static uint8_t* g_dst;
+static volatile size_t g_sink;
+
+// Adapters giving every primitive the memcpy signature
+static void* byte_set(void* d, const void* s, size_t n) { (void)s; return byte_memset(d, 0x66, n); }
+static void* fast_set(void* d, const void* s, size_t n) { (void)s; return kernel_memset(d, 0x66, n); }
+static void* byte_cpy(void* d, const void* s, size_t n) { return byte_memcpy(d, s, n); }
+static void* fast_cpy(void* d, const void* s, size_t n) { return kernel_memcpy(d, s, n); }
+static void* byte_mov(void* d, const void* s, size_t n) { (void)s; return byte_memmove((uint8_t*)d + 1, d, n); }
+static void* fast_mov(void* d, const void* s, size_t n) { (void)s; return kernel_memmove((uint8_t*)d + 1, d, n); }
+static void* byte_cmp(void* d, const void* s, size_t n) { g_sink += byte_memcmp(d, s, n); return d; }
+static void* fast_cmp(void* d, const void* s, size_t n) { g_sink += kernel_memcmp(d, s, n); return d; }
+static void* byte_len(void* d, const void* s, size_t n) { (void)d; (void)n; g_sink += byte_strlen(s); return d; }
+static void* fast_len(void* d, const void* s, size_t n) { (void)d; (void)n; g_sink += kernel_strlen(s); return d; }
+
+static bench_op_t g_ops[] = {
+    {"memset",  byte_set, fast_set},
+    {"memcpy",  byte_cpy, fast_cpy},
+    {"memmove", byte_mov, fast_mov},
+    {"memcmp",  byte_cmp, fast_cmp},
+    {"strlen",  byte_len, fast_len},
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Prepare buffers so memcmp compares equal data and strlen sees size - 1 chars
+static void prepare_buffers(size_t size) {
+    memset(g_src, 'H', size);
+    memset(g_dst, 'H', size);
+    g_src[size - 1] = '\0';
+    g_dst[size - 1] = '\0';
+}
+
+// Throughput in MB/s for one primitive at one size
+static double measure(void* (*volatile* fn)(void*, const void*, size_t), size_t size) {
+    size_t iterations = BYTES_PER_RUN / size;
+    if (iterations < 4) {
+        iterations = 4;
+    }
+
+    prepare_buffers(size);
+    (*fn)(g_dst, g_src, size);  // Warm up caches
+
+    double start = now_seconds();
+    for (size_t i = 0; i < iterations; i++) {
+        (*fn)(g_dst, g_src, size);
+    }
+    double elapsed = now_seconds() - start;
+
+    return (double)size * iterations / elapsed / (1024.0 * 1024.0);
+}
+
+// Check the kernel versions against libc across sizes and misalignments
+static int self_test(void) {
+    uint8_t* a = malloc(4096 + 16);
+    uint8_t* b = malloc(4096 + 16);
+    uint8_t* ref = malloc(4096 + 16);
+    int failures = 0;
+
+    for (size_t size = 0; size <= 300; size++) {
+        for (size_t off = 0; off < 4; off++) {
+            for (size_t i = 0; i < 4096 + 16; i++) {
+                a[i] = (uint8_t)(i * 7 + 1);
+                b[i] = 0;
+                ref[i] = 0;
+            }
+
+            kernel_memcpy(b + off, a + 3, size);
+            memcpy(ref + off, a + 3, size);
+            failures += memcmp(b, ref, 4096) != 0;
+
+            kernel_memset(b + off, 0x5A, size);
+            memset(ref + off, 0x5A, size);
+            failures += memcmp(b, ref, 4096) != 0;
+
+            memcpy(b, a, 4096);
+            memcpy(ref, a, 4096);
+            kernel_memmove(b + off + 5, b + 8, size);
+            memmove(ref + off + 5, ref + 8, size);
+            failures += memcmp(b, ref, 4096) != 0;
+            kernel_memmove(b + 8, b + off + 5, size);
+            memmove(ref + 8, ref + off + 5, size);
+            failures += memcmp(b, ref, 4096) != 0;
+
+            memcpy(b, a, 4096);
+            if (size) {
+                b[off + size - 1] ^= 0x80;
+            }
+            int expect = memcmp(a + off, b + off, size);
+            int got = kernel_memcmp(a + off, b + off, size);
+            failures += (expect > 0) != (got > 0) || (expect < 0) != (got < 0);
+
+            memset(b, 'x', 4096);
+            b[off + size] = '\0';
+            failures += kernel_strlen((char*)b + off) != size;
+        }
+    }
+
+    free(a);
+    free(b);
+    free(ref);
+    return failures;
+}
+
+static void run_benchmarks(void) {
+    printf("%-8s %10s %14s %14s %8s\n", "op", "size", "byte MB/s", "kernel MB/s", "speedup");
+    for (size_t op = 0; op < sizeof(g_ops) / sizeof(g_ops[0]); op++) {
+        for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+            double slow = measure(&g_ops[op].byte_fn, size);
+            double fast = measure(&g_ops[op].fast_fn, size);
+            printf("%-8s %10zu %14.1f %14.1f %7.2fx\n", g_ops[op].name, size, slow, fast, fast / slow);
+        }
+    }
+}
+
+// Show help
+static void show_help(void) {
+    printf("HellOS Memory Primitive Benchmark\n");
+    printf("Usage: mem_bench [options]\n\n");
+    printf("Options:\n");
+    printf("  -w             Force the rep movsd/stosd path even on ERMSB CPUs\n");
+    printf("  -t             Run the correctness check only\n");
+    printf("  -h             Show this help\n");
+}
+
+int main(int argc, char* argv[]) {
+    int test_only = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "wth")) != -1) {
+        switch (opt) {
+            case 'w':
+                ermsb_state = 0;
+                break;
+            case 't':
+                test_only = 1;
+                break;
+            case 'h':
+                show_help();
+                return 0;
+            default:
+                show_help();
+                return 1;
+        }
+    }
+
+    printf("Bulk path: %s\n", cpu_has_ermsb() ? "rep movsb/stosb (ERMSB)" : "rep movsd/stosd");
+
+    int failures = self_test();
+    printf("Self test: %s (%d failures)\n", failures ? "FAILED" : "passed", failures);
+    if (failures || test_only) {
+        return failures ? 1 : 0;
+    }
+
+    // One spare byte past the end for the overlapping memmove case
+    g_src = malloc(MAX_SIZE + 16);
+    g_dst = malloc(MAX_SIZE + 16);
+    if (!g_src || !g_dst) {
+        perror("Failed to allocate benchmark buffers");
+        return 1;
+    }
+
+    run_benchmarks();
+
+    free(g_src);
+    free(g_dst);
+    return 0;
+}
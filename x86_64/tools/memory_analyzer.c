@@ -3,13 +3,20 @@
  * Tool for analyzing memory dumps from HellOS
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include "../kernel/heap_snapshot.h"
+
 #define MAX_DUMP_SIZE (1024 * 1024)  // 1MB max dump size
+#define MAX_SNAPSHOT_SIZE (16 * 1024 * 1024)
+#define BLOCK_MAP_COLUMNS 64
+#define BLOCK_MAP_ROWS 16
 
 typedef struct {
     uint32_t address;
@@ -119,7 +126,7 @@ void analyze_memory(const memory_dump_t* dump) {
         
         if (byte >= 32 && byte <= 126) {
             // Printable ASCII
-            if (string_pos < sizeof(string_buffer) - 1) {
+            if (string_pos < (int)sizeof(string_buffer) - 1) {
                 string_buffer[string_pos++] = byte;
             }
         } else {
@@ -187,6 +194,230 @@ int load_memory_dump(const char* filename, memory_dump_t* dump, uint32_t base_ad
     return 1;
 }
 
+// Decode one hex line of a serial heap snapshot
+static int decode_hex_line(const char* hex, uint8_t* out, size_t* pos, size_t limit) {
+    while (hex[0] && hex[1] && hex[0] != '\n' && hex[0] != '\r') {
+        unsigned int byte;
+        if (sscanf(hex, "%2x", &byte) != 1 || *pos >= limit) {
+            return 0;
+        }
+        out[(*pos)++] = (uint8_t)byte;
+        hex += 2;
+    }
+    return 1;
+}
+
+// Load a heap snapshot, either raw or hex-framed inside a serial log
+int load_heap_snapshot(const char* filename, uint8_t** data, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("Failed to open snapshot file");
+        return 0;
+    }
+    
+    uint8_t* buffer = malloc(MAX_SNAPSHOT_SIZE);
+    if (!buffer) {
+        perror("Failed to allocate memory for snapshot");
+        fclose(file);
+        return 0;
+    }
+    
+    // Raw binary snapshot
+    size_t raw_size = fread(buffer, 1, MAX_SNAPSHOT_SIZE, file);
+    if (raw_size >= sizeof(heap_snapshot_header_t) &&
+        ((heap_snapshot_header_t*)buffer)->magic == HEAP_SNAPSHOT_MAGIC) {
+        fclose(file);
+        *data = buffer;
+        *size = raw_size;
+        return 1;
+    }
+    
+    // Serial log: use the last complete BEGIN..END frame
+    rewind(file);
+    char line[512];
+    const size_t tag_len = strlen(HEAP_SNAPSHOT_TAG);
+    size_t pos = 0;
+    unsigned int expected = 0;
+    int in_frame = 0;
+    int found = 0;
+    
+    while (fgets(line, sizeof(line), file)) {
+        char* tag = strstr(line, HEAP_SNAPSHOT_TAG);
+        if (!tag) {
+            continue;
+        }
+        char* body = tag + tag_len + 1;
+        
+        if (strncmp(body, "BEGIN ", 6) == 0) {
+            sscanf(body + 6, "%x", &expected);
+            pos = 0;
+            in_frame = 1;
+        } else if (strncmp(body, "END ", 4) == 0 && in_frame) {
+            unsigned int hash_expected;
+            sscanf(body + 4, "%x", &hash_expected);
+            uint32_t hash = 2166136261U;
+            for (size_t i = 0; i < pos; i++) {
+                hash = (hash ^ buffer[i]) * 16777619U;
+            }
+            if (pos != expected || hash != hash_expected) {
+                fprintf(stderr, "Snapshot frame damaged: %zu of %u bytes, hash %08X vs %08X\n",
+                        pos, expected, hash, hash_expected);
+            } else {
+                found = 1;
+                *size = pos;
+            }
+            in_frame = 0;
+        } else if (in_frame && !decode_hex_line(body, buffer, &pos, MAX_SNAPSHOT_SIZE)) {
+            fprintf(stderr, "Bad hex line in snapshot frame\n");
+            in_frame = 0;
+        }
+    }
+    fclose(file);
+    
+    if (!found) {
+        fprintf(stderr, "No complete heap snapshot found in %s\n", filename);
+        free(buffer);
+        return 0;
+    }
+    
+    *data = buffer;
+    return 1;
+}
+
+// Render a heap snapshot: summary, size histogram, call sites and block map
+int display_heap_snapshot(const uint8_t* data, size_t size) {
+    const heap_snapshot_header_t* header = (const heap_snapshot_header_t*)data;
+    if (size < sizeof(*header) || header->magic != HEAP_SNAPSHOT_MAGIC ||
+        header->version != HEAP_SNAPSHOT_VERSION) {
+        fprintf(stderr, "Not a version %d heap snapshot\n", HEAP_SNAPSHOT_VERSION);
+        return 0;
+    }
+    
+    size_t offset = header->header_size;
+    const uint32_t* histogram = (const uint32_t*)(data + offset);
+    offset += header->histogram_buckets * sizeof(uint32_t);
+    const heap_snapshot_block_t* blocks = (const heap_snapshot_block_t*)(data + offset);
+    offset += header->block_count * sizeof(heap_snapshot_block_t);
+    const heap_snapshot_site_t* sites = (const heap_snapshot_site_t*)(data + offset);
+    offset += header->site_count * sizeof(heap_snapshot_site_t);
+    if (offset > size) {
+        fprintf(stderr, "Snapshot truncated: need %zu bytes, have %zu\n", offset, size);
+        return 0;
+    }
+    
+    uint32_t span = header->heap_end - header->heap_start;
+    printf("=== Heap Snapshot ===\n");
+    printf("Heap: 0x%08X-0x%08X (%u KB)\n", header->heap_start, header->heap_end, span / 1024);
+    printf("Used: %u bytes, free: %u bytes, peak used: %u bytes\n",
+           header->used_bytes, header->free_bytes, header->high_water_bytes);
+    
+    // Replay the block list for fragmentation figures
+    uint32_t free_blocks = 0;
+    uint32_t largest_free = 0;
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        if (blocks[i].flags & HEAP_BLOCK_FREE) {
+            free_blocks++;
+            if (blocks[i].size > largest_free) {
+                largest_free = blocks[i].size;
+            }
+        }
+    }
+    printf("Blocks: %u (%u free), largest free: %u bytes (%.1f%% of free)\n",
+           header->block_count, free_blocks, largest_free,
+           header->free_bytes ? 100.0 * largest_free / header->free_bytes : 0.0);
+    
+    printf("\nRequest sizes:\n");
+    uint32_t max_count = 1;
+    for (uint32_t i = 0; i < header->histogram_buckets; i++) {
+        if (histogram[i] > max_count) {
+            max_count = histogram[i];
+        }
+    }
+    for (uint32_t i = 0; i < header->histogram_buckets; i++) {
+        if (!histogram[i]) {
+            continue;
+        }
+        int last = i == header->histogram_buckets - 1;
+        int bar = (int)(40.0 * histogram[i] / max_count + 0.5);
+        printf("  %s%8u %8u |%.*s\n", last ? "> " : "<=",
+               (uint32_t)HEAP_HISTOGRAM_MIN << (last ? i - 1 : i), histogram[i], bar,
+               "########################################");
+    }
+    
+    if (header->flags & HEAP_SNAPSHOT_PROFILED) {
+        printf("\nCall sites by live bytes:\n");
+        printf("  Caller       Allocs    Frees   Live bytes\n");
+        int* order = malloc(header->site_count * sizeof(int) + 1);
+        for (uint32_t i = 0; i < header->site_count; i++) {
+            order[i] = i;
+        }
+        for (uint32_t i = 1; i < header->site_count; i++) {
+            for (uint32_t j = i; j > 0 && sites[order[j - 1]].live_bytes < sites[order[j]].live_bytes; j--) {
+                int tmp = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = tmp;
+            }
+        }
+        for (uint32_t i = 0; i < header->site_count; i++) {
+            const heap_snapshot_site_t* site = &sites[order[i]];
+            printf("  0x%08X %8u %8u %12u\n", site->caller, site->allocs, site->frees, site->live_bytes);
+        }
+        free(order);
+    } else {
+        printf("\nCall sites: not tracked (kernel built without HEAP_PROFILING)\n");
+    }
+    
+    // Block map: each cell covers an equal slice of the heap
+    uint32_t cells = BLOCK_MAP_COLUMNS * BLOCK_MAP_ROWS;
+    uint32_t cell_size = (span + cells - 1) / cells;
+    if (cell_size < 16) {
+        cell_size = 16;
+    }
+    cells = (span + cell_size - 1) / cell_size;
+    uint32_t* used = calloc(cells + 1, sizeof(uint32_t));
+    uint32_t* unused = calloc(cells + 1, sizeof(uint32_t));
+    
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        // A block runs up to the next block, which accounts for its header
+        uint32_t start = blocks[i].offset;
+        uint32_t end = (i + 1 < header->block_count) ? blocks[i + 1].offset : span;
+        while (start < end) {
+            uint32_t cell = start / cell_size;
+            uint32_t cell_end = (cell + 1) * cell_size;
+            uint32_t chunk = (end < cell_end ? end : cell_end) - start;
+            if (blocks[i].flags & HEAP_BLOCK_FREE) {
+                unused[cell] += chunk;
+            } else {
+                used[cell] += chunk;
+            }
+            start += chunk;
+        }
+    }
+    
+    printf("\nBlock map (%u bytes per cell, # allocated, . free, + mixed):\n", cell_size);
+    for (uint32_t cell = 0; cell < cells; cell++) {
+        if (cell % BLOCK_MAP_COLUMNS == 0) {
+            printf("  0x%08X ", header->heap_start + cell * cell_size);
+        }
+        char c = ' ';
+        if (used[cell] && unused[cell]) {
+            c = '+';
+        } else if (used[cell]) {
+            c = '#';
+        } else if (unused[cell]) {
+            c = '.';
+        }
+        putchar(c);
+        if (cell % BLOCK_MAP_COLUMNS == BLOCK_MAP_COLUMNS - 1 || cell == cells - 1) {
+            putchar('\n');
+        }
+    }
+    
+    free(used);
+    free(unused);
+    return 1;
+}
+
 // Show help
 void show_help(void) {
     printf("HellOS Memory Analyzer\n");
@@ -197,25 +428,28 @@ void show_help(void) {
     printf("  -l <length>    Length to display (default: all)\n");
     printf("  -s <pattern>   Search for pattern in memory\n");
     printf("  -A             Perform automatic analysis\n");
+    printf("  -H             Decode a heap snapshot (raw or inside a serial log)\n");
     printf("  -h             Show this help\n\n");
     printf("Examples:\n");
     printf("  memory_analyzer memory.dump\n");
     printf("  memory_analyzer -a 0x8000 -o 0x100 -l 256 kernel.dump\n");
     printf("  memory_analyzer -s \"HellOS\" memory.dump\n");
     printf("  memory_analyzer -A memory.dump\n");
+    printf("  memory_analyzer -H serial.log\n");
 }
 
 int main(int argc, char* argv[]) {
     uint32_t base_address = 0x00000000;
     uint32_t start_offset = 0;
     size_t display_length = 0;  // 0 means all
-    char* search_pattern = NULL;
+    char* pattern = NULL;
     int auto_analyze = 0;
+    int heap_snapshot = 0;
     char* filename = NULL;
     
     // Parse command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "a:o:l:s:Ah")) != -1) {
+    while ((opt = getopt(argc, argv, "a:o:l:s:AHh")) != -1) {
         switch (opt) {
             case 'a':
                 base_address = strtoul(optarg, NULL, 0);
@@ -227,11 +461,14 @@ int main(int argc, char* argv[]) {
                 display_length = strtoul(optarg, NULL, 0);
                 break;
             case 's':
-                search_pattern = optarg;
+                pattern = optarg;
                 break;
             case 'A':
                 auto_analyze = 1;
                 break;
+            case 'H':
+                heap_snapshot = 1;
+                break;
             case 'h':
                 show_help();
                 return 0;
@@ -249,6 +486,18 @@ int main(int argc, char* argv[]) {
     }
     filename = argv[optind];
     
+    // Heap snapshots have their own loader and renderer
+    if (heap_snapshot) {
+        uint8_t* snapshot;
+        size_t snapshot_size;
+        if (!load_heap_snapshot(filename, &snapshot, &snapshot_size)) {
+            return 1;
+        }
+        int ok = display_heap_snapshot(snapshot, snapshot_size);
+        free(snapshot);
+        return ok ? 0 : 1;
+    }
+    
     // Load memory dump
     memory_dump_t dump;
     if (!load_memory_dump(filename, &dump, base_address)) {
@@ -270,8 +519,8 @@ int main(int argc, char* argv[]) {
     }
     
     // Perform requested operations
-    if (search_pattern) {
-        search_pattern(&dump, search_pattern);
+    if (pattern) {
+        search_pattern(&dump, pattern);
     } else if (auto_analyze) {
         analyze_memory(&dump);
     } else {